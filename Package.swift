@@ -17,12 +17,17 @@ let package = Package(
     ],
     targets: [
         .target(name: "TextStorage", dependencies: ["PieceTree"]),
-        .target(name: "PieceTree", sources: ["./tree-sitter/src/lib.c", "./fredbuf/fredbuf.cpp", "./fredbuf/PieceTreeStorage.mm", "./fredbuf/fredbuf-tree-sitter.mm", "./tree-sitter/c-parser/c-parser.c"], cSettings: [.headerSearchPath("./tree-sitter/include/")]),
+        .target(name: "PieceTree", sources: ["./tree-sitter/src/lib.c", "./fredbuf/fredbuf.cpp", "./fredbuf/fredbuf-search.cpp", "./fredbuf/fredbuf-regex.cpp", "./fredbuf/fredbuf-concurrent.cpp", "./fredbuf/fredbuf-diff.cpp", "./fredbuf/fredbuf-session.cpp", "./fredbuf/fredbuf-hash.cpp", "./fredbuf/fredbuf-write.cpp", "./fredbuf/PieceTreeStorage.mm", "./fredbuf/fredbuf-tree-sitter.mm", "./fredbuf/fredbuf-parse-service.mm", "./fredbuf/fredbuf-highlighter.mm", "./fredbuf/fredbuf-structure.mm", "./fredbuf/fredbuf-injections.mm", "./fredbuf/fredbuf-query.mm", "./fredbuf/fredbuf-query-predicates.mm", "./fredbuf/fredbuf-tree-query.mm", "./tree-sitter/c-parser/c-parser.c"], cSettings: [.headerSearchPath("./tree-sitter/include/")]),
         .testTarget(
             name: "TextStorageTests",
             dependencies: ["TextStorage"],
             path: "Tests/TextStorageTests",
             resources: [.copy("sqlite3.txt")]
+        ),
+        .testTarget(
+            name: "PieceTreeTests",
+            dependencies: ["PieceTree"],
+            path: "Tests/PieceTreeTests"
         )
     ],
     cxxLanguageStandard: .cxx20
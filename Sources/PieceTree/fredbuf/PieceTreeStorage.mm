@@ -5,12 +5,18 @@
 //  Created by mc-public on 2024/1/11.
 //
 #import "./fredbuf.h"
+#import "./fredbuf-concurrent.h"
+#import "./fredbuf-thread-pool.h"
 #import "../include/PieceTreeStorage.h"
 #import "./encoding.h"
 #import <Foundation/Foundation.h>
 #import "../tree-sitter/c-parser/c-parser.h"
+#import <optional>
 #import <string>
 #import <iostream>
+#import <fcntl.h>
+#import <unistd.h>
+#import <sys/stat.h>
 
 using namespace PieceTree;
 
@@ -51,6 +57,165 @@ typedef struct {
     NSRange line_range;
 } LineContent_t;
 
+/* The workers are shared by all storages and live for the whole process. */
+ThreadPool* sharedSearchPool() {
+    static ThreadPool* pool = new ThreadPool();
+    return pool;
+}
+
+NSArray<NSValue *>* convertFromMatches(std::span<const SearchMatch> matches) {
+    NSMutableArray<NSValue *> *result = [NSMutableArray arrayWithCapacity:matches.size()];
+    for (const SearchMatch& match : matches) {
+        [result addObject:[NSValue valueWithRange:NSMakeRange((NSUInteger)match.first, (NSUInteger)match.last - (NSUInteger)match.first)]];
+    }
+    return result;
+}
+
+/* Writes a temporary file next to `path` and renames it over `path`, so `path` is never partially written and a reader which has mapped the old file keeps it. */
+BOOL writeFileAtomically(NSString* path, BOOL (^write)(int fd)) {
+    NSString *temporaryPath = [path stringByAppendingFormat:@".%d.tmp", getpid()];
+    int fd = open(temporaryPath.fileSystemRepresentation, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return NO;
+    }
+    /* Keep the permissions of the file which is replaced. */
+    struct stat target;
+    if (stat(path.fileSystemRepresentation, &target) == 0) {
+        fchmod(fd, target.st_mode & 07777);
+    }
+    BOOL success = write(fd) && fsync(fd) == 0;
+    if (close(fd) != 0) {
+        success = NO;
+    }
+    if (success && rename(temporaryPath.fileSystemRepresentation, path.fileSystemRepresentation) == 0) {
+        return YES;
+    }
+    unlink(temporaryPath.fileSystemRepresentation);
+    return NO;
+}
+
+TextEncoding convertFromFileEncoding(FileEncoding_t encoding) {
+    return encoding == UTF16LE_FILE_ENCODING ? TextEncoding::UTF16LE : TextEncoding::UTF8;
+}
+
+LineEndings convertFromLineEndings(LineEndings_t lineEndings) {
+    switch (lineEndings) {
+        case LF_LINE_ENDINGS:
+            return LineEndings::LF;
+        case CRLF_LINE_ENDINGS:
+            return LineEndings::CRLF;
+        default:
+            return LineEndings::Preserve;
+    }
+}
+
+//MARK: - The Implementation of Search Task
+
+@interface PieceTreeSearchTask ()
+- (instancetype)initWithSearch: (ParallelSearch)search;
+@end
+
+@implementation PieceTreeSearchTask
+{
+    ParallelSearch _search;
+}
+
+- (instancetype)initWithSearch: (ParallelSearch)search {
+    self = [super init];
+    if (self) {
+        _search = std::move(search);
+    }
+    return self;
+}
+
+- (void)cancel {
+    _search.cancel();
+}
+
+- (BOOL)waitUntilFinished {
+    return _search.wait();
+}
+
+@end
+
+//MARK: - The Implementation of Snapshot
+
+@interface PieceTreeSnapshot ()
+- (instancetype)initWithSnapshot: (OwningSnapshot)snapshot version: (uint64_t)version;
+@end
+
+@implementation PieceTreeSnapshot
+{
+    /* Always set after init, `OwningSnapshot` cannot be default constructed. */
+    std::optional<OwningSnapshot> _snapshot;
+    uint64_t _version;
+}
+
+- (instancetype)initWithSnapshot: (OwningSnapshot)snapshot version: (uint64_t)version {
+    self = [super init];
+    if (self) {
+        _snapshot.emplace(std::move(snapshot));
+        _version = version;
+    }
+    return self;
+}
+
+- (uint64_t)version {
+    return _version;
+}
+
+- (Length_t)length {
+    return (Length_t)_snapshot->length();
+}
+
+- (Length_t)lineCount {
+    return (Length_t)_snapshot->line_count();
+}
+
+- (uint64_t)contentHash {
+    return _snapshot->content_hash().value;
+}
+
+- (nonnull NSString *)string {
+    std::STRING result_std_string;
+    result_std_string.reserve(rep(_snapshot->length()));
+    PieceTree::TreeWalker walker{ &*_snapshot };
+    while (not walker.exhausted()) {
+        result_std_string.push_back(walker.next());
+    }
+    return [self convertFromStdString: result_std_string];
+}
+
+- (Index_t)getLineIndexAtIndex: (Index_t)index {
+    NSAssert(index >= 0 && index < [self length], ([NSString stringWithFormat:@"Code unit index %ld out of range: 0..<%ld.", index, [self length]]));
+    return (Index_t)(_snapshot->line_at(CharOffset { index }));
+}
+
+- (nonnull NSString *)getLFLineContentAtLineIndex: (size_t)lineIndex {
+    NSAssert(lineIndex >= 1 && lineIndex <= [self lineCount], ([NSString stringWithFormat:@"Line index %ld out of range: 1...%ld.", lineIndex, [self lineCount]]));
+    std::STRING content;
+    _snapshot->get_line_content(&content, Line { lineIndex });
+    return [self convertFromStdString: content];
+}
+
+- (BOOL)writeToPath: (nonnull NSString*)path encoding: (FileEncoding_t)encoding lineEndings: (LineEndings_t)lineEndings {
+    const OwningSnapshot *snapshot = &*_snapshot;
+    return writeFileAtomically(path, ^BOOL(int fd) {
+        return snapshot->write_to(fd, convertFromFileEncoding(encoding), convertFromLineEndings(lineEndings)) == WriteResult::Success;
+    });
+}
+
+/* private */- (nonnull NSString*)convertFromStdString: (const std::STRING&)string {
+    NSData *data = [NSData dataWithBytes:string.c_str() length:string.length() * sizeof(CHAR_T)];
+    NSString *result = [[NSString alloc] initWithData:data encoding:NS_FREDBUF_ENCODING];
+    if (result) {
+        return result;
+    }
+    return [NSString string];
+}
+
+@end
+
 //MARK: - The Implementation of Bridge Object
 
 @implementation PieceTreeStorage
@@ -58,8 +223,9 @@ typedef struct {
 //MARK: - Private Property
 {
     NSStringEncoding _usedEncoding;
+    /* Edits are published to `snapshot` callers through `_document`, `_pieceTree` is its tree. */
+    ConcurrentTree *_document;
     Tree *_pieceTree;
-    UnRedoID_t _nextUsableUnRedoID ;
 }
 
 //MARK: - Private Get
@@ -67,12 +233,6 @@ typedef struct {
     return _pieceTree;
 }
 
-/* private */- (UnRedoID_t)nextUsableUnRedoID {
-    UnRedoID_t newID = _nextUsableUnRedoID;
-    _nextUsableUnRedoID++;
-    return newID;
-}
-
 - (NSStringEncoding)usedEncoding {
     return _usedEncoding;
 }
@@ -89,6 +249,10 @@ typedef struct {
     return (size_t)([self pieceTree]->line_count());
 }
 
+- (uint64_t)contentHash {
+    return [self pieceTree]->content_hash().value;
+}
+
 - (nonnull NSString *)string {
     if ((Length_t)_pieceTree->length() <= 0) {
         return [NSString string];
@@ -108,7 +272,7 @@ typedef struct {
 //MARK: - Life Cycle
 
 - (void)dealloc {
-    delete _pieceTree;
+    delete _document;
 }
 
 - (nonnull instancetype)init {
@@ -120,9 +284,11 @@ typedef struct {
     NSStringEncoding encoding = NS_FREDBUF_ENCODING;
     CFStringEncoding cf_encoding = CF_FREDBUF_ENCODING;
     if (self) {
-        _nextUsableUnRedoID = 0;
         _usedEncoding = encoding;
-        _pieceTree = loadTreeWithString(string, encoding, cf_encoding, sizeof(CHAR_T));
+        Tree *tree = loadTreeWithString(string, encoding, cf_encoding, sizeof(CHAR_T));
+        _document = new ConcurrentTree(std::move(*tree));
+        delete tree;
+        _pieceTree = &_document->tree();
     }
     return self;
 }
@@ -155,6 +321,7 @@ typedef struct {
 - (void)insertString: (nonnull NSString*)string atOffset: (size_t)offset {
     NSAssert(offset >= 0 && offset <= [self length], ([NSString stringWithFormat:@"Insert point index %ld out of range: 0...%ld", offset, [self length]]));
     [self pieceTree]->insert(CharOffset { offset }, [self convertFromString:string]);
+    _document->publish();
 }
 
 - (void)removeAtIndex: (size_t)index withLength: (size_t)length {
@@ -164,6 +331,26 @@ typedef struct {
         return;
     }
     [self pieceTree]->remove(CharOffset { index }, Length { length });
+    _document->publish();
+}
+
+- (BOOL)replaceRanges: (nonnull NSArray<NSValue *> *)ranges withStrings: (nonnull NSArray<NSString *> *)strings {
+    NSAssert(ranges.count == strings.count, ([NSString stringWithFormat:@"%ld ranges are replaced with %ld strings.", ranges.count, strings.count]));
+    /* The edits refer to the converted strings, which have to outlive them. */
+    std::vector<std::STRING> texts;
+    std::vector<TextEdit> edits;
+    texts.reserve(strings.count);
+    edits.reserve(ranges.count);
+    for (NSUInteger i = 0; i < ranges.count; i++) {
+        NSRange range = ranges[i].rangeValue;
+        texts.push_back([self convertFromString:strings[i]]);
+        edits.push_back({ .offset = CharOffset { range.location }, .length = Length { range.length }, .text = texts.back() });
+    }
+    if (not [self pieceTree]->apply_edits(edits)) {
+        return NO;
+    }
+    _document->publish();
+    return YES;
 }
 
 - (Index_t)getLineIndexAtIndex: (Index_t)index {
@@ -189,6 +376,65 @@ typedef struct {
     }
 }
 
+- (NSRange)findString: (nonnull NSString*)pattern fromIndex: (Index_t)index backwards: (BOOL)backwards caseSensitive: (BOOL)caseSensitive {
+    NSAssert(index >= 0 && index <= [self length], ([NSString stringWithFormat:@"Search index %ld out of range: 0...%ld", index, [self length]]));
+    SearchOptions options = { .case_sensitive = caseSensitive ? CaseSensitive::Yes : CaseSensitive::No };
+    SearchDirection direction = backwards ? SearchDirection::Backward : SearchDirection::Forward;
+    FindResult result = [self pieceTree]->find([self convertFromString:pattern], CharOffset { index }, direction, options);
+    if (!result.found) {
+        return NSMakeRange(NSNotFound, 0);
+    }
+    return NSMakeRange((NSUInteger)result.match.first, (NSUInteger)result.match.last - (NSUInteger)result.match.first);
+}
+
+- (NSArray<NSValue *> *)findAllString: (nonnull NSString*)pattern caseSensitive: (BOOL)caseSensitive {
+    SearchOptions options = { .case_sensitive = caseSensitive ? CaseSensitive::Yes : CaseSensitive::No };
+    SearchMatches matches;
+    [self pieceTree]->find_all(&matches, [self convertFromString:pattern], options);
+    return convertFromMatches(matches);
+}
+
+- (PieceTreeSearchTask*)findAllStringConcurrently: (nonnull NSString*)pattern caseSensitive: (BOOL)caseSensitive batchHandler: (BOOL (^)(NSArray<NSValue *> *batch))batchHandler completionHandler: (void (^)(BOOL finished))completionHandler {
+    SearchOptions options = { .case_sensitive = caseSensitive ? CaseSensitive::Yes : CaseSensitive::No };
+    auto on_batch = [batchHandler](std::span<const SearchMatch> batch) -> bool {
+        @autoreleasepool {
+            return batchHandler(convertFromMatches(batch));
+        }
+    };
+    auto on_done = [completionHandler](bool finished) {
+        completionHandler(finished);
+    };
+    ParallelSearch search = find_all_parallel([self pieceTree]->owning_snap(), [self convertFromString:pattern], sharedSearchPool(), on_batch, on_done, options);
+    return [[PieceTreeSearchTask alloc] initWithSearch:std::move(search)];
+}
+
++ (NSInteger)errorOffsetOfRegularExpression: (nonnull NSString*)pattern {
+    NSUInteger length = [pattern length];
+    std::STRING buffer(length, 0);
+    [pattern getCharacters:(unichar*)buffer.data() range:NSMakeRange(0, length)];
+    Regex regex { buffer };
+    return regex.valid() ? -1 : (NSInteger)regex.error_offset();
+}
+
+- (NSRange)findRegularExpression: (nonnull NSString*)pattern fromIndex: (Index_t)index caseSensitive: (BOOL)caseSensitive {
+    NSAssert(index >= 0 && index <= [self length], ([NSString stringWithFormat:@"Search index %ld out of range: 0...%ld", index, [self length]]));
+    Regex regex { [self convertFromString:pattern], caseSensitive ? CaseSensitive::Yes : CaseSensitive::No };
+    NSAssert(regex.valid(), ([NSString stringWithFormat:@"Invalid regular expression: %@", pattern]));
+    FindResult result = [self pieceTree]->find(regex, CharOffset { index });
+    if (!result.found) {
+        return NSMakeRange(NSNotFound, 0);
+    }
+    return NSMakeRange((NSUInteger)result.match.first, (NSUInteger)result.match.last - (NSUInteger)result.match.first);
+}
+
+- (NSArray<NSValue *> *)findAllRegularExpression: (nonnull NSString*)pattern caseSensitive: (BOOL)caseSensitive limit: (Index_t)limit {
+    Regex regex { [self convertFromString:pattern], caseSensitive ? CaseSensitive::Yes : CaseSensitive::No };
+    NSAssert(regex.valid(), ([NSString stringWithFormat:@"Invalid regular expression: %@", pattern]));
+    SearchMatches matches;
+    [self pieceTree]->find_all(&matches, regex, limit);
+    return convertFromMatches(matches);
+}
+
 - (nonnull NSString*)getLFLineContentAtLineIndex: (size_t)lineIndex {
     NSAssert(lineIndex >= 1 && lineIndex <= [self lineCount], ([NSString stringWithFormat:@"Line index %ld out of range: 1...%ld.", lineIndex, [self lineCount]]));
     return [self getLineContentAtLineIndex:lineIndex withCRLFType:LF_TYPE].content;
@@ -203,21 +449,43 @@ typedef struct {
 }
 
 /* private */- (LineContent_t)getLineContentAtLineIndex: (size_t)lineIndex withCRLFType: (CRLF_ENUM_t)crlf_type {
-    std::STRING content_buffer;
     CRLF_Type_t actualLineType = LF;
     NSRange lineNSRange = [self getLineRangeAtLineIndex:lineIndex withCRFLType:crlf_type withActualCRFLType:&actualLineType];
     //MARK: - ???????
 //    if (crlf_type == LF_TYPE && actualLineType == CRLF) {
 //        actualLineType = LF;
 //    }
-    
-    _pieceTree->get_line_content(&content_buffer, Line { lineIndex} );
-    Index_t remove_length = (content_buffer.length() - lineNSRange.length);
-    int loop_index = 0;
-    for(loop_index = 0; loop_index < remove_length; loop_index++) {
-        content_buffer.pop_back();
+    LineTerminator terminator = (crlf_type == CRLF_TYPE) ? LineTerminator::ExcludeCRLF : LineTerminator::ExcludeLF;
+    LineView line_view = _pieceTree->line_view(Line { lineIndex }, terminator);
+    NSAssert((Length_t)line_view.length() == lineNSRange.length, ([NSString stringWithFormat:@"Line view length %ld does not match line range length %ld.", (Length_t)line_view.length(), lineNSRange.length]));
+    return  { [self convertFromLineView: line_view], actualLineType, lineNSRange } ;
+}
+
+/// Build a string directly from the buffer spans of a line.
+///
+/// The spans point into the piece tree buffers, so the characters are copied exactly once.
+/* private */- (nonnull NSString*)convertFromLineView: (const LineView&)line_view {
+    if (line_view.empty()) {
+        return [NSString string];
+    }
+#ifdef TEXTBUF_UTF16
+    if (line_view.single_span()) {
+        const std::STRING_VIEW span = *line_view.begin();
+        return [[NSString alloc] initWithCharacters:(const unichar*)span.data() length:span.size()];
     }
-    return  { [self convertFromStdString: content_buffer], actualLineType, lineNSRange } ;
+    const NSUInteger length = (NSUInteger)line_view.length();
+    unichar *characters = (unichar *)malloc(length * sizeof(unichar));
+    NSUInteger offset = 0;
+    for (const std::STRING_VIEW span : line_view) {
+        memcpy(characters + offset, span.data(), span.size() * sizeof(unichar));
+        offset += span.size();
+    }
+    return [[NSString alloc] initWithCharactersNoCopy:characters length:length freeWhenDone:YES];
+#else
+    std::STRING content_buffer;
+    line_view.append_to(&content_buffer);
+    return [self convertFromStdString: content_buffer];
+#endif
 }
 
 
@@ -271,21 +539,119 @@ typedef struct {
 }
 
 - (UnRedoResult_t)undoWithID: (UnRedoID_t)id {
+    if (id != 0) {
+        return [self checkoutRevisionWithID:id];
+    }
     auto result = [self pieceTree]->try_undo(CharOffset { 0 });
-    UnRedoResult_t returnValue = { result.success, (Index_t)result.op_offset };
+    if (result.success) {
+        _document->publish();
+    }
+    UnRedoResult_t returnValue = { result.success, rep([self pieceTree]->current_revision()) };
     return returnValue;
 }
 
 - (UnRedoResult_t)redoWithID: (UnRedoID_t)id {
+    if (id != 0) {
+        return [self checkoutRevisionWithID:id];
+    }
     auto result = [self pieceTree]->try_redo(CharOffset { 0 });
-    UnRedoResult_t returnValue = { result.success, (Index_t)result.op_offset };
+    if (result.success) {
+        _document->publish();
+    }
+    UnRedoResult_t returnValue = { result.success, rep([self pieceTree]->current_revision()) };
     return returnValue;
 }
 
+- (UnRedoResult_t)checkoutRevisionWithID: (UnRedoID_t)id {
+    BOOL success = [self pieceTree]->checkout(RevisionId { id }, CharOffset { 0 });
+    if (success) {
+        _document->publish();
+    }
+    UnRedoResult_t returnValue = { success, rep([self pieceTree]->current_revision()) };
+    return returnValue;
+}
+
+- (UnRedoID_t)currentRevisionID {
+    return rep([self pieceTree]->current_revision());
+}
+
+- (NSArray<NSNumber *> *)revisionIDs {
+    const Revisions& revisions = [self pieceTree]->revisions();
+    NSMutableArray<NSNumber *> *result = [NSMutableArray arrayWithCapacity:revisions.size()];
+    for (const Revision& revision : revisions) {
+        [result addObject:@(rep(revision.id))];
+    }
+    return result;
+}
+
+- (UnRedoID_t)parentOfRevisionWithID: (UnRedoID_t)id {
+    const Revision *revision = [self pieceTree]->find_revision(RevisionId { id });
+    return revision == nullptr ? 0 : rep(revision->parent);
+}
+
+- (nullable PieceTreeSnapshot *)snapshotOfRevisionWithID: (UnRedoID_t)id {
+    const Revision *revision = [self pieceTree]->find_revision(RevisionId { id });
+    if (revision == nullptr) {
+        return nil;
+    }
+    OwningSnapshot snapshot { [self pieceTree], revision->root };
+    return [[PieceTreeSnapshot alloc] initWithSnapshot:std::move(snapshot) version:_document->version()];
+}
+
+- (nonnull PieceTreeSnapshot *)snapshot {
+    uint64_t version = 0;
+    OwningSnapshot snapshot = _document->snapshot(&version);
+    return [[PieceTreeSnapshot alloc] initWithSnapshot:std::move(snapshot) version:version];
+}
+
+- (BOOL)saveSessionToPath: (nonnull NSString*)path {
+    const Tree *tree = [self pieceTree];
+    return writeFileAtomically(path, ^BOOL(int fd) {
+        return tree->save_session(fd) == SessionResult::Success;
+    });
+}
+
+- (BOOL)loadSessionFromPath: (nonnull NSString*)path {
+    int fd = open(path.fileSystemRepresentation, O_RDONLY);
+    if (fd < 0) {
+        return NO;
+    }
+    BOOL success = [self pieceTree]->load_session(fd) == SessionResult::Success;
+    close(fd);
+    if (success) {
+        _document->publish();
+    }
+    return success;
+}
+
+- (BOOL)writeToPath: (nonnull NSString*)path encoding: (FileEncoding_t)encoding lineEndings: (LineEndings_t)lineEndings {
+    const Tree *tree = [self pieceTree];
+    return writeFileAtomically(path, ^BOOL(int fd) {
+        return tree->write_to(fd, convertFromFileEncoding(encoding), convertFromLineEndings(lineEndings)) == WriteResult::Success;
+    });
+}
+
 - (UnRedoID_t)commitState {
-    UnRedoID_t newID = [self nextUsableUnRedoID];
-    [self pieceTree]->commit_head( CharOffset { newID } );
-    return newID;
+    return rep([self pieceTree]->commit_head( CharOffset { 0 } ));
+}
+
+- (HistoryPolicy_t)historyPolicy {
+    const HistoryPolicy& policy = [self pieceTree]->history_policy();
+    HistoryPolicy_t result = { policy.max_entries, policy.max_bytes, policy.coalesce_interval.count() / 1000.0, is_yes(policy.coalesce_words) };
+    return result;
+}
+
+- (void)setHistoryPolicy: (HistoryPolicy_t)historyPolicy {
+    [self pieceTree]->set_history_policy({ .max_entries = historyPolicy.maxEntries,
+                                           .max_bytes = historyPolicy.maxBytes,
+                                           .coalesce_interval = std::chrono::milliseconds{ (long long)(historyPolicy.coalesceInterval * 1000) },
+                                           .coalesce_words = historyPolicy.coalesceWords ? CoalesceWords::Yes : CoalesceWords::No });
+}
+
+- (HistoryMemory_t)historyMemory {
+    HistoryMemory memory = [self pieceTree]->history_memory();
+    HistoryMemory_t result = { memory.undo_entries, memory.redo_entries, memory.pinned_bytes };
+    return result;
 }
 
 - (void)quickCommitState {
@@ -0,0 +1,101 @@
+//
+//  fredbuf-concurrent.cpp
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#include "fredbuf-concurrent.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+namespace PieceTree
+{
+    ConcurrentTree::ConcurrentTree(Tree&& tree):
+        writer_tree{ std::move(tree) },
+        current{ new Version{ .snapshot = writer_tree.owning_snap(), .number = 0 } } { }
+
+    ConcurrentTree::~ConcurrentTree()
+    {
+        // There must not be any readers left at this point.
+        reclaim();
+        assert(retired.empty());
+        delete current.load();
+        auto* slot = readers.load();
+        while (slot != nullptr)
+        {
+            auto* next = slot->next;
+            delete slot;
+            slot = next;
+        }
+    }
+
+    void ConcurrentTree::publish()
+    {
+        auto* old = current.load(std::memory_order_relaxed);
+        auto* next = new Version{ .snapshot = writer_tree.owning_snap(), .number = old->number + 1 };
+        current.exchange(next);
+        published.store(next->number, std::memory_order_release);
+        // A reader which still sees 'old' announced an epoch no later than this one.
+        retired.push_back({ .epoch = epoch.fetch_add(1), .version = old });
+        reclaim();
+    }
+
+    OwningSnapshot ConcurrentTree::snapshot(uint64_t* version) const
+    {
+        auto* slot = acquire_slot();
+        slot->epoch.store(epoch.load());
+        // Note: the announcement above must be visible before the version is loaded, both are sequentially
+        // consistent.
+        auto* latest = current.load();
+        OwningSnapshot snapshot = latest->snapshot;
+        if (version != nullptr)
+            *version = latest->number;
+        slot->epoch.store(0, std::memory_order_release);
+        slot->in_use.store(false, std::memory_order_release);
+        return snapshot;
+    }
+
+    ConcurrentTree::ReaderSlot* ConcurrentTree::acquire_slot() const
+    {
+        for (auto* slot = readers.load(std::memory_order_acquire); slot != nullptr; slot = slot->next)
+        {
+            bool expected = false;
+            if (not slot->in_use.load(std::memory_order_relaxed)
+                and slot->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                return slot;
+        }
+        // Every slot is taken, there are more readers than ever before.
+        auto* slot = new ReaderSlot;
+        auto* head = readers.load(std::memory_order_relaxed);
+        do
+        {
+            slot->next = head;
+        } while (not readers.compare_exchange_weak(head, slot, std::memory_order_release, std::memory_order_relaxed));
+        return slot;
+    }
+
+    void ConcurrentTree::reclaim()
+    {
+        if (retired.empty())
+            return;
+        // The oldest epoch a reader is still in.  Everything retired before it is unreachable.
+        auto oldest = std::numeric_limits<uint64_t>::max();
+        for (auto* slot = readers.load(std::memory_order_acquire); slot != nullptr; slot = slot->next)
+        {
+            auto reader_epoch = slot->epoch.load();
+            if (reader_epoch != 0)
+                oldest = std::min(oldest, reader_epoch);
+        }
+        auto last = std::remove_if(retired.begin(), retired.end(), [&](const Retired& entry)
+        {
+            if (entry.epoch >= oldest)
+                return false;
+            delete entry.version;
+            return true;
+        });
+        retired.erase(last, retired.end());
+    }
+} // namespace PieceTree
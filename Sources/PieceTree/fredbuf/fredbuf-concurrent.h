@@ -0,0 +1,91 @@
+//
+//  fredbuf-concurrent.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "fredbuf.h"
+
+// Multi-version access to a tree.  A single writer edits the tree and publishes versions of it, any number
+// of reader threads take snapshots of the latest published version while the writer keeps editing.
+//
+// A published version is a heap object holding an owning snapshot of the tree.  The writer swaps the current
+// version with an atomic pointer and retires the old one, readers announce the epoch they read in before
+// loading the pointer and copy the snapshot out.  A retired version is only freed once no reader can still be
+// copying it, so taking a snapshot never waits for the writer (and the writer never waits for readers).
+namespace PieceTree
+{
+    class ConcurrentTree
+    {
+    public:
+        explicit ConcurrentTree(Tree&& tree);
+        ~ConcurrentTree();
+
+        ConcurrentTree(const ConcurrentTree&) = delete;
+        ConcurrentTree& operator=(const ConcurrentTree&) = delete;
+
+        // Writer interface.  Only a single thread may use these at a time.
+        // Edits made through 'tree()' are not visible to readers until they are published.
+        Tree& tree()
+        {
+            return writer_tree;
+        }
+
+        const Tree& tree() const
+        {
+            return writer_tree;
+        }
+
+        // Makes the current state of the tree the latest version.  Costs an allocation and a few atomic
+        // operations, the text is shared with the tree.
+        void publish();
+
+        // Reader interface.  May be called from any thread, including concurrently with the writer.
+        // Versions are numbered in publication order, the initial state of the tree is version 0.
+        OwningSnapshot snapshot(uint64_t* version = nullptr) const;
+
+        uint64_t version() const
+        {
+            return published.load(std::memory_order_acquire);
+        }
+    private:
+        struct Version
+        {
+            OwningSnapshot snapshot;
+            uint64_t number;
+        };
+
+        // Each reader which is taking a snapshot holds a slot and announces the epoch it read in.  Slots are
+        // never freed, only released for reuse, so the list can be walked without locking.
+        struct ReaderSlot
+        {
+            std::atomic<uint64_t> epoch = 0;
+            std::atomic<bool> in_use = true;
+            ReaderSlot* next = nullptr;
+        };
+
+        struct Retired
+        {
+            uint64_t epoch;
+            const Version* version;
+        };
+
+        ReaderSlot* acquire_slot() const;
+        void reclaim();
+
+        Tree writer_tree;
+        std::atomic<const Version*> current;
+        std::atomic<uint64_t> published = 0;
+        // Starts at 1 so that 0 can mean a slot is idle.
+        std::atomic<uint64_t> epoch = 1;
+        mutable std::atomic<ReaderSlot*> readers = nullptr;
+        // Versions which were replaced but may still be read, only touched by the writer.
+        std::vector<Retired> retired;
+    };
+} // namespace PieceTree
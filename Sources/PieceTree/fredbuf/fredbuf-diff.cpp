@@ -0,0 +1,317 @@
+//
+//  fredbuf-diff.cpp
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#include "fredbuf-diff.h"
+
+#include <algorithm>
+#include <queue>
+
+#include "fredbuf.h"
+#include "enum-utils.h"
+
+namespace PieceTree
+{
+    namespace
+    {
+        struct DiffSide
+        {
+            const BufferCollection* buffers;
+            RedBlackTree::View root;
+        };
+
+        // A subtree which has not been matched yet.  Subtrees are expanded largest first: a subtree is always
+        // larger than any of its children, so by the time a shared subtree is the largest one left on one side
+        // all of its ancestors on the other side have been expanded as well and it can be matched there.
+        struct Subtree
+        {
+            RedBlackTree::View node;
+            size_t length;
+            // Where the subtree starts in its document.
+            size_t offset;
+
+            bool operator<(const Subtree& other) const
+            {
+                return length < other.length;
+            }
+        };
+
+        // A piece of a node which was not shared, positioned in its document and its buffer.
+        struct PieceSpan
+        {
+            BufferIndex index;
+            size_t buffer_first;
+            size_t length;
+            size_t offset;
+        };
+
+        // A range with the same content in both documents.
+        struct Common
+        {
+            size_t old_offset;
+            size_t new_offset;
+            size_t length;
+        };
+
+        using Frontier = std::priority_queue<Subtree>;
+
+        void take_group(std::vector<Subtree>* group, Frontier* frontier, size_t length)
+        {
+            while (not frontier->empty() and frontier->top().length == length)
+            {
+                group->push_back(frontier->top());
+                frontier->pop();
+            }
+        }
+
+        // Replaces 'subtree' with its children and records its own piece unless 'pieces' is null.
+        void expand(const DiffSide& side, const Subtree& subtree, Frontier* frontier, std::vector<PieceSpan>* pieces)
+        {
+            auto& data = subtree.node.root();
+            auto left_length = rep(data.left_subtree_length);
+            auto piece_length = rep(data.piece.length);
+            auto right_length = subtree.length - left_length - piece_length;
+            if (left_length != 0)
+            {
+                frontier->push({ .node = subtree.node.left(), .length = left_length, .offset = subtree.offset });
+            }
+            if (piece_length != 0 and pieces != nullptr)
+            {
+                pieces->push_back({ .index = data.piece.index,
+                                    .buffer_first = rep(side.buffers->buffer_offset(data.piece.index, data.piece.first)),
+                                    .length = piece_length,
+                                    .offset = subtree.offset + left_length });
+            }
+            if (right_length != 0)
+            {
+                frontier->push({ .node = subtree.node.right(), .length = right_length, .offset = subtree.offset + left_length + piece_length });
+            }
+        }
+
+        // Finds the shared subtrees, collecting the pieces of every node which is not shared on the way.  Returns
+        // the number of nodes of 'from' which are not shared.
+        size_t match_subtrees(const DiffSide& from, const DiffSide& to, size_t from_length, size_t to_length,
+                              std::vector<Common>* common, std::vector<PieceSpan>* old_pieces, std::vector<PieceSpan>* new_pieces)
+        {
+            size_t unshared = 0;
+            Frontier old_frontier;
+            Frontier new_frontier;
+            if (from_length != 0)
+            {
+                old_frontier.push({ .node = from.root, .length = from_length, .offset = 0 });
+            }
+            if (to_length != 0)
+            {
+                new_frontier.push({ .node = to.root, .length = to_length, .offset = 0 });
+            }
+            std::vector<Subtree> old_group;
+            std::vector<Subtree> new_group;
+            while (not old_frontier.empty() or not new_frontier.empty())
+            {
+                size_t length = 0;
+                if (not old_frontier.empty())
+                {
+                    length = old_frontier.top().length;
+                }
+                if (not new_frontier.empty())
+                {
+                    length = std::max(length, new_frontier.top().length);
+                }
+                old_group.clear();
+                new_group.clear();
+                take_group(&old_group, &old_frontier, length);
+                take_group(&new_group, &new_frontier, length);
+                // The groups are small (subtrees of exactly the same length) so a quadratic match is fine.
+                for (auto& old_subtree : old_group)
+                {
+                    auto match = std::find_if(new_group.begin(), new_group.end(), [&](const Subtree& new_subtree)
+                    {
+                        return new_subtree.node.root_ptr() == old_subtree.node.root_ptr();
+                    });
+                    if (match == new_group.end())
+                    {
+                        expand(from, old_subtree, &old_frontier, old_pieces);
+                        ++unshared;
+                        continue;
+                    }
+                    if (common != nullptr)
+                    {
+                        common->push_back({ .old_offset = old_subtree.offset, .new_offset = match->offset, .length = length });
+                    }
+                    *match = new_group.back();
+                    new_group.pop_back();
+                }
+                for (auto& new_subtree : new_group)
+                {
+                    expand(to, new_subtree, &new_frontier, new_pieces);
+                }
+            }
+            return unshared;
+        }
+
+        // Pieces of different nodes can still refer to the same buffer region, e.g. when a piece was split by
+        // an insert or a node was copied while rebalancing.  Overlapping regions have the same content.
+        void match_pieces(std::vector<PieceSpan>* old_pieces, std::vector<PieceSpan>* new_pieces, std::vector<Common>* common)
+        {
+            auto by_region = [](const PieceSpan& lhs, const PieceSpan& rhs)
+            {
+                if (lhs.index != rhs.index)
+                    return lhs.index < rhs.index;
+                return lhs.buffer_first < rhs.buffer_first;
+            };
+            std::sort(old_pieces->begin(), old_pieces->end(), by_region);
+            std::sort(new_pieces->begin(), new_pieces->end(), by_region);
+            auto old_piece = old_pieces->begin();
+            auto new_piece = new_pieces->begin();
+            while (old_piece != old_pieces->end() and new_piece != new_pieces->end())
+            {
+                if (old_piece->index != new_piece->index)
+                {
+                    if (old_piece->index < new_piece->index)
+                    {
+                        ++old_piece;
+                    }
+                    else
+                    {
+                        ++new_piece;
+                    }
+                    continue;
+                }
+                auto old_last = old_piece->buffer_first + old_piece->length;
+                auto new_last = new_piece->buffer_first + new_piece->length;
+                auto first = std::max(old_piece->buffer_first, new_piece->buffer_first);
+                auto last = std::min(old_last, new_last);
+                if (first < last)
+                {
+                    common->push_back({ .old_offset = old_piece->offset + (first - old_piece->buffer_first),
+                                        .new_offset = new_piece->offset + (first - new_piece->buffer_first),
+                                        .length = last - first });
+                }
+                // Advance whichever region ends first.
+                if (old_last < new_last)
+                {
+                    ++old_piece;
+                }
+                else
+                {
+                    ++new_piece;
+                }
+            }
+        }
+
+        void diff_roots(TreeChanges* changes, const DiffSide& from, const DiffSide& to)
+        {
+            changes->clear();
+            auto from_length = rep(tree_length(from.root));
+            auto to_length = rep(tree_length(to.root));
+            // Roots which were built independently but hold the same text, e.g. after a reload, have no
+            // changes.  Matching equal subtrees further down is not worth it: repetitive text has many of them
+            // at unrelated positions and they would split changes.
+            if (from_length == to_length and not from.root.is_empty() and not to.root.is_empty()
+                and from.root.root().subtree_hash == to.root.root().subtree_hash)
+                return;
+            std::vector<Common> common;
+            std::vector<PieceSpan> old_pieces;
+            std::vector<PieceSpan> new_pieces;
+            match_subtrees(from, to, from_length, to_length, &common, &old_pieces, &new_pieces);
+            match_pieces(&old_pieces, &new_pieces, &common);
+
+            // Edits never reorder text, so the common ranges are increasing in both documents.  Roots which
+            // are not related by edits may break this, such ranges are dropped and become part of a change.
+            std::sort(common.begin(), common.end(), [](const Common& lhs, const Common& rhs)
+            {
+                return lhs.old_offset < rhs.old_offset;
+            });
+            size_t old_cursor = 0;
+            size_t new_cursor = 0;
+            auto emit = [&](size_t old_last, size_t new_last)
+            {
+                if (old_cursor == old_last and new_cursor == new_last)
+                    return;
+                changes->push_back({ .old_first = CharOffset{ old_cursor },
+                                     .old_last = CharOffset{ old_last },
+                                     .new_first = CharOffset{ new_cursor },
+                                     .new_last = CharOffset{ new_last } });
+            };
+            for (auto& range : common)
+            {
+                if (range.old_offset < old_cursor or range.new_offset < new_cursor)
+                    continue;
+                emit(range.old_offset, range.new_offset);
+                old_cursor = range.old_offset + range.length;
+                new_cursor = range.new_offset + range.length;
+            }
+            emit(from_length, to_length);
+        }
+    } // namespace [anon]
+
+    size_t unshared_node_count(RedBlackTree::View from, RedBlackTree::View to)
+    {
+        return match_subtrees({ .buffers = nullptr, .root = from }, { .buffers = nullptr, .root = to },
+                              rep(tree_length(from)), rep(tree_length(to)), nullptr, nullptr, nullptr);
+    }
+
+    void Tree::diff(TreeChanges* changes, const RedBlackTree& from, const RedBlackTree& to) const
+    {
+        diff_roots(changes, { .buffers = &buffers, .root = from }, { .buffers = &buffers, .root = to });
+    }
+
+    bool Tree::diff_revisions(TreeChanges* changes, RevisionId from, RevisionId to) const
+    {
+        auto* from_revision = find_revision(from);
+        auto* to_revision = find_revision(to);
+        if (from_revision == nullptr or to_revision == nullptr)
+            return false;
+        diff(changes, from_revision->root, to_revision->root);
+        return true;
+    }
+
+    void diff(TreeChanges* changes, const OwningSnapshot& from, const OwningSnapshot& to)
+    {
+        diff_roots(changes, { .buffers = &from.buffers, .root = from.root }, { .buffers = &to.buffers, .root = to.root });
+    }
+
+    namespace
+    {
+        EditPoint edit_point(const OwningSnapshot& snapshot, CharOffset offset)
+        {
+            auto position = snapshot.line_position(offset);
+            return { .row = rep(position.line) - 1, .column = rep(distance(position.line_start, offset)) };
+        }
+    } // namespace [anon]
+
+    void diff_edits(EditJournal* edits, const OwningSnapshot& from, const OwningSnapshot& to)
+    {
+        TreeChanges changes;
+        diff(&changes, from, to);
+        edits->clear();
+        edits->reserve(changes.size());
+        for (auto& change : changes)
+        {
+            // The preceding changes have already been applied, so everything before the change is in the
+            // coordinates of 'to' (see Tree::journal_changes).
+            auto start_point = edit_point(to, change.new_first);
+            auto old_first_point = edit_point(from, change.old_first);
+            auto old_last_point = edit_point(from, change.old_last);
+            auto old_end_point = start_point;
+            if (old_last_point.row == old_first_point.row)
+            {
+                old_end_point.column += old_last_point.column - old_first_point.column;
+            }
+            else
+            {
+                old_end_point.row += old_last_point.row - old_first_point.row;
+                old_end_point.column = old_last_point.column;
+            }
+            edits->push_back({ .start = change.new_first,
+                               .old_end = change.new_first + distance(change.old_first, change.old_last),
+                               .new_end = change.new_last,
+                               .start_point = start_point,
+                               .old_end_point = old_end_point,
+                               .new_end_point = edit_point(to, change.new_last) });
+        }
+    }
+} // namespace PieceTree
@@ -0,0 +1,46 @@
+//
+//  fredbuf-diff.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+#include <vector>
+#include "fredbuf-rbtree.h"
+
+// Structural diff between two roots derived from the same buffers (e.g. two snapshots, or the roots before and
+// after an undo).  Subtrees which are shared between the roots are recognized by node identity and skipped
+// without being visited, so the cost depends on the number of nodes the edits in between created, not on the
+// size of the document.  Content is compared by the buffer region it comes from: text which was deleted and
+// typed again is reported as changed, unless the two documents are equal as a whole (same content hash).
+namespace PieceTree
+{
+    // The range [old_first, old_last) of the old root was replaced by [new_first, new_last) of the new root.
+    // Either range may be empty.
+    struct TreeChange
+    {
+        CharOffset old_first;
+        CharOffset old_last;
+        CharOffset new_first;
+        CharOffset new_last;
+    };
+
+    // Changes are in document order and never overlap or touch each other.
+    using TreeChanges = std::vector<TreeChange>;
+
+    class OwningSnapshot;
+    struct EditRecord;
+
+    // Populates 'changes' with the ranges which differ between 'from' and 'to'.
+    void diff(TreeChanges* changes, const OwningSnapshot& from, const OwningSnapshot& to);
+
+    // The same changes in the form of the edit journal (see Tree::journal_edits), e.g. to bring a tree-sitter
+    // tree of 'from' up to date with 'to' when the journal in between was not kept.
+    void diff_edits(std::vector<EditRecord>* edits, const OwningSnapshot& from, const OwningSnapshot& to);
+
+    // The number of nodes of 'from' which are not shared with 'to', i.e. the nodes that keeping 'from' alive
+    // costs on top of 'to'.  Costs the same as a diff.
+    size_t unshared_node_count(RedBlackTree::View from, RedBlackTree::View to);
+} // namespace PieceTree
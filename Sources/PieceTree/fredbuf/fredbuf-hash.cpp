@@ -0,0 +1,148 @@
+//
+//  fredbuf-hash.cpp
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#include "fredbuf-hash.h"
+
+#include <array>
+#include <cassert>
+#include <type_traits>
+
+namespace PieceTree
+{
+    namespace
+    {
+        constexpr uint64_t modulus = (uint64_t{ 1 } << 61) - 1;
+        constexpr uint64_t base = 0x1b873593cc9e2d51 % modulus;
+
+        constexpr uint64_t reduce(unsigned __int128 x)
+        {
+            // 2^61 is 1 modulo the modulus, so the bits above 61 fold back onto the low bits.
+            auto folded = static_cast<uint64_t>(x & modulus) + static_cast<uint64_t>((x >> 61) & modulus) + static_cast<uint64_t>(x >> 122);
+            folded = (folded & modulus) + (folded >> 61);
+            return folded >= modulus ? folded - modulus : folded;
+        }
+
+        constexpr uint64_t mul(uint64_t a, uint64_t b)
+        {
+            return reduce(static_cast<unsigned __int128>(a) * b);
+        }
+
+        constexpr uint64_t add(uint64_t a, uint64_t b)
+        {
+            auto sum = a + b;
+            return sum >= modulus ? sum - modulus : sum;
+        }
+
+        constexpr uint64_t sub(uint64_t a, uint64_t b)
+        {
+            return a >= b ? a - b : a + modulus - b;
+        }
+
+        // base^0 .. base^interval.
+        constexpr auto small_powers = []
+        {
+            std::array<uint64_t, hash_checkpoint_interval + 1> powers{ };
+            powers[0] = 1;
+            for (size_t i = 1; i < powers.size(); ++i)
+            {
+                powers[i] = mul(powers[i - 1], base);
+            }
+            return powers;
+        }();
+
+        // base^(2^k).
+        constexpr auto square_powers = []
+        {
+            std::array<uint64_t, 64> powers{ };
+            powers[0] = base;
+            for (size_t i = 1; i < powers.size(); ++i)
+            {
+                powers[i] = mul(powers[i - 1], powers[i - 1]);
+            }
+            return powers;
+        }();
+
+        uint64_t power_of_base(size_t n)
+        {
+            if (n < small_powers.size())
+                return small_powers[n];
+            uint64_t result = 1;
+            for (size_t bit = 0; n != 0; ++bit, n >>= 1)
+            {
+                if (n & 1)
+                {
+                    result = mul(result, square_powers[bit]);
+                }
+            }
+            return result;
+        }
+
+        // The hash of at most 'hash_checkpoint_interval' code units.  The products are independent of each other
+        // and are only reduced once at the end.
+        uint64_t chunk_value(const CHAR_T* text, size_t count)
+        {
+            assert(count <= hash_checkpoint_interval);
+            unsigned __int128 sum = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                sum += static_cast<unsigned __int128>(small_powers[count - 1 - i]) * static_cast<std::make_unsigned_t<CHAR_T>>(text[i]);
+            }
+            return reduce(sum);
+        }
+
+        // The hash value of the prefix [0, offset) of a buffer.
+        uint64_t prefix_value(const CHAR_T* buffer, const uint64_t* checkpoints, size_t offset)
+        {
+            auto checkpoint = offset / hash_checkpoint_interval;
+            auto tail = offset % hash_checkpoint_interval;
+            auto tail_first = checkpoint * hash_checkpoint_interval;
+            return add(mul(checkpoints[checkpoint], small_powers[tail]), chunk_value(buffer + tail_first, tail));
+        }
+    } // namespace [anon]
+
+    ContentHash concat(const ContentHash& first, const ContentHash& second)
+    {
+        return { .value = add(mul(first.value, second.power), second.value),
+                 .power = mul(first.power, second.power) };
+    }
+
+    ContentHash hash_text(std::STRING_VIEW text)
+    {
+        uint64_t value = 0;
+        size_t i = 0;
+        for (; i + hash_checkpoint_interval <= text.size(); i += hash_checkpoint_interval)
+        {
+            value = add(mul(value, small_powers[hash_checkpoint_interval]), chunk_value(text.data() + i, hash_checkpoint_interval));
+        }
+        auto tail = text.size() - i;
+        value = add(mul(value, small_powers[tail]), chunk_value(text.data() + i, tail));
+        return { .value = value, .power = power_of_base(text.size()) };
+    }
+
+    void extend_hash_checkpoints(HashCheckpoints* checkpoints, std::STRING_VIEW buffer)
+    {
+        if (checkpoints->empty())
+        {
+            checkpoints->push_back(0);
+        }
+        auto value = checkpoints->back();
+        for (auto first = (checkpoints->size() - 1) * hash_checkpoint_interval;
+             first + hash_checkpoint_interval <= buffer.size();
+             first += hash_checkpoint_interval)
+        {
+            value = add(mul(value, small_powers[hash_checkpoint_interval]), chunk_value(buffer.data() + first, hash_checkpoint_interval));
+            checkpoints->push_back(value);
+        }
+    }
+
+    ContentHash hash_range(const CHAR_T* buffer, const uint64_t* checkpoints, size_t first, size_t last)
+    {
+        auto power = power_of_base(last - first);
+        auto value = sub(prefix_value(buffer, checkpoints, last), mul(prefix_value(buffer, checkpoints, first), power));
+        return { .value = value, .power = power };
+    }
+} // namespace PieceTree
@@ -0,0 +1,47 @@
+//
+//  fredbuf-hash.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "encoding.h"
+
+// Content hashes.  The hash of a text is the polynomial sum of c[i] * base^(n - 1 - i) modulo the Mersenne
+// prime 2^61 - 1.  The hash of a concatenation is computed from the hashes of its parts, so it does not depend
+// on how the text is split into pieces: every node aggregates the hash of its subtree and the hash of the
+// document is the hash of the root.
+namespace PieceTree
+{
+    struct ContentHash
+    {
+        uint64_t value = 0;
+        // base^n for a text of length n, the factor by which the text shifts the hash of the text before it.
+        uint64_t power = 1;
+
+        bool operator==(const ContentHash&) const = default;
+    };
+
+    // The hash of 'first' followed by 'second'.
+    ContentHash concat(const ContentHash& first, const ContentHash& second);
+
+    ContentHash hash_text(std::STRING_VIEW text);
+
+    // The prefix hashes of a buffer at every multiple of 'hash_checkpoint_interval' code units, starting with
+    // the empty prefix.  With them the hash of a range costs O(interval + log n) instead of O(n).
+    constexpr size_t hash_checkpoint_interval = 64;
+
+    using HashCheckpoints = std::vector<uint64_t>;
+
+    // Extends the checkpoints of a buffer which was appended to.
+    void extend_hash_checkpoints(HashCheckpoints* checkpoints, std::STRING_VIEW buffer);
+
+    // The hash of the range [first, last) of a buffer.
+    ContentHash hash_range(const CHAR_T* buffer, const uint64_t* checkpoints, size_t first, size_t last);
+} // namespace PieceTree
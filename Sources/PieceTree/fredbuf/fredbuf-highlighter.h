@@ -0,0 +1,59 @@
+//
+//  fredbuf-highlighter.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "fredbuf-tree-query.h"
+
+// Syntax highlighting of the visible lines of a document with a tree-sitter highlights query.  The captures of
+// every line which was highlighted are cached for the tree they came from.  Moving to a newer parse keeps the
+// lines which neither the edits in between nor the syntax changes they caused (see ts_tree_get_changed_ranges)
+// touched, lines below an edit move along with it.  Scrolling only runs the query over the lines which were not
+// visible before, typing only over the lines around the edit.
+namespace PieceTree
+{
+    // The capture 'capture' (e.g. "keyword") covers the code units [first_column, last_column) of 'line'.  A capture which spans
+    // several lines is split at the line feeds.
+    struct HighlightSpan
+    {
+        Line line;
+        size_t first_column;
+        size_t last_column;
+        uint32_t capture;
+    };
+
+    using HighlightSpans = std::vector<HighlightSpan>;
+
+    class Highlighter : public TreeQuery
+    {
+    public:
+        using TreeQuery::TreeQuery;
+
+        // Moves to a newer parse, see TreeQuery::advance.
+        void update(ParsedVersion parse);
+
+        // Populates 'spans' with the captures on the lines [first, last] of the current parse, in line order.
+        // Nested captures are all reported, in the order the query cursor yields them.  The query only runs over
+        // lines which are not cached.
+        void highlight(HighlightSpans* spans, Line first, Line last);
+    private:
+        struct CachedLine
+        {
+            bool valid = false;
+            HighlightSpans spans;
+        };
+
+        void invalidate(size_t first_row, size_t last_row);
+        void run_query(size_t first_row, size_t last_row);
+
+        // One entry per line of 'snapshot'.
+        std::vector<CachedLine> lines;
+    };
+} // namespace PieceTree
@@ -0,0 +1,149 @@
+//
+//  fredbuf-highlighter.mm
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#import <algorithm>
+#import <cassert>
+
+#import "fredbuf-highlighter.h"
+
+namespace PieceTree
+{
+    void Highlighter::update(ParsedVersion parse)
+    {
+        ParseChanges changes;
+        if (not advance(std::move(parse), &changes))
+            return;
+        if (not changes.incremental)
+        {
+            lines.assign(rep(snapshot->line_count()), { });
+            return;
+        }
+        // The cached lines follow the text changes: the replaced lines are dropped, the lines below move.
+        for (auto& record : changes.edits)
+        {
+            auto first_row = record.start_point.row;
+            auto old_rows = record.old_end_point.row - first_row + 1;
+            auto new_rows = record.new_end_point.row - first_row + 1;
+            auto row = lines.begin() + first_row;
+            if (old_rows > new_rows)
+            {
+                lines.erase(row, row + (old_rows - new_rows));
+            }
+            else if (new_rows > old_rows)
+            {
+                lines.insert(row, new_rows - old_rows, { });
+            }
+            invalidate(first_row, first_row + new_rows - 1);
+        }
+        for (auto& [first_row, last_row] : changes.changed_rows)
+        {
+            invalidate(first_row, last_row);
+        }
+        assert(lines.size() == rep(snapshot->line_count()));
+    }
+
+    void Highlighter::invalidate(size_t first_row, size_t last_row)
+    {
+        last_row = std::min(last_row, lines.size() - 1);
+        for (size_t row = first_row; row <= last_row; ++row)
+        {
+            lines[row].valid = false;
+            lines[row].spans.clear();
+        }
+    }
+
+    void Highlighter::highlight(HighlightSpans* spans, Line first, Line last)
+    {
+        spans->clear();
+        if (tree == nullptr or query == nullptr or first == Line::IndexBeginning)
+            return;
+        size_t first_row = rep(first) - 1;
+        size_t last_row = std::min<size_t>(rep(last) - 1, lines.size() - 1);
+        // Consecutive lines which are not cached share one query.
+        size_t row = first_row;
+        while (row <= last_row)
+        {
+            if (lines[row].valid)
+            {
+                ++row;
+                continue;
+            }
+            size_t run_last = row;
+            while (run_last < last_row and not lines[run_last + 1].valid)
+            {
+                ++run_last;
+            }
+            run_query(row, run_last);
+            row = run_last + 1;
+        }
+        // Cached spans keep the line they were queried on, the line may have moved since.
+        for (row = first_row; row <= last_row; ++row)
+        {
+            for (auto span : lines[row].spans)
+            {
+                span.line = Line{ row + 1 };
+                spans->push_back(span);
+            }
+        }
+    }
+
+    void Highlighter::run_query(size_t first_row, size_t last_row)
+    {
+        // The starts of the lines and of the line after them, to clip captures which span several lines.
+        std::vector<Line> line_numbers;
+        for (size_t row = first_row; row <= last_row + 1 and row < lines.size(); ++row)
+        {
+            line_numbers.push_back(Line{ row + 1 });
+        }
+        std::vector<CharOffset> starts;
+        snapshot->line_start_offsets(&starts, line_numbers);
+        auto range_last = last_row + 1 < lines.size() ? starts.back() : CharOffset{ rep(snapshot->length()) };
+        auto line_length = [&](size_t row)
+        {
+            auto index = row - first_row;
+            if (index + 1 < starts.size())
+                return rep(distance(starts[index], starts[index + 1])) - 1;
+            return rep(distance(starts[index], range_last));
+        };
+        for (size_t row = first_row; row <= last_row; ++row)
+        {
+            lines[row].spans.clear();
+            lines[row].valid = true;
+        }
+
+        ts_query_cursor_set_byte_range(cursor, static_cast<uint32_t>(rep(starts.front()) * sizeof(CHAR_T)),
+                                       static_cast<uint32_t>(rep(range_last) * sizeof(CHAR_T)));
+        ts_query_cursor_exec(cursor, query, ts_tree_root_node(tree));
+        TSQueryMatch match;
+        uint32_t capture_index = 0;
+        while (ts_query_cursor_next_capture(cursor, &match, &capture_index))
+        {
+            if (not satisfied(match))
+            {
+                ts_query_cursor_remove_match(cursor, match.id);
+                continue;
+            }
+            const TSQueryCapture& capture = match.captures[capture_index];
+            TSPoint start = ts_node_start_point(capture.node);
+            TSPoint end = ts_node_end_point(capture.node);
+            // Matches may reach outside the range, their captures there are cached already or not wanted.
+            size_t row = std::max<size_t>(start.row, first_row);
+            size_t capture_last_row = std::min<size_t>(end.row, last_row);
+            for (; row <= capture_last_row; ++row)
+            {
+                size_t first_column = row == start.row ? start.column / sizeof(CHAR_T) : 0;
+                size_t last_column = row == end.row ? end.column / sizeof(CHAR_T) : line_length(row);
+                if (first_column == last_column and row != start.row)
+                    continue;
+                lines[row].spans.push_back({ .line = Line{ row + 1 },
+                                             .first_column = first_column,
+                                             .last_column = last_column,
+                                             .capture = capture.index });
+            }
+        }
+    }
+} // namespace PieceTree
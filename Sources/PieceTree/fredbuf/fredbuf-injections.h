@@ -0,0 +1,119 @@
+//
+//  fredbuf-injections.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fredbuf-parse-service.h"
+#include "fredbuf-query-predicates.h"
+#include "fredbuf-thread-pool.h"
+
+// Parses the languages which are embedded in a document (code blocks, macros, doc comments ...).  An injection
+// query over the host tree finds the embedded ranges, the ranges of each language are parsed together as one
+// tree (see ts_parser_set_included_ranges).  The languages parse in parallel on a thread pool, all of them over
+// the same snapshot.  Moving to a newer host parse replays the text changes on the injected trees, so a language
+// whose ranges merely moved with the text reparses incrementally.  The query only runs again over the text which
+// the edits and the syntax changes they caused in the host (see ts_tree_get_changed_ranges) touched.
+//
+// The query follows the convention of the tree-sitter highlighters: @injection.content captures the nodes to
+// parse, their language is the text of the @injection.language capture of the same match or is set by the
+// pattern with (#set! injection.language "name").  Ranges of languages which the resolver does not know are
+// skipped.  The text predicates of the query are evaluated, see QueryPredicates.
+namespace PieceTree
+{
+    // Maps a language name of the injection query to its grammar, null if there is none.
+    using LanguageResolver = std::function<const TSLanguage*(std::string_view name)>;
+
+    // The tree of one injected language.  It belongs to the layer and stays valid until the next update.
+    struct InjectedTree
+    {
+        std::string_view language;
+        const TSTree* tree;
+        // The ranges of the document the tree was parsed from, in document order.
+        std::span<const TSRange> ranges;
+    };
+
+    class InjectionLayer
+    {
+    public:
+        InjectionLayer(const TSLanguage* host_language, std::string_view query_source, LanguageResolver resolver,
+                       ThreadPool* pool);
+        ~InjectionLayer();
+
+        InjectionLayer(const InjectionLayer&) = delete;
+        InjectionLayer& operator=(const InjectionLayer&) = delete;
+
+        bool valid() const
+        {
+            return query_error == TSQueryErrorNone;
+        }
+
+        TSQueryError error() const
+        {
+            return query_error;
+        }
+
+        // The byte offset into the query source at which compilation failed, or of the pattern whose text
+        // predicates are invalid.
+        uint32_t error_offset() const
+        {
+            return query_error_offset;
+        }
+
+        // Moves to a newer parse of the host document (see ParseService::latest_parse), parses the injected
+        // languages and waits for them.  The snapshot must come from the same tree as the snapshots of the
+        // previous parses.  Parses which are not newer than the current one are dropped.  Blocks for as long as
+        // the slowest language takes, so call it off the main thread, e.g. from the parse service listener.
+        void update(ParsedVersion parse);
+
+        // The version of the current host parse, if any.
+        std::optional<uint64_t> version() const;
+
+        // Populates 'trees' with the injected languages of the current version, ordered by name.
+        void injected_trees(std::vector<InjectedTree>* trees) const;
+    private:
+        struct Injection
+        {
+            std::string name;
+            TSParser* parser;
+            TSTree* tree = nullptr;
+            std::vector<TSRange> ranges;
+        };
+
+        // Byte ranges [first, last] of the document, ordered and disjoint.
+        using ByteRanges = std::vector<std::pair<uint32_t, uint32_t>>;
+
+        void move_ranges(const EditJournal& edits, const ByteRanges& dirty);
+        void find_ranges(const ByteRanges& regions);
+        Injection* injection(std::string_view name);
+
+        LanguageResolver resolver;
+        ThreadPool* pool;
+        TSQuery* query = nullptr;
+        TSQueryError query_error = TSQueryErrorNone;
+        uint32_t query_error_offset = 0;
+        QueryPredicates predicates;
+        std::optional<uint32_t> content_capture;
+        std::optional<uint32_t> language_capture;
+        // The language each pattern sets with #set!, if any.
+        std::vector<std::optional<std::string>> pattern_languages;
+        TSQueryCursor* cursor;
+        TSTree* host_tree = nullptr;
+        uint64_t host_version = 0;
+        std::optional<OwningSnapshot> snapshot;
+        // Ordered by name.  Languages keep their parser once they were seen.
+        std::vector<std::unique_ptr<Injection>> injections;
+    };
+} // namespace PieceTree
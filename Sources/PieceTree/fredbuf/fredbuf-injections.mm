@@ -0,0 +1,461 @@
+//
+//  fredbuf-injections.mm
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#import <algorithm>
+#import <condition_variable>
+#import <limits>
+#import <mutex>
+
+#import "fredbuf-injections.h"
+
+namespace PieceTree
+{
+    namespace
+    {
+        std::string_view string_value(const TSQuery* query, uint32_t id)
+        {
+            uint32_t length = 0;
+            const char* value = ts_query_string_value_for_id(query, id, &length);
+            return { value, length };
+        }
+
+        // Language names are ASCII, any other code unit makes the name unknown.
+        std::string node_text(const OwningSnapshot& snapshot, TSNode node)
+        {
+            size_t first = ts_node_start_byte(node) / sizeof(CHAR_T);
+            size_t last = ts_node_end_byte(node) / sizeof(CHAR_T);
+            std::string text;
+            text.reserve(last - first);
+            TreeWalker walker{ &snapshot, CharOffset{ first } };
+            while (text.size() < last - first)
+            {
+                auto span = walker.next_span();
+                if (span.empty())
+                    break;
+                for (auto c : span.substr(0, last - first - text.size()))
+                {
+                    text.push_back(c < 0x80 ? static_cast<char>(c) : '\0');
+                }
+            }
+            return text;
+        }
+
+        // Included ranges must be ordered and must not overlap.
+        void normalize_ranges(std::vector<TSRange>* ranges)
+        {
+            std::sort(ranges->begin(), ranges->end(),
+                      [](const TSRange& a, const TSRange& b) { return a.start_byte < b.start_byte; });
+            size_t merged = 0;
+            for (auto& range : *ranges)
+            {
+                auto& previous = (*ranges)[merged == 0 ? 0 : merged - 1];
+                if (merged != 0 and range.start_byte <= previous.end_byte)
+                {
+                    if (range.end_byte > previous.end_byte)
+                    {
+                        previous.end_byte = range.end_byte;
+                        previous.end_point = range.end_point;
+                    }
+                    continue;
+                }
+                (*ranges)[merged++] = range;
+            }
+            ranges->resize(merged);
+        }
+    } // namespace [anon]
+
+    InjectionLayer::InjectionLayer(const TSLanguage* host_language, std::string_view query_source,
+                                   LanguageResolver resolver, ThreadPool* pool):
+        resolver{ std::move(resolver) },
+        pool{ pool },
+        cursor{ ts_query_cursor_new() }
+    {
+        query = ts_query_new(host_language, query_source.data(), static_cast<uint32_t>(query_source.size()),
+                             &query_error_offset, &query_error);
+        if (query == nullptr)
+        {
+            if (query_error == TSQueryErrorNone)
+            {
+                query_error = TSQueryErrorLanguage;
+            }
+            return;
+        }
+        predicates = QueryPredicates{ query };
+        if (not predicates.valid())
+        {
+            query_error = TSQueryErrorSyntax;
+            query_error_offset = predicates.error_offset();
+            ts_query_delete(query);
+            query = nullptr;
+            return;
+        }
+        for (uint32_t capture = 0; capture < ts_query_capture_count(query); ++capture)
+        {
+            uint32_t length = 0;
+            std::string_view name{ ts_query_capture_name_for_id(query, capture, &length), length };
+            if (name == "injection.content")
+            {
+                content_capture = capture;
+            }
+            else if (name == "injection.language")
+            {
+                language_capture = capture;
+            }
+        }
+        pattern_languages.resize(ts_query_pattern_count(query));
+        for (uint32_t pattern = 0; pattern < pattern_languages.size(); ++pattern)
+        {
+            uint32_t step_count = 0;
+            const TSQueryPredicateStep* steps = ts_query_predicates_for_pattern(query, pattern, &step_count);
+            // Predicates are runs of steps which end with a Done step, only (#set! injection.language "name")
+            // is of interest.
+            for (uint32_t first = 0, last = 0; first < step_count; first = last + 1)
+            {
+                last = first;
+                while (last < step_count and steps[last].type != TSQueryPredicateStepTypeDone)
+                {
+                    ++last;
+                }
+                auto is_string = [&](uint32_t i, std::string_view value)
+                {
+                    return steps[i].type == TSQueryPredicateStepTypeString
+                           and (value.empty() or string_value(query, steps[i].value_id) == value);
+                };
+                if (last - first == 3 and is_string(first, "set!") and is_string(first + 1, "injection.language")
+                    and is_string(first + 2, { }))
+                {
+                    pattern_languages[pattern] = std::string{ string_value(query, steps[first + 2].value_id) };
+                }
+            }
+        }
+    }
+
+    InjectionLayer::~InjectionLayer()
+    {
+        if (host_tree != nullptr)
+        {
+            ts_tree_delete(host_tree);
+        }
+        for (auto& injection : injections)
+        {
+            if (injection->tree != nullptr)
+            {
+                ts_tree_delete(injection->tree);
+            }
+            ts_parser_delete(injection->parser);
+        }
+        ts_query_cursor_delete(cursor);
+        if (query != nullptr)
+        {
+            ts_query_delete(query);
+        }
+    }
+
+    std::optional<uint64_t> InjectionLayer::version() const
+    {
+        if (host_tree == nullptr)
+            return std::nullopt;
+        return host_version;
+    }
+
+    InjectionLayer::Injection* InjectionLayer::injection(std::string_view name)
+    {
+        auto i = std::lower_bound(injections.begin(), injections.end(), name,
+                                  [](const auto& injection, std::string_view name) { return injection->name < name; });
+        if (i != injections.end() and (*i)->name == name)
+            return i->get();
+        const TSLanguage* language = resolver ? resolver(name) : nullptr;
+        if (language == nullptr)
+            return nullptr;
+        TSParser* parser = ts_parser_new();
+        if (not ts_parser_set_language(parser, language))
+        {
+            ts_parser_delete(parser);
+            return nullptr;
+        }
+        auto injection = std::make_unique<Injection>(Injection{ .name = std::string{ name },
+                                                                .parser = parser,
+                                                                .tree = nullptr,
+                                                                .ranges = { } });
+        return injections.insert(i, std::move(injection))->get();
+    }
+
+    void InjectionLayer::move_ranges(const EditJournal& edits, const ByteRanges& dirty)
+    {
+        // The edits in bytes, [old_first, old_last] of the old document became bytes of the new document which
+        // end on 'new_last'.
+        struct ByteChange
+        {
+            uint32_t old_first;
+            uint32_t old_last;
+            uint32_t new_last;
+        };
+        std::vector<ByteChange> changes;
+        changes.reserve(edits.size());
+        uint32_t shift = 0;
+        for (auto& record : edits)
+        {
+            TSInputEdit edit = fredbuf_convert_edit_record(record);
+            changes.push_back({ .old_first = edit.start_byte - shift,
+                                .old_last = edit.old_end_byte - shift,
+                                .new_last = edit.new_end_byte });
+            shift += edit.new_end_byte - edit.old_end_byte;
+        }
+        std::vector<CharOffset> offsets;
+        std::vector<LinePosition> positions;
+        for (auto& injection : injections)
+        {
+            // The ranges which reach into edited or dirty bytes are dropped, the query finds them again (see
+            // ts_query_cursor_set_byte_range).  The others move by the bytes the edits before them added or
+            // removed, their points are looked up again.
+            auto next_change = changes.begin();
+            auto next_dirty = dirty.begin();
+            size_t kept = 0;
+            size_t first_moved = injection->ranges.size();
+            for (auto range : injection->ranges)
+            {
+                while (next_change != changes.end() and next_change->old_last < range.start_byte)
+                {
+                    ++next_change;
+                }
+                if (next_change != changes.end() and next_change->old_first < range.end_byte)
+                    continue;
+                if (next_change != changes.begin())
+                {
+                    uint32_t delta = (next_change - 1)->new_last - (next_change - 1)->old_last;
+                    range.start_byte += delta;
+                    range.end_byte += delta;
+                    first_moved = std::min(first_moved, kept);
+                }
+                while (next_dirty != dirty.end() and next_dirty->second < range.start_byte)
+                {
+                    ++next_dirty;
+                }
+                if (next_dirty != dirty.end() and next_dirty->first < range.end_byte)
+                    continue;
+                injection->ranges[kept++] = range;
+            }
+            injection->ranges.resize(kept);
+
+            offsets.clear();
+            for (size_t i = first_moved; i < kept; ++i)
+            {
+                offsets.push_back(CharOffset{ injection->ranges[i].start_byte / sizeof(CHAR_T) });
+                offsets.push_back(CharOffset{ injection->ranges[i].end_byte / sizeof(CHAR_T) });
+            }
+            snapshot->line_positions(&positions, offsets);
+            auto point = [&](size_t i)
+            {
+                return TSPoint{ static_cast<uint32_t>(rep(positions[i].line) - 1),
+                                static_cast<uint32_t>(rep(distance(positions[i].line_start, offsets[i])) * sizeof(CHAR_T)) };
+            };
+            for (size_t i = first_moved; i < kept; ++i)
+            {
+                injection->ranges[i].start_point = point(2 * (i - first_moved));
+                injection->ranges[i].end_point = point(2 * (i - first_moved) + 1);
+            }
+        }
+    }
+
+    void InjectionLayer::find_ranges(const ByteRanges& regions)
+    {
+        if (query == nullptr or not content_capture.has_value())
+            return;
+        // The content of every match which was found again with the language it goes to.  A match whose
+        // language changed (e.g. the name of a macro) still has its content in the old language among the kept
+        // ranges, so the kept ranges which overlap found content are replaced.
+        std::vector<std::pair<Injection*, TSRange>> found;
+        TSNode root = ts_tree_root_node(host_tree);
+        for (auto& [first, last] : regions)
+        {
+            // One byte more on each side: the cursor range is half open, and a node which now ends or starts
+            // right at an edit (e.g. a comment whose tail was removed) was dropped and has to be found again.
+            constexpr uint32_t end = std::numeric_limits<uint32_t>::max();
+            ts_query_cursor_set_byte_range(cursor, first == 0 ? 0 : first - 1, last >= end - 2 ? end : last + 2);
+            ts_query_cursor_exec(cursor, query, root);
+            TSQueryMatch match;
+            while (ts_query_cursor_next_match(cursor, &match))
+            {
+                if (not predicates.satisfied(match, *snapshot))
+                    continue;
+                std::optional<std::string> name = pattern_languages[match.pattern_index];
+                for (uint16_t i = 0; i < match.capture_count; ++i)
+                {
+                    if (match.captures[i].index == language_capture)
+                    {
+                        name = node_text(*snapshot, match.captures[i].node);
+                    }
+                }
+                Injection* target = name.has_value() ? injection(*name) : nullptr;
+                for (uint16_t i = 0; i < match.capture_count; ++i)
+                {
+                    TSNode node = match.captures[i].node;
+                    if (match.captures[i].index == content_capture and ts_node_end_byte(node) > ts_node_start_byte(node))
+                    {
+                        found.push_back({ target, { .start_point = ts_node_start_point(node),
+                                                    .end_point = ts_node_end_point(node),
+                                                    .start_byte = ts_node_start_byte(node),
+                                                    .end_byte = ts_node_end_byte(node) } });
+                    }
+                }
+            }
+        }
+        // The found content as ordered, disjoint byte ranges [first, last).
+        std::vector<std::pair<uint32_t, uint32_t>> found_bytes;
+        found_bytes.reserve(found.size());
+        for (auto& [target, range] : found)
+        {
+            found_bytes.push_back({ range.start_byte, range.end_byte });
+        }
+        std::sort(found_bytes.begin(), found_bytes.end());
+        size_t merged = 0;
+        for (auto& bytes : found_bytes)
+        {
+            if (merged != 0 and bytes.first <= found_bytes[merged - 1].second)
+            {
+                found_bytes[merged - 1].second = std::max(found_bytes[merged - 1].second, bytes.second);
+                continue;
+            }
+            found_bytes[merged++] = bytes;
+        }
+        found_bytes.resize(merged);
+        for (auto& injection : injections)
+        {
+            std::erase_if(injection->ranges, [&](const TSRange& range)
+            {
+                // Only the last found range which starts before 'range' ends can overlap it.
+                auto next = std::lower_bound(found_bytes.begin(), found_bytes.end(), range.end_byte,
+                                             [](const auto& bytes, uint32_t byte) { return bytes.first < byte; });
+                return next != found_bytes.begin() and (next - 1)->second > range.start_byte;
+            });
+        }
+        for (auto& [target, range] : found)
+        {
+            if (target != nullptr)
+            {
+                target->ranges.push_back(range);
+            }
+        }
+        for (auto& injection : injections)
+        {
+            normalize_ranges(&injection->ranges);
+        }
+    }
+
+    void InjectionLayer::update(ParsedVersion parse)
+    {
+        if (host_tree != nullptr and parse.version <= host_version)
+        {
+            ts_tree_delete(parse.tree);
+            return;
+        }
+        ByteRanges dirty;
+        if (host_tree == nullptr)
+        {
+            dirty.push_back({ 0, std::numeric_limits<uint32_t>::max() - 1 });
+            snapshot.emplace(std::move(parse.snapshot));
+        }
+        else
+        {
+            // The injected trees follow the text, so a language whose ranges only moved parses incrementally.
+            // The old host tree follows as well so tree-sitter can compare it with the new one.
+            EditJournal edits;
+            diff_edits(&edits, *snapshot, parse.snapshot);
+            for (auto& record : edits)
+            {
+                TSInputEdit edit = fredbuf_convert_edit_record(record);
+                ts_tree_edit(host_tree, &edit);
+                for (auto& injection : injections)
+                {
+                    if (injection->tree != nullptr)
+                    {
+                        ts_tree_edit(injection->tree, &edit);
+                    }
+                }
+                dirty.push_back({ edit.start_byte, edit.new_end_byte });
+            }
+            uint32_t count = 0;
+            TSRange* ranges = ts_tree_get_changed_ranges(host_tree, parse.tree, &count);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                dirty.push_back({ ranges[i].start_byte, ranges[i].end_byte });
+            }
+            free(ranges);
+            ts_tree_delete(host_tree);
+
+            std::sort(dirty.begin(), dirty.end());
+            ByteRanges merged;
+            for (auto& bytes : dirty)
+            {
+                if (not merged.empty() and bytes.first <= merged.back().second)
+                {
+                    merged.back().second = std::max(merged.back().second, bytes.second);
+                }
+                else
+                {
+                    merged.push_back(bytes);
+                }
+            }
+            dirty = std::move(merged);
+            snapshot.emplace(std::move(parse.snapshot));
+            move_ranges(edits, dirty);
+        }
+        host_tree = parse.tree;
+        host_version = parse.version;
+        find_ranges(dirty);
+
+        std::vector<Injection*> parses;
+        for (auto& injection : injections)
+        {
+            if (not injection->ranges.empty())
+            {
+                parses.push_back(injection.get());
+            }
+            else if (injection->tree != nullptr)
+            {
+                ts_tree_delete(injection->tree);
+                injection->tree = nullptr;
+            }
+        }
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t pending = parses.size();
+        for (Injection* injection : parses)
+        {
+            pool->submit([&, injection]
+            {
+                ts_parser_set_included_ranges(injection->parser, injection->ranges.data(),
+                                              static_cast<uint32_t>(injection->ranges.size()));
+                fredbuf_snapshot_input input = { &*snapshot, nullptr, 0, { } };
+                TSTree* tree = ts_parser_parse(injection->parser, injection->tree, fredbuf_load_snapshot_ts_input(&input));
+                fredbuf_snapshot_input_free(&input);
+                if (injection->tree != nullptr)
+                {
+                    ts_tree_delete(injection->tree);
+                }
+                injection->tree = tree;
+                std::lock_guard lock{ mutex };
+                --pending;
+                done.notify_all();
+            });
+        }
+        std::unique_lock lock{ mutex };
+        done.wait(lock, [&] { return pending == 0; });
+    }
+
+    void InjectionLayer::injected_trees(std::vector<InjectedTree>* trees) const
+    {
+        trees->clear();
+        for (auto& injection : injections)
+        {
+            if (injection->tree != nullptr)
+            {
+                trees->push_back({ .language = injection->name, .tree = injection->tree, .ranges = injection->ranges });
+            }
+        }
+    }
+} // namespace PieceTree
@@ -0,0 +1,104 @@
+//
+//  fredbuf-parse-service.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "fredbuf-concurrent.h"
+#include "fredbuf-tree-sitter.h"
+
+// Parses a document on a worker thread, incrementally.  The writer hands the service every version it
+// publishes together with the edits which led to it, the worker parses snapshots so it never touches the
+// writer's tree and the writer never waits for a parse.
+//
+// Versions which arrive while an incremental parse is running cancel it, the parse restarts on the newest
+// version with the edits of all versions since the last finished parse.  The first parse is never cancelled.
+// Versions which arrive while the worker is busy are coalesced in the same way, so a burst of keystrokes costs
+// one parse.
+namespace PieceTree
+{
+    // A finished parse (see ParseService::latest_parse).
+    struct ParsedVersion
+    {
+        // Owned by the receiver, delete it with ts_tree_delete.
+        TSTree* tree;
+        uint64_t version;
+        // The text 'tree' was parsed from.
+        OwningSnapshot snapshot;
+    };
+
+    class ParseService
+    {
+    public:
+        // Called on the worker thread whenever a parse finished, with the version it parsed.  Use 'latest_tree'
+        // to get the tree.
+        using Listener = std::function<void(uint64_t version)>;
+
+        // A parse runs in slices of 'slice_micros' (see ts_parser_set_timeout_micros), between slices the
+        // worker checks whether it should stop.  Zero runs every parse in one slice.
+        ParseService(const TSLanguage* language, Listener listener = nullptr, uint64_t slice_micros = 10000);
+        ~ParseService();
+
+        ParseService(const ParseService&) = delete;
+        ParseService& operator=(const ParseService&) = delete;
+
+        // Writer interface.  'edits' lead from the previously submitted version to 'version' (drain the edit
+        // journal of the tree after every publish), the first submission is parsed from scratch.
+        void submit(OwningSnapshot snapshot, uint64_t version, const EditJournal& edits);
+
+        // Convenience for a ConcurrentTree with its edit journal turned on: drains the journal and submits the
+        // latest published version.
+        void submit(ConcurrentTree* document);
+
+        // Reader interface.  May be called from any thread.
+        // Returns a copy of the tree of the latest finished parse, which the caller deletes with
+        // ts_tree_delete, or null if no parse finished yet.
+        TSTree* latest_tree(uint64_t* version = nullptr) const;
+
+        // The version of the latest finished parse, if any.
+        std::optional<uint64_t> latest_version() const;
+
+        // Like 'latest_tree', together with the snapshot the tree was parsed from.
+        std::optional<ParsedVersion> latest_parse() const;
+    private:
+        struct Pending
+        {
+            std::optional<OwningSnapshot> snapshot;
+            uint64_t version = 0;
+            EditJournal edits;
+        };
+
+        void run();
+        TSTree* parse(const OwningSnapshot& snapshot);
+        bool should_stop() const;
+
+        TSParser* parser;
+        Listener listener;
+        // The tree of the last finished parse with the edits since applied, only touched by the worker.
+        TSTree* base_tree = nullptr;
+
+        mutable std::mutex mutex;
+        std::condition_variable wake;
+        Pending pending;
+        bool stopping = false;
+        // Whether newer work cancels the running parse.
+        bool restartable = false;
+        TSTree* published_tree = nullptr;
+        uint64_t published_version = 0;
+        std::optional<OwningSnapshot> published_snapshot;
+        // Set when newer work arrives or the service stops, the running parse checks it (see
+        // ts_parser_set_cancellation_flag).
+        size_t cancel_flag = 0;
+        std::thread worker;
+    };
+} // namespace PieceTree
@@ -0,0 +1,168 @@
+//
+//  fredbuf-parse-service.mm
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#import "fredbuf-parse-service.h"
+
+namespace PieceTree
+{
+    ParseService::ParseService(const TSLanguage* language, Listener listener, uint64_t slice_micros):
+        parser{ ts_parser_new() },
+        listener{ std::move(listener) }
+    {
+        ts_parser_set_language(parser, language);
+        ts_parser_set_timeout_micros(parser, slice_micros);
+        ts_parser_set_cancellation_flag(parser, &cancel_flag);
+        worker = std::thread{ [this] { run(); } };
+    }
+
+    ParseService::~ParseService()
+    {
+        {
+            std::lock_guard lock{ mutex };
+            stopping = true;
+            __atomic_store_n(&cancel_flag, 1, __ATOMIC_SEQ_CST);
+        }
+        wake.notify_one();
+        worker.join();
+        if (base_tree != nullptr)
+        {
+            ts_tree_delete(base_tree);
+        }
+        if (published_tree != nullptr)
+        {
+            ts_tree_delete(published_tree);
+        }
+        ts_parser_delete(parser);
+    }
+
+    void ParseService::submit(OwningSnapshot snapshot, uint64_t version, const EditJournal& edits)
+    {
+        {
+            std::lock_guard lock{ mutex };
+            pending.snapshot.emplace(std::move(snapshot));
+            pending.version = version;
+            pending.edits.insert(pending.edits.end(), edits.begin(), edits.end());
+            if (restartable)
+            {
+                __atomic_store_n(&cancel_flag, 1, __ATOMIC_SEQ_CST);
+            }
+        }
+        wake.notify_one();
+    }
+
+    void ParseService::submit(ConcurrentTree* document)
+    {
+        EditJournal edits;
+        document->tree().drain_edit_journal(&edits);
+        uint64_t version = 0;
+        auto snapshot = document->snapshot(&version);
+        submit(std::move(snapshot), version, edits);
+    }
+
+    TSTree* ParseService::latest_tree(uint64_t* version) const
+    {
+        std::lock_guard lock{ mutex };
+        if (published_tree == nullptr)
+            return nullptr;
+        if (version != nullptr)
+        {
+            *version = published_version;
+        }
+        return ts_tree_copy(published_tree);
+    }
+
+    std::optional<uint64_t> ParseService::latest_version() const
+    {
+        std::lock_guard lock{ mutex };
+        if (published_tree == nullptr)
+            return std::nullopt;
+        return published_version;
+    }
+
+    std::optional<ParsedVersion> ParseService::latest_parse() const
+    {
+        std::lock_guard lock{ mutex };
+        if (published_tree == nullptr)
+            return std::nullopt;
+        return ParsedVersion{ .tree = ts_tree_copy(published_tree),
+                              .version = published_version,
+                              .snapshot = *published_snapshot };
+    }
+
+    bool ParseService::should_stop() const
+    {
+        std::lock_guard lock{ mutex };
+        return stopping or (restartable and pending.snapshot.has_value());
+    }
+
+    TSTree* ParseService::parse(const OwningSnapshot& snapshot)
+    {
+        fredbuf_snapshot_input input = { &snapshot, nullptr, 0, { } };
+        TSTree* tree = nullptr;
+        // A parse which ran out of time resumes where it stopped when it is called with the same arguments.
+        while (tree == nullptr and not should_stop())
+        {
+            tree = ts_parser_parse(parser, base_tree, fredbuf_load_snapshot_ts_input(&input));
+        }
+        fredbuf_snapshot_input_free(&input);
+        return tree;
+    }
+
+    void ParseService::run()
+    {
+        while (true)
+        {
+            Pending work;
+            {
+                std::unique_lock lock{ mutex };
+                wake.wait(lock, [this] { return stopping or pending.snapshot.has_value(); });
+                if (stopping)
+                    return;
+                work = std::move(pending);
+                pending = { };
+                // Work submitted from here on cancels this parse, unless it starts from scratch: restarting
+                // it would throw away all of its work and keep the document without a tree while typing.
+                restartable = base_tree != nullptr;
+                __atomic_store_n(&cancel_flag, 0, __ATOMIC_SEQ_CST);
+            }
+            // The edits are applied to the last finished tree even if the parse is cancelled, the next parse
+            // continues from there.  A cancelled parse must not be resumed, the input changed since.
+            ts_parser_reset(parser);
+            if (base_tree != nullptr)
+            {
+                for (auto& record : work.edits)
+                {
+                    TSInputEdit edit = fredbuf_convert_edit_record(record);
+                    ts_tree_edit(base_tree, &edit);
+                }
+            }
+            TSTree* tree = parse(*work.snapshot);
+            if (tree == nullptr)
+                continue;
+            if (base_tree != nullptr)
+            {
+                ts_tree_delete(base_tree);
+            }
+            base_tree = tree;
+            {
+                std::lock_guard lock{ mutex };
+                if (published_tree != nullptr)
+                {
+                    ts_tree_delete(published_tree);
+                }
+                // Readers copy the published tree while the worker edits its own.
+                published_tree = ts_tree_copy(tree);
+                published_version = work.version;
+                published_snapshot = std::move(work.snapshot);
+            }
+            if (listener)
+            {
+                listener(work.version);
+            }
+        }
+    }
+} // namespace PieceTree
@@ -0,0 +1,73 @@
+//
+//  fredbuf-query-predicates.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "fredbuf-regex.h"
+#include "fredbuf-tree-sitter.h"
+
+// The text predicates of a tree-sitter query, evaluated on the text of a snapshot.  tree-sitter only parses
+// predicates, a match whose predicates do not hold has to be skipped by the caller.
+//
+// Supported are #eq?, #match? and #any-of?, their negations #not-eq?, #not-match? and #not-any-of?, and the
+// #any-eq? ... forms which hold as soon as one node of a quantified capture does.  #eq? compares with a string
+// or with the text of another capture.  #match? uses the regular expressions of fredbuf-regex.h on the text of
+// the node alone, so '^' and '$' match at its ends (and at its line breaks).  Other predicates (#set!, #is? ...)
+// are properties and are left to the caller.
+namespace PieceTree
+{
+    class QueryPredicates
+    {
+    public:
+        // No predicates, every match satisfies them.
+        QueryPredicates() = default;
+        explicit QueryPredicates(const TSQuery* query);
+
+        // False if a text predicate has the wrong arguments or an invalid regular expression.
+        bool valid() const
+        {
+            return not error_at.has_value();
+        }
+
+        // The byte offset into the query source of the pattern with the invalid predicate.
+        uint32_t error_offset() const
+        {
+            return error_at.value_or(0);
+        }
+
+        // Whether the predicates of the pattern of 'match' hold for the text of its captures in 'snapshot'.  A
+        // predicate on a capture which the match does not contain holds.
+        bool satisfied(const TSQueryMatch& match, const OwningSnapshot& snapshot) const;
+    private:
+        enum class Kind { Eq, Match, AnyOf };
+
+        struct Predicate
+        {
+            Kind kind;
+            // False for the #not- forms.
+            bool positive;
+            // False for the #any- forms: one node of the capture has to satisfy the predicate, not all of them.
+            bool match_all;
+            uint32_t capture;
+            // #eq? with another capture.
+            std::optional<uint32_t> other_capture;
+            // The string of #eq?, the strings of #any-of?.
+            std::vector<std::STRING> strings;
+            std::optional<Regex> regex;
+        };
+
+        bool holds(const Predicate& predicate, const TSQueryMatch& match, const OwningSnapshot& snapshot) const;
+
+        // The predicates of every pattern.
+        std::vector<std::vector<Predicate>> patterns;
+        std::optional<uint32_t> error_at;
+    };
+} // namespace PieceTree
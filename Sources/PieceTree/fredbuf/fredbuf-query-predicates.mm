@@ -0,0 +1,252 @@
+//
+//  fredbuf-query-predicates.mm
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#import <algorithm>
+#import <span>
+#import <string_view>
+
+#import "fredbuf-query-predicates.h"
+
+namespace PieceTree
+{
+    namespace
+    {
+        // Query strings are UTF-8, the document is stored in CHAR_T.
+        std::STRING convert_utf8(std::string_view text)
+        {
+            std::STRING result;
+            for (size_t i = 0; i < text.size();)
+            {
+                auto lead = static_cast<unsigned char>(text[i]);
+                size_t length = lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+                char32_t code_point = length == 1 ? lead : lead & (0x7F >> length);
+                for (size_t k = 1; k < length and i + k < text.size(); ++k)
+                {
+                    code_point = (code_point << 6) | (static_cast<unsigned char>(text[i + k]) & 0x3F);
+                }
+                if (sizeof(CHAR_T) == 1)
+                {
+                    for (auto c : text.substr(i, length))
+                    {
+                        result.push_back(static_cast<CHAR_T>(c));
+                    }
+                }
+                else if (sizeof(CHAR_T) == 2 and code_point > 0xFFFF)
+                {
+                    code_point -= 0x10000;
+                    result.push_back(static_cast<CHAR_T>(0xD800 + (code_point >> 10)));
+                    result.push_back(static_cast<CHAR_T>(0xDC00 + (code_point & 0x3FF)));
+                }
+                else
+                {
+                    result.push_back(static_cast<CHAR_T>(code_point));
+                }
+                i += length;
+            }
+            return result;
+        }
+
+        std::STRING node_text(const OwningSnapshot& snapshot, TSNode node)
+        {
+            size_t first = ts_node_start_byte(node) / sizeof(CHAR_T);
+            size_t last = ts_node_end_byte(node) / sizeof(CHAR_T);
+            std::STRING text;
+            text.reserve(last - first);
+            TreeWalker walker{ &snapshot, CharOffset{ first } };
+            while (text.size() < last - first)
+            {
+                auto span = walker.next_span();
+                if (span.empty())
+                    break;
+                text.append(span.substr(0, last - first - text.size()));
+            }
+            return text;
+        }
+
+        bool regex_matches(const Regex& regex, std::STRING_VIEW text)
+        {
+            TreeBuilder builder;
+            if (not text.empty())
+            {
+                builder.accept(text);
+            }
+            Tree tree = builder.create();
+            return tree.find(regex, CharOffset{ }).found;
+        }
+    } // namespace [anon]
+
+    QueryPredicates::QueryPredicates(const TSQuery* query)
+    {
+        uint32_t pattern_count = ts_query_pattern_count(query);
+        patterns.resize(pattern_count);
+        for (uint32_t pattern = 0; pattern < pattern_count and valid(); ++pattern)
+        {
+            uint32_t step_count = 0;
+            const TSQueryPredicateStep* steps = ts_query_predicates_for_pattern(query, pattern, &step_count);
+            auto string_value = [&](const TSQueryPredicateStep& step)
+            {
+                uint32_t length = 0;
+                const char* value = ts_query_string_value_for_id(query, step.value_id, &length);
+                return std::string_view{ value, length };
+            };
+            auto fail = [&] { error_at = ts_query_start_byte_for_pattern(query, pattern); };
+            for (uint32_t first = 0; first < step_count and valid();)
+            {
+                uint32_t last = first;
+                while (last < step_count and steps[last].type != TSQueryPredicateStepTypeDone)
+                {
+                    ++last;
+                }
+                std::span<const TSQueryPredicateStep> predicate{ steps + first, steps + last };
+                first = last + 1;
+                if (predicate.empty() or predicate[0].type != TSQueryPredicateStepTypeString)
+                    continue;
+
+                std::string_view name = string_value(predicate[0]);
+                bool match_all = not name.starts_with("any-") or name == "any-of?";
+                if (not match_all)
+                {
+                    name.remove_prefix(4);
+                }
+                bool positive = not name.starts_with("not-");
+                if (not positive)
+                {
+                    name.remove_prefix(4);
+                }
+                Kind kind;
+                if (name == "eq?")
+                {
+                    kind = Kind::Eq;
+                }
+                else if (name == "match?")
+                {
+                    kind = Kind::Match;
+                }
+                else if (name == "any-of?")
+                {
+                    kind = Kind::AnyOf;
+                }
+                else
+                {
+                    // A property, not a text predicate.
+                    continue;
+                }
+
+                bool arguments_valid = predicate.size() >= 3 and predicate[1].type == TSQueryPredicateStepTypeCapture;
+                if (kind != Kind::AnyOf)
+                {
+                    arguments_valid = arguments_valid and predicate.size() == 3;
+                }
+                if (kind == Kind::Match)
+                {
+                    arguments_valid = arguments_valid and predicate[2].type == TSQueryPredicateStepTypeString;
+                }
+                for (size_t i = 2; kind == Kind::AnyOf and i < predicate.size(); ++i)
+                {
+                    arguments_valid = arguments_valid and predicate[i].type == TSQueryPredicateStepTypeString;
+                }
+                if (not arguments_valid)
+                {
+                    fail();
+                    break;
+                }
+
+                Predicate entry{ .kind = kind,
+                                 .positive = positive,
+                                 .match_all = match_all,
+                                 .capture = predicate[1].value_id,
+                                 .other_capture = std::nullopt,
+                                 .strings = { },
+                                 .regex = std::nullopt };
+                if (kind == Kind::Eq and predicate[2].type == TSQueryPredicateStepTypeCapture)
+                {
+                    entry.other_capture = predicate[2].value_id;
+                }
+                else
+                {
+                    for (size_t i = 2; i < predicate.size(); ++i)
+                    {
+                        entry.strings.push_back(convert_utf8(string_value(predicate[i])));
+                    }
+                }
+                if (kind == Kind::Match)
+                {
+                    entry.regex.emplace(entry.strings.front());
+                    if (not entry.regex->valid())
+                    {
+                        fail();
+                        break;
+                    }
+                }
+                patterns[pattern].push_back(std::move(entry));
+            }
+        }
+        if (not valid())
+        {
+            patterns.clear();
+        }
+    }
+
+    bool QueryPredicates::satisfied(const TSQueryMatch& match, const OwningSnapshot& snapshot) const
+    {
+        if (match.pattern_index >= patterns.size())
+            return true;
+        return std::all_of(patterns[match.pattern_index].begin(), patterns[match.pattern_index].end(),
+                           [&](const Predicate& predicate) { return holds(predicate, match, snapshot); });
+    }
+
+    bool QueryPredicates::holds(const Predicate& predicate, const TSQueryMatch& match, const OwningSnapshot& snapshot) const
+    {
+        auto nodes = [&](uint32_t capture)
+        {
+            std::vector<TSNode> result;
+            for (uint16_t i = 0; i < match.capture_count; ++i)
+            {
+                if (match.captures[i].index == capture)
+                {
+                    result.push_back(match.captures[i].node);
+                }
+            }
+            return result;
+        };
+        std::vector<TSNode> subjects = nodes(predicate.capture);
+        std::vector<TSNode> others;
+        if (predicate.other_capture.has_value())
+        {
+            others = nodes(*predicate.other_capture);
+            subjects.resize(std::min(subjects.size(), others.size()));
+        }
+        if (subjects.empty())
+            return true;
+
+        auto node_holds = [&](size_t i)
+        {
+            std::STRING text = node_text(snapshot, subjects[i]);
+            bool result = false;
+            switch (predicate.kind)
+            {
+            case Kind::Eq:
+                result = predicate.other_capture.has_value() ? text == node_text(snapshot, others[i])
+                                                             : text == predicate.strings.front();
+                break;
+            case Kind::Match:
+                result = regex_matches(*predicate.regex, text);
+                break;
+            case Kind::AnyOf:
+                result = std::find(predicate.strings.begin(), predicate.strings.end(), text) != predicate.strings.end();
+                break;
+            }
+            return result == predicate.positive;
+        };
+        for (size_t i = 0; i < subjects.size(); ++i)
+        {
+            if (node_holds(i) != predicate.match_all)
+                return not predicate.match_all;
+        }
+        return predicate.match_all;
+    }
+} // namespace PieceTree
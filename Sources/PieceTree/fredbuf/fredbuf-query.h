@@ -0,0 +1,54 @@
+//
+//  fredbuf-query.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "fredbuf-thread-pool.h"
+#include "fredbuf-tree-sitter.h"
+
+// Runs a tree-sitter query over a whole document on a thread pool.  The document is split into byte ranges of
+// about the same length at the boundaries of the nodes below the root (a node which is much longer than a range
+// is split at its children in turn), every range is queried by a cursor of its own over a copy of the tree (see
+// ts_query_cursor_set_byte_range).
+//
+// A match may reach into several ranges and be found by all of their cursors, it is reported by the range which
+// holds the earliest start of its captures, so every match is reported once.  Captures come in pattern order, so
+// that need not be the first capture.  Matches without captures are not reported.
+//
+// The work of the cursors adds up to about that of a single cursor over the whole document, except for patterns
+// of several sibling nodes (e.g. "((comment) . (function_definition))").  Their matches start wherever the parent
+// of the siblings is in range, so every cursor goes through all the children of the root for them.
+namespace PieceTree
+{
+    // The captures of the match are QueryMatches::captures [first_capture, first_capture + capture_count).
+    struct QueryMatch
+    {
+        uint32_t pattern_index;
+        uint32_t first_capture;
+        uint32_t capture_count;
+    };
+
+    struct QueryMatches
+    {
+        // Ordered by the earliest start of their captures, then by pattern.
+        std::vector<QueryMatch> matches;
+        // The nodes belong to the tree which was queried.
+        std::vector<TSQueryCapture> captures;
+        // Whether a cursor dropped matches because more than the match limit were in progress at once (see
+        // ts_query_cursor_did_exceed_match_limit).
+        bool exceeded_match_limit = false;
+    };
+
+    // Populates 'result' with the matches of 'query' in 'tree' and waits for them.  'match_limit' bounds the
+    // matches in progress of every cursor (see ts_query_cursor_set_match_limit).  The query and the tree are
+    // only read.
+    void query_matches_parallel(QueryMatches* result, const TSQuery* query, const TSTree* tree, ThreadPool* pool,
+                                uint32_t match_limit = UINT32_MAX);
+} // namespace PieceTree
@@ -0,0 +1,175 @@
+//
+//  fredbuf-query.mm
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#import <algorithm>
+#import <condition_variable>
+#import <mutex>
+
+#import "fredbuf-query.h"
+
+namespace PieceTree
+{
+    namespace
+    {
+        constexpr size_t ranges_per_worker = 4;
+        constexpr uint32_t min_range_bytes = 1 << 16;
+
+        struct FoundMatch
+        {
+            // The earliest start of its captures.
+            uint32_t start_byte;
+            QueryMatch match;
+        };
+
+        struct RangeMatches
+        {
+            std::vector<FoundMatch> matches;
+            std::vector<TSQueryCapture> captures;
+            bool exceeded_match_limit = false;
+        };
+
+        // The starts of the ranges, about 'target' bytes apart.  The first range starts at 0, the last one
+        // ends with the document.
+        std::vector<uint32_t> split_ranges(TSNode root, uint32_t target)
+        {
+            std::vector<uint32_t> starts = { 0 };
+            uint32_t next = target;
+            TSTreeCursor cursor = ts_tree_cursor_new(root);
+            auto advance = [&]
+            {
+                while (not ts_tree_cursor_goto_next_sibling(&cursor))
+                {
+                    if (not ts_tree_cursor_goto_parent(&cursor))
+                        return false;
+                }
+                return true;
+            };
+            bool more = ts_tree_cursor_goto_first_child(&cursor);
+            while (more)
+            {
+                TSNode node = ts_tree_cursor_current_node(&cursor);
+                uint32_t start = ts_node_start_byte(node);
+                uint32_t end = ts_node_end_byte(node);
+                if (end > next)
+                {
+                    if (start < next and end - start > target / 2 and ts_tree_cursor_goto_first_child(&cursor))
+                        continue;
+                    // The node goes to the range it overlaps most.
+                    uint32_t boundary = start >= next or next - start <= end - next ? start : end;
+                    if (boundary > starts.back())
+                    {
+                        starts.push_back(boundary);
+                    }
+                    next = std::max(starts.back() + target, end);
+                }
+                more = advance();
+            }
+            ts_tree_cursor_delete(&cursor);
+            return starts;
+        }
+
+        void query_range(RangeMatches* found, const TSQuery* query, const TSTree* tree, uint32_t first_byte,
+                         uint32_t last_byte, uint32_t match_limit)
+        {
+            // The root node of a tree refers to the root field of its TSTree, so the cursor starts from the root
+            // node of 'tree' moved to the copy, which leaves no capture referring to the copy's own memory.
+            TSTree* copy = ts_tree_copy(tree);
+            TSNode root = ts_tree_root_node(tree);
+            root.tree = copy;
+            TSQueryCursor* cursor = ts_query_cursor_new();
+            ts_query_cursor_set_match_limit(cursor, match_limit);
+            // One byte more on each side: a zero-width node (e.g. a missing semicolon) right on a boundary does
+            // not intersect either half open range, the widened cursors find it and its start decides the owner.
+            ts_query_cursor_set_byte_range(cursor, first_byte == 0 ? 0 : first_byte - 1,
+                                           last_byte == UINT32_MAX ? UINT32_MAX : last_byte + 1);
+            ts_query_cursor_exec(cursor, query, root);
+            TSQueryMatch match;
+            while (ts_query_cursor_next_match(cursor, &match))
+            {
+                if (match.capture_count == 0)
+                    continue;
+                uint32_t start_byte = UINT32_MAX;
+                for (uint16_t i = 0; i < match.capture_count; ++i)
+                {
+                    start_byte = std::min(start_byte, ts_node_start_byte(match.captures[i].node));
+                }
+                // The cursors of the other ranges the match reaches into find it as well.
+                if (start_byte < first_byte or start_byte >= last_byte)
+                    continue;
+                found->matches.push_back({ .start_byte = start_byte,
+                                           .match = { .pattern_index = match.pattern_index,
+                                                      .first_capture = static_cast<uint32_t>(found->captures.size()),
+                                                      .capture_count = match.capture_count } });
+                for (uint16_t i = 0; i < match.capture_count; ++i)
+                {
+                    // The copy shares every subtree with 'tree', the root included, so the captures can refer to
+                    // 'tree' and outlive the copy.
+                    TSQueryCapture capture = match.captures[i];
+                    capture.node.tree = tree;
+                    found->captures.push_back(capture);
+                }
+            }
+            found->exceeded_match_limit = ts_query_cursor_did_exceed_match_limit(cursor);
+            ts_query_cursor_delete(cursor);
+            ts_tree_delete(copy);
+            std::stable_sort(found->matches.begin(), found->matches.end(), [](const FoundMatch& a, const FoundMatch& b)
+            {
+                if (a.start_byte != b.start_byte)
+                    return a.start_byte < b.start_byte;
+                return a.match.pattern_index < b.match.pattern_index;
+            });
+        }
+    } // namespace [anon]
+
+    void query_matches_parallel(QueryMatches* result, const TSQuery* query, const TSTree* tree, ThreadPool* pool,
+                                uint32_t match_limit)
+    {
+        result->matches.clear();
+        result->captures.clear();
+        result->exceeded_match_limit = false;
+
+        TSNode root = ts_tree_root_node(tree);
+        const uint32_t total = ts_node_end_byte(root);
+        const uint32_t count = std::clamp<uint32_t>(total / min_range_bytes, 1,
+                                                    static_cast<uint32_t>(std::max<size_t>(1, pool->size() * ranges_per_worker)));
+        std::vector<uint32_t> starts = split_ranges(root, std::max<uint32_t>(1, total / count));
+        std::vector<RangeMatches> found(starts.size());
+
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t pending = starts.size();
+        for (size_t i = 0; i < starts.size(); ++i)
+        {
+            pool->submit([&, i]
+            {
+                uint32_t last_byte = i + 1 < starts.size() ? starts[i + 1] : UINT32_MAX;
+                query_range(&found[i], query, tree, starts[i], last_byte, match_limit);
+                std::lock_guard lock{ mutex };
+                --pending;
+                done.notify_all();
+            });
+        }
+        {
+            std::unique_lock lock{ mutex };
+            done.wait(lock, [&] { return pending == 0; });
+        }
+
+        // The ranges are in document order, so are their matches.
+        for (auto& range : found)
+        {
+            uint32_t offset = static_cast<uint32_t>(result->captures.size());
+            for (auto& match : range.matches)
+            {
+                QueryMatch moved = match.match;
+                moved.first_capture += offset;
+                result->matches.push_back(moved);
+            }
+            result->captures.insert(result->captures.end(), range.captures.begin(), range.captures.end());
+            result->exceeded_match_limit = result->exceeded_match_limit or range.exceeded_match_limit;
+        }
+    }
+} // namespace PieceTree
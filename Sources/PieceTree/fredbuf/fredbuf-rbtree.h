@@ -4,6 +4,7 @@
 
 #include "types.h"
 #include "encoding.h"
+#include "fredbuf-hash.h"
 
 // The concept for the RB tree is borrowed from
 // https://bartoszmilewski.com/2013/11/25/functional-data-structures-in-c-trees/ (Bartosz Milewski)
@@ -19,7 +20,9 @@ namespace PieceTree
 {
     enum class BufferIndex : size_t
     {
-        ModBuf = sentinel_for<BufferIndex>
+        // Indices with this bit set refer to a segment of the mod buffer, the remaining bits are the
+        // segment number.
+        ModBuf = size_t{ 1 } << (sizeof(size_t) * 8 - 1)
     };
 
     enum class Line : size_t
@@ -61,11 +64,14 @@ namespace PieceTree
 
         PieceTree::Length left_subtree_length = { };
         PieceTree::LFCount left_subtree_lf_count = { };
+        // The hash of the text of the piece, and of the whole subtree.
+        PieceTree::ContentHash piece_hash = { };
+        PieceTree::ContentHash subtree_hash = { };
     };
 
     class RedBlackTree;
 
-    NodeData attribute(const NodeData& data, const RedBlackTree& left);
+    NodeData attribute(const NodeData& data, const RedBlackTree& left, const RedBlackTree& right);
 
     enum class Color
     {
@@ -102,6 +108,55 @@ namespace PieceTree
     public:
         struct ColorTree;
 
+        // The memory a node takes, including the reference counts make_shared allocates next to it.
+        static constexpr size_t node_bytes = sizeof(Node) + 2 * sizeof(void*);
+
+        // A non-owning handle to a (sub)tree with the same queries as the tree itself.  Walking a tree through
+        // views touches no reference counts.  Nodes are immutable and owned by every root they are reachable
+        // from, so a view stays valid for as long as the tree it was taken from is alive.
+        class View
+        {
+        public:
+            View() = default;
+            View(const RedBlackTree& tree):
+                node{ tree.root_node.get() } { }
+
+            const Node* root_ptr() const
+            {
+                return node;
+            }
+
+            bool is_empty() const
+            {
+                return node == nullptr;
+            }
+
+            const NodeData& root() const
+            {
+                return node->data;
+            }
+
+            View left() const
+            {
+                return View{ node->left.get() };
+            }
+
+            View right() const
+            {
+                return View{ node->right.get() };
+            }
+
+            Color root_color() const
+            {
+                return node->color;
+            }
+        private:
+            explicit View(const Node* node):
+                node{ node } { }
+
+            const Node* node = nullptr;
+        };
+
         explicit RedBlackTree() = default;
 
         // Queries.
@@ -118,6 +173,9 @@ namespace PieceTree
         // Mutators.
         RedBlackTree insert(const NodeData& x, Offset at) const;
         RedBlackTree remove(Offset at) const;
+        // Rebuilds a node from its parts without rebalancing, e.g. when loading a saved session.  The caller
+        // guarantees that the parts form a valid tree and that 'data' is attributed for 'lft' and 'rgt'.
+        static RedBlackTree restore(Color c, const RedBlackTree& lft, const NodeData& data, const RedBlackTree& rgt);
     private:
         RedBlackTree(Color c,
                     const RedBlackTree& lft,
@@ -154,6 +212,6 @@ namespace PieceTree
     };
 
     // Global queries.
-    PieceTree::Length tree_length(const RedBlackTree& root);
-    PieceTree::LFCount tree_lf_count(const RedBlackTree& root);
+    PieceTree::Length tree_length(RedBlackTree::View root);
+    PieceTree::LFCount tree_lf_count(RedBlackTree::View root);
 } // namespace PieceTree
@@ -0,0 +1,1378 @@
+//
+//  fredbuf-regex.cpp
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#include "fredbuf-regex.h"
+#include "fredbuf.h"
+#include "encoding.h"
+#include <algorithm>
+#include <bitset>
+#include <cassert>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "enum-utils.h"
+
+namespace PieceTree
+{
+    namespace
+    {
+        // Code units are widened so that the positions before the beginning and after the end of the document
+        // can be told apart from real code units.
+        using Unit = int32_t;
+        constexpr Unit no_unit = -1;
+        constexpr Unit max_unit = 0xFFFF;
+
+        constexpr size_t npos = size_t(-1);
+        constexpr uint32_t unbounded = uint32_t(-1);
+
+        // Counted repetitions are expanded, so the program size (and the nesting depth of the parser) is capped
+        // to keep hostile patterns from exhausting memory or the stack.
+        constexpr size_t max_program_size = 1 << 16;
+        constexpr size_t max_nesting_depth = 512;
+        constexpr uint32_t max_repetition = 1 << 12;
+
+        constexpr Unit unit_of(CHAR_T c)
+        {
+            return static_cast<Unit>(static_cast<std::make_unsigned_t<CHAR_T>>(c));
+        }
+
+        constexpr bool is_word(Unit c)
+        {
+            return (c >= 'a' and c <= 'z') or (c >= 'A' and c <= 'Z') or (c >= '0' and c <= '9') or c == '_';
+        }
+
+        constexpr Unit other_case(Unit c)
+        {
+            if (c >= 'a' and c <= 'z')
+                return c - ('a' - 'A');
+            if (c >= 'A' and c <= 'Z')
+                return c + ('a' - 'A');
+            return c;
+        }
+
+        enum class Assertion : uint8_t { LineBegin, LineEnd, WordBoundary, NotWordBoundary };
+
+        class CharClass
+        {
+        public:
+            struct Range
+            {
+                Unit first;
+                Unit last; // Inclusive.
+            };
+
+            void add(Unit first, Unit last)
+            {
+                ranges.push_back({ .first = first, .last = last });
+            }
+
+            // Note: only for classes which are not negated, predefined classes are built from ranges alone.
+            void add(const CharClass& other)
+            {
+                assert(not other.negated);
+                ranges.insert(end(ranges), begin(other.ranges), end(other.ranges));
+            }
+
+            void add_complement_of(CharClass other)
+            {
+                other.normalize();
+                Unit next = 0;
+                for (auto& range : other.ranges)
+                {
+                    if (range.first > next)
+                    {
+                        add(next, range.first - 1);
+                    }
+                    next = range.last + 1;
+                }
+                if (next <= max_unit)
+                {
+                    add(next, max_unit);
+                }
+            }
+
+            void negate()
+            {
+                negated = not negated;
+            }
+
+            // Sorts and merges the ranges and builds the ASCII lookup table.  Folding adds the other case of
+            // every ASCII letter in the class.
+            void finalize(bool fold)
+            {
+                if (fold)
+                {
+                    auto count = ranges.size();
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        auto range = ranges[i];
+                        auto lower_first = std::max<Unit>(range.first, 'a');
+                        auto lower_last = std::min<Unit>(range.last, 'z');
+                        if (lower_first <= lower_last)
+                        {
+                            add(other_case(lower_first), other_case(lower_last));
+                        }
+                        auto upper_first = std::max<Unit>(range.first, 'A');
+                        auto upper_last = std::min<Unit>(range.last, 'Z');
+                        if (upper_first <= upper_last)
+                        {
+                            add(other_case(upper_first), other_case(upper_last));
+                        }
+                    }
+                }
+                normalize();
+                ascii.reset();
+                for (Unit c = 0; c < 128; ++c)
+                {
+                    ascii[c] = search(c) != negated;
+                }
+            }
+
+            bool contains(Unit c) const
+            {
+                if (c < 128)
+                    return c >= 0 and ascii[c];
+                return search(c) != negated;
+            }
+        private:
+            void normalize()
+            {
+                std::sort(begin(ranges), end(ranges), [](const Range& a, const Range& b) { return a.first < b.first; });
+                std::vector<Range> merged;
+                for (auto& range : ranges)
+                {
+                    if (not merged.empty() and range.first <= merged.back().last + 1)
+                    {
+                        merged.back().last = std::max(merged.back().last, range.last);
+                        continue;
+                    }
+                    merged.push_back(range);
+                }
+                ranges = std::move(merged);
+            }
+
+            bool search(Unit c) const
+            {
+                auto it = std::upper_bound(begin(ranges), end(ranges), c, [](Unit c, const Range& range) { return c < range.first; });
+                return it != begin(ranges) and c <= std::prev(it)->last;
+            }
+
+            std::vector<Range> ranges;
+            bool negated = false;
+            std::bitset<128> ascii;
+        };
+
+        void add_digits(CharClass* cls)
+        {
+            cls->add('0', '9');
+        }
+
+        void add_word(CharClass* cls)
+        {
+            cls->add('a', 'z');
+            cls->add('A', 'Z');
+            cls->add('0', '9');
+            cls->add('_', '_');
+        }
+
+        void add_space(CharClass* cls)
+        {
+            cls->add('\t', '\r');
+            cls->add(' ', ' ');
+            cls->add(0x00A0, 0x00A0);
+            cls->add(0x1680, 0x1680);
+            cls->add(0x2000, 0x200A);
+            cls->add(0x2028, 0x2029);
+            cls->add(0x202F, 0x202F);
+            cls->add(0x205F, 0x205F);
+            cls->add(0x3000, 0x3000);
+            cls->add(0xFEFF, 0xFEFF);
+        }
+
+        enum class NodeKind : uint8_t { Empty, Char, Any, Class, Assert, Concat, Alternate, Repeat };
+
+        struct Node
+        {
+            NodeKind kind = NodeKind::Empty;
+            Unit c = 0;
+            uint32_t cls = 0;
+            Assertion assertion = Assertion::LineBegin;
+            uint32_t min = 0;
+            uint32_t max = 0;
+            bool greedy = true;
+            std::vector<Node> children;
+        };
+
+        class Parser
+        {
+        public:
+            Parser(std::STRING_VIEW pattern, std::vector<CharClass>* classes, bool fold):
+                pattern{ pattern },
+                classes{ classes },
+                fold{ fold } { }
+
+            bool parse(Node* root)
+            {
+                if (not parse_alternation(root))
+                    return false;
+                // The only way to stop early is an unbalanced ')'.
+                if (pos != pattern.size())
+                    return fail(RegexError::UnmatchedParenthesis);
+                return true;
+            }
+
+            RegexError error = RegexError::None;
+            size_t error_at = 0;
+        private:
+            enum class EscapeKind { Unit, Class, Assertion };
+
+            struct Escape
+            {
+                EscapeKind kind;
+                Unit unit;
+                CharClass cls;
+                Assertion assertion;
+            };
+
+            bool fail(RegexError e)
+            {
+                error = e;
+                error_at = pos;
+                return false;
+            }
+
+            bool at_end() const
+            {
+                return pos == pattern.size();
+            }
+
+            Unit peek() const
+            {
+                return at_end() ? no_unit : unit_of(pattern[pos]);
+            }
+
+            bool parse_alternation(Node* out)
+            {
+                if (++depth > max_nesting_depth)
+                    return fail(RegexError::TooComplex);
+                Node branch;
+                if (not parse_concat(&branch))
+                    return false;
+                if (peek() != '|')
+                {
+                    *out = std::move(branch);
+                    --depth;
+                    return true;
+                }
+                out->kind = NodeKind::Alternate;
+                out->children.push_back(std::move(branch));
+                while (peek() == '|')
+                {
+                    ++pos;
+                    Node next;
+                    if (not parse_concat(&next))
+                        return false;
+                    out->children.push_back(std::move(next));
+                }
+                --depth;
+                return true;
+            }
+
+            bool parse_concat(Node* out)
+            {
+                out->kind = NodeKind::Concat;
+                while (not at_end() and peek() != '|' and peek() != ')')
+                {
+                    Node item;
+                    if (not parse_repeat(&item))
+                        return false;
+                    out->children.push_back(std::move(item));
+                }
+                return true;
+            }
+
+            bool parse_repeat(Node* out)
+            {
+                Node atom;
+                if (not parse_atom(&atom))
+                    return false;
+                uint32_t min = 0;
+                uint32_t max = 0;
+                auto start = pos;
+                switch (peek())
+                {
+                case '*':
+                    ++pos;
+                    min = 0;
+                    max = unbounded;
+                    break;
+                case '+':
+                    ++pos;
+                    min = 1;
+                    max = unbounded;
+                    break;
+                case '?':
+                    ++pos;
+                    min = 0;
+                    max = 1;
+                    break;
+                case '{':
+                    if (not parse_counted(&min, &max))
+                    {
+                        if (error != RegexError::None)
+                            return false;
+                        // Not a quantifier, the brace is a literal.
+                        pos = start;
+                        *out = std::move(atom);
+                        return true;
+                    }
+                    break;
+                default:
+                    *out = std::move(atom);
+                    return true;
+                }
+                out->kind = NodeKind::Repeat;
+                out->min = min;
+                out->max = max;
+                out->greedy = true;
+                if (peek() == '?')
+                {
+                    ++pos;
+                    out->greedy = false;
+                }
+                out->children.push_back(std::move(atom));
+                return true;
+            }
+
+            // Parses "{n}", "{n,}" or "{n,m}".  Returns false without an error if the text is not a quantifier.
+            bool parse_counted(uint32_t* min, uint32_t* max)
+            {
+                assert(peek() == '{');
+                ++pos;
+                if (not parse_number(min))
+                    return false;
+                *max = *min;
+                if (peek() == ',')
+                {
+                    ++pos;
+                    *max = unbounded;
+                    if (peek() != '}' and not parse_number(max))
+                        return false;
+                }
+                if (peek() != '}')
+                    return false;
+                ++pos;
+                if (*max != unbounded and *max < *min)
+                    return fail(RegexError::InvalidRepetition);
+                if (*min > max_repetition or (*max != unbounded and *max > max_repetition))
+                    return fail(RegexError::TooComplex);
+                return true;
+            }
+
+            bool parse_number(uint32_t* value)
+            {
+                if (peek() < '0' or peek() > '9')
+                    return false;
+                uint64_t n = 0;
+                while (peek() >= '0' and peek() <= '9')
+                {
+                    n = std::min<uint64_t>(n * 10 + (peek() - '0'), uint64_t(max_repetition) + 1);
+                    ++pos;
+                }
+                *value = static_cast<uint32_t>(n);
+                return true;
+            }
+
+            bool parse_atom(Node* out)
+            {
+                auto c = peek();
+                switch (c)
+                {
+                case '(':
+                {
+                    ++pos;
+                    if (pos + 1 < pattern.size() and pattern[pos] == '?' and pattern[pos + 1] == ':')
+                    {
+                        pos += 2;
+                    }
+                    if (not parse_alternation(out))
+                        return false;
+                    if (peek() != ')')
+                        return fail(RegexError::UnmatchedParenthesis);
+                    ++pos;
+                    return true;
+                }
+                case '[':
+                    return parse_class(out);
+                case '.':
+                    ++pos;
+                    out->kind = NodeKind::Any;
+                    return true;
+                case '^':
+                    ++pos;
+                    out->kind = NodeKind::Assert;
+                    out->assertion = Assertion::LineBegin;
+                    return true;
+                case '$':
+                    ++pos;
+                    out->kind = NodeKind::Assert;
+                    out->assertion = Assertion::LineEnd;
+                    return true;
+                case '*':
+                case '+':
+                case '?':
+                    return fail(RegexError::NothingToRepeat);
+                case '{':
+                {
+                    auto start = pos;
+                    uint32_t min = 0;
+                    uint32_t max = 0;
+                    if (parse_counted(&min, &max))
+                    {
+                        pos = start;
+                        return fail(RegexError::NothingToRepeat);
+                    }
+                    if (error != RegexError::None)
+                        return false;
+                    pos = start + 1;
+                    set_char(out, c);
+                    return true;
+                }
+                case '\\':
+                {
+                    Escape escape;
+                    if (not parse_escape(&escape, /* in_class = */ false))
+                        return false;
+                    switch (escape.kind)
+                    {
+                    case EscapeKind::Unit:
+                        set_char(out, escape.unit);
+                        break;
+                    case EscapeKind::Class:
+                        set_class(out, std::move(escape.cls));
+                        break;
+                    case EscapeKind::Assertion:
+                        out->kind = NodeKind::Assert;
+                        out->assertion = escape.assertion;
+                        break;
+                    }
+                    return true;
+                }
+                default:
+                    ++pos;
+                    set_char(out, c);
+                    return true;
+                }
+            }
+
+            bool parse_class(Node* out)
+            {
+                assert(peek() == '[');
+                auto start = pos;
+                ++pos;
+                CharClass cls;
+                bool negated = false;
+                if (peek() == '^')
+                {
+                    ++pos;
+                    negated = true;
+                }
+                while (peek() != ']')
+                {
+                    if (at_end())
+                    {
+                        pos = start;
+                        return fail(RegexError::UnmatchedBracket);
+                    }
+                    Escape first;
+                    if (not parse_class_atom(&first))
+                        return false;
+                    // A '-' at the end of the class or next to a predefined class is a literal.
+                    if (first.kind == EscapeKind::Unit and peek() == '-' and pos + 1 < pattern.size() and pattern[pos + 1] != ']')
+                    {
+                        ++pos;
+                        Escape last;
+                        if (not parse_class_atom(&last))
+                            return false;
+                        if (last.kind == EscapeKind::Unit)
+                        {
+                            if (last.unit < first.unit)
+                                return fail(RegexError::InvalidRange);
+                            cls.add(first.unit, last.unit);
+                            continue;
+                        }
+                        cls.add(first.unit, first.unit);
+                        cls.add('-', '-');
+                        add_escape(&cls, last);
+                        continue;
+                    }
+                    add_escape(&cls, first);
+                }
+                ++pos;
+                if (negated)
+                {
+                    cls.negate();
+                }
+                set_class(out, std::move(cls));
+                return true;
+            }
+
+            bool parse_class_atom(Escape* escape)
+            {
+                if (peek() == '\\')
+                    return parse_escape(escape, /* in_class = */ true);
+                escape->kind = EscapeKind::Unit;
+                escape->unit = peek();
+                ++pos;
+                return true;
+            }
+
+            void add_escape(CharClass* cls, const Escape& escape)
+            {
+                if (escape.kind == EscapeKind::Unit)
+                {
+                    cls->add(escape.unit, escape.unit);
+                    return;
+                }
+                cls->add(escape.cls);
+            }
+
+            bool parse_escape(Escape* escape, bool in_class)
+            {
+                assert(peek() == '\\');
+                ++pos;
+                if (at_end())
+                    return fail(RegexError::TrailingBackslash);
+                auto c = peek();
+                ++pos;
+                escape->kind = EscapeKind::Unit;
+                switch (c)
+                {
+                case 'n': escape->unit = '\n'; return true;
+                case 'r': escape->unit = '\r'; return true;
+                case 't': escape->unit = '\t'; return true;
+                case 'f': escape->unit = '\f'; return true;
+                case 'v': escape->unit = '\v'; return true;
+                case '0': escape->unit = 0; return true;
+                case 'x':
+                    return parse_hex(escape, 2);
+                case 'u':
+                    return parse_hex(escape, 4);
+                case 'd':
+                case 'D':
+                case 'w':
+                case 'W':
+                case 's':
+                case 'S':
+                {
+                    escape->kind = EscapeKind::Class;
+                    CharClass cls;
+                    auto kind = (c >= 'A' and c <= 'Z') ? other_case(c) : c;
+                    if (kind == 'd')
+                    {
+                        add_digits(&cls);
+                    }
+                    else if (kind == 'w')
+                    {
+                        add_word(&cls);
+                    }
+                    else
+                    {
+                        add_space(&cls);
+                    }
+                    if (c >= 'A' and c <= 'Z')
+                    {
+                        escape->cls.add_complement_of(cls);
+                        return true;
+                    }
+                    escape->cls = std::move(cls);
+                    return true;
+                }
+                case 'b':
+                    if (in_class)
+                    {
+                        escape->unit = '\b';
+                        return true;
+                    }
+                    escape->kind = EscapeKind::Assertion;
+                    escape->assertion = Assertion::WordBoundary;
+                    return true;
+                case 'B':
+                    if (in_class)
+                    {
+                        escape->unit = 'B';
+                        return true;
+                    }
+                    escape->kind = EscapeKind::Assertion;
+                    escape->assertion = Assertion::NotWordBoundary;
+                    return true;
+                default:
+                    // Identity escape.
+                    escape->unit = c;
+                    return true;
+                }
+            }
+
+            bool parse_hex(Escape* escape, size_t digits)
+            {
+                Unit value = 0;
+                auto start = pos;
+                for (size_t i = 0; i < digits; ++i)
+                {
+                    auto c = peek();
+                    Unit digit = -1;
+                    if (c >= '0' and c <= '9')
+                    {
+                        digit = c - '0';
+                    }
+                    else if (c >= 'a' and c <= 'f')
+                    {
+                        digit = c - 'a' + 10;
+                    }
+                    else if (c >= 'A' and c <= 'F')
+                    {
+                        digit = c - 'A' + 10;
+                    }
+                    if (digit < 0)
+                    {
+                        // Not a valid escape sequence, treat the letter as a literal like ECMAScript does.
+                        pos = start;
+                        escape->unit = unit_of(pattern[start - 1]);
+                        return true;
+                    }
+                    value = value * 16 + digit;
+                    ++pos;
+                }
+                escape->unit = value;
+                return true;
+            }
+
+            void set_char(Node* out, Unit c)
+            {
+                out->kind = NodeKind::Char;
+                out->c = c;
+            }
+
+            void set_class(Node* out, CharClass cls)
+            {
+                cls.finalize(fold);
+                out->kind = NodeKind::Class;
+                out->cls = static_cast<uint32_t>(classes->size());
+                classes->push_back(std::move(cls));
+            }
+
+            std::STRING_VIEW pattern;
+            std::vector<CharClass>* classes;
+            bool fold;
+            size_t pos = 0;
+            size_t depth = 0;
+        };
+
+        enum class Op : uint8_t { Char, Any, Class, Assert, Split, Jump, Match };
+
+        struct Inst
+        {
+            Op op;
+            Assertion assertion = Assertion::LineBegin;
+            // Char: the code unit and its other case (the same code unit when not folding).
+            Unit c = 0;
+            Unit alt = 0;
+            // Split: 'x' is preferred over 'y'.  Jump: 'x' is the target.  Class: 'x' is the class index.
+            uint32_t x = 0;
+            uint32_t y = 0;
+        };
+
+        class Compiler
+        {
+        public:
+            Compiler(std::vector<Inst>* insts, bool fold):
+                insts{ insts },
+                fold{ fold } { }
+
+            bool emit(const Node& node)
+            {
+                if (insts->size() >= max_program_size)
+                    return false;
+                switch (node.kind)
+                {
+                case NodeKind::Empty:
+                    return true;
+                case NodeKind::Char:
+                {
+                    auto alt = fold ? other_case(node.c) : node.c;
+                    insts->push_back({ .op = Op::Char, .c = node.c, .alt = alt });
+                    return true;
+                }
+                case NodeKind::Any:
+                    insts->push_back({ .op = Op::Any });
+                    return true;
+                case NodeKind::Class:
+                    insts->push_back({ .op = Op::Class, .x = node.cls });
+                    return true;
+                case NodeKind::Assert:
+                    insts->push_back({ .op = Op::Assert, .assertion = node.assertion });
+                    return true;
+                case NodeKind::Concat:
+                    for (auto& child : node.children)
+                    {
+                        if (not emit(child))
+                            return false;
+                    }
+                    return true;
+                case NodeKind::Alternate:
+                {
+                    std::vector<size_t> jumps;
+                    for (size_t i = 0; i < node.children.size(); ++i)
+                    {
+                        size_t split = npos;
+                        if (i + 1 < node.children.size())
+                        {
+                            split = insts->size();
+                            insts->push_back({ .op = Op::Split, .x = pc() + 1 });
+                        }
+                        if (not emit(node.children[i]))
+                            return false;
+                        if (split != npos)
+                        {
+                            jumps.push_back(insts->size());
+                            insts->push_back({ .op = Op::Jump });
+                            (*insts)[split].y = pc();
+                        }
+                    }
+                    for (auto jump : jumps)
+                    {
+                        (*insts)[jump].x = pc();
+                    }
+                    return true;
+                }
+                case NodeKind::Repeat:
+                    return emit_repeat(node);
+                }
+                return true;
+            }
+        private:
+            uint32_t pc() const
+            {
+                return static_cast<uint32_t>(insts->size());
+            }
+
+            void patch_split(size_t split, uint32_t body, uint32_t out, bool greedy)
+            {
+                (*insts)[split].x = greedy ? body : out;
+                (*insts)[split].y = greedy ? out : body;
+            }
+
+            bool emit_repeat(const Node& node)
+            {
+                auto& child = node.children.front();
+                for (uint32_t i = 0; i < node.min; ++i)
+                {
+                    if (not emit(child))
+                        return false;
+                }
+                if (node.max == unbounded)
+                {
+                    auto split = insts->size();
+                    insts->push_back({ .op = Op::Split });
+                    if (not emit(child))
+                        return false;
+                    insts->push_back({ .op = Op::Jump, .x = static_cast<uint32_t>(split) });
+                    patch_split(split, static_cast<uint32_t>(split + 1), pc(), node.greedy);
+                    return true;
+                }
+                std::vector<size_t> splits;
+                for (uint32_t i = node.min; i < node.max; ++i)
+                {
+                    splits.push_back(insts->size());
+                    insts->push_back({ .op = Op::Split });
+                    if (not emit(child))
+                        return false;
+                }
+                for (auto split : splits)
+                {
+                    patch_split(split, static_cast<uint32_t>(split + 1), pc(), node.greedy);
+                }
+                return true;
+            }
+
+            std::vector<Inst>* insts;
+            bool fold;
+        };
+    } // namespace [anon]
+
+    struct RegexProgram
+    {
+        std::vector<Inst> insts;
+        std::vector<CharClass> classes;
+        // Every match begins at the start of a line, so the search can jump from line to line.
+        bool line_anchored = false;
+        // The code units a match can begin with.  Only valid when the pattern cannot match the empty string.
+        bool has_first_units = false;
+        std::bitset<max_unit + 1> first_units;
+    };
+
+    namespace
+    {
+        // Walks the epsilon closure of the start of the program.  'visit' is called with each instruction
+        // which is reached and returns whether to follow the instruction further.
+        template <typename Visit>
+        void walk_start(const RegexProgram& program, Visit&& visit)
+        {
+            std::vector<bool> seen(program.insts.size());
+            std::vector<uint32_t> stack{ 0 };
+            while (not stack.empty())
+            {
+                auto pc = stack.back();
+                stack.pop_back();
+                if (seen[pc])
+                    continue;
+                seen[pc] = true;
+                auto& inst = program.insts[pc];
+                if (not visit(inst))
+                    continue;
+                switch (inst.op)
+                {
+                case Op::Split:
+                    stack.push_back(inst.y);
+                    stack.push_back(inst.x);
+                    break;
+                case Op::Jump:
+                    stack.push_back(inst.x);
+                    break;
+                case Op::Assert:
+                    stack.push_back(pc + 1);
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+
+        void analyze(RegexProgram* program)
+        {
+            bool anchored = true;
+            walk_start(*program, [&](const Inst& inst) {
+                if (inst.op == Op::Assert and inst.assertion == Assertion::LineBegin)
+                    return false;
+                if (inst.op != Op::Split and inst.op != Op::Jump and inst.op != Op::Assert)
+                {
+                    anchored = false;
+                }
+                return true;
+            });
+            program->line_anchored = anchored;
+
+            bool useful = true;
+            program->first_units.reset();
+            walk_start(*program, [&](const Inst& inst) {
+                switch (inst.op)
+                {
+                case Op::Char:
+                    program->first_units.set(inst.c);
+                    program->first_units.set(inst.alt);
+                    break;
+                case Op::Class:
+                {
+                    auto& cls = program->classes[inst.x];
+                    for (Unit c = 0; c <= max_unit; ++c)
+                    {
+                        if (cls.contains(c))
+                        {
+                            program->first_units.set(c);
+                        }
+                    }
+                    break;
+                }
+                case Op::Any:
+                case Op::Match:
+                    useful = false;
+                    break;
+                default:
+                    break;
+                }
+                return true;
+            });
+            program->has_first_units = useful;
+        }
+
+        // A set of threads (program counters and the offset their match started at) in priority order.
+        class ThreadList
+        {
+        public:
+            explicit ThreadList(size_t size):
+                sparse(size),
+                dense(size) { }
+
+            bool contains(uint32_t pc) const
+            {
+                auto idx = sparse[pc];
+                return idx < count and dense[idx].pc == pc;
+            }
+
+            void insert(uint32_t pc, size_t start)
+            {
+                sparse[pc] = static_cast<uint32_t>(count);
+                dense[count++] = { .pc = pc, .start = start };
+            }
+
+            void clear()
+            {
+                count = 0;
+            }
+
+            bool empty() const
+            {
+                return count == 0;
+            }
+
+            struct Thread
+            {
+                uint32_t pc;
+                size_t start;
+            };
+
+            const Thread* begin() const
+            {
+                return dense.data();
+            }
+
+            const Thread* end() const
+            {
+                return dense.data() + count;
+            }
+        private:
+            std::vector<uint32_t> sparse;
+            std::vector<Thread> dense;
+            size_t count = 0;
+        };
+
+        // The code units around a position which the assertions look at.
+        struct Context
+        {
+            Unit prev;
+            Unit cur;
+            Unit next;
+        };
+
+        bool holds(Assertion assertion, const Context& context)
+        {
+            switch (assertion)
+            {
+            case Assertion::LineBegin:
+                return context.prev == no_unit or context.prev == '\n';
+            case Assertion::LineEnd:
+                return context.cur == no_unit or context.cur == '\n' or (context.cur == '\r' and context.next == '\n');
+            case Assertion::WordBoundary:
+                return is_word(context.prev) != is_word(context.cur);
+            case Assertion::NotWordBoundary:
+                return is_word(context.prev) == is_word(context.cur);
+            }
+            return false;
+        }
+
+        // A forward cursor over the spans of a tree with two code units of lookahead, which may reach into
+        // the following pieces.
+        class SpanCursor
+        {
+        public:
+            template <typename TreeT>
+            SpanCursor(const TreeT* tree, CharOffset offset):
+                walker{ tree }
+            {
+                seek(offset);
+            }
+
+            void seek(CharOffset offset)
+            {
+                ahead_count = 0;
+                pos = rep(offset);
+                idx = 0;
+                if (pos == 0)
+                {
+                    walker.seek(offset);
+                    prev_unit = no_unit;
+                    span = walker.next_span();
+                    return;
+                }
+                walker.seek(retract(offset));
+                span = walker.next_span();
+                prev_unit = span.empty() ? no_unit : unit_of(span.front());
+                idx = 1;
+                if (idx >= span.size())
+                {
+                    next_span();
+                }
+            }
+
+            size_t offset() const
+            {
+                return pos;
+            }
+
+            Unit prev() const
+            {
+                return prev_unit;
+            }
+
+            Unit current() const
+            {
+                return idx < span.size() ? unit_of(span[idx]) : no_unit;
+            }
+
+            Unit peek(size_t k)
+            {
+                if (idx + k < span.size())
+                    return unit_of(span[idx + k]);
+                if (idx >= span.size())
+                    return no_unit;
+                size_t rest = k - (span.size() - idx);
+                for (size_t n = 0;; ++n)
+                {
+                    if (n == ahead_count)
+                    {
+                        auto next = walker.next_span();
+                        if (next.empty())
+                            return no_unit;
+                        ahead[ahead_count++] = next;
+                    }
+                    if (rest < ahead[n].size())
+                        return unit_of(ahead[n][rest]);
+                    rest -= ahead[n].size();
+                }
+            }
+
+            void advance()
+            {
+                assert(idx < span.size());
+                prev_unit = unit_of(span[idx]);
+                ++idx;
+                ++pos;
+                if (idx == span.size())
+                {
+                    next_span();
+                }
+            }
+
+            // Advances until the current code unit is in 'units', the end of the document or 'limit'.
+            void skip_to(const std::bitset<max_unit + 1>& units, size_t limit)
+            {
+                while (idx < span.size() and pos < limit)
+                {
+                    auto stop = std::min(span.size(), idx + (limit - pos));
+                    auto j = idx;
+                    while (j < stop and not units[unit_of(span[j])])
+                    {
+                        ++j;
+                    }
+                    if (j == idx)
+                        return;
+                    pos += j - idx;
+                    prev_unit = unit_of(span[j - 1]);
+                    idx = j;
+                    if (idx < span.size())
+                        return;
+                    next_span();
+                }
+            }
+
+            // Advances past the next 'unit' in the current span.  Returns false (without moving) if the span
+            // does not contain it.
+            bool skip_past_in_span(CHAR_T unit)
+            {
+                auto found = span.find(unit, idx);
+                if (found == std::STRING_VIEW::npos)
+                    return false;
+                pos += found + 1 - idx;
+                prev_unit = unit;
+                idx = found + 1;
+                if (idx == span.size())
+                {
+                    next_span();
+                }
+                return true;
+            }
+        private:
+            void next_span()
+            {
+                idx = 0;
+                if (ahead_count == 0)
+                {
+                    span = walker.next_span();
+                    return;
+                }
+                span = ahead[0];
+                ahead[0] = ahead[1];
+                --ahead_count;
+            }
+
+            TreeWalker walker;
+            std::STRING_VIEW span;
+            size_t idx = 0;
+            // Lookahead can reach at most two code units, so at most two pieces past the current one.
+            std::STRING_VIEW ahead[2];
+            size_t ahead_count = 0;
+            size_t pos = 0;
+            Unit prev_unit = no_unit;
+        };
+
+        template <typename TreeT>
+        class Matcher
+        {
+        public:
+            Matcher(const TreeT* tree, const RegexProgram& program, CharOffset first):
+                tree{ tree },
+                program{ program },
+                cursor{ tree, first },
+                clist{ program.insts.size() },
+                nlist{ program.insts.size() } { }
+
+            // Finds the leftmost match (preferring the alternatives and quantifiers the way a backtracking
+            // engine would) which starts at or after 'first' and before 'start_limit'.  An empty match at
+            // 'no_empty_at' is skipped.
+            bool next(CharOffset first, size_t start_limit, size_t no_empty_at, SearchMatch* match)
+            {
+                if (cursor.offset() != rep(first))
+                {
+                    cursor.seek(first);
+                }
+                clist.clear();
+                bool matched = false;
+                while (true)
+                {
+                    const size_t pos = cursor.offset();
+                    if (not matched and pos < start_limit and clist.empty())
+                    {
+                        if (not seek_candidate(start_limit))
+                            return false;
+                    }
+                    if (not matched and cursor.offset() < start_limit)
+                    {
+                        add(&clist, 0, cursor.offset(), { .prev = cursor.prev(), .cur = cursor.current(), .next = cursor.peek(1) });
+                    }
+                    if (clist.empty())
+                        break;
+
+                    const size_t at = cursor.offset();
+                    const Unit c = cursor.current();
+                    const Context next_context{ .prev = c, .cur = cursor.peek(1), .next = cursor.peek(2) };
+                    nlist.clear();
+                    for (auto& thread : clist)
+                    {
+                        auto& inst = program.insts[thread.pc];
+                        bool advance = false;
+                        bool cut = false;
+                        switch (inst.op)
+                        {
+                        case Op::Match:
+                            if (thread.start == at and at == no_empty_at)
+                                break;
+                            matched = true;
+                            cut = true;
+                            *match = { .first = CharOffset{ thread.start }, .last = CharOffset{ at } };
+                            break;
+                        case Op::Char:
+                            advance = c == inst.c or c == inst.alt;
+                            break;
+                        case Op::Any:
+                            advance = c != no_unit and c != '\n' and c != '\r';
+                            break;
+                        case Op::Class:
+                            advance = c != no_unit and program.classes[inst.x].contains(c);
+                            break;
+                        default:
+                            break;
+                        }
+                        if (advance)
+                        {
+                            add(&nlist, thread.pc + 1, thread.start, next_context);
+                        }
+                        // Threads after a match have a lower priority and are cut off.
+                        if (cut)
+                            break;
+                    }
+                    if (c == no_unit)
+                        break;
+                    std::swap(clist, nlist);
+                    cursor.advance();
+                }
+                return matched;
+            }
+        private:
+            // Moves the cursor to the next position a match could start at.  Returns false if there is none.
+            bool seek_candidate(size_t start_limit)
+            {
+                if (program.line_anchored)
+                {
+                    while (cursor.prev() != no_unit and cursor.prev() != '\n')
+                    {
+                        if (cursor.current() == no_unit)
+                            return false;
+                        if (cursor.skip_past_in_span('\n'))
+                            continue;
+                        // The rest of the line spans several pieces, use the line index to jump over it.
+                        auto line = tree->line_at(CharOffset{ cursor.offset() });
+                        if (rep(line) >= rep(tree->line_count()))
+                            return false;
+                        cursor.seek(tree->get_line_range_with_newline(line).last);
+                    }
+                    return cursor.offset() < start_limit;
+                }
+                if (program.has_first_units)
+                {
+                    cursor.skip_to(program.first_units, start_limit);
+                    return cursor.current() != no_unit and cursor.offset() < start_limit;
+                }
+                return true;
+            }
+
+            void add(ThreadList* list, uint32_t pc, size_t start, const Context& context)
+            {
+                stack.push_back(pc);
+                while (not stack.empty())
+                {
+                    pc = stack.back();
+                    stack.pop_back();
+                    if (list->contains(pc))
+                        continue;
+                    list->insert(pc, start);
+                    auto& inst = program.insts[pc];
+                    switch (inst.op)
+                    {
+                    case Op::Jump:
+                        stack.push_back(inst.x);
+                        break;
+                    case Op::Split:
+                        stack.push_back(inst.y);
+                        stack.push_back(inst.x);
+                        break;
+                    case Op::Assert:
+                        if (holds(inst.assertion, context))
+                        {
+                            stack.push_back(pc + 1);
+                        }
+                        break;
+                    default:
+                        break;
+                    }
+                }
+            }
+
+            const TreeT* tree;
+            const RegexProgram& program;
+            SpanCursor cursor;
+            ThreadList clist;
+            ThreadList nlist;
+            std::vector<uint32_t> stack;
+        };
+    } // namespace [anon]
+
+    class RegexSearcher
+    {
+    public:
+        // Reports the non-overlapping matches which start in [first, start_limit) until 'on_match' returns
+        // false.  'start_limit' may be one past the end of the document to allow an empty match there.
+        template <typename TreeT, typename OnMatch>
+        static void search(const TreeT* tree, const Regex& regex, CharOffset first, CharOffset start_limit, OnMatch&& on_match)
+        {
+            assert(regex.valid());
+            if (not regex.valid() or rep(first) > rep(tree->length()))
+                return;
+            Matcher<TreeT> matcher{ tree, *regex.program, first };
+            size_t no_empty_at = npos;
+            SearchMatch match{ };
+            while (matcher.next(first, rep(start_limit), no_empty_at, &match))
+            {
+                if (not on_match(match))
+                    return;
+                // After an empty match the search resumes at the same offset but only accepts non-empty matches.
+                no_empty_at = match.first == match.last ? rep(match.last) : npos;
+                first = match.last;
+            }
+        }
+    };
+
+    Regex::Regex(std::STRING_VIEW pattern, CaseSensitive case_sensitive)
+    {
+        const bool fold = is_no(case_sensitive);
+        auto compiled = std::make_shared<RegexProgram>();
+        Node root;
+        Parser parser{ pattern, &compiled->classes, fold };
+        if (not parser.parse(&root))
+        {
+            error_code = parser.error;
+            error_at = parser.error_at;
+            return;
+        }
+        Compiler compiler{ &compiled->insts, fold };
+        if (not compiler.emit(root) or compiled->insts.size() >= max_program_size)
+        {
+            error_code = RegexError::TooComplex;
+            error_at = pattern.size();
+            return;
+        }
+        compiled->insts.push_back({ .op = Op::Match });
+        analyze(compiled.get());
+        program = std::move(compiled);
+    }
+
+    namespace
+    {
+        template <typename TreeT>
+        FindResult find_regex_in(const TreeT* tree, const Regex& regex, CharOffset from)
+        {
+            FindResult result{ .found = false, .match = { } };
+            RegexSearcher::search(tree, regex, from, extend(CharOffset{ rep(tree->length()) }), [&](const SearchMatch& match) {
+                result = { .found = true, .match = match };
+                return false;
+            });
+            return result;
+        }
+
+        template <typename TreeT>
+        void find_all_regex_in(const TreeT* tree, SearchMatches* matches, const Regex& regex, size_t max_matches)
+        {
+            matches->clear();
+            RegexSearcher::search(tree, regex, CharOffset{ }, extend(CharOffset{ rep(tree->length()) }), [&](const SearchMatch& match) {
+                matches->push_back(match);
+                return max_matches == 0 or matches->size() < max_matches;
+            });
+        }
+    } // namespace [anon]
+
+    FindResult Tree::find(const Regex& regex, CharOffset from) const
+    {
+        return find_regex_in(this, regex, from);
+    }
+
+    FindResult OwningSnapshot::find(const Regex& regex, CharOffset from) const
+    {
+        return find_regex_in(this, regex, from);
+    }
+
+    FindResult ReferenceSnapshot::find(const Regex& regex, CharOffset from) const
+    {
+        return find_regex_in(this, regex, from);
+    }
+
+    void Tree::find_all(SearchMatches* matches, const Regex& regex, size_t max_matches) const
+    {
+        find_all_regex_in(this, matches, regex, max_matches);
+    }
+
+    void OwningSnapshot::find_all(SearchMatches* matches, const Regex& regex, size_t max_matches) const
+    {
+        find_all_regex_in(this, matches, regex, max_matches);
+    }
+
+    void ReferenceSnapshot::find_all(SearchMatches* matches, const Regex& regex, size_t max_matches) const
+    {
+        find_all_regex_in(this, matches, regex, max_matches);
+    }
+} // namespace PieceTree
@@ -0,0 +1,71 @@
+//
+//  fredbuf-regex.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+#include <memory>
+#include "encoding.h"
+#include "fredbuf-search.h"
+
+// Regular expression search over the piece tree.  Patterns are compiled into a small NFA program which is
+// executed as a Pike VM over the spans of the tree, so the automaton state simply carries over from one
+// piece to the next and the document is never flattened.
+//
+// The supported syntax is the common subset of ECMAScript:
+//   * literals, '.', character classes ("[a-z]", "[^...]") and the escapes \d \D \w \W \s \S \n \r \t \f \v \0
+//     \xHH \uHHHH.
+//   * groups "(...)" and "(?:...)" (both are non-capturing, only the whole match is reported), alternation '|'.
+//   * the quantifiers '*', '+', '?', "{n}", "{n,}" and "{n,m}", each with a lazy '?' form.
+//   * the assertions '^' and '$' (always multi-line, a line ends before "\n" or "\r\n") and \b \B.
+// Matching works on UTF-16 code units and case insensitive patterns only fold ASCII letters, the same as the
+// literal search.
+namespace PieceTree
+{
+    enum class RegexError
+    {
+        None,
+        UnmatchedParenthesis,
+        UnmatchedBracket,
+        InvalidRange,
+        InvalidRepetition,
+        NothingToRepeat,
+        TrailingBackslash,
+        TooComplex
+    };
+
+    // The compiled form of a pattern.  Only the search engine looks inside.
+    struct RegexProgram;
+
+    class Regex
+    {
+    public:
+        explicit Regex(std::STRING_VIEW pattern, CaseSensitive case_sensitive = CaseSensitive::Yes);
+
+        bool valid() const
+        {
+            return error_code == RegexError::None;
+        }
+
+        RegexError error() const
+        {
+            return error_code;
+        }
+
+        // The offset into the pattern at which compilation failed.
+        size_t error_offset() const
+        {
+            return error_at;
+        }
+    private:
+        friend class RegexSearcher;
+
+        // Shared so that copies of the same regex (e.g. handed to several searches) compile only once.
+        std::shared_ptr<const RegexProgram> program;
+        RegexError error_code = RegexError::None;
+        size_t error_at = 0;
+    };
+} // namespace PieceTree
@@ -0,0 +1,653 @@
+//
+//  fredbuf-search.cpp
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#include "fredbuf-search.h"
+#include "fredbuf.h"
+#include "fredbuf-thread-pool.h"
+#include "encoding.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string_view>
+#include <string>
+
+#include "enum-utils.h"
+
+#ifdef TEXTBUF_UTF16
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TEXTBUF_SEARCH_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define TEXTBUF_SEARCH_SSE2
+#endif
+#endif // TEXTBUF_UTF16
+
+namespace PieceTree
+{
+    namespace
+    {
+        constexpr size_t npos = std::STRING_VIEW::npos;
+
+        // Needles of at least this length use Boyer-Moore-Horspool, shorter needles scan for the first
+        // code unit and verify the candidates.
+        constexpr size_t horspool_threshold = 8;
+
+        // Parallel searches use a few ranges per worker so that uneven ranges even out, but do not split
+        // below this many code units since small ranges are not worth a job.
+        constexpr size_t ranges_per_worker = 4;
+        constexpr size_t min_range_length = 1 << 20;
+
+        constexpr CHAR_T fold_ascii(CHAR_T c)
+        {
+            return (c >= 'A' and c <= 'Z') ? CHAR_T(c + ('a' - 'A')) : c;
+        }
+
+        constexpr CHAR_T upper_ascii(CHAR_T c)
+        {
+            return (c >= 'a' and c <= 'z') ? CHAR_T(c - ('a' - 'A')) : c;
+        }
+
+        // Returns the first code unit in [first, last) which is equal to 'a' or 'b', or 'last' if there is none.
+        const CHAR_T* scan_forward(const CHAR_T* first, const CHAR_T* last, CHAR_T a, CHAR_T b)
+        {
+#if defined(TEXTBUF_SEARCH_NEON)
+            const uint16x8_t va = vdupq_n_u16(a);
+            const uint16x8_t vb = vdupq_n_u16(b);
+            while (last - first >= 8)
+            {
+                uint16x8_t v = vld1q_u16(reinterpret_cast<const uint16_t*>(first));
+                uint16x8_t eq = vorrq_u16(vceqq_u16(v, va), vceqq_u16(v, vb));
+                // Narrow each 16-bit lane to 8 bits so the whole comparison fits in a scalar.
+                uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(eq)), 0);
+                if (mask != 0)
+                    return first + (__builtin_ctzll(mask) / 8);
+                first += 8;
+            }
+#elif defined(TEXTBUF_SEARCH_SSE2)
+            const __m128i va = _mm_set1_epi16(static_cast<short>(a));
+            const __m128i vb = _mm_set1_epi16(static_cast<short>(b));
+            while (last - first >= 8)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+                __m128i eq = _mm_or_si128(_mm_cmpeq_epi16(v, va), _mm_cmpeq_epi16(v, vb));
+                unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(eq));
+                if (mask != 0)
+                    return first + (__builtin_ctz(mask) / 2);
+                first += 8;
+            }
+#endif
+            for (; first != last; ++first)
+            {
+                if (*first == a or *first == b)
+                    return first;
+            }
+            return last;
+        }
+
+        // Returns the last code unit in [first, last) which is equal to 'a' or 'b', or nullptr if there is none.
+        const CHAR_T* scan_backward(const CHAR_T* first, const CHAR_T* last, CHAR_T a, CHAR_T b)
+        {
+#if defined(TEXTBUF_SEARCH_NEON)
+            const uint16x8_t va = vdupq_n_u16(a);
+            const uint16x8_t vb = vdupq_n_u16(b);
+            while (last - first >= 8)
+            {
+                last -= 8;
+                uint16x8_t v = vld1q_u16(reinterpret_cast<const uint16_t*>(last));
+                uint16x8_t eq = vorrq_u16(vceqq_u16(v, va), vceqq_u16(v, vb));
+                uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(eq)), 0);
+                if (mask != 0)
+                    return last + ((63 - __builtin_clzll(mask)) / 8);
+            }
+#elif defined(TEXTBUF_SEARCH_SSE2)
+            const __m128i va = _mm_set1_epi16(static_cast<short>(a));
+            const __m128i vb = _mm_set1_epi16(static_cast<short>(b));
+            while (last - first >= 8)
+            {
+                last -= 8;
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(last));
+                __m128i eq = _mm_or_si128(_mm_cmpeq_epi16(v, va), _mm_cmpeq_epi16(v, vb));
+                unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(eq));
+                if (mask != 0)
+                    return last + ((31 - __builtin_clz(mask)) / 2);
+            }
+#endif
+            while (last != first)
+            {
+                --last;
+                if (*last == a or *last == b)
+                    return last;
+            }
+            return nullptr;
+        }
+
+        // Locates a literal needle within contiguous text.
+        class LiteralMatcher
+        {
+        public:
+            LiteralMatcher(std::STRING_VIEW pattern, SearchOptions options):
+                needle{ pattern },
+                fold{ is_no(options.case_sensitive) }
+            {
+                if (fold)
+                {
+                    for (auto& c : needle)
+                    {
+                        c = fold_ascii(c);
+                    }
+                }
+                if (needle.empty())
+                    return;
+                first_alt = fold ? upper_ascii(needle.front()) : needle.front();
+                use_horspool = needle.size() >= horspool_threshold;
+                if (not use_horspool)
+                    return;
+                const size_t m = needle.size();
+                shift.fill(m);
+                rshift.fill(m);
+                // Note: the tables are keyed by the low byte of the code unit, so code units which share
+                // a low byte share the smallest shift, which keeps the skips conservative.
+                for (size_t i = 0; i + 1 < m; ++i)
+                {
+                    shift[needle[i] & 0xFF] = m - 1 - i;
+                }
+                for (size_t i = m - 1; i > 0; --i)
+                {
+                    rshift[needle[i] & 0xFF] = i;
+                }
+            }
+
+            size_t length() const
+            {
+                return needle.size();
+            }
+
+            // Returns the index of the first match in 'text' which starts at or after 'from', or npos.
+            size_t find_first(std::STRING_VIEW text, size_t from) const
+            {
+                const size_t m = needle.size();
+                if (m == 0 or text.size() < m or from > text.size() - m)
+                    return npos;
+                if (use_horspool)
+                {
+                    const size_t last_start = text.size() - m;
+                    const CHAR_T tail = needle.back();
+                    for (size_t j = from; j <= last_start;)
+                    {
+                        CHAR_T c = unit(text[j + m - 1]);
+                        if (c == tail and matches_at(text.data() + j))
+                            return j;
+                        j += shift[c & 0xFF];
+                    }
+                    return npos;
+                }
+                const CHAR_T* first = text.data() + from;
+                const CHAR_T* last = text.data() + (text.size() - m + 1);
+                while (true)
+                {
+                    first = scan_forward(first, last, needle.front(), first_alt);
+                    if (first == last)
+                        return npos;
+                    if (matches_at(first))
+                        return static_cast<size_t>(first - text.data());
+                    ++first;
+                }
+            }
+
+            // Returns the index of the last match in 'text' which starts at or before 'until', or npos.
+            size_t find_last(std::STRING_VIEW text, size_t until) const
+            {
+                const size_t m = needle.size();
+                if (m == 0 or text.size() < m)
+                    return npos;
+                until = std::min(until, text.size() - m);
+                if (use_horspool)
+                {
+                    const CHAR_T head = needle.front();
+                    for (size_t j = until;;)
+                    {
+                        CHAR_T c = unit(text[j]);
+                        if (c == head and matches_at(text.data() + j))
+                            return j;
+                        auto skip = rshift[c & 0xFF];
+                        if (skip > j)
+                            return npos;
+                        j -= skip;
+                    }
+                }
+                const CHAR_T* first = text.data();
+                const CHAR_T* last = text.data() + until + 1;
+                while (true)
+                {
+                    auto* candidate = scan_backward(first, last, needle.front(), first_alt);
+                    if (candidate == nullptr)
+                        return npos;
+                    if (matches_at(candidate))
+                        return static_cast<size_t>(candidate - text.data());
+                    last = candidate;
+                }
+            }
+        private:
+            CHAR_T unit(CHAR_T c) const
+            {
+                return fold ? fold_ascii(c) : c;
+            }
+
+            bool matches_at(const CHAR_T* p) const
+            {
+                if (not fold)
+                    return std::memcmp(p, needle.data(), needle.size() * sizeof(CHAR_T)) == 0;
+                for (size_t i = 0; i < needle.size(); ++i)
+                {
+                    if (fold_ascii(p[i]) != needle[i])
+                        return false;
+                }
+                return true;
+            }
+
+            std::STRING needle;
+            bool fold = false;
+            // The other spelling of the first code unit when folding, otherwise the first code unit itself.
+            CHAR_T first_alt = { };
+            bool use_horspool = false;
+            std::array<size_t, 256> shift = { };
+            std::array<size_t, 256> rshift = { };
+        };
+
+        // Streams the spans of 'tree' starting at 'first' and reports every non-overlapping match which starts
+        // before 'start_limit'.  Text past 'start_limit' is only read to complete matches which begin before it.
+        // 'on_match' returns false to stop the search.
+        template <typename TreeT, typename OnMatch>
+        void search_forward(const TreeT* tree, const LiteralMatcher& matcher, CharOffset first, CharOffset start_limit, OnMatch&& on_match)
+        {
+            const size_t m = matcher.length();
+            const size_t total = rep(tree->length());
+            if (m == 0 or rep(first) >= total or first >= start_limit)
+                return;
+            const size_t read_limit = std::min(total, rep(start_limit) + (m - 1));
+
+            TreeWalker walker{ tree, first };
+            // The last (m - 1) code units before the current span, used to find matches crossing into it.
+            std::STRING tail;
+            std::STRING window;
+            size_t tail_offset = rep(first);
+            size_t base = rep(first);
+            size_t min_start = rep(first);
+            auto report = [&](size_t at) {
+                min_start = at + m;
+                return on_match(SearchMatch{ .first = CharOffset{ at }, .last = CharOffset{ at + m } });
+            };
+            while (base < read_limit)
+            {
+                auto span = walker.next_span();
+                if (span.empty())
+                    break;
+                span = span.substr(0, read_limit - base);
+
+                // Matches which start in the tail and end in this span.
+                if (not tail.empty())
+                {
+                    window.assign(tail);
+                    window.append(span.substr(0, m - 1));
+                    for (size_t k = 0;;)
+                    {
+                        auto idx = matcher.find_first(window, k);
+                        if (idx == npos or idx >= tail.size())
+                            break;
+                        auto at = tail_offset + idx;
+                        if (at >= rep(start_limit))
+                            return;
+                        if (at >= min_start)
+                        {
+                            if (not report(at))
+                                return;
+                            k = idx + m;
+                            continue;
+                        }
+                        k = idx + 1;
+                    }
+                }
+
+                // Matches entirely within this span.
+                for (size_t k = min_start > base ? min_start - base : 0;;)
+                {
+                    auto idx = matcher.find_first(span, k);
+                    if (idx == npos)
+                        break;
+                    if (base + idx >= rep(start_limit))
+                        return;
+                    if (not report(base + idx))
+                        return;
+                    k = idx + m;
+                }
+
+                // Retain the final (m - 1) code units for the next boundary.
+                if (span.size() >= m - 1)
+                {
+                    tail.assign(span.substr(span.size() - (m - 1)));
+                }
+                else
+                {
+                    tail.append(span);
+                    if (tail.size() > m - 1)
+                    {
+                        tail.erase(0, tail.size() - (m - 1));
+                    }
+                }
+                base += span.size();
+                tail_offset = base - tail.size();
+            }
+        }
+
+        // Streams the spans of 'tree' backwards from 'last' and returns the last match which ends at or before it.
+        template <typename TreeT>
+        FindResult search_backward(const TreeT* tree, const LiteralMatcher& matcher, CharOffset last)
+        {
+            const size_t m = matcher.length();
+            last = CharOffset{ std::min(rep(last), rep(tree->length())) };
+            if (m == 0 or rep(last) < m)
+                return { .found = false, .match = { } };
+
+            ReverseTreeWalker walker{ tree, retract(last) };
+            // The first (m - 1) code units after the current span, used to find matches crossing out of it.
+            std::STRING head;
+            std::STRING window;
+            auto found = [&](size_t at) {
+                return FindResult{ .found = true, .match = { .first = CharOffset{ at }, .last = CharOffset{ at + m } } };
+            };
+            while (true)
+            {
+                auto span = walker.next_span();
+                if (span.empty())
+                    break;
+                // Note: the walker offset is now one before the span (and wraps at the beginning).
+                const size_t base = rep(walker.offset()) + 1;
+
+                // Matches which start in this span and end in the head.  These are always to the right of the
+                // matches entirely within the span.
+                if (not head.empty())
+                {
+                    auto prefix = span.substr(span.size() - std::min(span.size(), m - 1));
+                    window.assign(prefix);
+                    window.append(head);
+                    auto idx = matcher.find_last(window, prefix.size() - 1);
+                    if (idx != npos)
+                        return found(base + (span.size() - prefix.size()) + idx);
+                }
+
+                auto idx = matcher.find_last(span, span.size());
+                if (idx != npos)
+                    return found(base + idx);
+
+                // Retain the leading (m - 1) code units for the next boundary.
+                if (span.size() >= m - 1)
+                {
+                    head.assign(span.substr(0, m - 1));
+                }
+                else
+                {
+                    head.insert(0, span);
+                    head.resize(std::min(head.size(), m - 1));
+                }
+            }
+            return { .found = false, .match = { } };
+        }
+
+        template <typename TreeT>
+        FindResult find_in(const TreeT* tree, std::STRING_VIEW pattern, CharOffset from, SearchDirection direction, SearchOptions options)
+        {
+            LiteralMatcher matcher{ pattern, options };
+            if (direction == SearchDirection::Backward)
+                return search_backward(tree, matcher, from);
+            FindResult result{ .found = false, .match = { } };
+            search_forward(tree, matcher, from, CharOffset{ rep(tree->length()) }, [&](const SearchMatch& match) {
+                result = { .found = true, .match = match };
+                return false;
+            });
+            return result;
+        }
+
+        template <typename TreeT>
+        void find_all_in(const TreeT* tree, SearchMatches* matches, std::STRING_VIEW pattern, SearchOptions options)
+        {
+            matches->clear();
+            LiteralMatcher matcher{ pattern, options };
+            search_forward(tree, matcher, CharOffset{ }, CharOffset{ rep(tree->length()) }, [&](const SearchMatch& match) {
+                matches->push_back(match);
+                return true;
+            });
+        }
+    } // namespace [anon]
+
+    FindResult Tree::find(std::STRING_VIEW pattern, CharOffset from, SearchDirection direction, SearchOptions options) const
+    {
+        return find_in(this, pattern, from, direction, options);
+    }
+
+    FindResult OwningSnapshot::find(std::STRING_VIEW pattern, CharOffset from, SearchDirection direction, SearchOptions options) const
+    {
+        return find_in(this, pattern, from, direction, options);
+    }
+
+    FindResult ReferenceSnapshot::find(std::STRING_VIEW pattern, CharOffset from, SearchDirection direction, SearchOptions options) const
+    {
+        return find_in(this, pattern, from, direction, options);
+    }
+
+    void Tree::find_all(SearchMatches* matches, std::STRING_VIEW pattern, SearchOptions options) const
+    {
+        find_all_in(this, matches, pattern, options);
+    }
+
+    void OwningSnapshot::find_all(SearchMatches* matches, std::STRING_VIEW pattern, SearchOptions options) const
+    {
+        find_all_in(this, matches, pattern, options);
+    }
+
+    void ReferenceSnapshot::find_all(SearchMatches* matches, std::STRING_VIEW pattern, SearchOptions options) const
+    {
+        find_all_in(this, matches, pattern, options);
+    }
+
+    struct ParallelSearch::State
+    {
+        State(OwningSnapshot&& snapshot, std::STRING_VIEW pattern, SearchOptions options):
+            snapshot{ std::move(snapshot) },
+            matcher{ pattern, options } { }
+
+        void search_range(size_t index);
+        void deliver();
+        void fix_up(size_t index, SearchMatches* batch) const;
+
+        const OwningSnapshot snapshot;
+        const LiteralMatcher matcher;
+        SearchBatchCallback on_batch;
+        SearchCompletionCallback on_done;
+        // Range i covers the matches which start in [bounds[i], bounds[i + 1]).
+        std::vector<CharOffset> bounds;
+        std::atomic<bool> cancelled = false;
+
+        std::mutex mutex;
+        std::condition_variable done;
+        std::vector<SearchMatches> results;
+        std::vector<bool> ready;
+        size_t next_range = 0;
+        size_t pending = 0;
+        bool delivering = false;
+        bool completed = false;
+        bool finished = false;
+        // The end of the last delivered match.
+        CharOffset delivered_end = { };
+    };
+
+    void ParallelSearch::State::search_range(size_t index)
+    {
+        SearchMatches matches;
+        if (not cancelled)
+        {
+            search_forward(&snapshot, matcher, bounds[index], bounds[index + 1], [&](const SearchMatch& match) {
+                matches.push_back(match);
+                return not cancelled.load(std::memory_order_relaxed);
+            });
+        }
+        {
+            std::lock_guard lock{ mutex };
+            results[index] = std::move(matches);
+            ready[index] = true;
+        }
+        deliver();
+    }
+
+    // Each range is searched on its own, so the first matches of a range can overlap the last match of the
+    // range before it (e.g. "aa" in "aaa").  The sequential search is replayed from the end of the last
+    // delivered match until it lines up with a match of the range, after which both agree.
+    void ParallelSearch::State::fix_up(size_t index, SearchMatches* batch) const
+    {
+        if (batch->empty() or batch->front().first >= delivered_end)
+            return;
+        SearchMatches fixed;
+        size_t k = 0;
+        bool aligned = false;
+        search_forward(&snapshot, matcher, delivered_end, bounds[index + 1], [&](const SearchMatch& match) {
+            while (k < batch->size() and (*batch)[k].first < match.first)
+            {
+                ++k;
+            }
+            if (k < batch->size() and (*batch)[k].first == match.first)
+            {
+                aligned = true;
+                return false;
+            }
+            fixed.push_back(match);
+            return true;
+        });
+        if (aligned)
+        {
+            fixed.insert(end(fixed), begin(*batch) + k, end(*batch));
+        }
+        *batch = std::move(fixed);
+    }
+
+    // Hands the ranges which are ready to the callback in order.  Only one thread delivers at a time, the
+    // others leave their results behind for it.
+    void ParallelSearch::State::deliver()
+    {
+        std::unique_lock lock{ mutex };
+        if (delivering)
+        {
+            --pending;
+            done.notify_all();
+            return;
+        }
+        delivering = true;
+        while (not cancelled and next_range < results.size() and ready[next_range])
+        {
+            auto index = next_range++;
+            SearchMatches batch = std::move(results[index]);
+            lock.unlock();
+            fix_up(index, &batch);
+            if (not batch.empty())
+            {
+                delivered_end = batch.back().last;
+                if (not on_batch(std::span<const SearchMatch>{ batch }))
+                {
+                    cancelled = true;
+                }
+            }
+            lock.lock();
+        }
+        delivering = false;
+        if (not completed and (cancelled or next_range == results.size()))
+        {
+            completed = true;
+            finished = not cancelled;
+            lock.unlock();
+            if (on_done)
+            {
+                on_done(finished);
+            }
+            lock.lock();
+        }
+        --pending;
+        done.notify_all();
+    }
+
+    void ParallelSearch::cancel()
+    {
+        if (state == nullptr)
+            return;
+        state->cancelled = true;
+        std::unique_lock lock{ state->mutex };
+        state->done.wait(lock, [&] { return not state->delivering; });
+    }
+
+    bool ParallelSearch::wait()
+    {
+        if (state == nullptr)
+            return true;
+        std::unique_lock lock{ state->mutex };
+        state->done.wait(lock, [&] { return state->pending == 0; });
+        return state->finished;
+    }
+
+    ParallelSearch find_all_parallel(OwningSnapshot snapshot, std::STRING_VIEW pattern, ThreadPool* pool, SearchBatchCallback on_batch, SearchCompletionCallback on_done, SearchOptions options)
+    {
+        ParallelSearch search;
+        auto state = std::make_shared<ParallelSearch::State>(std::move(snapshot), pattern, options);
+        state->on_batch = std::move(on_batch);
+        state->on_done = std::move(on_done);
+
+        // Split into ranges of roughly equal length.  A split point moves forward to the next piece boundary
+        // when it is close, so that most ranges start on a piece, but a large piece (a freshly loaded file is
+        // a single piece) is split as well since matches crossing a split are handled by the overlap.
+        const size_t total = rep(state->snapshot.length());
+        const size_t count = pattern.empty() ? 0 : std::clamp<size_t>(total / min_range_length, 1, std::max<size_t>(1, pool->size() * ranges_per_worker));
+        const size_t slack = count == 0 ? 0 : total / count / 8;
+        state->bounds.push_back(CharOffset{ });
+        for (size_t i = 1; i < count; ++i)
+        {
+            size_t target = total / count * i;
+            TreeWalker walker{ &state->snapshot, CharOffset{ target } };
+            auto rest = walker.next_span().size();
+            if (rest <= slack)
+            {
+                target += rest;
+            }
+            if (target > rep(state->bounds.back()) and target < total)
+            {
+                state->bounds.push_back(CharOffset{ target });
+            }
+        }
+        state->bounds.push_back(CharOffset{ total });
+
+        const size_t ranges = count == 0 ? 0 : state->bounds.size() - 1;
+        state->results.resize(ranges);
+        state->ready.resize(ranges);
+        search.state = state;
+        if (ranges == 0)
+        {
+            state->completed = true;
+            state->finished = true;
+            if (state->on_done)
+            {
+                state->on_done(true);
+            }
+            return search;
+        }
+        state->pending = ranges;
+        for (size_t i = 0; i < ranges; ++i)
+        {
+            pool->submit([state, i] { state->search_range(i); });
+        }
+        return search;
+    }
+} // namespace PieceTree
@@ -0,0 +1,77 @@
+//
+//  fredbuf-search.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <span>
+#include <vector>
+#include "encoding.h"
+#include "enum-utils.h"
+#include "fredbuf-rbtree.h"
+
+// Literal search over the piece tree.  The search never flattens the document, instead it streams over the
+// spans of the pieces and stitches together the few code units around piece boundaries so that matches
+// which straddle two (or more) pieces are found as well.
+namespace PieceTree
+{
+    enum class SearchDirection { Forward, Backward };
+
+    enum class CaseSensitive : bool { No, Yes };
+
+    struct SearchOptions
+    {
+        // Case insensitive searches only fold ASCII letters.
+        CaseSensitive case_sensitive = CaseSensitive::Yes;
+    };
+
+    struct SearchMatch
+    {
+        CharOffset first;
+        CharOffset last; // One past the final code unit of the match.
+    };
+
+    using SearchMatches = std::vector<SearchMatch>;
+
+    struct FindResult
+    {
+        bool found;
+        SearchMatch match;
+    };
+
+    class OwningSnapshot;
+    class ThreadPool;
+
+    // Receives the matches of a parallel search.  Batches arrive in document order, one at a time, on the
+    // pool's worker threads.  Returning false cancels the search.
+    using SearchBatchCallback = std::function<bool(std::span<const SearchMatch> batch)>;
+    // Called once after the final batch.  'finished' is false if the search was cancelled.
+    using SearchCompletionCallback = std::function<void(bool finished)>;
+
+    // A handle to a search running on a thread pool.  Dropping the handle does not stop the search.
+    class ParallelSearch
+    {
+    public:
+        // No batch is delivered once this returns.  Must not be called from the batch callback, which returns
+        // false to cancel instead.
+        void cancel();
+        // Blocks until the search has finished or was cancelled and every worker has let go of it.  Returns
+        // false if the search was cancelled.
+        bool wait();
+    private:
+        struct State;
+
+        friend ParallelSearch find_all_parallel(OwningSnapshot snapshot, std::STRING_VIEW pattern, ThreadPool* pool, SearchBatchCallback on_batch, SearchCompletionCallback on_done, SearchOptions options);
+
+        std::shared_ptr<State> state;
+    };
+
+    // Finds all non-overlapping matches of 'pattern' (the same matches as find_all) by splitting the snapshot
+    // into ranges which are searched concurrently on 'pool'.
+    ParallelSearch find_all_parallel(OwningSnapshot snapshot, std::STRING_VIEW pattern, ThreadPool* pool, SearchBatchCallback on_batch, SearchCompletionCallback on_done = { }, SearchOptions options = { });
+} // namespace PieceTree
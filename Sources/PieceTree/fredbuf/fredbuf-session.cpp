@@ -0,0 +1,516 @@
+//
+//  fredbuf-session.cpp
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#include "fredbuf-session.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fredbuf.h"
+#include "enum-utils.h"
+
+namespace PieceTree
+{
+    namespace
+    {
+        constexpr char session_magic[8] = { 'f', 'r', 'e', 'd', 'b', 'u', 'f', '\0' };
+        constexpr uint32_t session_version = 3;
+        constexpr uint32_t session_byte_order = 0x01020304;
+
+        struct SessionHeader
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t byte_order;
+            uint32_t code_unit_size;
+            uint32_t reserved;
+            uint64_t orig_buffer_count;
+            uint64_t mod_segment_count;
+            uint64_t node_count;
+            uint64_t undo_count;
+            uint64_t redo_count;
+            uint64_t revision_count;
+            uint64_t current_revision;
+            uint64_t next_revision;
+            // A node reference: zero is the empty tree, 'n' is the record at index n - 1.
+            uint64_t root;
+            // The buffer records, the original buffers first.
+            uint64_t buffers_offset;
+            // The node records.  Children always precede their parents.
+            uint64_t nodes_offset;
+            // The undo entries followed by the redo entries, the top of each stack first.
+            uint64_t history_offset;
+            // The revisions, the oldest first.
+            uint64_t revisions_offset;
+            uint64_t file_length;
+        };
+
+        struct BufferRecord
+        {
+            uint64_t text_offset;
+            uint64_t length;
+            uint64_t line_starts_offset;
+            uint64_t line_start_count;
+            uint64_t hash_checkpoints_offset;
+            uint64_t hash_checkpoint_count;
+        };
+
+        // The left subtree attributes and the subtree hash are not stored, they are recomputed while loading.
+        struct NodeRecord
+        {
+            uint64_t left;
+            uint64_t right;
+            uint64_t color;
+            uint64_t index;
+            uint64_t first_line;
+            uint64_t first_column;
+            uint64_t last_line;
+            uint64_t last_column;
+            uint64_t length;
+            uint64_t newline_count;
+            uint64_t hash_value;
+            uint64_t hash_power;
+        };
+
+        struct HistoryRecord
+        {
+            uint64_t root;
+            uint64_t op_offset;
+            uint64_t revision;
+        };
+
+        struct RevisionRecord
+        {
+            uint64_t id;
+            uint64_t parent;
+            uint64_t root;
+            uint64_t op_offset;
+        };
+
+        static_assert(sizeof(LineStart) == sizeof(uint64_t));
+        static_assert(sizeof(SessionHeader) % 8 == 0);
+
+        constexpr uint64_t align_up(uint64_t offset)
+        {
+            return (offset + 7) & ~uint64_t{ 7 };
+        }
+
+        constexpr bool is_mod_segment(BufferIndex index)
+        {
+            return (rep(index) & rep(BufferIndex::ModBuf)) != 0;
+        }
+
+        class SessionWriter
+        {
+        public:
+            explicit SessionWriter(int fd):
+                fd{ fd } { }
+
+            bool write(const void* data, size_t size)
+            {
+                auto* bytes = static_cast<const char*>(data);
+                while (size != 0)
+                {
+                    auto written = ::write(fd, bytes, size);
+                    if (written < 0)
+                    {
+                        if (errno == EINTR)
+                            continue;
+                        return false;
+                    }
+                    bytes += written;
+                    size -= written;
+                    position += written;
+                }
+                return true;
+            }
+
+            bool pad_to(uint64_t offset)
+            {
+                constexpr char zeros[8] = { };
+                return write(zeros, offset - position);
+            }
+        private:
+            int fd;
+            uint64_t position = 0;
+        };
+
+        // Numbers the nodes reachable from the roots, children before parents, each shared node once.
+        class NodeTable
+        {
+        public:
+            uint64_t add(RedBlackTree::View node)
+            {
+                if (node.is_empty())
+                    return 0;
+                auto found = ids.find(node.root_ptr());
+                if (found != ids.end())
+                    return found->second;
+                auto left = add(node.left());
+                auto right = add(node.right());
+                auto& data = node.root();
+                records.push_back({ .left = left,
+                                    .right = right,
+                                    .color = static_cast<uint64_t>(node.root_color()),
+                                    .index = rep(data.piece.index),
+                                    .first_line = rep(data.piece.first.line),
+                                    .first_column = rep(data.piece.first.column),
+                                    .last_line = rep(data.piece.last.line),
+                                    .last_column = rep(data.piece.last.column),
+                                    .length = rep(data.piece.length),
+                                    .newline_count = rep(data.piece.newline_count),
+                                    .hash_value = data.piece_hash.value,
+                                    .hash_power = data.piece_hash.power });
+                ids.emplace(node.root_ptr(), records.size());
+                return records.size();
+            }
+
+            std::vector<NodeRecord> records;
+        private:
+            std::unordered_map<const void*, uint64_t> ids;
+        };
+
+        // A mapped session with bounds checked access to its sections.
+        class SessionMapping
+        {
+        public:
+            SessionMapping(std::shared_ptr<const void> mapping, uint64_t size):
+                mapping{ std::move(mapping) }, size{ size } { }
+
+            const std::shared_ptr<const void>& owner() const
+            {
+                return mapping;
+            }
+
+            template <typename T>
+            const T* section(uint64_t offset, uint64_t count) const
+            {
+                if (offset % 8 != 0 or offset > size)
+                    return nullptr;
+                if (count > (size - offset) / sizeof(T))
+                    return nullptr;
+                return reinterpret_cast<const T*>(static_cast<const char*>(mapping.get()) + offset);
+            }
+        private:
+            std::shared_ptr<const void> mapping;
+            uint64_t size;
+        };
+
+        // The buffer borrows its content from the mapping.  The line starts are checked, not recomputed.
+        std::shared_ptr<CharBuffer> load_buffer(const SessionMapping& mapping, const BufferRecord& record)
+        {
+            auto* text = mapping.section<CHAR_T>(record.text_offset, record.length);
+            auto* starts = mapping.section<LineStart>(record.line_starts_offset, record.line_start_count);
+            auto* checkpoints = mapping.section<uint64_t>(record.hash_checkpoints_offset, record.hash_checkpoint_count);
+            if (text == nullptr or starts == nullptr or checkpoints == nullptr
+                or record.line_start_count == 0 or rep(starts[0]) != 0
+                or record.hash_checkpoint_count != record.length / hash_checkpoint_interval + 1)
+                return nullptr;
+            for (uint64_t i = 1; i < record.line_start_count; ++i)
+            {
+                if (starts[i] <= starts[i - 1] or rep(starts[i]) > record.length)
+                    return nullptr;
+            }
+            auto buffer = std::make_shared<CharBuffer>();
+            buffer->mapped = { .mapping = mapping.owner(),
+                               .chars = text,
+                               .starts = starts,
+                               .hash_checkpoints = checkpoints,
+                               .length = record.length,
+                               .line_start_count = record.line_start_count };
+            return buffer;
+        }
+
+        bool valid_cursor(const CharBuffer& buffer, uint64_t line, uint64_t column, uint64_t* offset)
+        {
+            if (line >= buffer.line_start_count())
+                return false;
+            auto line_first = rep(buffer.starts()[line]);
+            auto line_last = line + 1 < buffer.line_start_count() ? rep(buffer.starts()[line + 1]) : buffer.length();
+            if (column > line_last - line_first)
+                return false;
+            *offset = line_first + column;
+            return true;
+        }
+    } // namespace [anon]
+
+    SessionResult Tree::save_session(int fd) const
+    {
+        NodeTable nodes;
+        std::vector<HistoryRecord> history;
+        auto root_ref = nodes.add(root);
+        size_t undo_count = 0;
+        for (auto& entry : undo_stack)
+        {
+            history.push_back({ .root = nodes.add(entry.root), .op_offset = rep(entry.op_offset), .revision = rep(entry.revision) });
+            ++undo_count;
+        }
+        for (auto& entry : redo_stack)
+        {
+            history.push_back({ .root = nodes.add(entry.root), .op_offset = rep(entry.op_offset), .revision = rep(entry.revision) });
+        }
+        std::vector<RevisionRecord> revisions;
+        revisions.reserve(revision_list.size());
+        for (auto& revision : revision_list)
+        {
+            revisions.push_back({ .id = rep(revision.id),
+                                  .parent = rep(revision.parent),
+                                  .root = nodes.add(revision.root),
+                                  .op_offset = rep(revision.op_offset) });
+        }
+
+        std::vector<const CharBuffer*> all_buffers;
+        for (auto& buffer : *buffers.orig_buffers)
+        {
+            all_buffers.push_back(buffer.get());
+        }
+        for (auto& segment : *buffers.mod_segments)
+        {
+            all_buffers.push_back(segment.get());
+        }
+
+        // Lay out the metadata first and the bulk data after it.
+        uint64_t buffers_offset = sizeof(SessionHeader);
+        uint64_t nodes_offset = buffers_offset + all_buffers.size() * sizeof(BufferRecord);
+        uint64_t history_offset = nodes_offset + nodes.records.size() * sizeof(NodeRecord);
+        uint64_t revisions_offset = history_offset + history.size() * sizeof(HistoryRecord);
+        uint64_t offset = revisions_offset + revisions.size() * sizeof(RevisionRecord);
+        std::vector<BufferRecord> buffer_records;
+        buffer_records.reserve(all_buffers.size());
+        for (auto* buffer : all_buffers)
+        {
+            auto text_offset = align_up(offset);
+            auto line_starts_offset = align_up(text_offset + buffer->length() * sizeof(CHAR_T));
+            auto hash_checkpoints_offset = line_starts_offset + buffer->line_start_count() * sizeof(LineStart);
+            BufferRecord record = { .text_offset = text_offset,
+                                    .length = buffer->length(),
+                                    .line_starts_offset = line_starts_offset,
+                                    .line_start_count = buffer->line_start_count(),
+                                    .hash_checkpoints_offset = hash_checkpoints_offset,
+                                    .hash_checkpoint_count = buffer->length() / hash_checkpoint_interval + 1 };
+            offset = record.hash_checkpoints_offset + record.hash_checkpoint_count * sizeof(uint64_t);
+            buffer_records.push_back(record);
+        }
+        SessionHeader header = { .magic = { },
+                                 .version = session_version,
+                                 .byte_order = session_byte_order,
+                                 .code_unit_size = sizeof(CHAR_T),
+                                 .reserved = 0,
+                                 .orig_buffer_count = buffers.orig_buffers->size(),
+                                 .mod_segment_count = buffers.mod_segments->size(),
+                                 .node_count = nodes.records.size(),
+                                 .undo_count = undo_count,
+                                 .redo_count = history.size() - undo_count,
+                                 .revision_count = revisions.size(),
+                                 .current_revision = rep(head_revision),
+                                 .next_revision = rep(next_revision),
+                                 .root = root_ref,
+                                 .buffers_offset = buffers_offset,
+                                 .nodes_offset = nodes_offset,
+                                 .history_offset = history_offset,
+                                 .revisions_offset = revisions_offset,
+                                 .file_length = offset };
+        std::memcpy(header.magic, session_magic, sizeof(session_magic));
+
+        SessionWriter writer{ fd };
+        if (not writer.write(&header, sizeof(header))
+            or not writer.write(buffer_records.data(), buffer_records.size() * sizeof(BufferRecord))
+            or not writer.write(nodes.records.data(), nodes.records.size() * sizeof(NodeRecord))
+            or not writer.write(history.data(), history.size() * sizeof(HistoryRecord))
+            or not writer.write(revisions.data(), revisions.size() * sizeof(RevisionRecord)))
+            return SessionResult::IOError;
+        for (size_t i = 0; i < all_buffers.size(); ++i)
+        {
+            auto* buffer = all_buffers[i];
+            auto& record = buffer_records[i];
+            if (not writer.pad_to(record.text_offset)
+                or not writer.write(buffer->chars(), record.length * sizeof(CHAR_T))
+                or not writer.pad_to(record.line_starts_offset)
+                or not writer.write(buffer->starts(), record.line_start_count * sizeof(LineStart))
+                or not writer.write(buffer->checkpoints(), record.hash_checkpoint_count * sizeof(uint64_t)))
+                return SessionResult::IOError;
+        }
+        return SessionResult::Success;
+    }
+
+    SessionResult Tree::load_session(int fd)
+    {
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+            return SessionResult::IOError;
+        auto size = static_cast<uint64_t>(info.st_size);
+        if (size < sizeof(SessionHeader))
+            return SessionResult::InvalidFormat;
+        auto* base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED)
+            return SessionResult::IOError;
+        madvise(base, size, MADV_WILLNEED);
+        // The mapping lives until the last buffer (of the tree or of a snapshot) borrowing from it is gone.
+        std::shared_ptr<const void> owner{ base, [size](const void* mapped)
+        {
+            munmap(const_cast<void*>(mapped), size);
+        } };
+        SessionMapping mapping{ std::move(owner), size };
+        auto& header = *mapping.section<SessionHeader>(0, 1);
+        if (std::memcmp(header.magic, session_magic, sizeof(session_magic)) != 0
+            or header.version != session_version
+            or header.byte_order != session_byte_order
+            or header.code_unit_size != sizeof(CHAR_T)
+            or header.file_length != size
+            or header.orig_buffer_count > size
+            or header.mod_segment_count > size
+            or header.undo_count > size
+            or header.redo_count > size
+            or header.revision_count > size
+            or header.current_revision >= header.next_revision)
+            return SessionResult::InvalidFormat;
+        auto buffer_count = header.orig_buffer_count + header.mod_segment_count;
+        auto history_count = header.undo_count + header.redo_count;
+        auto* buffer_records = mapping.section<BufferRecord>(header.buffers_offset, buffer_count);
+        auto* node_records = mapping.section<NodeRecord>(header.nodes_offset, header.node_count);
+        auto* history = mapping.section<HistoryRecord>(header.history_offset, history_count);
+        auto* revisions = mapping.section<RevisionRecord>(header.revisions_offset, header.revision_count);
+        if (buffer_records == nullptr or node_records == nullptr or history == nullptr or revisions == nullptr)
+            return SessionResult::InvalidFormat;
+
+        auto orig_buffers = std::make_shared<Buffers>();
+        auto mod_segments = std::make_shared<ModSegments>();
+        orig_buffers->reserve(header.orig_buffer_count);
+        mod_segments->reserve(header.mod_segment_count);
+        for (uint64_t i = 0; i < buffer_count; ++i)
+        {
+            auto buffer = load_buffer(mapping, buffer_records[i]);
+            if (buffer == nullptr)
+                return SessionResult::InvalidFormat;
+            if (i < header.orig_buffer_count)
+            {
+                orig_buffers->push_back(std::move(buffer));
+            }
+            else
+            {
+                mod_segments->push_back(std::move(buffer));
+            }
+        }
+        BufferCollection loaded_buffers = { .orig_buffers = orig_buffers, .mod_segments = mod_segments };
+
+        // The attributes of a node are the totals of its left subtree, which was loaded before it.
+        struct SubtreeTotals
+        {
+            Length length;
+            LFCount lf_count;
+            ContentHash hash;
+        };
+        std::vector<RedBlackTree> nodes(header.node_count + 1);
+        std::vector<SubtreeTotals> totals(header.node_count + 1);
+        for (uint64_t i = 0; i < header.node_count; ++i)
+        {
+            auto& record = node_records[i];
+            if (record.left > i or record.right > i)
+                return SessionResult::InvalidFormat;
+            auto color = static_cast<Color>(record.color);
+            if (color != Color::Red and color != Color::Black)
+                return SessionResult::InvalidFormat;
+            auto index = BufferIndex{ record.index };
+            auto segment = rep(index) & ~rep(BufferIndex::ModBuf);
+            if (is_mod_segment(index) ? segment >= header.mod_segment_count : segment >= header.orig_buffer_count)
+                return SessionResult::InvalidFormat;
+            auto& buffer = *loaded_buffers.buffer_at(index);
+            uint64_t first = 0;
+            uint64_t last = 0;
+            if (not valid_cursor(buffer, record.first_line, record.first_column, &first)
+                or not valid_cursor(buffer, record.last_line, record.last_column, &last)
+                or last < first
+                or record.length != last - first
+                or record.newline_count != record.last_line - record.first_line)
+                return SessionResult::InvalidFormat;
+            NodeData data = { .piece = { .index = index,
+                                         .first = { .line = Line{ record.first_line }, .column = Column{ record.first_column } },
+                                         .last = { .line = Line{ record.last_line }, .column = Column{ record.last_column } },
+                                         .length = Length{ record.length },
+                                         .newline_count = LFCount{ record.newline_count } },
+                              .left_subtree_length = totals[record.left].length,
+                              .left_subtree_lf_count = totals[record.left].lf_count,
+                              .piece_hash = { .value = record.hash_value, .power = record.hash_power } };
+            auto& right = totals[record.right];
+            data.subtree_hash = concat(concat(totals[record.left].hash, data.piece_hash), right.hash);
+            totals[i + 1] = { .length = data.left_subtree_length + data.piece.length + right.length,
+                              .lf_count = LFCount{ rep(data.left_subtree_lf_count) + record.newline_count + rep(right.lf_count) },
+                              .hash = data.subtree_hash };
+            nodes[i + 1] = RedBlackTree::restore(color, nodes[record.left], data, nodes[record.right]);
+        }
+        if (header.root > header.node_count)
+            return SessionResult::InvalidFormat;
+        UndoStack loaded_undo;
+        RedoStack loaded_redo;
+        for (uint64_t i = history_count; i-- != 0;)
+        {
+            if (history[i].root > header.node_count or history[i].revision >= header.next_revision)
+                return SessionResult::InvalidFormat;
+            UndoRedoEntry entry = { .root = nodes[history[i].root],
+                                    .op_offset = CharOffset{ history[i].op_offset },
+                                    .revision = RevisionId{ history[i].revision } };
+            if (i < header.undo_count)
+            {
+                loaded_undo.push_front(std::move(entry));
+            }
+            else
+            {
+                loaded_redo.push_front(std::move(entry));
+            }
+        }
+        // The ids are consecutive, see Tree::find_revision.
+        Revisions loaded_revisions;
+        for (uint64_t i = 0; i < header.revision_count; ++i)
+        {
+            auto& record = revisions[i];
+            if (record.root > header.node_count
+                or record.id != revisions[0].id + i
+                or record.id == 0
+                or record.id >= header.next_revision
+                or record.parent >= record.id)
+                return SessionResult::InvalidFormat;
+            loaded_revisions.push_back({ .id = RevisionId{ record.id },
+                                         .parent = RevisionId{ record.parent },
+                                         .root = nodes[record.root],
+                                         .op_offset = CharOffset{ record.op_offset } });
+        }
+
+        // The whole session is valid, replace the tree.
+        EditRecord replaced = { };
+        if (is_yes(journal))
+        {
+            replaced.old_end = CharOffset{ rep(meta.total_content_length) };
+            replaced.old_end_point = edit_point(&buffers, root, replaced.old_end);
+        }
+        buffers = loaded_buffers;
+        root = nodes[header.root];
+        undo_stack = std::move(loaded_undo);
+        redo_stack = std::move(loaded_redo);
+        revision_list = std::move(loaded_revisions);
+        head_revision = RevisionId{ header.current_revision };
+        next_revision = RevisionId{ header.next_revision };
+        measure_history();
+        prune_history();
+        // The restored segments are never appended to, the next insert starts a new one.
+        last_insert = { };
+        end_last_insert = CharOffset::Sentinel;
+        compute_buffer_meta();
+        if (is_yes(journal))
+        {
+            replaced.new_end = CharOffset{ rep(meta.total_content_length) };
+            replaced.new_end_point = edit_point(&buffers, root, replaced.new_end);
+            edit_journal.push_back(replaced);
+        }
+        return SessionResult::Success;
+    }
+} // namespace PieceTree
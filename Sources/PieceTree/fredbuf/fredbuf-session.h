@@ -0,0 +1,30 @@
+//
+//  fredbuf-session.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+// Binary sessions.  A session holds everything needed to restore a tree together with its undo and redo
+// history and its revisions: the original buffers, the mod buffer segments, their line starts and hash
+// checkpoints and the shape of every root.
+// Nodes which are shared between the roots are written once.
+//
+// The file starts with a fixed header and tables of fixed-size records, every section is 8-byte aligned.  A
+// load maps the file and the restored buffers borrow their text and line starts from the mapping, nothing is
+// copied, scanned for newlines or rebalanced.  The file must therefore not be modified or truncated while it
+// is loaded: replace it by renaming a new file over it.  Sessions use the native byte order and code unit
+// size, they are meant to be restored on the machine that saved them.
+namespace PieceTree
+{
+    enum class SessionResult
+    {
+        Success,
+        // Reading or writing the file failed.
+        IOError,
+        // The file is not a session, is truncated or was saved with a different layout.
+        InvalidFormat
+    };
+} // namespace PieceTree
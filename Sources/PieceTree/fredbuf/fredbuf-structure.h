@@ -0,0 +1,74 @@
+//
+//  fredbuf-structure.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "fredbuf-tree-query.h"
+
+// Index of the structure of a document for code folding and the outline: the line ranges of the nodes a
+// tree-sitter query captures (e.g. "(function_definition) @fold").  A capture named "name" is not an entry of its
+// own, it names the other captures of its match (e.g. the identifier of a function for the outline).
+//
+// Moving to a newer parse only runs the query over the lines which the edits in between and the syntax changes
+// they caused (see ts_tree_get_changed_ranges) touched, the entries elsewhere are kept and moved along with
+// their lines.  Looking up the entries of a line range costs O(log n + d + k) for n entries, a nesting depth of
+// d and k results.
+namespace PieceTree
+{
+    // A node the query captured, it covers the lines [first_line, last_line].  If its match captured a name
+    // the name covers the code units [name_first_column, name_last_column) of 'name_line', otherwise
+    // 'name_line' is Line::IndexBeginning.
+    struct StructureEntry
+    {
+        Line first_line;
+        Line last_line;
+        uint32_t capture;
+        Line name_line;
+        size_t name_first_column;
+        size_t name_last_column;
+
+        bool operator==(const StructureEntry&) const = default;
+    };
+
+    using StructureEntries = std::vector<StructureEntry>;
+
+    class StructureIndex : public TreeQuery
+    {
+    public:
+        StructureIndex(const TSLanguage* language, std::string_view query_source);
+
+        // Moves to a newer parse, see TreeQuery::advance.
+        void update(ParsedVersion parse);
+
+        // Populates 'result' with the entries which intersect the lines [first, last], ordered by their first
+        // line.  Entries which start on the same line are ordered outermost first.
+        void entries(StructureEntries* result, Line first, Line last) const;
+
+        size_t entry_count() const
+        {
+            return index.size();
+        }
+    private:
+        using Rows = std::vector<std::pair<size_t, size_t>>;
+
+        void run_query(StructureEntries* found, const Rows& rows);
+        void link_parents();
+
+        // The capture which names the other captures of its match, if the query has one.
+        std::optional<uint32_t> name_capture;
+        // Ordered by first line, then by last line descending.
+        StructureEntries index;
+        // For every entry the closest preceding entry which ends on the same line or later, the entries which
+        // contain a line are all on the chain of the last entry starting before it.
+        std::vector<size_t> parents;
+    };
+} // namespace PieceTree
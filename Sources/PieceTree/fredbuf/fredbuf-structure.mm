@@ -0,0 +1,247 @@
+//
+//  fredbuf-structure.mm
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#import <algorithm>
+#import <limits>
+
+#import "fredbuf-structure.h"
+
+namespace PieceTree
+{
+    namespace
+    {
+        constexpr size_t no_parent = std::numeric_limits<size_t>::max();
+
+        bool entry_less(const StructureEntry& a, const StructureEntry& b)
+        {
+            if (a.first_line != b.first_line)
+                return a.first_line < b.first_line;
+            if (a.last_line != b.last_line)
+                return a.last_line > b.last_line;
+            if (a.capture != b.capture)
+                return a.capture < b.capture;
+            if (a.name_line != b.name_line)
+                return a.name_line < b.name_line;
+            if (a.name_first_column != b.name_first_column)
+                return a.name_first_column < b.name_first_column;
+            return a.name_last_column < b.name_last_column;
+        }
+
+        Line line_of(size_t row)
+        {
+            return Line{ row + 1 };
+        }
+
+        size_t row_of(Line line)
+        {
+            return rep(line) - 1;
+        }
+
+        // An edit in rows: [old_first, old_last] of the old document became lines of the new document which
+        // end on 'new_last'.
+        struct RowChange
+        {
+            size_t old_first;
+            size_t old_last;
+            size_t new_last;
+        };
+    } // namespace [anon]
+
+    StructureIndex::StructureIndex(const TSLanguage* language, std::string_view query_source):
+        TreeQuery{ language, query_source }
+    {
+        for (uint32_t capture = 0; capture < capture_count(); ++capture)
+        {
+            if (capture_name(capture) == "name")
+            {
+                name_capture = capture;
+            }
+        }
+    }
+
+    void StructureIndex::update(ParsedVersion parse)
+    {
+        ParseChanges changes;
+        if (not advance(std::move(parse), &changes))
+            return;
+        Rows dirty;
+        if (not changes.incremental)
+        {
+            index.clear();
+            dirty.push_back({ 0, rep(snapshot->line_count()) - 1 });
+        }
+        else
+        {
+            // Journal records are in the coordinates left behind by the preceding records, the row changes are
+            // kept in the coordinates of both documents.
+            std::vector<RowChange> row_changes;
+            row_changes.reserve(changes.edits.size());
+            size_t shift = 0;
+            for (auto& record : changes.edits)
+            {
+                row_changes.push_back({ .old_first = record.start_point.row - shift,
+                                        .old_last = record.old_end_point.row - shift,
+                                        .new_last = record.new_end_point.row });
+                dirty.push_back({ record.start_point.row, record.new_end_point.row });
+                shift += record.new_end_point.row - record.old_end_point.row;
+            }
+            dirty.insert(dirty.end(), changes.changed_rows.begin(), changes.changed_rows.end());
+
+            std::sort(dirty.begin(), dirty.end());
+            Rows merged;
+            for (auto& rows : dirty)
+            {
+                if (not merged.empty() and rows.first <= merged.back().second + 1)
+                {
+                    merged.back().second = std::max(merged.back().second, rows.second);
+                }
+                else
+                {
+                    merged.push_back(rows);
+                }
+            }
+            dirty = std::move(merged);
+
+            // Entries on the edited lines are dropped, the entries below an edit move by the lines it added or
+            // removed, the entries on lines which are queried again are dropped as the query finds them again.
+            // Both the entries and the ranges are ordered by first line, so the ranges which can touch an entry
+            // only move forward.
+            auto next_change = row_changes.begin();
+            auto next_dirty = dirty.begin();
+            size_t kept = 0;
+            for (auto entry : index)
+            {
+                size_t first = row_of(entry.first_line);
+                size_t last = row_of(entry.last_line);
+                while (next_change != row_changes.end() and next_change->old_last < first)
+                {
+                    ++next_change;
+                }
+                if (next_change != row_changes.end() and next_change->old_first <= last)
+                    continue;
+                // The changes before the entry all end above it.
+                if (next_change != row_changes.begin())
+                {
+                    size_t delta = (next_change - 1)->new_last - (next_change - 1)->old_last;
+                    first += delta;
+                    last += delta;
+                    entry.first_line = line_of(first);
+                    entry.last_line = line_of(last);
+                    if (entry.name_line != Line::IndexBeginning)
+                    {
+                        entry.name_line = line_of(row_of(entry.name_line) + delta);
+                    }
+                }
+                while (next_dirty != dirty.end() and next_dirty->second < first)
+                {
+                    ++next_dirty;
+                }
+                if (next_dirty != dirty.end() and next_dirty->first <= last)
+                    continue;
+                index[kept++] = entry;
+            }
+            index.resize(kept);
+        }
+
+        StructureEntries found;
+        run_query(&found, dirty);
+        std::sort(found.begin(), found.end(), entry_less);
+        auto middle = index.insert(index.end(), found.begin(), found.end());
+        std::inplace_merge(index.begin(), middle, index.end(), entry_less);
+        index.erase(std::unique(index.begin(), index.end()), index.end());
+        link_parents();
+    }
+
+    void StructureIndex::run_query(StructureEntries* found, const Rows& rows)
+    {
+        if (query == nullptr)
+            return;
+        TSNode root = ts_tree_root_node(tree);
+        for (auto& [first_row, last_row] : rows)
+        {
+            ts_query_cursor_set_point_range(cursor, { static_cast<uint32_t>(first_row), 0 },
+                                            { static_cast<uint32_t>(last_row + 1), 0 });
+            ts_query_cursor_exec(cursor, query, root);
+            TSQueryMatch match;
+            while (ts_query_cursor_next_match(cursor, &match))
+            {
+                if (not satisfied(match))
+                    continue;
+                StructureEntry entry = { };
+                for (uint16_t i = 0; i < match.capture_count; ++i)
+                {
+                    auto& capture = match.captures[i];
+                    if (capture.index == name_capture)
+                    {
+                        TSPoint start = ts_node_start_point(capture.node);
+                        TSPoint end = ts_node_end_point(capture.node);
+                        entry.name_line = line_of(start.row);
+                        entry.name_first_column = start.column / sizeof(CHAR_T);
+                        entry.name_last_column = end.row == start.row ? end.column / sizeof(CHAR_T) : entry.name_first_column;
+                        break;
+                    }
+                }
+                for (uint16_t i = 0; i < match.capture_count; ++i)
+                {
+                    auto& capture = match.captures[i];
+                    if (capture.index == name_capture)
+                        continue;
+                    TSPoint start = ts_node_start_point(capture.node);
+                    TSPoint end = ts_node_end_point(capture.node);
+                    // A node which ends with its line feed does not reach into the next line.
+                    size_t end_row = end.column == 0 and end.row > start.row ? end.row - 1 : end.row;
+                    entry.first_line = line_of(start.row);
+                    entry.last_line = line_of(end_row);
+                    entry.capture = capture.index;
+                    found->push_back(entry);
+                }
+            }
+        }
+    }
+
+    void StructureIndex::link_parents()
+    {
+        parents.assign(index.size(), no_parent);
+        std::vector<size_t> open;
+        for (size_t i = 0; i < index.size(); ++i)
+        {
+            while (not open.empty() and index[open.back()].last_line < index[i].last_line)
+            {
+                open.pop_back();
+            }
+            if (not open.empty())
+            {
+                parents[i] = open.back();
+            }
+            open.push_back(i);
+        }
+    }
+
+    void StructureIndex::entries(StructureEntries* result, Line first, Line last) const
+    {
+        result->clear();
+        if (first == Line::IndexBeginning)
+            return;
+        auto begin = std::lower_bound(index.begin(), index.end(), first,
+                                      [](const StructureEntry& entry, Line line) { return entry.first_line < line; });
+        // Syntax nodes nest, so of the entries which start before 'first' only those on the chain of the last
+        // one can reach it.
+        size_t next = begin - index.begin();
+        for (size_t i = next == 0 ? no_parent : next - 1; i != no_parent; i = parents[i])
+        {
+            if (index[i].last_line >= first)
+            {
+                result->push_back(index[i]);
+            }
+        }
+        std::reverse(result->begin(), result->end());
+        for (; next < index.size() and index[next].first_line <= last; ++next)
+        {
+            result->push_back(index[next]);
+        }
+    }
+} // namespace PieceTree
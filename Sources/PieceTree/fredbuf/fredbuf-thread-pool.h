@@ -0,0 +1,89 @@
+//
+//  fredbuf-thread-pool.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace PieceTree
+{
+    // A fixed set of worker threads which run submitted jobs in FIFO order.  Jobs which are still queued when
+    // the pool is destroyed are run before the workers exit.
+    class ThreadPool
+    {
+    public:
+        using Job = std::function<void()>;
+
+        explicit ThreadPool(size_t thread_count = std::max(1u, std::thread::hardware_concurrency()))
+        {
+            workers.reserve(thread_count);
+            for (size_t i = 0; i < thread_count; ++i)
+            {
+                workers.emplace_back([this] { run(); });
+            }
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard lock{ mutex };
+                stopping = true;
+            }
+            wake.notify_all();
+            for (auto& worker : workers)
+            {
+                worker.join();
+            }
+        }
+
+        size_t size() const
+        {
+            return workers.size();
+        }
+
+        void submit(Job job)
+        {
+            {
+                std::lock_guard lock{ mutex };
+                jobs.push_back(std::move(job));
+            }
+            wake.notify_one();
+        }
+    private:
+        void run()
+        {
+            while (true)
+            {
+                Job job;
+                {
+                    std::unique_lock lock{ mutex };
+                    wake.wait(lock, [this] { return stopping or not jobs.empty(); });
+                    if (jobs.empty())
+                        return;
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                job();
+            }
+        }
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<Job> jobs;
+        bool stopping = false;
+        std::vector<std::thread> workers;
+    };
+} // namespace PieceTree
@@ -0,0 +1,93 @@
+//
+//  fredbuf-tree-query.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "fredbuf-parse-service.h"
+#include "fredbuf-query-predicates.h"
+
+// A tree-sitter query together with the latest parse of a document it runs on, the common part of the views
+// which keep query results for a document (Highlighter, StructureIndex).  Moving to a newer parse replays the
+// text changes in between on the old tree so tree-sitter can tell which rows changed syntax, the view keeps
+// its results elsewhere.
+//
+// The text predicates of the query are evaluated on the snapshot of the parse (see QueryPredicates), a query
+// whose text predicates are invalid fails with TSQueryErrorSyntax.
+namespace PieceTree
+{
+    class TreeQuery
+    {
+    public:
+        TreeQuery(const TSLanguage* language, std::string_view query_source);
+        ~TreeQuery();
+
+        TreeQuery(const TreeQuery&) = delete;
+        TreeQuery& operator=(const TreeQuery&) = delete;
+
+        bool valid() const
+        {
+            return query_error == TSQueryErrorNone;
+        }
+
+        TSQueryError error() const
+        {
+            return query_error;
+        }
+
+        // The byte offset into the query source at which compilation failed, or of the pattern whose text
+        // predicates are invalid.
+        uint32_t error_offset() const
+        {
+            return query_error_offset;
+        }
+
+        // The captures of the query.  Results refer to them by index.
+        uint32_t capture_count() const;
+        std::string_view capture_name(uint32_t capture) const;
+
+        // The version of the current parse, if any.
+        std::optional<uint64_t> version() const;
+    protected:
+        // What changed from the previous parse to the current one.
+        struct ParseChanges
+        {
+            // False for the first parse, there is nothing to compare it with.
+            bool incremental = false;
+            // The text changes, see diff_edits.
+            EditJournal edits;
+            // The rows [first, last] of the current parse whose syntax changed (see ts_tree_get_changed_ranges).
+            std::vector<std::pair<size_t, size_t>> changed_rows;
+        };
+
+        // Moves to a newer parse of the document (see ParseService::latest_parse) and takes ownership of its
+        // tree.  The snapshot must come from the same tree as the snapshots of the previous parses.  Parses
+        // which are not newer than the current one are dropped and false is returned.
+        bool advance(ParsedVersion parse, ParseChanges* changes);
+
+        // Whether the text predicates of 'match' hold on the current snapshot.
+        bool satisfied(const TSQueryMatch& match) const
+        {
+            return predicates.satisfied(match, *snapshot);
+        }
+
+        TSQuery* query = nullptr;
+        TSQueryCursor* cursor;
+        TSTree* tree = nullptr;
+        std::optional<OwningSnapshot> snapshot;
+    private:
+        TSQueryError query_error = TSQueryErrorNone;
+        uint32_t query_error_offset = 0;
+        QueryPredicates predicates;
+        uint64_t tree_version = 0;
+    };
+} // namespace PieceTree
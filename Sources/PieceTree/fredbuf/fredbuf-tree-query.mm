@@ -0,0 +1,99 @@
+//
+//  fredbuf-tree-query.mm
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#import <cstdlib>
+
+#import "fredbuf-tree-query.h"
+
+namespace PieceTree
+{
+    TreeQuery::TreeQuery(const TSLanguage* language, std::string_view query_source):
+        cursor{ ts_query_cursor_new() }
+    {
+        query = ts_query_new(language, query_source.data(), static_cast<uint32_t>(query_source.size()),
+                             &query_error_offset, &query_error);
+        if (query == nullptr and query_error == TSQueryErrorNone)
+        {
+            query_error = TSQueryErrorLanguage;
+        }
+        if (query == nullptr)
+            return;
+        predicates = QueryPredicates{ query };
+        if (not predicates.valid())
+        {
+            query_error = TSQueryErrorSyntax;
+            query_error_offset = predicates.error_offset();
+            ts_query_delete(query);
+            query = nullptr;
+        }
+    }
+
+    TreeQuery::~TreeQuery()
+    {
+        if (tree != nullptr)
+        {
+            ts_tree_delete(tree);
+        }
+        ts_query_cursor_delete(cursor);
+        if (query != nullptr)
+        {
+            ts_query_delete(query);
+        }
+    }
+
+    uint32_t TreeQuery::capture_count() const
+    {
+        return query == nullptr ? 0 : ts_query_capture_count(query);
+    }
+
+    std::string_view TreeQuery::capture_name(uint32_t capture) const
+    {
+        uint32_t length = 0;
+        const char* name = ts_query_capture_name_for_id(query, capture, &length);
+        return { name, length };
+    }
+
+    std::optional<uint64_t> TreeQuery::version() const
+    {
+        if (tree == nullptr)
+            return std::nullopt;
+        return tree_version;
+    }
+
+    bool TreeQuery::advance(ParsedVersion parse, ParseChanges* changes)
+    {
+        if (tree != nullptr and parse.version <= tree_version)
+        {
+            ts_tree_delete(parse.tree);
+            return false;
+        }
+        changes->incremental = tree != nullptr;
+        changes->edits.clear();
+        changes->changed_rows.clear();
+        if (tree != nullptr)
+        {
+            diff_edits(&changes->edits, *snapshot, parse.snapshot);
+            for (auto& record : changes->edits)
+            {
+                TSInputEdit edit = fredbuf_convert_edit_record(record);
+                ts_tree_edit(tree, &edit);
+            }
+            uint32_t count = 0;
+            TSRange* ranges = ts_tree_get_changed_ranges(tree, parse.tree, &count);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                changes->changed_rows.push_back({ ranges[i].start_point.row, ranges[i].end_point.row });
+            }
+            free(ranges);
+            ts_tree_delete(tree);
+        }
+        tree = parse.tree;
+        tree_version = parse.version;
+        snapshot.emplace(std::move(parse.snapshot));
+        return true;
+    }
+} // namespace PieceTree
@@ -22,10 +22,14 @@ typedef struct {
     ///
     /// The lifecycle must be longer than `TSParser`. **Don't** directly operate this pointer. Use API functions to handle cancel state.
     PieceTree::Tree *piece_tree;
-    /// `TSInput` closure cache
+    /// `TSInput` chunk cursor
     ///
-    /// **Don't** directly operate this pointer. Use API functions to handle cancel state.
-    char *input_char;
+    /// Walks the pieces of `piece_tree` while parsing, it is created by the first read of every parse. **Don't** directly operate this pointer.
+    PieceTree::TreeWalker *chunk_walker;
+    /// The code unit index of the chunk which was read last, `chunk_walker` stands at its end.
+    size_t chunk_first;
+    /// The chunk which was read last, it points into a piece buffer of `piece_tree`.
+    std::STRING_VIEW chunk;
     /// Cancel parse flag
     ///
     /// **Don't** directly operate this pointer. Use API functions to handle cancel state.
@@ -37,8 +41,21 @@ typedef struct {
     
 } tree_sitter_parser;
 
+typedef struct {
+    /// The snapshot which is read, it must outlive the parse.
+    const PieceTree::OwningSnapshot *snapshot;
+    /// `TSInput` chunk cursor, see `tree_sitter_parser`.
+    PieceTree::TreeWalker *chunk_walker;
+    /// The code unit index of the chunk which was read last.
+    size_t chunk_first;
+    /// The chunk which was read last, it points into a piece buffer of `snapshot`.
+    std::STRING_VIEW chunk;
+} fredbuf_snapshot_input;
+
 
 /// Initialize a `tree_sitter_parser` object.
+///
+/// This turns on the edit journal of `piece_tree`, see `fredbuf_ts_parser_apply_edits`.
 inline tree_sitter_parser *fredbuf_ts_parser_init(Tree *piece_tree);
 /// Delete a `tree_sitter_parser` object and free memory(except `Tree` object).
 inline void fredbuf_ts_parser_free(tree_sitter_parser *self);
@@ -64,16 +81,44 @@ inline void fredbuf_ts_parser_set_cancel(tree_sitter_parser *self, bool is_cance
 inline bool fredbuf_ts_parser_get_cancel(tree_sitter_parser *self);
 /// Parsing entire document for the first time.
 ///
+/// Returns `NULL` if the parse was cancelled, see `fredbuf_ts_parser_set_cancel`.
+///
 /// Time Complexity: `O(n)`.
 inline TSTree *fredbuf_ts_parser_first_parse_string(tree_sitter_parser *self);
+/// Apply the edits made to the Piece Tree since the last parse to `old_tree` (see `ts_tree_edit`).
+///
+/// Time Complexity: `O(k log n)`, `k` is the number of edits.
+inline void fredbuf_ts_parser_apply_edits(tree_sitter_parser *self, TSTree *old_tree);
 /// Parsing entire document increasly by old `TSTree` object.
 ///
+/// The edits made since the last parse are applied to `old_tree` first. Returns `NULL` if the parse was cancelled, `old_tree` can be passed again to the next parse.
+///
 /// Time Complexity: `O(m)`, `m` is the length of modified text range.
-inline TSTree *fredbuf_ts_parser_update_parse_string(tree_sitter_parser *self, const TSTree *old_tree);
-/// Convert a `UTF-16` code unit index at Piece Tree to `TSPoint` struct.
+inline TSTree *fredbuf_ts_parser_update_parse_string(tree_sitter_parser *self, TSTree *old_tree);
+/// Make a `TSInput` which reads `input->snapshot` straight from its piece buffers. Any thread may parse a snapshot.
+///
+/// The previous chunk cursor of `input` is released, it must outlive the parse.
+TSInput fredbuf_load_snapshot_ts_input(fredbuf_snapshot_input *input);
+/// Release the chunk cursor of a `fredbuf_snapshot_input`, the snapshot is not owned by it.
+void fredbuf_snapshot_input_free(fredbuf_snapshot_input *input);
+/// Convert an edit journal record to the `TSInputEdit` which describes it.
+TSInputEdit fredbuf_convert_edit_record(const EditRecord &record);
+/// Convert a `UTF-16` code unit index at Piece Tree to `TSPoint` struct. The end of the document is a valid index.
+///
+/// Time Complexity: `O(log n)`, a single descent.
 inline TSPoint fredbuf_convert_u16index_to_point(tree_sitter_parser *parser, size_t utf16_index);
 /// Convert a `UTF-16` code unit index range at Piece Tree to `TSRange` struct.
 inline TSRange fredbuf_convert_u16range_to_range(tree_sitter_parser *self, size_t utf16_index_start, size_t utf16_index_end);
 /// Convert a  `TSPoint` struct to `UTF-16` code unit index.
+///
+/// Time Complexity: `O(log n)`, a single descent.
 inline size_t fredbuf_convert_point_to_index(tree_sitter_parser *self, TSPoint point);
+/// Convert `count` `UTF-16` code unit indices at Piece Tree to `TSPoint` structs.
+///
+/// Sorted indices are cheapest: an index in the same piece as the previous one needs no descent.
+void fredbuf_convert_u16indices_to_points(tree_sitter_parser *self, const size_t *utf16_indices, size_t count, TSPoint *points);
+/// Convert `count` `TSPoint` structs to `UTF-16` code unit indices.
+///
+/// Sorted points are cheapest: a line which starts in the same piece as the previous one needs no descent.
+void fredbuf_convert_points_to_indices(tree_sitter_parser *self, const TSPoint *points, size_t count, size_t *utf16_indices);
 #endif /* fredbuf_tree_sitter_h */
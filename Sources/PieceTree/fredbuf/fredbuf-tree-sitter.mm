@@ -9,6 +9,7 @@
 #import "../fredbuf/encoding.h"
 #import "../tree-sitter/src/atomic.h"
 #import <assert.h>
+#import <algorithm>
 
 
 using namespace PieceTree;
@@ -21,15 +22,19 @@ using namespace PieceTree;
 /// Initialize a `tree_sitter_parser` object.
 inline tree_sitter_parser *fredbuf_ts_parser_init(Tree *piece_tree)
 {
-    tree_sitter_parser *parser = (tree_sitter_parser*)malloc(sizeof(TSParser*) + sizeof(Tree*) + sizeof(char*) + sizeof(size_t*));
+    tree_sitter_parser *parser = (tree_sitter_parser*)malloc(sizeof(tree_sitter_parser));
     size_t *cancel_flag = (size_t*)malloc(sizeof(size_t));
-    __atomic_store_n((volatile uint32_t*)cancel_flag, 0U, __ATOMIC_SEQ_CST);
+    __atomic_store_n(cancel_flag, (size_t)0, __ATOMIC_SEQ_CST);
     *parser = {
         ts_parser_new(),
         piece_tree,
         NULL,
+        0,
+        {},
         cancel_flag
     };
+    ts_parser_set_cancellation_flag(parser->parser, cancel_flag);
+    piece_tree->journal_edits(JournalEdits::Yes);
     return parser;
 }
 
@@ -37,12 +42,11 @@ inline tree_sitter_parser *fredbuf_ts_parser_init(Tree *piece_tree)
 inline void fredbuf_ts_parser_free(tree_sitter_parser *self)
 {
     ts_parser_delete(self->parser);
-    if (self->input_char) {
-        free(self->input_char);
-    }
+    delete self->chunk_walker;
     if (self->cancel_flag) {
         free((void*)self->cancel_flag);
     }
+    free(self);
 }
 
 /// Set the parsing language for a `TSParser` object.
@@ -64,56 +68,92 @@ inline const TSLanguage *fredbuf_ts_parser_get_language(tree_sitter_parser self)
     return ts_parser_language(self.parser);
 }
 
-static const char *fredbuf_load_utf16_string(tree_sitter_parser *parser, uint32_t byte_index, TSPoint position, uint32_t *bytes_read)
+/// Forget the chunk cursor, the document may have been edited since the previous parse.
+static void fredbuf_reset_chunk_cursor(tree_sitter_parser *parser)
 {
-    if (parser->input_char) {
-        free(parser);
-        parser->input_char = NULL;
-    }
-    uint32_t index = byte_index / sizeof(CHAR_T);
-    uint32_t length = (uint32_t)parser->piece_tree->length();
-    if (index >= length) {
+    delete parser->chunk_walker;
+    parser->chunk_walker = NULL;
+    parser->chunk_first = 0;
+    parser->chunk = {};
+}
+
+/// Hand tree-sitter the rest of the piece which contains `byte_index`, straight from the piece buffer.
+///
+/// Tree-sitter mostly reads the document front to back. A read which continues where the previous chunk ended takes the next piece from the walker in `O(1)` amortized time, a read inside the previous chunk costs nothing and any other read seeks in `O(log n)`.
+template <typename Source>
+static const char *fredbuf_read_chunk(const Source *source, TreeWalker **chunk_walker, size_t *chunk_first, std::STRING_VIEW *chunk, uint32_t byte_index, uint32_t *bytes_read)
+{
+    size_t index = byte_index / sizeof(CHAR_T);
+    if (index >= (size_t)source->length()) {
         *bytes_read = 0;
         return "";
     }
-    Line line = parser->piece_tree->line_at(CharOffset { index });
-    LineRange line_range = parser->piece_tree->get_line_range(line);
-    uint32_t read_length = 0;
-    uint32_t line_start_index = (uint32_t)line_range.first;
-    uint32_t line_end_index = (uint32_t)line_range.last;
-    if (line_end_index >= length) {
-        read_length = 1;
-    } else {
-        read_length = line_end_index - index + 1;
+    size_t chunk_last = *chunk_first + chunk->size();
+    if (index < *chunk_first || index >= chunk_last) {
+        if (*chunk_walker == NULL) {
+            *chunk_walker = new TreeWalker(source, CharOffset { index });
+        } else if (index != chunk_last) {
+            (*chunk_walker)->seek(CharOffset { index });
+        }
+        *chunk_first = index;
+        *chunk = (*chunk_walker)->next_span();
     }
-    parser->input_char = (char*)malloc((read_length + 1) * sizeof(CHAR_T));
-    int loop_index = 0;
-    CHAR_T *input_char = (CHAR_T*)parser->input_char;
-    for(; loop_index < read_length; loop_index++) {
-        CHAR_T codeUnit = parser->piece_tree->at(CharOffset { loop_index + index });
-        input_char[loop_index] = codeUnit;
-    }
-    input_char[loop_index] = '\0';
-    *bytes_read = read_length * sizeof(CHAR_T);
-    return parser->input_char;
+    size_t skipped = index - *chunk_first;
+    /* `bytes_read` is 32 bits wide, a longer piece is handed out in several chunks. */
+    size_t read_length = std::min(chunk->size() - skipped, (size_t)(UINT32_MAX / sizeof(CHAR_T)));
+    *bytes_read = (uint32_t)(read_length * sizeof(CHAR_T));
+    return (const char *)(chunk->data() + skipped);
+}
+
+static const char *fredbuf_read_utf16_chunk(void *payload, uint32_t byte_index, TSPoint position, uint32_t *bytes_read)
+{
+    tree_sitter_parser *parser = (tree_sitter_parser*)payload;
+    return fredbuf_read_chunk((const Tree*)parser->piece_tree, &parser->chunk_walker, &parser->chunk_first, &parser->chunk, byte_index, bytes_read);
+}
+
+static const char *fredbuf_read_snapshot_chunk(void *payload, uint32_t byte_index, TSPoint position, uint32_t *bytes_read)
+{
+    fredbuf_snapshot_input *input = (fredbuf_snapshot_input*)payload;
+    return fredbuf_read_chunk(input->snapshot, &input->chunk_walker, &input->chunk_first, &input->chunk, byte_index, bytes_read);
 }
 
 inline TSInput fredbuf_load_ts_input(tree_sitter_parser *parser)
 {
+    fredbuf_reset_chunk_cursor(parser);
     TSInput input = {
         parser,
-        (const char *(*)(void *, uint32_t, TSPoint, uint32_t *))fredbuf_load_utf16_string,
+        fredbuf_read_utf16_chunk,
         TSInputEncodingUTF16
     };
     return input;
 }
 
+/// Make a `TSInput` which reads `input->snapshot`, the chunk cursor of `input` is reset.
+TSInput fredbuf_load_snapshot_ts_input(fredbuf_snapshot_input *input)
+{
+    fredbuf_snapshot_input_free(input);
+    return {
+        input,
+        fredbuf_read_snapshot_chunk,
+        TSInputEncodingUTF16
+    };
+}
+
+/// Release the chunk cursor of a `fredbuf_snapshot_input`, the snapshot is not owned by it.
+void fredbuf_snapshot_input_free(fredbuf_snapshot_input *input)
+{
+    delete input->chunk_walker;
+    input->chunk_walker = NULL;
+    input->chunk_first = 0;
+    input->chunk = {};
+}
+
 /// Set parse cancel state
 ///
 /// This function is thread safe.
 inline void fredbuf_ts_parser_set_cancel(tree_sitter_parser *self, bool is_cancel)
 {
-    __atomic_store_n((volatile uint32_t*)self->cancel_flag, (is_cancel ? 1U : 0U), __ATOMIC_SEQ_CST);
+    __atomic_store_n((size_t*)self->cancel_flag, (size_t)(is_cancel ? 1 : 0), __ATOMIC_SEQ_CST);
 }
 
 
@@ -131,14 +171,47 @@ inline bool fredbuf_ts_parser_get_cancel(tree_sitter_parser *self)
 /// Time Complexity: `O(n)`.
 inline TSTree *fredbuf_ts_parser_first_parse_string(tree_sitter_parser *self) {
     fredbuf_ts_parser_set_cancel(self, false);
+    /* A cancelled parse would be resumed otherwise, but the document has changed since. */
+    ts_parser_reset(self->parser);
+    // The whole document is parsed, the edits before it are irrelevant.
+    EditJournal edits;
+    self->piece_tree->drain_edit_journal(&edits);
     return ts_parser_parse(self->parser, NULL, fredbuf_load_ts_input(self));
 }
 
+/// Apply the edits made to the Piece Tree since the last parse to `old_tree` (see `ts_tree_edit`).
+///
+/// Time Complexity: `O(k log n)`, `k` is the number of edits.
+inline void fredbuf_ts_parser_apply_edits(tree_sitter_parser *self, TSTree *old_tree)
+{
+    EditJournal edits;
+    self->piece_tree->drain_edit_journal(&edits);
+    for (const EditRecord &record : edits) {
+        TSInputEdit edit = fredbuf_convert_edit_record(record);
+        ts_tree_edit(old_tree, &edit);
+    }
+}
+
+/// Convert an edit journal record to the `TSInputEdit` which describes it.
+TSInputEdit fredbuf_convert_edit_record(const EditRecord &record)
+{
+    return {
+        (uint32_t)((size_t)record.start * sizeof(CHAR_T)),
+        (uint32_t)((size_t)record.old_end * sizeof(CHAR_T)),
+        (uint32_t)((size_t)record.new_end * sizeof(CHAR_T)),
+        { (uint32_t)record.start_point.row, (uint32_t)(record.start_point.column * sizeof(CHAR_T)) },
+        { (uint32_t)record.old_end_point.row, (uint32_t)(record.old_end_point.column * sizeof(CHAR_T)) },
+        { (uint32_t)record.new_end_point.row, (uint32_t)(record.new_end_point.column * sizeof(CHAR_T)) }
+    };
+}
+
 /// Parsing entire document increasly by old `TSTree` object.
 ///
 /// Time Complexity: `O(m)`, `m` is the length of modified text range.
-inline TSTree *fredbuf_ts_parser_update_parse_string(tree_sitter_parser *self, const TSTree *old_tree) {
+inline TSTree *fredbuf_ts_parser_update_parse_string(tree_sitter_parser *self, TSTree *old_tree) {
     fredbuf_ts_parser_set_cancel(self, false);
+    ts_parser_reset(self->parser);
+    fredbuf_ts_parser_apply_edits(self, old_tree);
     return ts_parser_parse(self->parser, old_tree, fredbuf_load_ts_input(self));
 }
 
@@ -148,64 +221,90 @@ inline TSTree *fredbuf_ts_parser_update_parse_string(tree_sitter_parser *self, c
 
 //MARK: - TSPoint Convert
 
-/// Convert a `UTF-16` code unit index at Piece Tree to `TSPoint` struct.
-inline TSPoint fredbuf_convert_u16index_to_point(tree_sitter_parser *parser, size_t utf16_index)
+/// Convert a `LinePosition` of `utf16_index` to `TSPoint` struct.
+static TSPoint fredbuf_convert_line_position_to_point(LinePosition position, size_t utf16_index)
+{
+    return {
+        (uint32_t)((size_t)position.line - 1),
+        (uint32_t)((utf16_index - (size_t)position.line_start) * sizeof(CHAR_T))
+    };
+}
+
+/// Check a `UTF-16` code unit index, the end of the document is a valid index.
+static size_t fredbuf_checked_u16index(tree_sitter_parser *parser, size_t utf16_index)
 {
     size_t piece_tree_length = (size_t)parser->piece_tree->length();
-    uint16_t byte_index = sizeof(CHAR_T) * utf16_index;
-    
-    if (utf16_index >= piece_tree_length) { /// This situation must be consider to ASSERT false.
-        Line line = parser->piece_tree->line_at(CharOffset { (size_t)parser->piece_tree->line_count() });
-        LineRange line_range = parser->piece_tree->get_line_range(line);
-        size_t start_u16_index = (size_t)line_range.first;
+    if (utf16_index > piece_tree_length) { /// This situation must be consider to ASSERT false.
         printf("[fredbuf][AssertFailure] UTF-16 index %ld out of range.\n", utf16_index);
         assert(false);
-        return {
-            (uint32_t)(size_t)parser->piece_tree->line_count(),
-            (uint32_t)((piece_tree_length - start_u16_index) * sizeof(CHAR_T))
-        };
+        return piece_tree_length;
     }
-    Line line = parser->piece_tree->line_at(CharOffset { utf16_index });
-    LineRange line_range = parser->piece_tree->get_line_range(line);
-    size_t start_u16_index = (size_t)line_range.first;
-    uint32_t column = (uint32_t)((utf16_index - start_u16_index + 1) * sizeof(CHAR_T));
-    return {
-        (uint32_t)(size_t)line,
-        column
-    };
+    return utf16_index;
+}
+
+/// Convert a `UTF-16` code unit index at Piece Tree to `TSPoint` struct.
+inline TSPoint fredbuf_convert_u16index_to_point(tree_sitter_parser *parser, size_t utf16_index)
+{
+    utf16_index = fredbuf_checked_u16index(parser, utf16_index);
+    LinePosition position = parser->piece_tree->line_position(CharOffset { utf16_index });
+    return fredbuf_convert_line_position_to_point(position, utf16_index);
 }
 
 /// Convert a `UTF-16` code unit index range at Piece Tree to `TSRange` struct.
 inline TSRange fredbuf_convert_u16range_to_range(tree_sitter_parser *self, size_t utf16_index_start, size_t utf16_index_end) {
+    size_t indices[2] = { utf16_index_start, utf16_index_end };
+    TSPoint points[2];
+    fredbuf_convert_u16indices_to_points(self, indices, 2, points);
     return {
-        fredbuf_convert_u16index_to_point(self, utf16_index_start),
-        fredbuf_convert_u16index_to_point(self, utf16_index_end),
-        (uint16_t)(utf16_index_start * sizeof(CHAR_T)),
-        (uint16_t)(utf16_index_end * sizeof(CHAR_T))
+        points[0],
+        points[1],
+        (uint32_t)(utf16_index_start * sizeof(CHAR_T)),
+        (uint32_t)(utf16_index_end * sizeof(CHAR_T))
     };
 }
 
 /// Convert a  `TSPoint` struct to `UTF-16` code unit index.
 inline size_t fredbuf_convert_point_to_index(tree_sitter_parser *self, TSPoint point) {
-    size_t row = point.row;
-    size_t column_u16index = point.column;
-    size_t line_count = (size_t)self->piece_tree->line_count();
-    if (row > line_count) {
-        printf("[fredbuf][AssertFailure] line index %ld out of range: 1..%ld\n", row, line_count);
-        assert(false);
-    }
-    LineRange line_range = self->piece_tree->get_line_range(Line{ row });
-    size_t line_range_start = (size_t)line_range.first;
-    size_t line_range_end = (size_t)line_range.last;
-    size_t line_length = line_range_end - line_range_start;
-    if ((size_t)line_range.last < (size_t)self->piece_tree->length()) {
-        line_length ++;
+    size_t index = 0;
+    fredbuf_convert_points_to_indices(self, &point, 1, &index);
+    return index;
+}
+
+/// Convert `UTF-16` code unit indices at Piece Tree to `TSPoint` structs.
+void fredbuf_convert_u16indices_to_points(tree_sitter_parser *self, const size_t *utf16_indices, size_t count, TSPoint *points)
+{
+    std::vector<CharOffset> offsets;
+    offsets.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        offsets.push_back(CharOffset { fredbuf_checked_u16index(self, utf16_indices[i]) });
     }
-    if (column_u16index > line_length) {
-        printf("[fredbuf][AssertFailure]");
-        assert(false);
+    std::vector<LinePosition> positions;
+    self->piece_tree->line_positions(&positions, offsets);
+    for (size_t i = 0; i < count; i++) {
+        points[i] = fredbuf_convert_line_position_to_point(positions[i], (size_t)offsets[i]);
     }
-    return (line_range_start + column_u16index - 1);
 }
 
-
+/// Convert `TSPoint` structs to `UTF-16` code unit indices.
+void fredbuf_convert_points_to_indices(tree_sitter_parser *self, const TSPoint *points, size_t count, size_t *utf16_indices)
+{
+    size_t line_count = (size_t)self->piece_tree->line_count();
+    std::vector<Line> lines;
+    lines.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        size_t row = points[i].row;
+        if (row >= line_count) {
+            printf("[fredbuf][AssertFailure] line index %ld out of range: 0..<%ld\n", row, line_count);
+            assert(false);
+            row = line_count - 1;
+        }
+        lines.push_back(Line { row + 1 });
+    }
+    std::vector<CharOffset> starts;
+    self->piece_tree->line_start_offsets(&starts, lines);
+    size_t piece_tree_length = (size_t)self->piece_tree->length();
+    for (size_t i = 0; i < count; i++) {
+        /* Columns are not checked against the length of the line, that would take another descent. */
+        utf16_indices[i] = std::min((size_t)starts[i] + points[i].column / sizeof(CHAR_T), piece_tree_length);
+    }
+}
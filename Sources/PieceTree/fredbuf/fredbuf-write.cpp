@@ -0,0 +1,461 @@
+//
+//  fredbuf-write.cpp
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#include "fredbuf-write.h"
+#include "fredbuf.h"
+#include "encoding.h"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef TEXTBUF_UTF16
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TEXTBUF_WRITE_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define TEXTBUF_WRITE_SSE2
+#endif
+#endif // TEXTBUF_UTF16
+
+namespace PieceTree
+{
+    namespace
+    {
+        constexpr CHAR_T cr = CHAR_T('\r');
+        constexpr CHAR_T lf = CHAR_T('\n');
+
+        // Transcoded text is staged in a buffer of this size.
+        constexpr size_t staging_size = 1 << 16;
+        // A single writev takes at most this many spans (IOV_MAX on Darwin and Linux) and this many bytes, Darwin
+        // rejects calls which write more than INT_MAX bytes.
+        constexpr size_t max_iovecs = 1024;
+        constexpr size_t max_batch_bytes = size_t(1) << 30;
+
+        // Writes all of 'iov', resuming after partial writes.
+        bool write_all(int fd, iovec* iov, size_t count)
+        {
+            while (count != 0)
+            {
+                auto written = ::writev(fd, iov, static_cast<int>(count));
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                auto remaining = static_cast<size_t>(written);
+                while (count != 0 and remaining >= iov->iov_len)
+                {
+                    remaining -= iov->iov_len;
+                    ++iov;
+                    --count;
+                }
+                if (count != 0)
+                {
+                    iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+                    iov->iov_len -= remaining;
+                }
+            }
+            return true;
+        }
+
+        // Hands the spans of the document to writev as they are.
+        class SpanWriter
+        {
+        public:
+            explicit SpanWriter(int fd):
+                fd{ fd }
+            {
+                iov.reserve(max_iovecs);
+            }
+
+            bool add(const void* data, size_t size)
+            {
+                auto* bytes = static_cast<const char*>(data);
+                while (size != 0)
+                {
+                    if (iov.size() == max_iovecs or batch_bytes == max_batch_bytes)
+                    {
+                        if (not flush())
+                            return false;
+                    }
+                    auto length = std::min(size, max_batch_bytes - batch_bytes);
+                    iov.push_back({ .iov_base = const_cast<char*>(bytes), .iov_len = length });
+                    batch_bytes += length;
+                    bytes += length;
+                    size -= length;
+                }
+                return true;
+            }
+
+            bool flush()
+            {
+                bool success = write_all(fd, iov.data(), iov.size());
+                iov.clear();
+                batch_bytes = 0;
+                return success;
+            }
+        private:
+            int fd;
+            std::vector<iovec> iov;
+            size_t batch_bytes = 0;
+        };
+
+        // Returns the end of the run at 'first' which can be copied without looking at the code units one by
+        // one: code units up to 'max' and, when 'newlines' is set, no line breaks.
+        const CHAR_T* plain_run(const CHAR_T* first, const CHAR_T* last, CHAR_T max, bool newlines)
+        {
+#if defined(TEXTBUF_WRITE_NEON)
+            const uint16x8_t vmax = vdupq_n_u16(max);
+            const uint16x8_t vcr = vdupq_n_u16(cr);
+            const uint16x8_t vlf = vdupq_n_u16(lf);
+            while (last - first >= 8)
+            {
+                uint16x8_t v = vld1q_u16(reinterpret_cast<const uint16_t*>(first));
+                uint16x8_t special = vcgtq_u16(v, vmax);
+                if (newlines)
+                {
+                    special = vorrq_u16(special, vorrq_u16(vceqq_u16(v, vcr), vceqq_u16(v, vlf)));
+                }
+                uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(special)), 0);
+                if (mask != 0)
+                    return first + (__builtin_ctzll(mask) / 8);
+                first += 8;
+            }
+#elif defined(TEXTBUF_WRITE_SSE2)
+            // SSE2 has no unsigned 16-bit compare, a saturating subtraction is zero exactly for code units up to 'max'.
+            const __m128i vmax = _mm_set1_epi16(static_cast<short>(max));
+            const __m128i vcr = _mm_set1_epi16(static_cast<short>(cr));
+            const __m128i vlf = _mm_set1_epi16(static_cast<short>(lf));
+            const __m128i zero = _mm_setzero_si128();
+            while (last - first >= 8)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+                __m128i plain = _mm_cmpeq_epi16(_mm_subs_epu16(v, vmax), zero);
+                if (newlines)
+                {
+                    plain = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi16(v, vcr), _mm_cmpeq_epi16(v, vlf)), plain);
+                }
+                unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(plain)) & 0xFFFF;
+                if (mask != 0)
+                    return first + (__builtin_ctz(mask) / 2);
+                first += 8;
+            }
+#endif
+            for (; first != last; ++first)
+            {
+                if (*first > max or (newlines and (*first == cr or *first == lf)))
+                    return first;
+            }
+            return last;
+        }
+
+        // Narrows ASCII code units to bytes.
+        void pack_ascii(char* out, const CHAR_T* first, const CHAR_T* last)
+        {
+#if defined(TEXTBUF_WRITE_NEON)
+            while (last - first >= 8)
+            {
+                vst1_u8(reinterpret_cast<uint8_t*>(out), vmovn_u16(vld1q_u16(reinterpret_cast<const uint16_t*>(first))));
+                out += 8;
+                first += 8;
+            }
+#elif defined(TEXTBUF_WRITE_SSE2)
+            while (last - first >= 8)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(v, v));
+                out += 8;
+                first += 8;
+            }
+#endif
+            for (; first != last; ++first)
+            {
+                *out++ = static_cast<char>(*first);
+            }
+        }
+
+        constexpr bool is_high_surrogate(uint32_t c)
+        {
+            return c >= 0xD800 and c <= 0xDBFF;
+        }
+
+        constexpr bool is_low_surrogate(uint32_t c)
+        {
+            return c >= 0xDC00 and c <= 0xDFFF;
+        }
+
+        // Transcodes the spans of the document into a staging buffer which is written whenever it fills up.  A
+        // surrogate or a "\r" at the end of a span is held back until the next span tells how to write it.
+        class Transcoder
+        {
+        public:
+            Transcoder(int fd, TextEncoding encoding, LineEndings line_endings):
+                fd{ fd },
+                encoding{ encoding },
+                line_endings{ line_endings },
+                staging{ std::make_unique<char[]>(staging_size) } { }
+
+            bool put(std::STRING_VIEW span)
+            {
+                const bool newlines = line_endings != LineEndings::Preserve;
+                const CHAR_T max = encoding == TextEncoding::UTF8 ? CHAR_T(0x7F) : CHAR_T(0xFFFF);
+                auto* first = span.data();
+                auto* last = first + span.size();
+                while (first != last and success)
+                {
+                    auto* run_last = plain_run(first, last, max, newlines);
+                    if (run_last == first)
+                    {
+                        put_unit(*first++);
+                        continue;
+                    }
+                    settle();
+                    put_run(first, run_last);
+                    first = run_last;
+                }
+                return success;
+            }
+
+            bool finish()
+            {
+                settle();
+                flush();
+                return success;
+            }
+        private:
+            // Writes what is held back before a run, which never starts with a "\n" or a low surrogate.
+            void settle()
+            {
+                if (pending_cr)
+                {
+                    pending_cr = false;
+                    emit(cr);
+                }
+                after_cr = false;
+                if (high_surrogate != 0)
+                {
+                    high_surrogate = 0;
+                    emit_replacement();
+                }
+            }
+
+            void put_run(const CHAR_T* first, const CHAR_T* last)
+            {
+                const size_t unit_size = encoding == TextEncoding::UTF8 ? 1 : 2;
+                while (first != last)
+                {
+                    if (used == staging_size)
+                    {
+                        flush();
+                    }
+                    auto count = std::min<size_t>(last - first, (staging_size - used) / unit_size);
+                    if (encoding == TextEncoding::UTF8)
+                    {
+                        pack_ascii(staging.get() + used, first, first + count);
+                    }
+                    else if constexpr (std::endian::native == std::endian::little)
+                    {
+                        std::memcpy(staging.get() + used, first, count * 2);
+                    }
+                    else
+                    {
+                        for (size_t i = 0; i < count; ++i)
+                        {
+                            put_utf16(first[i], staging.get() + used + i * 2);
+                        }
+                    }
+                    used += count * unit_size;
+                    first += count;
+                }
+            }
+
+            void put_unit(CHAR_T c)
+            {
+                if (line_endings == LineEndings::LF)
+                {
+                    if (pending_cr)
+                    {
+                        pending_cr = false;
+                        if (c != lf)
+                        {
+                            emit(cr);
+                        }
+                    }
+                    if (c == cr)
+                    {
+                        pending_cr = true;
+                        return;
+                    }
+                }
+                else if (line_endings == LineEndings::CRLF)
+                {
+                    if (c == lf and not after_cr)
+                    {
+                        emit(cr);
+                    }
+                    after_cr = c == cr;
+                }
+                emit(c);
+            }
+
+            void emit(CHAR_T c)
+            {
+                if (staging_size - used < 4)
+                {
+                    flush();
+                }
+                auto* out = staging.get() + used;
+                if (encoding == TextEncoding::UTF16LE)
+                {
+                    put_utf16(c, out);
+                    used += 2;
+                    return;
+                }
+                uint32_t code = c;
+                if (high_surrogate != 0)
+                {
+                    if (is_low_surrogate(code))
+                    {
+                        code = 0x10000 + ((uint32_t(high_surrogate) - 0xD800) << 10) + (code - 0xDC00);
+                        high_surrogate = 0;
+                        out[0] = char(0xF0 | (code >> 18));
+                        out[1] = char(0x80 | ((code >> 12) & 0x3F));
+                        out[2] = char(0x80 | ((code >> 6) & 0x3F));
+                        out[3] = char(0x80 | (code & 0x3F));
+                        used += 4;
+                        return;
+                    }
+                    high_surrogate = 0;
+                    emit_replacement();
+                    // The replacement took room the check above made for 'c'.
+                    if (staging_size - used < 3)
+                    {
+                        flush();
+                    }
+                    out = staging.get() + used;
+                }
+                if (is_high_surrogate(code))
+                {
+                    high_surrogate = c;
+                    return;
+                }
+                if (is_low_surrogate(code))
+                {
+                    emit_replacement();
+                    return;
+                }
+                if (code < 0x80)
+                {
+                    out[0] = char(code);
+                    used += 1;
+                }
+                else if (code < 0x800)
+                {
+                    out[0] = char(0xC0 | (code >> 6));
+                    out[1] = char(0x80 | (code & 0x3F));
+                    used += 2;
+                }
+                else
+                {
+                    out[0] = char(0xE0 | (code >> 12));
+                    out[1] = char(0x80 | ((code >> 6) & 0x3F));
+                    out[2] = char(0x80 | (code & 0x3F));
+                    used += 3;
+                }
+            }
+
+            // Unpaired surrogates cannot be encoded in UTF-8, they are written as U+FFFD.
+            void emit_replacement()
+            {
+                if (staging_size - used < 3)
+                {
+                    flush();
+                }
+                std::memcpy(staging.get() + used, "\xEF\xBF\xBD", 3);
+                used += 3;
+            }
+
+            static void put_utf16(CHAR_T c, char* out)
+            {
+                out[0] = char(c & 0xFF);
+                out[1] = char(c >> 8);
+            }
+
+            void flush()
+            {
+                if (used == 0)
+                    return;
+                iovec iov{ .iov_base = staging.get(), .iov_len = used };
+                if (not write_all(fd, &iov, 1))
+                {
+                    success = false;
+                }
+                used = 0;
+            }
+
+            int fd;
+            TextEncoding encoding;
+            LineEndings line_endings;
+            std::unique_ptr<char[]> staging;
+            size_t used = 0;
+            bool success = true;
+            // A "\r" which is dropped if the next code unit is a "\n" (LineEndings::LF).
+            bool pending_cr = false;
+            // Whether the last code unit was a "\r" (LineEndings::CRLF).
+            bool after_cr = false;
+            // A high surrogate waiting for its low surrogate (UTF-8 only).
+            CHAR_T high_surrogate = 0;
+        };
+
+        template <typename TreeT>
+        WriteResult write_tree(const TreeT* tree, int fd, TextEncoding encoding, LineEndings line_endings)
+        {
+            TreeWalker walker{ tree };
+            if (encoding == TextEncoding::UTF16LE and line_endings == LineEndings::Preserve
+                and std::endian::native == std::endian::little)
+            {
+                SpanWriter writer{ fd };
+                for (auto span = walker.next_span(); not span.empty(); span = walker.next_span())
+                {
+                    if (not writer.add(span.data(), span.size() * sizeof(CHAR_T)))
+                        return WriteResult::IOError;
+                }
+                return writer.flush() ? WriteResult::Success : WriteResult::IOError;
+            }
+            Transcoder transcoder{ fd, encoding, line_endings };
+            for (auto span = walker.next_span(); not span.empty(); span = walker.next_span())
+            {
+                if (not transcoder.put(span))
+                    return WriteResult::IOError;
+            }
+            return transcoder.finish() ? WriteResult::Success : WriteResult::IOError;
+        }
+    } // namespace [anon]
+
+    WriteResult Tree::write_to(int fd, TextEncoding encoding, LineEndings line_endings) const
+    {
+        return write_tree(this, fd, encoding, line_endings);
+    }
+
+    WriteResult OwningSnapshot::write_to(int fd, TextEncoding encoding, LineEndings line_endings) const
+    {
+        return write_tree(this, fd, encoding, line_endings);
+    }
+
+    WriteResult ReferenceSnapshot::write_to(int fd, TextEncoding encoding, LineEndings line_endings) const
+    {
+        return write_tree(this, fd, encoding, line_endings);
+    }
+} // namespace PieceTree
@@ -0,0 +1,39 @@
+//
+//  fredbuf-write.h
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#pragma once
+
+// Streaming saves.  The document is written straight from the spans of its pieces, it is never flattened: a
+// UTF-16 save which keeps the line endings hands the spans to writev without copying them, every other save
+// transcodes the spans through a fixed-size buffer.  Either way the memory used does not depend on the size of
+// the document.
+namespace PieceTree
+{
+    enum class TextEncoding
+    {
+        UTF8,
+        // Little endian, without a byte order mark.
+        UTF16LE
+    };
+
+    enum class LineEndings
+    {
+        // Write the text as it is.
+        Preserve,
+        // "\r\n" becomes "\n".  A lone "\r" is not a line ending and is kept.
+        LF,
+        // A "\n" which does not follow a "\r" becomes "\r\n".
+        CRLF
+    };
+
+    enum class WriteResult
+    {
+        Success,
+        // Writing to the file failed.
+        IOError
+    };
+} // namespace PieceTree
@@ -1,6 +1,7 @@
 
 #include "fredbuf.h"
 #include "encoding.h"
+#include <algorithm>
 #include <cassert>
 
 #include <memory>
@@ -67,7 +68,7 @@ namespace PieceTree
                 const RedBlackTree& lft,
                 const NodeData& val,
                 const RedBlackTree& rgt)
-        : root_node(std::make_shared<Node>(c, lft.root_node, attribute(val, lft), rgt.root_node))
+        : root_node(std::make_shared<Node>(c, lft.root_node, attribute(val, lft, rgt), rgt.root_node))
     {
     }
 
@@ -76,6 +77,11 @@ namespace PieceTree
     {
     }
 
+    RedBlackTree RedBlackTree::restore(Color c, const RedBlackTree& lft, const NodeData& data, const RedBlackTree& rgt)
+    {
+        return RedBlackTree(std::make_shared<Node>(c, lft.root_node, data, rgt.root_node));
+    }
+
     RedBlackTree RedBlackTree::ins(const NodeData& x, Offset at, Offset total_offset) const
     {
         if (is_empty())
@@ -151,25 +157,34 @@ namespace PieceTree
         return RedBlackTree(c, left(), root(), right());
     }
 
-    PieceTree::Length tree_length(const RedBlackTree& root)
+    PieceTree::Length tree_length(RedBlackTree::View root)
     {
         if (root.is_empty())
             return { };
         return root.root().left_subtree_length + root.root().piece.length + tree_length(root.right());
     }
 
-    PieceTree::LFCount tree_lf_count(const RedBlackTree& root)
+    PieceTree::LFCount tree_lf_count(RedBlackTree::View root)
     {
         if (root.is_empty())
             return { };
         return root.root().left_subtree_lf_count + root.root().piece.newline_count + tree_lf_count(root.right());
     }
 
-    NodeData attribute(const NodeData& data, const RedBlackTree& left)
+    NodeData attribute(const NodeData& data, const RedBlackTree& left, const RedBlackTree& right)
     {
         auto new_data = data;
         new_data.left_subtree_length = tree_length(left);
         new_data.left_subtree_lf_count = tree_lf_count(left);
+        new_data.subtree_hash = data.piece_hash;
+        if (not left.is_empty())
+        {
+            new_data.subtree_hash = concat(left.root().subtree_hash, new_data.subtree_hash);
+        }
+        if (not right.is_empty())
+        {
+            new_data.subtree_hash = concat(new_data.subtree_hash, right.root().subtree_hash);
+        }
         return new_data;
     }
 
@@ -596,51 +611,69 @@ namespace PieceTree
             }
         }
 
-        void compute_buffer_meta(BufferMeta* meta, const RedBlackTree& root)
+        void compute_buffer_meta(BufferMeta* meta, RedBlackTree::View root)
         {
             meta->lf_count = tree_lf_count(root);
             meta->total_content_length = tree_length(root);
+            meta->content_hash = root.is_empty() ? ContentHash{ } : root.root().subtree_hash;
+        }
+    } // namespace [anon]
+
+    namespace
+    {
+        // The reserved size of a mod buffer segment.  Inserts which do not fit into the remaining space start
+        // a new segment (larger inserts get a segment of their own size).
+        constexpr size_t mod_segment_capacity = 64 * 1024;
+        constexpr size_t mod_segment_line_capacity = 4 * 1024;
+
+        constexpr BufferIndex mod_segment_index(size_t segment)
+        {
+            return BufferIndex{ rep(BufferIndex::ModBuf) | segment };
+        }
+
+        constexpr bool is_mod_segment(BufferIndex index)
+        {
+            return (rep(index) & rep(BufferIndex::ModBuf)) != 0;
         }
     } // namespace [anon]
 
     const CharBuffer* BufferCollection::buffer_at(BufferIndex index) const
     {
-        if (index == BufferIndex::ModBuf)
-            return &mod_buffer;
-        return orig_buffers[rep(index)].get();
+        if (is_mod_segment(index))
+            return (*mod_segments)[rep(index) & ~rep(BufferIndex::ModBuf)].get();
+        return (*orig_buffers)[rep(index)].get();
     }
 
     CharOffset BufferCollection::buffer_offset(BufferIndex index, const BufferCursor& cursor) const
     {
-        auto& starts = buffer_at(index)->line_starts;
+        auto* starts = buffer_at(index)->starts();
         return CharOffset{ rep(starts[rep(cursor.line)]) + rep(cursor.column) };
     }
 
     Tree::Tree():
-        buffers{ }
+        buffers{ .orig_buffers = std::make_shared<const Buffers>(), .mod_segments = { } }
     {
         build_tree();
     }
 
     Tree::Tree(Buffers&& buffers):
-        buffers{ std::move(buffers) }
+        buffers{ .orig_buffers = std::make_shared<const Buffers>(std::move(buffers)), .mod_segments = { } }
     {
         build_tree();
     }
 
     void Tree::build_tree()
     {
-        buffers.mod_buffer.line_starts.clear();
-        buffers.mod_buffer.buffer.clear();
-        // In order to maintain the invariant of other buffers, the mod_buffer needs a single line-start of 0.
-        buffers.mod_buffer.line_starts.push_back({});
+        // The first mod buffer segment is created by the first insert.
+        buffers.mod_segments = std::make_shared<const ModSegments>();
         last_insert = { };
 
-        const auto buf_count = buffers.orig_buffers.size();
+        const auto& orig_buffers = *buffers.orig_buffers;
+        const auto buf_count = orig_buffers.size();
         CharOffset offset = { };
         for (size_t i = 0; i < buf_count; ++i)
         {
-            const auto& buf = *buffers.orig_buffers[i];
+            const auto& buf = *orig_buffers[i];
             assert(not buf.line_starts.empty());
             // If this immutable buffer is empty, we can avoid creating a piece for it altogether.
             if (buf.buffer.empty())
@@ -656,7 +689,7 @@ namespace PieceTree
                 // Note: the number of newlines
                 .newline_count = LFCount{ rep(last_line) }
             };
-            root = root.insert({ piece }, offset);
+            root = root.insert(node_data(piece), offset);
             offset = offset + piece.length;
         }
 
@@ -676,7 +709,7 @@ namespace PieceTree
         if (root.is_empty())
         {
             auto piece = build_piece(txt);
-            root = root.insert({ piece }, CharOffset{ 0 });
+            root = root.insert(node_data(piece), CharOffset{ 0 });
             return;
         }
 
@@ -710,19 +743,20 @@ namespace PieceTree
             // 3. Remove the old piece.
             // 4. Extend the old piece's length to the length of the newly created piece.
             // 5. Re-insert the new piece.
+            // Note: the new piece is built first because it may start a new mod buffer segment, in which
+            // case it cannot extend the previous piece.
+            auto piece = build_piece(txt);
             if (offset != CharOffset{})
             {
                 auto prev_node_result = node_at(&buffers, root, retract(offset));
-                if (prev_node_result.node->piece.index == BufferIndex::ModBuf
-                    and prev_node_result.node->piece.last == last_insert)
+                if (prev_node_result.node->piece.index == piece.index
+                    and prev_node_result.node->piece.last == piece.first)
                 {
-                    auto new_piece = build_piece(txt);
-                    combine_pieces(prev_node_result, new_piece);
+                    combine_pieces(prev_node_result, piece);
                     return;
                 }
             }
-            auto piece = build_piece(txt);
-            root = root.insert({ piece }, offset);
+            root = root.insert(node_data(piece), offset);
             return;
         }
 
@@ -738,15 +772,14 @@ namespace PieceTree
             // 2. Remove the old piece.
             // 3. Extend the old piece's length to the length of the newly created piece.
             // 4. Re-insert the new piece.
-            if (node->piece.index == BufferIndex::ModBuf and node->piece.last == last_insert)
+            auto piece = build_piece(txt);
+            if (node->piece.index == piece.index and node->piece.last == piece.first)
             {
-                auto new_piece = build_piece(txt);
-                combine_pieces(result, new_piece);
+                combine_pieces(result, piece);
                 return;
             }
             // Insert the new piece at the end.
-            auto piece = build_piece(txt);
-            root = root.insert({ piece }, offset);
+            root = root.insert(node_data(piece), offset);
             return;
         }
 
@@ -769,15 +802,15 @@ namespace PieceTree
         root = root.remove(node_start_offset);
 
         // Insert the left.
-        root = root.insert({ new_piece_left }, node_start_offset);
+        root = root.insert(node_data(new_piece_left), node_start_offset);
 
         // Insert the new mid.
         node_start_offset = node_start_offset + new_piece_left.length;
-        root = root.insert({ new_piece }, node_start_offset);
+        root = root.insert(node_data(new_piece), node_start_offset);
 
         // Insert remainder.
         node_start_offset = node_start_offset + new_piece.length;
-        root = root.insert({ new_piece_right }, node_start_offset);
+        root = root.insert(node_data(new_piece_right), node_start_offset);
     }
 
     void Tree::internal_remove(CharOffset offset, Length count)
@@ -815,7 +848,7 @@ namespace PieceTree
                 auto new_piece = trim_piece_left(&buffers, first_node->piece, end_split_pos);
                 // Remove the old one and update.
                 root = root.remove(first.start_offset)
-                            .insert({ new_piece }, first.start_offset);
+                            .insert(node_data(new_piece), first.start_offset);
                 return;
             }
 
@@ -825,7 +858,7 @@ namespace PieceTree
                 auto new_piece = trim_piece_right(&buffers, first_node->piece, start_split_pos);
                 // Remove the old one and update.
                 root = root.remove(first.start_offset)
-                            .insert({ new_piece }, first.start_offset);
+                            .insert(node_data(new_piece), first.start_offset);
                 return;
             }
 
@@ -834,8 +867,8 @@ namespace PieceTree
             root = root.remove(first.start_offset)
                         // Note: We insert right first so that the 'left' will be inserted
                         // to the right node's left.
-                        .insert({ right }, first.start_offset)
-                        .insert({ left }, first.start_offset);
+                        .insert(node_data(right), first.start_offset)
+                        .insert(node_data(left), first.start_offset);
             return;
         }
 
@@ -864,14 +897,14 @@ namespace PieceTree
             {
                 if (new_last.length != Length{})
                 {
-                    root = root.insert({ new_last }, first.start_offset);
+                    root = root.insert(node_data(new_last), first.start_offset);
                 }
             }
         }
 
         if (new_first.length != Length{})
         {
-            root = root.insert({ new_first }, first.start_offset);
+            root = root.insert(node_data(new_first), first.start_offset);
         }
     }
 
@@ -880,7 +913,7 @@ namespace PieceTree
     Length Tree::accumulate_value(const BufferCollection* buffers, const Piece& piece, Line index)
     {
         auto* buffer = buffers->buffer_at(piece.index);
-        auto& line_starts = buffer->line_starts;
+        auto* line_starts = buffer->starts();
         // Extend it so we can capture the entire line content including newline.
         auto expected_start = extend(piece.first.line, rep(index) + 1);
         auto first = rep(line_starts[rep(piece.first.line)]) + rep(piece.first.column);
@@ -898,7 +931,7 @@ namespace PieceTree
     Length Tree::accumulate_value_no_lf(const BufferCollection* buffers, const Piece& piece, Line index)
     {
         auto* buffer = buffers->buffer_at(piece.index);
-        auto& line_starts = buffer->line_starts;
+        auto* line_starts = buffer->starts();
         // Extend it so we can capture the entire line content including newline.
         auto expected_start = extend(piece.first.line, rep(index) + 1);
         auto first = rep(line_starts[rep(piece.first.line)]) + rep(piece.first.column);
@@ -907,32 +940,32 @@ namespace PieceTree
             auto last = rep(line_starts[rep(piece.last.line)]) + rep(piece.last.column);
             if (last == first)
                 return Length{ };
-            if (buffer->buffer[last - 1] == '\n')
+            if (buffer->chars()[last - 1] == '\n')
                 return Length{ last - 1 - first };
             return Length{ last - first };
         }
         auto last = rep(line_starts[rep(expected_start)]);
         if (last == first)
             return Length{ };
-        if (buffer->buffer[last - 1] == '\n')
+        if (buffer->chars()[last - 1] == '\n')
             return Length{ last - 1 - first };
         return Length{ last - first };
     }
 
-    void Tree::populate_from_node(std::STRING* buf, const BufferCollection* buffers, const PieceTree::RedBlackTree& node)
+    void Tree::populate_from_node(std::STRING* buf, const BufferCollection* buffers, RedBlackTree::View node)
     {
-        auto& buffer = buffers->buffer_at(node.root().piece.index)->buffer;
+        auto* buffer = buffers->buffer_at(node.root().piece.index)->chars();
         auto old_buf_size = buf->size();
         // We know we want the first line (index 0).
         auto accumulated_value = accumulate_value(buffers, node.root().piece, node.root().piece.first.line);
         auto start_offset = buffers->buffer_offset(node.root().piece.index, node.root().piece.first);
-        auto first = buffer.data() + rep(start_offset);
+        auto first = buffer + rep(start_offset);
         auto last = first + rep(accumulated_value);
         buf->resize(buf->size() + std::distance(first, last));
         std::copy(first, last, buf->data() + old_buf_size);
     }
 
-    void Tree::populate_from_node(std::STRING* buf, const BufferCollection* buffers, const PieceTree::RedBlackTree& node, Line line_index)
+    void Tree::populate_from_node(std::STRING* buf, const BufferCollection* buffers, RedBlackTree::View node, Line line_index)
     {
         auto accumulated_value = accumulate_value(buffers, node.root().piece, line_index);
         Length prev_accumulated_value = { };
@@ -940,18 +973,18 @@ namespace PieceTree
         {
             prev_accumulated_value = accumulate_value(buffers, node.root().piece, retract(line_index));
         }
-        auto& buffer = buffers->buffer_at(node.root().piece.index)->buffer;
+        auto* buffer = buffers->buffer_at(node.root().piece.index)->chars();
         auto start_offset = buffers->buffer_offset(node.root().piece.index, node.root().piece.first);
 
-        auto first = buffer.data() + rep(start_offset) + rep(prev_accumulated_value);
-        auto last = buffer.data() + rep(start_offset) + rep(accumulated_value);
+        auto first = buffer + rep(start_offset) + rep(prev_accumulated_value);
+        auto last = buffer + rep(start_offset) + rep(accumulated_value);
         auto old_buf_size = buf->size();
         buf->resize(buf->size() + std::distance(first, last));
         std::copy(first, last, buf->data() + old_buf_size);
     }
 
     template <Tree::Accumulator accumulate>
-    void Tree::line_start(CharOffset* offset, const BufferCollection* buffers, const PieceTree::RedBlackTree& node, Line line)
+    void Tree::line_start(CharOffset* offset, const BufferCollection* buffers, RedBlackTree::View node, Line line)
     {
         if (node.is_empty())
             return;
@@ -983,7 +1016,7 @@ namespace PieceTree
         }
     }
 
-    void Tree::line_end_crlf(CharOffset* offset, const BufferCollection* buffers, const RedBlackTree& root, const RedBlackTree& node, Line line)
+    void Tree::line_end_crlf(CharOffset* offset, const BufferCollection* buffers, RedBlackTree::View root, RedBlackTree::View node, Line line)
     {
         if (node.is_empty())
             return;
@@ -1068,38 +1101,181 @@ namespace PieceTree
         return result.line;
     }
 
+    LinePosition Tree::line_position(CharOffset offset) const
+    {
+        LineCursor cursor;
+        return line_position(&buffers, root, offset, &cursor);
+    }
+
+    CharOffset Tree::line_start_offset(Line line) const
+    {
+        LineCursor cursor;
+        return line_start_offset(&buffers, root, line, &cursor);
+    }
+
+    void Tree::line_positions(std::vector<LinePosition>* positions, std::span<const CharOffset> offsets) const
+    {
+        positions->clear();
+        positions->reserve(offsets.size());
+        LineCursor cursor;
+        for (auto offset : offsets)
+        {
+            positions->push_back(line_position(&buffers, root, offset, &cursor));
+        }
+    }
+
+    void Tree::line_start_offsets(std::vector<CharOffset>* starts, std::span<const Line> lines) const
+    {
+        starts->clear();
+        starts->reserve(lines.size());
+        LineCursor cursor;
+        for (auto line : lines)
+        {
+            starts->push_back(line_start_offset(&buffers, root, line, &cursor));
+        }
+    }
+
 CHAR_T Tree::at(CharOffset offset) const
     {
         return char_at(&buffers, root, offset);
     }
 
-CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node, CharOffset offset)
+CHAR_T Tree::char_at(const BufferCollection* buffers, RedBlackTree::View node, CharOffset offset)
     {
         auto result = node_at(buffers, node, offset);
         if (result.node == nullptr)
             return '\0';
         auto* buffer = buffers->buffer_at(result.node->piece.index);
         auto buf_offset = buffers->buffer_offset(result.node->piece.index, result.node->piece.first);
-        const CHAR_T* p = buffer->buffer.data() + rep(buf_offset) + rep(result.remainder);
+        const CHAR_T* p = buffer->chars() + rep(buf_offset) + rep(result.remainder);
         return *p;
     }
 
-    void Tree::assemble_line(std::STRING* buf, const PieceTree::RedBlackTree& node, Line line) const
+    void LineView::append_to(std::STRING* buf) const
+    {
+        buf->reserve(buf->size() + rep(total_length));
+        for (auto span : *this)
+        {
+            buf->append(span);
+        }
+    }
+
+    void LineView::push_back(Span span)
+    {
+        if (span.empty())
+            return;
+        total_length = total_length + Length{ span.size() };
+        if (spilled.empty() and inline_count < inline_capacity)
+        {
+            inline_spans[inline_count++] = span;
+            return;
+        }
+        if (spilled.empty())
+        {
+            spilled.reserve(inline_capacity * 2);
+            spilled.assign(inline_spans, inline_spans + inline_count);
+        }
+        spilled.push_back(span);
+    }
+
+    CHAR_T LineView::back() const
+    {
+        assert(not empty());
+        // Empty spans are never pushed so the last span always has content.
+        return (end() - 1)->back();
+    }
+
+    void LineView::trim_back()
+    {
+        assert(not empty());
+        total_length = retract(total_length);
+        Span* last = spilled.empty() ? &inline_spans[inline_count - 1] : &spilled.back();
+        last->remove_suffix(1);
+        if (not last->empty())
+            return;
+        if (spilled.empty())
+        {
+            --inline_count;
+        }
+        else
+        {
+            spilled.pop_back();
+        }
+    }
+
+    template <typename TreeT>
+    LineView Tree::build_line_view(const TreeT* tree, const BufferCollection* buffers, RedBlackTree::View root, Line line, LineTerminator terminator)
+    {
+        LineView view;
+        if (line == Line::IndexBeginning or root.is_empty())
+            return view;
+        CharOffset first{ };
+        CharOffset last{ };
+        line_start<&Tree::accumulate_value>(&first, buffers, root, line);
+        line_start<&Tree::accumulate_value>(&last, buffers, root, extend(line));
+        auto len = distance(first, last);
+        if (len == Length{ })
+            return view;
+
+        // Fast path: the entire line (including its line break) lives within a single piece so we can
+        // reference it directly without building a walker.
+        auto pos = node_at(buffers, root, first);
+        assert(pos.node != nullptr);
+        auto& piece = pos.node->piece;
+        if (pos.remainder + len <= piece.length)
+        {
+            auto* buffer = buffers->buffer_at(piece.index);
+            auto start = buffers->buffer_offset(piece.index, piece.first);
+            view.push_back({ buffer->chars() + rep(start) + rep(pos.remainder), rep(len) });
+        }
+        else
+        {
+            TreeWalker walker{ tree, first };
+            while (view.length() < len)
+            {
+                auto span = walker.next_span();
+                if (span.empty())
+                    break;
+                view.push_back(span.substr(0, rep(len - view.length())));
+            }
+        }
+
+        if (terminator == LineTerminator::Include)
+            return view;
+        if (view.back() != '\n')
+            return view;
+        view.trim_back();
+        if (terminator == LineTerminator::ExcludeCRLF
+            and not view.empty()
+            and view.back() == '\r')
+        {
+            view.trim_back();
+        }
+        return view;
+    }
+
+    LineView Tree::line_view(Line line, LineTerminator terminator) const
+    {
+        return build_line_view(this, &buffers, root, line, terminator);
+    }
+
+    LineView OwningSnapshot::line_view(Line line, LineTerminator terminator) const
+    {
+        return Tree::build_line_view(this, &buffers, root, line, terminator);
+    }
+
+    LineView ReferenceSnapshot::line_view(Line line, LineTerminator terminator) const
+    {
+        return Tree::build_line_view(this, buffers, root, line, terminator);
+    }
+
+    void Tree::assemble_line(std::STRING* buf, RedBlackTree::View node, Line line) const
     {
         if (node.is_empty())
             return;
         // Trying this new logic for now.
 #if 1
-        CharOffset line_offset{ };
-        line_start<&Tree::accumulate_value>(&line_offset, &buffers, node, line);
-        TreeWalker walker{ this, line_offset };
-        while (not walker.exhausted())
-        {
-            CHAR_T c = walker.next();
-            if (c == '\n')
-                break;
-            buf->push_back(c);
-        }
+        build_line_view(this, &buffers, node, line, LineTerminator::ExcludeLF).append_to(buf);
 #else
         assert(line != Line::IndexBeginning);
         auto line_index = rep(retract(line));
@@ -1155,18 +1331,7 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         buf->clear();
         if (line == Line::IndexBeginning)
             return;
-        if (root.is_empty())
-            return;
-        CharOffset line_offset{ };
-        Tree::line_start<&Tree::accumulate_value>(&line_offset, &buffers, root, line);
-        TreeWalker walker{ this, line_offset };
-        while (not walker.exhausted())
-        {
-            CHAR_T c = walker.next();
-            if (c == '\n')
-                break;
-            buf->push_back(c);
-        }
+        line_view(line, LineTerminator::ExcludeLF).append_to(buf);
     }
 
     void ReferenceSnapshot::get_line_content(std::STRING* buf, Line line) const
@@ -1175,44 +1340,25 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         buf->clear();
         if (line == Line::IndexBeginning)
             return;
-        if (root.is_empty())
-            return;
-        CharOffset line_offset{ };
-        Tree::line_start<&Tree::accumulate_value>(&line_offset, buffers, root, line);
-        TreeWalker walker{ this, line_offset };
-        while (not walker.exhausted())
-        {
-            CHAR_T c = walker.next();
-            if (c == '\n')
-                break;
-            buf->push_back(c);
-        }
+        line_view(line, LineTerminator::ExcludeLF).append_to(buf);
     }
 
     namespace
     {
         template <typename TreeT>
-        [[nodiscard]] IncompleteCRLF trim_crlf(std::STRING* buf, TreeT* tree, CharOffset line_offset)
+        [[nodiscard]] IncompleteCRLF trim_crlf(std::STRING* buf, TreeT* tree, Line line)
         {
-            TreeWalker walker{ tree, line_offset };
-            auto prev_char = '\0';
-            while (not walker.exhausted())
+            tree->line_view(line, LineTerminator::Include).append_to(buf);
+            // End of the buffer is not an incomplete CRLF.
+            if (buf->empty() or buf->back() != '\n')
+                return IncompleteCRLF::No;
+            buf->pop_back();
+            if (not buf->empty() and buf->back() == '\r')
             {
-                CHAR_T c = walker.next();
-                if (c == '\n')
-                {
-                    if (prev_char == '\r')
-                    {
-                        buf->pop_back();
-                        return IncompleteCRLF::No;
-                    }
-                    return IncompleteCRLF::Yes;
-                }
-                buf->push_back(c);
-                prev_char = c;
+                buf->pop_back();
+                return IncompleteCRLF::No;
             }
-            // End of the buffer is not an incomplete CRLF.
-            return IncompleteCRLF::No;
+            return IncompleteCRLF::Yes;
         }
     } // namespace [anon]
 
@@ -1222,13 +1368,7 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         buf->clear();
         if (line == Line::IndexBeginning)
             return IncompleteCRLF::No;
-        auto node = root;
-        if (node.is_empty())
-            return IncompleteCRLF::No;
-        // Trying this new logic for now.
-        CharOffset line_offset{ };
-        line_start<&Tree::accumulate_value>(&line_offset, &buffers, node, line);
-        return trim_crlf(buf, this, line_offset);
+        return trim_crlf(buf, this, line);
     }
 
     IncompleteCRLF OwningSnapshot::get_line_content_crlf(std::STRING* buf, Line line) const
@@ -1237,13 +1377,7 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         buf->clear();
         if (line == Line::IndexBeginning)
             return IncompleteCRLF::No;
-        auto node = root;
-        if (node.is_empty())
-            return IncompleteCRLF::No;
-        // Trying this new logic for now.
-        CharOffset line_offset{ };
-        Tree::line_start<&Tree::accumulate_value>(&line_offset, &buffers, node, line);
-        return trim_crlf(buf, this, line_offset);
+        return trim_crlf(buf, this, line);
     }
 
     IncompleteCRLF ReferenceSnapshot::get_line_content_crlf(std::STRING* buf, Line line) const
@@ -1252,13 +1386,7 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         buf->clear();
         if (line == Line::IndexBeginning)
             return IncompleteCRLF::No;
-        auto node = root;
-        if (node.is_empty())
-            return IncompleteCRLF::No;
-        // Trying this new logic for now.
-        CharOffset line_offset{ };
-        Tree::line_start<&Tree::accumulate_value>(&line_offset, buffers, node, line);
-        return trim_crlf(buf, this, line_offset);
+        return trim_crlf(buf, this, line);
     }
 
     Line OwningSnapshot::line_at(CharOffset offset) const
@@ -1269,6 +1397,40 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         return result.line;
     }
 
+    LinePosition OwningSnapshot::line_position(CharOffset offset) const
+    {
+        Tree::LineCursor cursor;
+        return Tree::line_position(&buffers, root, offset, &cursor);
+    }
+
+    CharOffset OwningSnapshot::line_start_offset(Line line) const
+    {
+        Tree::LineCursor cursor;
+        return Tree::line_start_offset(&buffers, root, line, &cursor);
+    }
+
+    void OwningSnapshot::line_positions(std::vector<LinePosition>* positions, std::span<const CharOffset> offsets) const
+    {
+        positions->clear();
+        positions->reserve(offsets.size());
+        Tree::LineCursor cursor;
+        for (auto offset : offsets)
+        {
+            positions->push_back(Tree::line_position(&buffers, root, offset, &cursor));
+        }
+    }
+
+    void OwningSnapshot::line_start_offsets(std::vector<CharOffset>* starts, std::span<const Line> lines) const
+    {
+        starts->clear();
+        starts->reserve(lines.size());
+        Tree::LineCursor cursor;
+        for (auto line : lines)
+        {
+            starts->push_back(Tree::line_start_offset(&buffers, root, line, &cursor));
+        }
+    }
+
     Line ReferenceSnapshot::line_at(CharOffset offset) const
     {
         if (is_empty())
@@ -1277,6 +1439,40 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         return result.line;
     }
 
+    LinePosition ReferenceSnapshot::line_position(CharOffset offset) const
+    {
+        Tree::LineCursor cursor;
+        return Tree::line_position(buffers, root, offset, &cursor);
+    }
+
+    CharOffset ReferenceSnapshot::line_start_offset(Line line) const
+    {
+        Tree::LineCursor cursor;
+        return Tree::line_start_offset(buffers, root, line, &cursor);
+    }
+
+    void ReferenceSnapshot::line_positions(std::vector<LinePosition>* positions, std::span<const CharOffset> offsets) const
+    {
+        positions->clear();
+        positions->reserve(offsets.size());
+        Tree::LineCursor cursor;
+        for (auto offset : offsets)
+        {
+            positions->push_back(Tree::line_position(buffers, root, offset, &cursor));
+        }
+    }
+
+    void ReferenceSnapshot::line_start_offsets(std::vector<CharOffset>* starts, std::span<const Line> lines) const
+    {
+        starts->clear();
+        starts->reserve(lines.size());
+        Tree::LineCursor cursor;
+        for (auto line : lines)
+        {
+            starts->push_back(Tree::line_start_offset(buffers, root, line, &cursor));
+        }
+    }
+
     LineRange OwningSnapshot::get_line_range(Line line) const
     {
         LineRange range{ };
@@ -1330,9 +1526,10 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         // If the end position is the beginning of a new line, then we can just return the difference in lines.
         if (rep(end.column) == 0)
             return LFCount{ rep(retract(end.line, rep(start.line))) };
-        auto& starts = buffers->buffer_at(index)->line_starts;
+        auto* buffer = buffers->buffer_at(index);
+        auto* starts = buffer->starts();
         // It means, there is no LF after end.
-        if (end.line == Line{ starts.size() - 1})
+        if (end.line == Line{ buffer->line_start_count() - 1 })
             return LFCount{ rep(retract(end.line, rep(start.line))) };
         // Due to the check above, we know that there's at least one more line after 'end.line'.
         auto next_start_offset = starts[rep(extend(end.line))];
@@ -1346,10 +1543,42 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         return LFCount{ rep(retract(end.line, rep(start.line))) };
     }
 
+    CharBuffer* Tree::mod_segment_for(size_t length, size_t new_line_starts)
+    {
+        const auto& segments = *buffers.mod_segments;
+        if (not segments.empty())
+        {
+            auto& last = *segments.back();
+            // Segments restored from a session are never appended to.
+            if (not last.mapped.mapping
+                and last.buffer.size() + length <= last.buffer.capacity()
+                and last.line_starts.size() + new_line_starts <= last.line_starts.capacity())
+                return &last;
+        }
+        // The last segment is full.  Appending would reallocate storage which snapshots may be reading, so
+        // start a new segment and publish it through a new segment list.
+        auto segment = std::make_shared<CharBuffer>();
+        segment->buffer.reserve(std::max(mod_segment_capacity, length));
+        segment->line_starts.reserve(std::max(mod_segment_line_capacity, new_line_starts + 1));
+        // In order to maintain the invariant of other buffers, a segment needs a single line-start of 0.
+        segment->line_starts.push_back({});
+        auto next = std::make_shared<ModSegments>();
+        next->reserve(segments.size() + 1);
+        next->assign(segments.begin(), segments.end());
+        next->push_back(segment);
+        buffers.mod_segments = std::move(next);
+        last_insert = { };
+        return segment.get();
+    }
+
     Piece Tree::build_piece(std::STRING_VIEW txt)
     {
-        auto start_offset = buffers.mod_buffer.buffer.size();
         populate_line_starts(&scratch_starts, txt);
+        // Note: we can drop the first start because the algorithm always adds an empty start.
+        auto new_starts_end = scratch_starts.size();
+        auto* segment = mod_segment_for(txt.size(), new_starts_end - 1);
+        const auto index = mod_segment_index(buffers.mod_segments->size() - 1);
+        auto start_offset = segment->buffer.size();
         auto start = last_insert;
         // TODO: Handle CRLF (where the new buffer starts with LF and the end of our buffer ends with CR).
         // Offset the new starts relative to the existing buffer.
@@ -1357,35 +1586,38 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         {
             new_start = extend(new_start, start_offset);
         }
-        // Append new starts.
-        // Note: we can drop the first start because the algorithm always adds an empty start.
-        auto new_starts_end = scratch_starts.size();
-        buffers.mod_buffer.line_starts.reserve(buffers.mod_buffer.line_starts.size() + new_starts_end);
+        // Append new starts.  Both appends stay within the reserved capacity of the segment.
         for (size_t i = 1; i < new_starts_end; ++i)
         {
-            buffers.mod_buffer.line_starts.push_back(scratch_starts[i]);
+            segment->line_starts.push_back(scratch_starts[i]);
         }
-        auto old_size = buffers.mod_buffer.buffer.size();
-        buffers.mod_buffer.buffer.resize(buffers.mod_buffer.buffer.size() + txt.size());
-        auto insert_at = buffers.mod_buffer.buffer.data() + old_size;
-        std::copy(txt.data(), txt.data() + txt.size(), insert_at);
+        segment->buffer.append(txt);
+        extend_hash_checkpoints(&segment->hash_checkpoints, segment->buffer);
 
         // Build the new piece for the inserted buffer.
-        auto end_offset = buffers.mod_buffer.buffer.size();
-        auto end_index = buffers.mod_buffer.line_starts.size() - 1;
-        auto end_col = end_offset - rep(buffers.mod_buffer.line_starts[end_index]);
+        auto end_offset = segment->buffer.size();
+        auto end_index = segment->line_starts.size() - 1;
+        auto end_col = end_offset - rep(segment->line_starts[end_index]);
         BufferCursor end_pos = { .line = Line{ end_index }, .column = Column{ end_col } };
-        Piece piece = { .index = BufferIndex::ModBuf,
+        Piece piece = { .index = index,
                         .first = start,
                         .last = end_pos,
                         .length = Length{ end_offset - start_offset },
-                        .newline_count = line_feed_count(&buffers, BufferIndex::ModBuf, start, end_pos) };
+                        .newline_count = line_feed_count(&buffers, index, start, end_pos) };
         // Update the last insertion.
         last_insert = end_pos;
         return piece;
     }
 
-    NodePosition Tree::node_at(const BufferCollection* buffers, RedBlackTree node, CharOffset off)
+    NodeData Tree::node_data(const Piece& piece) const
+    {
+        auto* buffer = buffers.buffer_at(piece.index);
+        auto first = rep(buffers.buffer_offset(piece.index, piece.first));
+        return { .piece = piece,
+                 .piece_hash = hash_range(buffer->chars(), buffer->checkpoints(), first, first + rep(piece.length)) };
+    }
+
+    NodePosition Tree::node_at(const BufferCollection* buffers, RedBlackTree::View node, CharOffset off)
     {
         size_t node_start_offset = 0;
         size_t newline_count = 0;
@@ -1435,9 +1667,141 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         return { };
     }
 
+    LinePosition Tree::line_position(const BufferCollection* buffers, RedBlackTree::View root, CharOffset offset, LineCursor* cursor)
+    {
+        if (root.is_empty())
+            return { .line = Line::Beginning, .line_start = CharOffset{ } };
+        // The end of a piece gives the same position as the start of the next one.
+        if (cursor->node != nullptr and cursor->node_start <= offset
+            and rep(offset) <= rep(cursor->node_start + cursor->node->piece.length))
+        {
+            auto& piece = cursor->node->piece;
+            auto pos = buffer_position(buffers, piece, distance(cursor->node_start, offset));
+            auto lines = rep(pos.line) - rep(piece.first.line);
+            if (lines != 0)
+                return { .line = extend(cursor->node_line, lines), .line_start = CharOffset{ rep(offset) - rep(pos.column) } };
+            if (cursor->node_line_start_known)
+                return { .line = cursor->node_line, .line_start = cursor->node_line_start };
+        }
+        size_t node_start = 0;
+        size_t newline_count = 0;
+        // Where the last line feed before the current subtree is: in the piece of a node or in a subtree which
+        // was passed on the way.  It is only looked up if the line of 'offset' starts before its node.
+        const NodeData* lf_node = nullptr;
+        size_t lf_node_start = 0;
+        RedBlackTree::View lf_subtree;
+        size_t lf_subtree_start = 0;
+        size_t lf_subtree_count = 0;
+        auto pass_left = [&](const NodeData& data, RedBlackTree::View left)
+        {
+            if (rep(data.left_subtree_lf_count) == 0)
+                return;
+            lf_node = nullptr;
+            lf_subtree = left;
+            lf_subtree_start = node_start;
+            lf_subtree_count = rep(data.left_subtree_lf_count);
+        };
+        auto node = root;
+        auto off = rep(offset);
+        while (true)
+        {
+            auto& data = node.root();
+            if (rep(data.left_subtree_length) > off)
+            {
+                node = node.left();
+                continue;
+            }
+            auto right_start = rep(data.left_subtree_length + data.piece.length);
+            if (right_start > off or node.right().is_empty())
+            {
+                pass_left(data, node.left());
+                node_start += rep(data.left_subtree_length);
+                newline_count += rep(data.left_subtree_lf_count);
+                // Offsets past the end are clamped to the end.
+                off = std::min(off - rep(data.left_subtree_length), rep(data.piece.length));
+                break;
+            }
+            if (rep(data.piece.newline_count) != 0)
+            {
+                lf_subtree = { };
+                lf_node = &data;
+                lf_node_start = node_start + rep(data.left_subtree_length);
+            }
+            else
+            {
+                pass_left(data, node.left());
+            }
+            off -= right_start;
+            node_start += right_start;
+            newline_count += rep(data.left_subtree_lf_count + data.piece.newline_count);
+            node = node.right();
+        }
+        auto& piece = node.root().piece;
+        auto pos = buffer_position(buffers, piece, Length{ off });
+        auto lines = rep(pos.line) - rep(piece.first.line);
+        *cursor = { .node = &node.root(),
+                    .node_start = CharOffset{ node_start },
+                    .node_line = Line{ newline_count + 1 } };
+        if (lines != 0)
+            return { .line = extend(cursor->node_line, lines), .line_start = CharOffset{ node_start + off - rep(pos.column) } };
+        // The line starts before the node, after the last line feed on the way.
+        if (lf_node != nullptr)
+        {
+            cursor->node_line_start = CharOffset{ lf_node_start } + accumulate_value(buffers, lf_node->piece, Line{ rep(lf_node->piece.newline_count) - 1 });
+        }
+        else if (not lf_subtree.is_empty())
+        {
+            cursor->node_line_start = CharOffset{ lf_subtree_start };
+            line_start<&Tree::accumulate_value>(&cursor->node_line_start, buffers, lf_subtree, Line{ lf_subtree_count + 1 });
+        }
+        cursor->node_line_start_known = true;
+        return { .line = cursor->node_line, .line_start = cursor->node_line_start };
+    }
+
+    CharOffset Tree::line_start_offset(const BufferCollection* buffers, RedBlackTree::View root, Line line, LineCursor* cursor)
+    {
+        assert(line != Line::IndexBeginning);
+        auto line_index = rep(retract(line));
+        // Lines which start within the piece of the previous lookup.
+        if (cursor->node != nullptr and rep(cursor->node_line) <= line_index
+            and line_index < rep(cursor->node_line) + rep(cursor->node->piece.newline_count))
+        {
+            return cursor->node_start + accumulate_value(buffers, cursor->node->piece, Line{ line_index - rep(cursor->node_line) });
+        }
+        size_t offset = 0;
+        size_t newline_count = 0;
+        auto node = root;
+        while (not node.is_empty())
+        {
+            auto& data = node.root();
+            if (rep(data.left_subtree_lf_count) >= line_index)
+            {
+                node = node.left();
+            }
+            else if (rep(data.left_subtree_lf_count + data.piece.newline_count) >= line_index)
+            {
+                offset += rep(data.left_subtree_length);
+                newline_count += rep(data.left_subtree_lf_count);
+                line_index -= rep(data.left_subtree_lf_count);
+                *cursor = { .node = &data,
+                            .node_start = CharOffset{ offset },
+                            .node_line = Line{ newline_count + 1 } };
+                return CharOffset{ offset } + accumulate_value(buffers, data.piece, Line{ line_index - 1 });
+            }
+            else
+            {
+                line_index -= rep(data.left_subtree_lf_count + data.piece.newline_count);
+                offset += rep(data.left_subtree_length + data.piece.length);
+                newline_count += rep(data.left_subtree_lf_count + data.piece.newline_count);
+                node = node.right();
+            }
+        }
+        return CharOffset{ offset };
+    }
+
     BufferCursor Tree::buffer_position(const BufferCollection* buffers, const Piece& piece, Length remainder)
     {
-        auto& starts = buffers->buffer_at(piece.index)->line_starts;
+        auto* starts = buffers->buffer_at(piece.index)->starts();
         auto start_offset = rep(starts[rep(piece.first.line)]) + rep(piece.first.column);
         auto offset = start_offset + rep(remainder);
 
@@ -1523,7 +1887,8 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
     void Tree::combine_pieces(NodePosition existing, Piece new_piece)
     {
         // This transformation is only valid under the following conditions.
-        assert(existing.node->piece.index == BufferIndex::ModBuf);
+        assert(is_mod_segment(existing.node->piece.index));
+        assert(existing.node->piece.index == new_piece.index);
         // This assumes that the piece was just built.
         assert(existing.node->piece.last == new_piece.first);
         auto old_piece = existing.node->piece;
@@ -1531,7 +1896,7 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         new_piece.newline_count = new_piece.newline_count + old_piece.newline_count;
         new_piece.length = new_piece.length + old_piece.length;
         root = root.remove(existing.start_offset)
-                    .insert({ new_piece }, existing.start_offset);
+                    .insert(node_data(new_piece), existing.start_offset);
     }
 
     void Tree::remove_node_range(NodePosition first, Length length)
@@ -1569,11 +1934,36 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
             return;
         // This allows us to undo blocks of code.
         if (is_no(suppress_history)
-            and (end_last_insert != offset or root.is_empty()))
+            and (end_last_insert != offset or root.is_empty() or history_group_ended()))
         {
-            append_undo(root, offset);
+            append_undo(root, offset, HistoryEdit::Insert);
+        }
+        if (is_yes(journal))
+        {
+            auto start_point = edit_point(&buffers, root, offset);
+            auto new_end_point = start_point;
+            auto last_lf = txt.find_last_of(CHAR_T('\n'));
+            if (last_lf == txt.npos)
+            {
+                new_end_point.column += txt.size();
+            }
+            else
+            {
+                new_end_point.row += std::count(txt.begin(), txt.end(), CHAR_T('\n'));
+                new_end_point.column = txt.size() - last_lf - 1;
+            }
+            edit_journal.push_back({ .start = offset,
+                                     .old_end = offset,
+                                     .new_end = extend(offset, txt.size()),
+                                     .start_point = start_point,
+                                     .old_end_point = start_point,
+                                     .new_end_point = new_end_point });
         }
         internal_insert(offset, txt);
+        if (is_no(suppress_history))
+        {
+            note_history_edit(HistoryEdit::Insert, txt);
+        }
     }
 
     void Tree::remove(CharOffset offset, Length count, SuppressHistory suppress_history)
@@ -1581,11 +1971,314 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         // Rule out the obvious noop.
         if (rep(count) == 0 or root.is_empty())
             return;
+        // Note: a range which runs past the end would leave an empty piece behind.
+        auto old_end = std::min(offset + count, CharOffset{ rep(meta.total_content_length) });
+        if (old_end <= offset)
+            return;
+        count = distance(offset, old_end);
         if (is_no(suppress_history))
         {
-            append_undo(root, offset);
+            append_undo(root, offset, HistoryEdit::Remove);
+        }
+        if (is_yes(journal))
+        {
+            auto start_point = edit_point(&buffers, root, offset);
+            edit_journal.push_back({ .start = offset,
+                                     .old_end = old_end,
+                                     .new_end = offset,
+                                     .start_point = start_point,
+                                     .old_end_point = edit_point(&buffers, root, old_end),
+                                     .new_end_point = start_point });
         }
         internal_remove(offset, count);
+        if (is_no(suppress_history))
+        {
+            note_history_edit(HistoryEdit::Remove, { });
+        }
+    }
+
+    namespace
+    {
+        // The pieces of a tree in document order.
+        void collect_pieces(std::vector<NodeData>* pieces, RedBlackTree::View node)
+        {
+            if (node.is_empty())
+                return;
+            collect_pieces(pieces, node.left());
+            pieces->push_back(node.root());
+            collect_pieces(pieces, node.right());
+        }
+
+        struct BuiltSubtree
+        {
+            RedBlackTree tree;
+            Length length;
+            LFCount lf_count;
+        };
+
+        // Builds a perfectly balanced tree.  Its leaves are at most one level apart, painting the deepest
+        // level red (when it is not the root) leaves every path with the same number of black nodes.
+        BuiltSubtree build_balanced(const std::vector<NodeData>& pieces, size_t first, size_t last, size_t depth, size_t red_depth)
+        {
+            if (first == last)
+                return { .tree = RedBlackTree{ }, .length = Length{ }, .lf_count = LFCount{ } };
+            auto mid = first + (last - first) / 2;
+            auto left = build_balanced(pieces, first, mid, depth + 1, red_depth);
+            auto right = build_balanced(pieces, mid + 1, last, depth + 1, red_depth);
+            auto data = pieces[mid];
+            data.left_subtree_length = left.length;
+            data.left_subtree_lf_count = left.lf_count;
+            data.subtree_hash = data.piece_hash;
+            if (not left.tree.is_empty())
+            {
+                data.subtree_hash = concat(left.tree.root().subtree_hash, data.subtree_hash);
+            }
+            if (not right.tree.is_empty())
+            {
+                data.subtree_hash = concat(data.subtree_hash, right.tree.root().subtree_hash);
+            }
+            auto color = depth == red_depth and depth != 0 ? Color::Red : Color::Black;
+            return { .tree = RedBlackTree::restore(color, left.tree, data, right.tree),
+                     .length = left.length + data.piece.length + right.length,
+                     .lf_count = left.lf_count + data.piece.newline_count + right.lf_count };
+        }
+
+        RedBlackTree build_balanced(const std::vector<NodeData>& pieces)
+        {
+            // The depth of the deepest level.
+            size_t red_depth = 0;
+            while ((size_t{ 2 } << red_depth) <= pieces.size())
+            {
+                ++red_depth;
+            }
+            return build_balanced(pieces, 0, pieces.size(), 0, red_depth).tree;
+        }
+
+        // The depth of the leftmost leaf, close to the base 2 logarithm of the number of pieces.
+        size_t leftmost_depth(RedBlackTree::View node)
+        {
+            size_t depth = 0;
+            for (; not node.is_empty(); node = node.left())
+            {
+                ++depth;
+            }
+            return depth;
+        }
+    } // namespace [anon]
+
+    bool Tree::apply_edits(std::span<const TextEdit> edits, SuppressHistory suppress_history)
+    {
+        auto total = CharOffset{ rep(meta.total_content_length) };
+        auto end = CharOffset{ };
+        for (auto& edit : edits)
+        {
+            if (edit.offset < end or edit.offset + edit.length > total)
+                return false;
+            end = edit.offset + edit.length;
+        }
+        // Edits which change nothing are dropped from the journal and the history.
+        TreeChanges changes;
+        changes.reserve(edits.size());
+        size_t inserted = 0;
+        size_t removed = 0;
+        for (auto& edit : edits)
+        {
+            if (rep(edit.length) == 0 and edit.text.empty())
+                continue;
+            auto new_first = CharOffset{ rep(edit.offset) + inserted - removed };
+            changes.push_back({ .old_first = edit.offset,
+                                .old_last = edit.offset + edit.length,
+                                .new_first = new_first,
+                                .new_last = extend(new_first, edit.text.size()) });
+            inserted += edit.text.size();
+            removed += rep(edit.length);
+        }
+        if (changes.empty())
+            return true;
+
+        if (is_no(suppress_history))
+        {
+            // The batch gets an entry of its own, no edit before or after it merges with it.
+            history_group_open = false;
+            append_undo(root, changes.front().old_first, HistoryEdit::Commit);
+            history_group_open = false;
+        }
+        auto old_root = root;
+        // Rebuilding allocates a node per piece, editing in place a few paths of nodes per edit.
+        auto depth = leftmost_depth(root);
+        if (depth >= 64 or edits.size() * 4 * depth < (size_t{ 1 } << depth))
+        {
+            // Going backwards keeps the offsets of the edits which are still to come valid.
+            for (auto edit = edits.rbegin(); edit != edits.rend(); ++edit)
+            {
+                if (rep(edit->length) != 0)
+                {
+                    internal_remove(edit->offset, edit->length);
+                }
+                if (not edit->text.empty())
+                {
+                    internal_insert(edit->offset, edit->text);
+                }
+            }
+        }
+        else
+        {
+            root = rebuild_with_edits(edits);
+            compute_buffer_meta();
+#ifdef TEXTBUF_DEBUG
+            satisfies_rb_invariants(root);
+#endif // TEXTBUF_DEBUG
+        }
+        // The next insert starts a new undo entry, it does not continue the batch.
+        end_last_insert = CharOffset::Sentinel;
+        if (is_yes(journal))
+        {
+            journal_changes(old_root, changes);
+        }
+        return true;
+    }
+
+    // Rebuilds the tree from its pieces with the edits applied in one sweep.  The inserted text is appended to
+    // the mod buffer in one go.
+    RedBlackTree Tree::rebuild_with_edits(std::span<const TextEdit> edits)
+    {
+        std::vector<NodeData> pieces;
+        collect_pieces(&pieces, root);
+        std::STRING text;
+        for (auto& edit : edits)
+        {
+            text.append(edit.text);
+        }
+        Piece text_piece = { };
+        if (not text.empty())
+        {
+            text_piece = build_piece(text);
+        }
+        auto slice = [&](const Piece& piece, Length first, Length last)
+        {
+            auto first_pos = buffer_position(&buffers, piece, first);
+            auto last_pos = buffer_position(&buffers, piece, last);
+            return Piece{ .index = piece.index,
+                          .first = first_pos,
+                          .last = last_pos,
+                          .length = Length{ rep(last) - rep(first) },
+                          .newline_count = line_feed_count(&buffers, piece.index, first_pos, last_pos) };
+        };
+
+        std::vector<NodeData> result;
+        result.reserve(pieces.size() + 2 * edits.size());
+        size_t next_piece = 0;
+        auto piece_first = CharOffset{ };
+        // Copies [first, last) of the old document, the range starts at or after the previous one.
+        auto keep = [&](CharOffset first, CharOffset last)
+        {
+            while (first < last)
+            {
+                auto& data = pieces[next_piece];
+                auto piece_last = piece_first + data.piece.length;
+                if (piece_last <= first)
+                {
+                    ++next_piece;
+                    piece_first = piece_last;
+                    continue;
+                }
+                auto kept_last = std::min(last, piece_last);
+                if (first == piece_first and kept_last == piece_last)
+                {
+                    result.push_back(data);
+                }
+                else
+                {
+                    result.push_back(node_data(slice(data.piece, distance(piece_first, first), distance(piece_first, kept_last))));
+                }
+                first = kept_last;
+            }
+        };
+        auto cursor = CharOffset{ };
+        size_t text_offset = 0;
+        for (auto& edit : edits)
+        {
+            keep(cursor, edit.offset);
+            if (not edit.text.empty())
+            {
+                auto first = Length{ text_offset };
+                text_offset += edit.text.size();
+                result.push_back(node_data(slice(text_piece, first, Length{ text_offset })));
+            }
+            cursor = edit.offset + edit.length;
+        }
+        keep(cursor, CharOffset{ rep(meta.total_content_length) });
+        return build_balanced(result);
+    }
+
+    EditPoint Tree::edit_point(const BufferCollection* buffers, RedBlackTree::View root, CharOffset offset)
+    {
+        LineCursor cursor;
+        auto position = line_position(buffers, root, offset, &cursor);
+        return { .row = rep(position.line) - 1, .column = rep(distance(position.line_start, offset)) };
+    }
+
+    void Tree::journal_edits(JournalEdits journal)
+    {
+        this->journal = journal;
+        if (is_no(journal))
+        {
+            edit_journal.clear();
+        }
+    }
+
+    void Tree::drain_edit_journal(EditJournal* edits)
+    {
+        edits->clear();
+        std::swap(*edits, edit_journal);
+    }
+
+    void Tree::journal_changes(const RedBlackTree& old_root, const TreeChanges& changes)
+    {
+        for (auto& change : changes)
+        {
+            // The preceding changes have already been applied, so everything before the change is in the
+            // coordinates of the new root.
+            auto start_point = edit_point(&buffers, root, change.new_first);
+            auto old_first_point = edit_point(&buffers, old_root, change.old_first);
+            auto old_last_point = edit_point(&buffers, old_root, change.old_last);
+            auto old_end_point = start_point;
+            if (old_last_point.row == old_first_point.row)
+            {
+                old_end_point.column += old_last_point.column - old_first_point.column;
+            }
+            else
+            {
+                old_end_point.row += old_last_point.row - old_first_point.row;
+                old_end_point.column = old_last_point.column;
+            }
+            edit_journal.push_back({ .start = change.new_first,
+                                     .old_end = change.new_first + distance(change.old_first, change.old_last),
+                                     .new_end = change.new_last,
+                                     .start_point = start_point,
+                                     .old_end_point = old_end_point,
+                                     .new_end_point = edit_point(&buffers, root, change.new_last) });
+        }
+    }
+
+    void Tree::switch_root(const RedBlackTree& new_root, TreeChanges* changes)
+    {
+        TreeChanges journal_scratch;
+        if (changes == nullptr and is_yes(journal))
+        {
+            changes = &journal_scratch;
+        }
+        if (changes != nullptr)
+        {
+            diff(changes, root, new_root);
+        }
+        auto old_root = root;
+        root = new_root;
+        compute_buffer_meta();
+        if (is_yes(journal))
+        {
+            journal_changes(old_root, *changes);
+        }
     }
 
     void Tree::compute_buffer_meta()
@@ -1593,44 +2286,218 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         ::PieceTree::compute_buffer_meta(&meta, root);
     }
 
-    void Tree::append_undo(const RedBlackTree& old_root, CharOffset op_offset)
+    namespace
+    {
+        size_t pinned_bytes(const RedBlackTree& root, const RedBlackTree& neighbour)
+        {
+            return unshared_node_count(root, neighbour) * RedBlackTree::node_bytes;
+        }
+
+        // The previous top entry gets the new one as its neighbour.
+        void push_history(UndoStack* stack, size_t* stack_bytes, const RedBlackTree& root, CharOffset op_offset, RevisionId revision)
+        {
+            if (not stack->empty())
+            {
+                auto& top = stack->front();
+                top.pinned_bytes = pinned_bytes(top.root, root);
+                *stack_bytes += top.pinned_bytes;
+            }
+            stack->push_front({ .root = root, .op_offset = op_offset, .revision = revision });
+        }
+
+        // The next entry moves to the top, where its neighbour is the current root.
+        UndoRedoEntry pop_history(UndoStack* stack, size_t* stack_bytes)
+        {
+            auto entry = std::move(stack->front());
+            stack->pop_front();
+            if (not stack->empty())
+            {
+                *stack_bytes -= stack->front().pinned_bytes;
+                stack->front().pinned_bytes = 0;
+            }
+            return entry;
+        }
+
+        bool ends_word(CHAR_T c)
+        {
+            return c < 0x80 and not (c >= 'a' and c <= 'z') and not (c >= 'A' and c <= 'Z')
+                and not (c >= '0' and c <= '9') and c != '_';
+        }
+    } // namespace [anon]
+
+    void Tree::append_undo(const RedBlackTree& old_root, CharOffset op_offset, HistoryEdit edit)
     {
         // Can't redo if we're creating a new undo entry.
         if (not redo_stack.empty())
         {
             redo_stack.clear();
+            redo_pinned_bytes = 0;
         }
-        undo_stack.push_front({ .root = old_root, .op_offset = op_offset });
+        // Merge into the entry at the top, the root it holds already undoes this edit as well.
+        const bool coalescing = policy.coalesce_interval != std::chrono::milliseconds{ } or is_yes(policy.coalesce_words);
+        if (coalescing and history_group_open and not history_group_ended()
+            and (edit == HistoryEdit::Commit or history_group_edit == HistoryEdit::Commit or edit == history_group_edit))
+            return;
+        push_history(&undo_stack, &undo_pinned_bytes, old_root, op_offset, head_revision);
+        history_group_open = true;
+        history_group_edit = edit;
+        history_word_ended = false;
+        prune_history();
     }
 
-    UndoRedoResult Tree::try_undo(CharOffset op_offset)
+    // Whether the next edit has to start a new undo entry even if it continues the previous one.
+    bool Tree::history_group_ended() const
+    {
+        if (is_yes(policy.coalesce_words) and history_word_ended)
+            return true;
+        return policy.coalesce_interval != std::chrono::milliseconds{ }
+            and std::chrono::steady_clock::now() - last_history_edit > policy.coalesce_interval;
+    }
+
+    // An entry opened by a commit takes the kind of the first edit which follows.
+    void Tree::note_history_edit(HistoryEdit edit, std::STRING_VIEW inserted)
+    {
+        if (history_group_edit == HistoryEdit::Commit)
+        {
+            history_group_edit = edit;
+        }
+        if (policy.coalesce_interval != std::chrono::milliseconds{ })
+        {
+            last_history_edit = std::chrono::steady_clock::now();
+        }
+        if (is_yes(policy.coalesce_words))
+        {
+            history_word_ended = std::any_of(inserted.begin(), inserted.end(), ends_word);
+        }
+    }
+
+    // Drops the oldest revisions and undo entries until the history fits the policy.  The newest revision and
+    // the newest entry are always kept.
+    void Tree::prune_history()
+    {
+        auto drop_revision = [&]
+        {
+            revision_pinned_bytes -= revision_list.front().pinned_bytes;
+            revision_list.pop_front();
+        };
+        while (policy.max_entries != 0 and revision_list.size() > policy.max_entries)
+        {
+            drop_revision();
+        }
+        auto over_budget = [&]
+        {
+            return policy.max_bytes != 0 and undo_pinned_bytes + revision_pinned_bytes > policy.max_bytes;
+        };
+        while (revision_list.size() > 1 and over_budget())
+        {
+            drop_revision();
+        }
+        while (undo_stack.size() > 1
+               and ((policy.max_entries != 0 and undo_stack.size() > policy.max_entries) or over_budget()))
+        {
+            undo_pinned_bytes -= undo_stack.back().pinned_bytes;
+            undo_stack.pop_back();
+        }
+    }
+
+    // Measures every entry again, e.g. after the stacks were replaced.
+    void Tree::measure_history()
+    {
+        auto measure = [](UndoStack* stack)
+        {
+            size_t total = 0;
+            for (size_t i = 0; i < stack->size(); ++i)
+            {
+                auto& entry = (*stack)[i];
+                entry.pinned_bytes = i == 0 ? 0 : pinned_bytes(entry.root, (*stack)[i - 1].root);
+                total += entry.pinned_bytes;
+            }
+            return total;
+        };
+        undo_pinned_bytes = measure(&undo_stack);
+        redo_pinned_bytes = measure(&redo_stack);
+        revision_pinned_bytes = 0;
+        for (size_t i = 0; i + 1 < revision_list.size(); ++i)
+        {
+            auto& revision = revision_list[i];
+            revision.pinned_bytes = pinned_bytes(revision.root, revision_list[i + 1].root);
+            revision_pinned_bytes += revision.pinned_bytes;
+        }
+        history_group_open = false;
+    }
+
+    void Tree::set_history_policy(const HistoryPolicy& new_policy)
+    {
+        policy = new_policy;
+        prune_history();
+    }
+
+    const HistoryPolicy& Tree::history_policy() const
+    {
+        return policy;
+    }
+
+    HistoryMemory Tree::history_memory() const
+    {
+        HistoryMemory memory = { .undo_entries = undo_stack.size(),
+                                 .redo_entries = redo_stack.size(),
+                                 .pinned_bytes = undo_pinned_bytes + redo_pinned_bytes + revision_pinned_bytes };
+        if (not undo_stack.empty())
+        {
+            memory.pinned_bytes += pinned_bytes(undo_stack.front().root, root);
+        }
+        if (not redo_stack.empty())
+        {
+            memory.pinned_bytes += pinned_bytes(redo_stack.front().root, root);
+        }
+        if (not revision_list.empty())
+        {
+            memory.pinned_bytes += pinned_bytes(revision_list.back().root, root);
+        }
+        return memory;
+    }
+
+    UndoRedoResult Tree::try_undo(CharOffset op_offset, TreeChanges* changes)
     {
         if (undo_stack.empty())
             return { .success = false, .op_offset = CharOffset{ } };
-        redo_stack.push_front({ .root = root, .op_offset = op_offset });
-        auto [node, undo_offset] = undo_stack.front();
-        root = node;
-        undo_stack.pop_front();
-        compute_buffer_meta();
-        return { .success = true, .op_offset = undo_offset };
+        auto entry = pop_history(&undo_stack, &undo_pinned_bytes);
+        push_history(&redo_stack, &redo_pinned_bytes, root, op_offset, head_revision);
+        history_group_open = false;
+        head_revision = entry.revision;
+        switch_root(entry.root, changes);
+        return { .success = true, .op_offset = entry.op_offset };
     }
 
-    UndoRedoResult Tree::try_redo(CharOffset op_offset)
+    UndoRedoResult Tree::try_redo(CharOffset op_offset, TreeChanges* changes)
     {
         if (redo_stack.empty())
             return { .success = false, .op_offset = CharOffset{ } };
-        undo_stack.push_front({ .root = root, .op_offset = op_offset });
-        auto [node, redo_offset] = redo_stack.front();
-        root = node;
-        redo_stack.pop_front();
-        compute_buffer_meta();
-        return { .success = true, .op_offset = redo_offset };
+        auto entry = pop_history(&redo_stack, &redo_pinned_bytes);
+        push_history(&undo_stack, &undo_pinned_bytes, root, op_offset, head_revision);
+        history_group_open = false;
+        head_revision = entry.revision;
+        switch_root(entry.root, changes);
+        return { .success = true, .op_offset = entry.op_offset };
     }
 
     // Direct history manipulation.
-    void Tree::commit_head(CharOffset offset)
+    RevisionId Tree::commit_head(CharOffset offset)
     {
-        append_undo(root, offset);
+        auto id = next_revision;
+        next_revision = extend(next_revision);
+        if (not revision_list.empty())
+        {
+            auto& newest = revision_list.back();
+            newest.pinned_bytes = pinned_bytes(newest.root, root);
+            revision_pinned_bytes += newest.pinned_bytes;
+        }
+        revision_list.push_back({ .id = id, .parent = head_revision, .root = root, .op_offset = offset });
+        head_revision = id;
+        append_undo(root, offset, HistoryEdit::Commit);
+        // The commit may have merged into the previous undo entry, which skips pruning.
+        prune_history();
+        return id;
     }
 
     RedBlackTree Tree::head() const
@@ -1638,10 +2505,42 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         return root;
     }
 
-    void Tree::snap_to(const RedBlackTree& new_root)
+    void Tree::snap_to(const RedBlackTree& new_root, TreeChanges* changes)
     {
-        root = new_root;
-        compute_buffer_meta();
+        history_group_open = false;
+        switch_root(new_root, changes);
+    }
+
+    // Revisions.
+    bool Tree::checkout(RevisionId id, CharOffset op_offset, TreeChanges* changes)
+    {
+        auto* revision = find_revision(id);
+        if (revision == nullptr)
+            return false;
+        // The checkout gets an entry of its own, no edit before or after it merges with it.
+        history_group_open = false;
+        append_undo(root, op_offset, HistoryEdit::Commit);
+        history_group_open = false;
+        head_revision = id;
+        switch_root(revision->root, changes);
+        return true;
+    }
+
+    RevisionId Tree::current_revision() const
+    {
+        return head_revision;
+    }
+
+    const Revisions& Tree::revisions() const
+    {
+        return revision_list;
+    }
+
+    const Revision* Tree::find_revision(RevisionId id) const
+    {
+        if (revision_list.empty() or id < revision_list.front().id or id > revision_list.back().id)
+            return nullptr;
+        return &revision_list[rep(id) - rep(revision_list.front().id)];
     }
 
 #ifdef TEXTBUF_DEBUG
@@ -1656,13 +2555,13 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         auto* buffer = tree->buffers.buffer_at(piece.index);
         auto offset = tree->buffers.buffer_offset(piece.index, piece.first);
 #ifdef TEXTBUF_UTF8
-        printf("%.*sPiece content: %.*s\n", level, levels, static_cast<int>(piece.length), buffer->buffer.data() + rep(offset)); /* char */
+        printf("%.*sPiece content: %.*s\n", level, levels, static_cast<int>(piece.length), buffer->chars() + rep(offset)); /* char */
 #elif defined(TEXTBUF_UTF16)
         //MARK: Need some convert, to do it.
-        //const char16_t *res = buffer->buffer.data() + rep(offset);
+        //const char16_t *res = buffer->chars() + rep(offset);
         //printf("%.*sPiece content: %.*s\n", level, levels, static_cast<int>(piece.length), res); /* char16_t */
 #elif defined(TEXTBUF_UTF32)
-        printf("%.*sPiece content: %.*ls\n", level, levels, static_cast<int>(piece.length), buffer->buffer.data() + rep(offset)); /* wchar_t*/
+        printf("%.*sPiece content: %.*ls\n", level, levels, static_cast<int>(piece.length), buffer->chars() + rep(offset)); /* wchar_t*/
 #endif
     }
 #endif // TEXTBUF_DEBUG
@@ -1670,7 +2569,9 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
     void TreeBuilder::accept(std::STRING_VIEW txt)
     {
         populate_line_starts(&scratch_starts, txt);
-        buffers.push_back(std::make_shared<CharBuffer>(CharBuffer{ std::STRING{ txt }, scratch_starts }));
+        auto buffer = std::make_shared<CharBuffer>(CharBuffer{ .buffer = std::STRING{ txt }, .line_starts = scratch_starts, .hash_checkpoints = { }, .mapped = { } });
+        extend_hash_checkpoints(&buffer->hash_checkpoints, buffer->buffer);
+        buffers.push_back(std::move(buffer));
     }
 
     OwningSnapshot::OwningSnapshot(const Tree* tree):
@@ -1679,7 +2580,7 @@ CHAR_T Tree::char_at(const BufferCollection* buffers, const RedBlackTree& node,
         buffers{ tree->buffers } { }
 
     OwningSnapshot::OwningSnapshot(const Tree* tree, const RedBlackTree& dt):
-        root{ tree->root },
+        root{ dt },
         meta{ tree->meta },
         buffers{ tree->buffers }
     {
@@ -1747,6 +2648,24 @@ CHAR_T TreeWalker::next()
         return *first_ptr++;
     }
 
+    std::STRING_VIEW TreeWalker::next_span()
+    {
+        if (first_ptr == last_ptr)
+        {
+            populate_ptrs();
+            // If this is exhausted, we're done.
+            if (exhausted())
+                return { };
+            // Catchall.
+            if (first_ptr == last_ptr)
+                return next_span();
+        }
+        std::STRING_VIEW span{ first_ptr, static_cast<size_t>(last_ptr - first_ptr) };
+        total_offset = total_offset + Length{ span.size() };
+        first_ptr = last_ptr;
+        return span;
+    }
+
 CHAR_T TreeWalker::current()
     {
         if (first_ptr == last_ptr)
@@ -1827,8 +2746,8 @@ CHAR_T TreeWalker::current()
             auto* buffer = buffers->buffer_at(piece.index);
             auto first_offset = buffers->buffer_offset(piece.index, piece.first);
             auto last_offset = buffers->buffer_offset(piece.index, piece.last);
-            first_ptr = buffer->buffer.data() + rep(first_offset);
-            last_ptr = buffer->buffer.data() + rep(last_offset);
+            first_ptr = buffer->chars() + rep(first_offset);
+            last_ptr = buffer->chars() + rep(last_offset);
             // Change this direction.
             stack.back().dir = Direction::Right;
             return;
@@ -1843,7 +2762,7 @@ CHAR_T TreeWalker::current()
 
     void TreeWalker::fast_forward_to(CharOffset offset)
     {
-        auto node = root;
+        RedBlackTree::View node = root;
         while (not node.is_empty())
         {
             if (rep(node.root().left_subtree_length) > rep(offset))
@@ -1863,8 +2782,8 @@ CHAR_T TreeWalker::current()
                 auto* buffer = buffers->buffer_at(piece.index);
                 auto first_offset = buffers->buffer_offset(piece.index, piece.first);
                 auto last_offset = buffers->buffer_offset(piece.index, piece.last);
-                first_ptr = buffer->buffer.data() + rep(first_offset) + rep(offset);
-                last_ptr = buffer->buffer.data() + rep(last_offset);
+                first_ptr = buffer->chars() + rep(first_offset) + rep(offset);
+                last_ptr = buffer->chars() + rep(last_offset);
                 return;
             }
             else
@@ -1930,6 +2849,25 @@ CHAR_T ReverseTreeWalker::next()
         return *(--first_ptr);
     }
 
+    std::STRING_VIEW ReverseTreeWalker::next_span()
+    {
+        if (first_ptr == last_ptr)
+        {
+            populate_ptrs();
+            // If this is exhausted, we're done.
+            if (exhausted())
+                return { };
+            // Catchall.
+            if (first_ptr == last_ptr)
+                return next_span();
+        }
+        // Note: 'first_ptr' walks backwards towards 'last_ptr'.
+        std::STRING_VIEW span{ last_ptr, static_cast<size_t>(first_ptr - last_ptr) };
+        total_offset = CharOffset{ rep(total_offset) - span.size() };
+        first_ptr = last_ptr;
+        return span;
+    }
+
 CHAR_T ReverseTreeWalker::current()
     {
         if (first_ptr == last_ptr)
@@ -2011,8 +2949,8 @@ CHAR_T ReverseTreeWalker::current()
             auto* buffer = buffers->buffer_at(piece.index);
             auto first_offset = buffers->buffer_offset(piece.index, piece.first);
             auto last_offset = buffers->buffer_offset(piece.index, piece.last);
-            last_ptr = buffer->buffer.data() + rep(first_offset);
-            first_ptr = buffer->buffer.data() + rep(last_offset);
+            last_ptr = buffer->chars() + rep(first_offset);
+            first_ptr = buffer->chars() + rep(last_offset);
             // Change this direction.
             stack.back().dir = Direction::Left;
             return;
@@ -2027,7 +2965,7 @@ CHAR_T ReverseTreeWalker::current()
 
     void ReverseTreeWalker::fast_forward_to(CharOffset offset)
     {
-        auto node = root;
+        RedBlackTree::View node = root;
         while (not node.is_empty())
         {
             if (rep(node.root().left_subtree_length) > rep(offset))
@@ -2047,10 +2985,10 @@ CHAR_T ReverseTreeWalker::current()
                 auto& piece = node.root().piece;
                 auto* buffer = buffers->buffer_at(piece.index);
                 auto first_offset = buffers->buffer_offset(piece.index, piece.first);
-                last_ptr = buffer->buffer.data() + rep(first_offset);
+                last_ptr = buffer->chars() + rep(first_offset);
                 // We extend offset because it is the point where we want to start and because this walker works by dereferencing
                 // 'first_ptr - 1', offset + 1 is our 'begin'.
-                first_ptr = buffer->buffer.data() + rep(first_offset) + rep(extend(offset));
+                first_ptr = buffer->chars() + rep(first_offset) + rep(extend(offset));
                 return;
             }
             else
@@ -1,12 +1,19 @@
 #pragma once
 
-#include <forward_list>
+#include <chrono>
+#include <deque>
 #include <memory>
+#include <span>
 #include <string_view>
 #include <string>
 #include <vector>
 #include "encoding.h"
+#include "fredbuf-diff.h"
 #include "fredbuf-rbtree.h"
+#include "fredbuf-regex.h"
+#include "fredbuf-search.h"
+#include "fredbuf-session.h"
+#include "fredbuf-write.h"
 #include "types.h"
 
 #ifndef NDEBUG
@@ -18,15 +25,42 @@
 // that this version is based on immutable data structures to achieve fast undo/redo.
 namespace PieceTree
 {
+    // Revisions are numbered from 1 in commit order.  An id is never reused, not even after the revision was
+    // dropped.
+    enum class RevisionId : size_t { None = 0 };
+
     struct UndoRedoEntry
     {
         RedBlackTree root;
         CharOffset op_offset;
+        // The current revision (see Tree::current_revision) while 'root' was the current root.
+        RevisionId revision = RevisionId::None;
+        // The memory only this entry keeps alive: the nodes of 'root' which the next entry towards the current
+        // root does not share.  Left at zero for the entry at the top of the stack, whose neighbour is the
+        // current root itself and changes with every edit.
+        size_t pinned_bytes = 0;
+    };
+
+    // The newest entry is at the front, entries beyond the history limits are released from the back.
+    using UndoStack = std::deque<UndoRedoEntry>;
+    using RedoStack = std::deque<UndoRedoEntry>;
+
+    // A committed state of the tree.  Revisions form a tree through their parents: committing after an undo
+    // or a checkout starts a branch, and the revisions of the abandoned branch stay available.
+    struct Revision
+    {
+        RevisionId id;
+        // The current revision when this one was committed, None for the first one.
+        RevisionId parent;
+        RedBlackTree root;
+        CharOffset op_offset;
+        // The memory only this revision keeps alive: the nodes of 'root' which the next newer revision does
+        // not share.  Left at zero for the newest revision, whose neighbour is the current root.
+        size_t pinned_bytes = 0;
     };
 
-    // We need the ability to 'release' old entries in this stack.
-    using UndoStack = std::forward_list<UndoRedoEntry>;
-    using RedoStack = std::forward_list<UndoRedoEntry>;
+    // The oldest revision is at the front, the ids are consecutive.
+    using Revisions = std::deque<Revision>;
 
     enum class LineStart : size_t { };
 
@@ -44,23 +78,74 @@ namespace PieceTree
         Line line = { };
     };
 
+    // A buffer restored from a session borrows its content from the mapped session file instead of owning it
+    // ('buffer' and 'line_starts' stay empty then).  Readers go through the accessors below.
+    struct MappedContent
+    {
+        // Keeps the mapping alive, it is shared by every buffer of the session.
+        std::shared_ptr<const void> mapping;
+        const CHAR_T* chars = nullptr;
+        const LineStart* starts = nullptr;
+        const uint64_t* hash_checkpoints = nullptr;
+        size_t length = 0;
+        size_t line_start_count = 0;
+    };
+
     struct CharBuffer
     {
+        // Note: these two only read the pointer, never the size, of 'buffer' and 'line_starts' so that
+        // snapshots can read a mod segment while the tree appends to it.
+        const CHAR_T* chars() const
+        {
+            return mapped.mapping ? mapped.chars : buffer.data();
+        }
+
+        const LineStart* starts() const
+        {
+            return mapped.mapping ? mapped.starts : line_starts.data();
+        }
+
+        size_t length() const
+        {
+            return mapped.mapping ? mapped.length : buffer.size();
+        }
+
+        size_t line_start_count() const
+        {
+            return mapped.mapping ? mapped.line_start_count : line_starts.size();
+        }
+
+        // Only the tree reads these (to hash new pieces), so unlike the content they may be reallocated
+        // while snapshots are alive.
+        const uint64_t* checkpoints() const
+        {
+            return mapped.mapping ? mapped.hash_checkpoints : hash_checkpoints.data();
+        }
+
         std::STRING buffer;
         LineStarts line_starts;
+        HashCheckpoints hash_checkpoints;
+        MappedContent mapped;
     };
 
     using BufferReference = std::shared_ptr<const CharBuffer>;
 
     using Buffers = std::vector<BufferReference>;
 
+    // The text inserted by edits is kept in segments whose storage is reserved up front and never
+    // reallocated.  The tree only ever appends past the end of the last segment, which no existing piece
+    // references, so the segments can be shared with snapshots instead of being copied.
+    using ModSegments = std::vector<std::shared_ptr<CharBuffer>>;
+
+    // Copying a collection only copies two references, the segment list itself is replaced (not modified)
+    // when a new segment is started.
     struct BufferCollection
     {
         const CharBuffer* buffer_at(BufferIndex index) const;
         CharOffset buffer_offset(BufferIndex index, const BufferCursor& cursor) const;
 
-        Buffers orig_buffers;
-        CharBuffer mod_buffer;
+        std::shared_ptr<const Buffers> orig_buffers;
+        std::shared_ptr<const ModSegments> mod_segments;
     };
 
     struct LineRange
@@ -69,15 +154,22 @@ namespace PieceTree
         CharOffset last; // Does not include LF.
     };
 
+    // The line which contains an offset and the offset where that line starts.
+    struct LinePosition
+    {
+        Line line;
+        CharOffset line_start;
+    };
+
     struct UndoRedoResult
     {
         bool success;
         CharOffset op_offset;
     };
 
-    // Owning snapshot owns its own buffer data (performs a lightweight copy) so
-    // that even if the original tree is destroyed, the owning snapshot can still
-    // reference the underlying text.
+    // Owning snapshot shares ownership of the buffer data (only references are copied,
+    // so creating one is O(1)) so that even if the original tree is destroyed or edited,
+    // the owning snapshot can still reference the underlying text.
     class OwningSnapshot;
 
     // Reference snapshot owns no data and is only valid for as long as the original
@@ -88,15 +180,149 @@ namespace PieceTree
     // allows callers to suppress this behavior.
     enum class SuppressHistory : bool { No, Yes };
 
+    // Controls whether the tree records its edits in the edit journal.
+    enum class JournalEdits : bool { No, Yes };
+
+    enum class CoalesceWords : bool { No, Yes };
+
+    // Limits on the undo history.  Zero means no limit.
+    struct HistoryPolicy
+    {
+        // Also limits the number of revisions kept.
+        size_t max_entries = 0;
+        // The memory the undo entries and the revisions may pin (see HistoryMemory).  The oldest revisions are
+        // dropped first, then the oldest undo entries.
+        size_t max_bytes = 0;
+        // Edits (and commits) which follow the previous edit within this interval merge into the undo entry
+        // of the previous edit, as long as they are of the same kind (inserts or removals).
+        std::chrono::milliseconds coalesce_interval = { };
+        // Edits merge into the undo entry of the previous edit until an insert ends a word, i.e. contains
+        // white space or ASCII punctuation.  Combined with an interval both conditions must hold.
+        CoalesceWords coalesce_words = CoalesceWords::No;
+    };
+
+    // The cost of the undo history.  'pinned_bytes' counts the nodes which only the history and the revisions
+    // keep alive, the text lives in append-only buffers shared with snapshots and is not released by dropping
+    // entries.
+    struct HistoryMemory
+    {
+        size_t undo_entries = 0;
+        size_t redo_entries = 0;
+        size_t pinned_bytes = 0;
+    };
+
+    // A position in the form tree-sitter expects (see TSPoint): a 0-based row and the column in code units.
+    struct EditPoint
+    {
+        size_t row = 0;
+        size_t column = 0;
+
+        bool operator==(const EditPoint&) const = default;
+    };
+
+    // An edit in the form tree-sitter expects (see TSInputEdit): the range [start, old_end) was replaced by
+    // [start, new_end).  Records apply in order, each in the coordinates left behind by the previous one.
+    struct EditRecord
+    {
+        CharOffset start;
+        CharOffset old_end;
+        CharOffset new_end;
+        EditPoint start_point;
+        EditPoint old_end_point;
+        EditPoint new_end_point;
+    };
+
+    using EditJournal = std::vector<EditRecord>;
+
+    // One edit of a batch (see Tree::apply_edits): [offset, offset + length) is replaced by 'text'.  Offsets
+    // are in the coordinates of the document before the batch.
+    struct TextEdit
+    {
+        CharOffset offset;
+        Length length;
+        std::STRING_VIEW text;
+    };
+
     struct BufferMeta
     {
         LFCount lf_count = { };
         Length total_content_length = { };
+        ContentHash content_hash = { };
     };
 
     // Indicates whether or not line was missing a CR (e.g. only a '\n' was at the end).
     enum class IncompleteCRLF : bool { No, Yes };
 
+    // Controls how the line break at the end of a line is treated when producing a line view.
+    enum class LineTerminator
+    {
+        // Keep the line break ("\n" or "\r\n") as part of the line.
+        Include,
+        // Drop a trailing '\n'.  A '\r' before it remains part of the line.
+        ExcludeLF,
+        // Drop a trailing '\n' or "\r\n".
+        ExcludeCRLF
+    };
+
+    // A sequence of views into the underlying buffers which, in order, cover the content of a single line.
+    // The views are only valid for as long as the buffers they were produced from are alive and unmodified
+    // in the referenced region (the buffers are append-only so this is true until the tree is destroyed).
+    // Lines which are contained within a single piece (the common case) produce exactly one span and the
+    // view performs no allocation.
+    class LineView
+    {
+    public:
+        using Span = std::STRING_VIEW;
+
+        const Span* begin() const
+        {
+            return spilled.empty() ? inline_spans : spilled.data();
+        }
+
+        const Span* end() const
+        {
+            return begin() + span_count();
+        }
+
+        size_t span_count() const
+        {
+            return spilled.empty() ? inline_count : spilled.size();
+        }
+
+        bool single_span() const
+        {
+            return span_count() == 1;
+        }
+
+        Length length() const
+        {
+            return total_length;
+        }
+
+        bool empty() const
+        {
+            return total_length == Length{};
+        }
+
+        // Appends the line content to 'buf'.
+        void append_to(std::STRING* buf) const;
+
+    private:
+        friend class Tree;
+
+        void push_back(Span span);
+        CHAR_T back() const;
+        void trim_back();
+
+        static constexpr size_t inline_capacity = 4;
+
+        Span inline_spans[inline_capacity];
+        size_t inline_count = 0;
+        // Only populated once the line covers more than 'inline_capacity' pieces.
+        std::vector<Span> spilled;
+        Length total_length = { };
+    };
+
     class Tree
     {
     public:
@@ -110,25 +336,89 @@ namespace PieceTree
         // Manipulation.
         void insert(CharOffset offset, std::STRING_VIEW txt, SuppressHistory suppress_history = SuppressHistory::No);
         void remove(CharOffset offset, Length count, SuppressHistory suppress_history = SuppressHistory::No);
-        UndoRedoResult try_undo(CharOffset op_offset);
-        UndoRedoResult try_redo(CharOffset op_offset);
+        // Applies a batch of edits, e.g. the occurrences of a replace-all, as one undo entry.  The edits are
+        // sorted by offset and do not overlap (inserts at the end of the previous edit are fine).  Returns
+        // false and leaves the tree untouched if they are not sorted, overlap or run past the end.
+        bool apply_edits(std::span<const TextEdit> edits, SuppressHistory suppress_history = SuppressHistory::No);
+        // When 'changes' is given it is populated with the ranges which the undo (or redo) replaced.
+        UndoRedoResult try_undo(CharOffset op_offset, TreeChanges* changes = nullptr);
+        UndoRedoResult try_redo(CharOffset op_offset, TreeChanges* changes = nullptr);
+
+        // Edit journal.  While it is enabled every insert, remove, undo, redo and snap is recorded so that
+        // incremental consumers (e.g. a tree-sitter parse) can be told exactly what changed.
+        void journal_edits(JournalEdits journal);
+        // Moves the recorded edits into 'edits' and clears the journal.
+        void drain_edit_journal(EditJournal* edits);
+
+        // History limits.  A new policy applies right away, entries beyond its limits are dropped oldest first.
+        void set_history_policy(const HistoryPolicy& policy);
+        const HistoryPolicy& history_policy() const;
+        HistoryMemory history_memory() const;
 
         // Direct history manipulation.
         // This will commit the current node to the history.  The offset provided will be the undo point later.
-        void commit_head(CharOffset offset);
+        // Returns the revision which records the committed root.
+        RevisionId commit_head(CharOffset offset);
         RedBlackTree head() const;
         // Snaps the tree back to the specified root.  This needs to be called with a root that is derived from
         // the set of buffers based on its creation.
-        void snap_to(const RedBlackTree& new_root);
+        void snap_to(const RedBlackTree& new_root, TreeChanges* changes = nullptr);
+        // Populates 'changes' with the ranges which differ between two roots derived from this tree.
+        void diff(TreeChanges* changes, const RedBlackTree& from, const RedBlackTree& to) const;
+
+        // Revisions.
+        // Snaps the tree to a revision.  The checkout is recorded like an edit: it can be undone, clears the redo
+        // stack and 'op_offset' is its undo point.  Returns false if the revision does not exist (any more).
+        bool checkout(RevisionId id, CharOffset op_offset, TreeChanges* changes = nullptr);
+        // The revision last committed or checked out on the way to the current root, the root itself may have
+        // been edited since.  Undo and redo move it along with the root.
+        RevisionId current_revision() const;
+        const Revisions& revisions() const;
+        // Null if the revision does not exist (any more).
+        const Revision* find_revision(RevisionId id) const;
+        // Populates 'changes' with the ranges which differ between two revisions.  Returns false if either
+        // does not exist.
+        bool diff_revisions(TreeChanges* changes, RevisionId from, RevisionId to) const;
+
+        // Sessions.
+        // Writes the buffers, the current root, the undo and redo history and the revisions to 'fd'.
+        SessionResult save_session(int fd) const;
+        // Replaces the content and the history of this tree with a session read from 'fd'.  The tree is left
+        // untouched unless the whole session could be read.
+        SessionResult load_session(int fd);
 
         // Queries.
         void get_line_content(std::STRING* buf, Line line) const;
         [[nodiscard]] IncompleteCRLF get_line_content_crlf(std::STRING* buf, Line line) const;
         CHAR_T at(CharOffset offset) const;
         Line line_at(CharOffset offset) const;
+        // The line which contains 'offset' and where that line starts, found in a single descent.
+        LinePosition line_position(CharOffset offset) const;
+        // Where 'line' starts, found in a single descent (get_line_range takes two).
+        CharOffset line_start_offset(Line line) const;
+        // Batch variants, the results are in input order.  Sorted input is cheapest: a lookup which ends in the
+        // same piece as the previous one needs no descent.
+        void line_positions(std::vector<LinePosition>* positions, std::span<const CharOffset> offsets) const;
+        void line_start_offsets(std::vector<CharOffset>* starts, std::span<const Line> lines) const;
         LineRange get_line_range(Line line) const;
         LineRange get_line_range_crlf(Line line) const;
         LineRange get_line_range_with_newline(Line line) const;
+        LineView line_view(Line line, LineTerminator terminator = LineTerminator::ExcludeLF) const;
+
+        // Search.
+        // A forward search finds the first match starting at or after 'from', a backward search finds the last
+        // match ending at or before 'from'.
+        FindResult find(std::STRING_VIEW pattern, CharOffset from, SearchDirection direction = SearchDirection::Forward, SearchOptions options = { }) const;
+        // Populates 'matches' with all non-overlapping matches in document order.
+        void find_all(SearchMatches* matches, std::STRING_VIEW pattern, SearchOptions options = { }) const;
+        // Regular expression searches always run forward from 'from'.  The regex must be valid.
+        FindResult find(const Regex& regex, CharOffset from) const;
+        // Stops after 'max_matches' matches, zero means no limit.
+        void find_all(SearchMatches* matches, const Regex& regex, size_t max_matches = 0) const;
+
+        // Saving.
+        // Writes the text to 'fd' without flattening it.
+        WriteResult write_to(int fd, TextEncoding encoding = TextEncoding::UTF8, LineEndings line_endings = LineEndings::Preserve) const;
 
         Length length() const
         {
@@ -145,6 +435,13 @@ namespace PieceTree
             return meta.lf_count;
         }
 
+        // Equal text has an equal hash no matter how it was edited, so comparing hashes (e.g. with the hash of
+        // the saved state) tells whether the text differs without comparing it.
+        ContentHash content_hash() const
+        {
+            return meta.content_hash;
+        }
+
         Length line_count() const
         {
             return Length{ rep(line_feed_count()) + 1 };
@@ -167,16 +464,33 @@ namespace PieceTree
         using Accumulator = Length(*)(const BufferCollection*, const Piece&, Line);
 
         template <Accumulator accumulate>
-        static void line_start(CharOffset* offset, const BufferCollection* buffers, const RedBlackTree& node, Line line);
-        static void line_end_crlf(CharOffset* offset, const BufferCollection* buffers, const RedBlackTree& root, const RedBlackTree& node, Line line);
+        static void line_start(CharOffset* offset, const BufferCollection* buffers, RedBlackTree::View node, Line line);
+        static void line_end_crlf(CharOffset* offset, const BufferCollection* buffers, RedBlackTree::View root, RedBlackTree::View node, Line line);
         static Length accumulate_value(const BufferCollection* buffers, const Piece& piece, Line index);
         static Length accumulate_value_no_lf(const BufferCollection* buffers, const Piece& piece, Line index);
-        static void populate_from_node(std::STRING* buf, const BufferCollection* buffers, const RedBlackTree& node);
-        static void populate_from_node(std::STRING* buf, const BufferCollection* buffers, const RedBlackTree& node, Line line_index);
+        template <typename TreeT>
+        static LineView build_line_view(const TreeT* tree, const BufferCollection* buffers, RedBlackTree::View root, Line line, LineTerminator terminator);
+        static void populate_from_node(std::STRING* buf, const BufferCollection* buffers, RedBlackTree::View node);
+        static void populate_from_node(std::STRING* buf, const BufferCollection* buffers, RedBlackTree::View node, Line line_index);
         static LFCount line_feed_count(const BufferCollection* buffers, BufferIndex index, const BufferCursor& start, const BufferCursor& end);
-        static NodePosition node_at(const BufferCollection* buffers, RedBlackTree node, CharOffset off);
+        static NodePosition node_at(const BufferCollection* buffers, RedBlackTree::View node, CharOffset off);
+        // The node which the previous lookup of a batch ended in, a lookup which ends in the same node needs no
+        // descent.
+        struct LineCursor
+        {
+            const NodeData* node = nullptr;
+            CharOffset node_start = { };
+            // The line which the node starts in and where that line starts.  Finding the start takes another
+            // descent if the line starts in an earlier subtree, line_position only does that when it needs it.
+            Line node_line = { };
+            CharOffset node_line_start = { };
+            bool node_line_start_known = false;
+        };
+        static LinePosition line_position(const BufferCollection* buffers, RedBlackTree::View root, CharOffset offset, LineCursor* cursor);
+        static CharOffset line_start_offset(const BufferCollection* buffers, RedBlackTree::View root, Line line, LineCursor* cursor);
         static BufferCursor buffer_position(const BufferCollection* buffers, const Piece& piece, Length remainder);
-        static CHAR_T char_at(const BufferCollection* buffers, const RedBlackTree& node, CharOffset offset);
+        static EditPoint edit_point(const BufferCollection* buffers, RedBlackTree::View root, CharOffset offset);
+        static CHAR_T char_at(const BufferCollection* buffers, RedBlackTree::View node, CharOffset offset);
         static Piece trim_piece_right(const BufferCollection* buffers, const Piece& piece, const BufferCursor& pos);
         static Piece trim_piece_left(const BufferCollection* buffers, const Piece& piece, const BufferCursor& pos);
 
@@ -189,16 +503,26 @@ namespace PieceTree
         static ShrinkResult shrink_piece(const BufferCollection* buffers, const Piece& piece, const BufferCursor& first, const BufferCursor& last);
 
         // Direct mutations.
-        void assemble_line(std::STRING* buf, const RedBlackTree& node, Line line) const;
+        void assemble_line(std::STRING* buf, RedBlackTree::View node, Line line) const;
         Piece build_piece(std::STRING_VIEW txt);
+        NodeData node_data(const Piece& piece) const;
+        CharBuffer* mod_segment_for(size_t length, size_t new_line_starts);
         void combine_pieces(NodePosition existing_piece, Piece new_piece);
         void remove_node_range(NodePosition first, Length length);
+        RedBlackTree rebuild_with_edits(std::span<const TextEdit> edits);
         void compute_buffer_meta();
-        void append_undo(const RedBlackTree& old_root, CharOffset op_offset);
+        void switch_root(const RedBlackTree& new_root, TreeChanges* changes);
+        void journal_changes(const RedBlackTree& old_root, const TreeChanges& changes);
+        // What recorded an undo entry, edits of different kinds never coalesce.
+        enum class HistoryEdit { Insert, Remove, Commit };
+
+        void append_undo(const RedBlackTree& old_root, CharOffset op_offset, HistoryEdit edit);
+        bool history_group_ended() const;
+        void note_history_edit(HistoryEdit edit, std::STRING_VIEW inserted);
+        void prune_history();
+        void measure_history();
 
         BufferCollection buffers;
-        //Buffers buffers;
-        //CharBuffer mod_buffer;
         PieceTree::RedBlackTree root;
         LineStarts scratch_starts;
         BufferCursor last_insert;
@@ -207,6 +531,23 @@ namespace PieceTree
         BufferMeta meta;
         UndoStack undo_stack;
         RedoStack redo_stack;
+        HistoryPolicy policy;
+        // The sums of 'pinned_bytes' of the entries of each stack.
+        size_t undo_pinned_bytes = 0;
+        size_t redo_pinned_bytes = 0;
+        Revisions revision_list;
+        // The sum of 'pinned_bytes' of the revisions.
+        size_t revision_pinned_bytes = 0;
+        RevisionId head_revision = RevisionId::None;
+        RevisionId next_revision = RevisionId{ 1 };
+        // Whether the next edit may merge into the undo entry at the top, i.e. no undo, redo or snap happened
+        // since it was recorded, and the kind of the edits in it.
+        bool history_group_open = false;
+        HistoryEdit history_group_edit = HistoryEdit::Commit;
+        bool history_word_ended = false;
+        std::chrono::steady_clock::time_point last_history_edit = { };
+        JournalEdits journal = JournalEdits::No;
+        EditJournal edit_journal;
     };
 
     class OwningSnapshot
@@ -219,9 +560,30 @@ namespace PieceTree
         void get_line_content(std::STRING* buf, Line line) const;
         [[nodiscard]] IncompleteCRLF get_line_content_crlf(std::STRING* buf, Line line) const;
         Line line_at(CharOffset offset) const;
+        LinePosition line_position(CharOffset offset) const;
+        CharOffset line_start_offset(Line line) const;
+        void line_positions(std::vector<LinePosition>* positions, std::span<const CharOffset> offsets) const;
+        void line_start_offsets(std::vector<CharOffset>* starts, std::span<const Line> lines) const;
         LineRange get_line_range(Line line) const;
         LineRange get_line_range_crlf(Line line) const;
         LineRange get_line_range_with_newline(Line line) const;
+        LineView line_view(Line line, LineTerminator terminator = LineTerminator::ExcludeLF) const;
+
+        // Search.
+        FindResult find(std::STRING_VIEW pattern, CharOffset from, SearchDirection direction = SearchDirection::Forward, SearchOptions options = { }) const;
+        void find_all(SearchMatches* matches, std::STRING_VIEW pattern, SearchOptions options = { }) const;
+        FindResult find(const Regex& regex, CharOffset from) const;
+        void find_all(SearchMatches* matches, const Regex& regex, size_t max_matches = 0) const;
+
+        // Saving.
+        // Writes the text to 'fd' without flattening it.
+        WriteResult write_to(int fd, TextEncoding encoding = TextEncoding::UTF8, LineEndings line_endings = LineEndings::Preserve) const;
+
+        Length length() const
+        {
+            return meta.total_content_length;
+        }
+
         bool is_empty() const
         {
             return meta.total_content_length == Length{};
@@ -231,9 +593,15 @@ namespace PieceTree
         {
             return Length{ rep(meta.lf_count) + 1 };
         }
+
+        ContentHash content_hash() const
+        {
+            return meta.content_hash;
+        }
     private:
         friend class TreeWalker;
         friend class ReverseTreeWalker;
+        friend void diff(TreeChanges* changes, const OwningSnapshot& from, const OwningSnapshot& to);
 
         RedBlackTree root;
         BufferMeta meta;
@@ -252,9 +620,30 @@ namespace PieceTree
         void get_line_content(std::STRING* buf, Line line) const;
         [[nodiscard]] IncompleteCRLF get_line_content_crlf(std::STRING* buf, Line line) const;
         Line line_at(CharOffset offset) const;
+        LinePosition line_position(CharOffset offset) const;
+        CharOffset line_start_offset(Line line) const;
+        void line_positions(std::vector<LinePosition>* positions, std::span<const CharOffset> offsets) const;
+        void line_start_offsets(std::vector<CharOffset>* starts, std::span<const Line> lines) const;
         LineRange get_line_range(Line line) const;
         LineRange get_line_range_crlf(Line line) const;
         LineRange get_line_range_with_newline(Line line) const;
+        LineView line_view(Line line, LineTerminator terminator = LineTerminator::ExcludeLF) const;
+
+        // Search.
+        FindResult find(std::STRING_VIEW pattern, CharOffset from, SearchDirection direction = SearchDirection::Forward, SearchOptions options = { }) const;
+        void find_all(SearchMatches* matches, std::STRING_VIEW pattern, SearchOptions options = { }) const;
+        FindResult find(const Regex& regex, CharOffset from) const;
+        void find_all(SearchMatches* matches, const Regex& regex, size_t max_matches = 0) const;
+
+        // Saving.
+        // Writes the text to 'fd' without flattening it.
+        WriteResult write_to(int fd, TextEncoding encoding = TextEncoding::UTF8, LineEndings line_endings = LineEndings::Preserve) const;
+
+        Length length() const
+        {
+            return meta.total_content_length;
+        }
+
         bool is_empty() const
         {
             return meta.total_content_length == Length{};
@@ -264,6 +653,11 @@ namespace PieceTree
         {
             return Length{ rep(meta.lf_count) + 1 };
         }
+
+        ContentHash content_hash() const
+        {
+            return meta.content_hash;
+        }
     private:
         friend class TreeWalker;
         friend class ReverseTreeWalker;
@@ -309,6 +703,9 @@ namespace PieceTree
         {
             return total_offset;
         }
+        // Returns the remaining content of the current piece and advances the walker past it.  An empty
+        // view is returned once the walker is exhausted.
+        std::STRING_VIEW next_span();
 
         // For Iterator-like behavior.
         TreeWalker& operator++()
@@ -326,9 +723,10 @@ namespace PieceTree
 
         enum class Direction { Left, Center, Right };
 
+        // The nodes are kept alive by 'root'.
         struct StackEntry
         {
-            PieceTree::RedBlackTree node;
+            RedBlackTree::View node;
             Direction dir = Direction::Left;
         };
 
@@ -358,6 +756,9 @@ namespace PieceTree
         {
             return total_offset;
         }
+        // Returns the content of the current piece which precedes the walker and moves the walker before
+        // it.  An empty view is returned once the walker is exhausted.
+        std::STRING_VIEW next_span();
 
         // For Iterator-like behavior.
         ReverseTreeWalker& operator++()
@@ -375,9 +776,10 @@ namespace PieceTree
 
         enum class Direction { Left, Center, Right };
 
+        // The nodes are kept alive by 'root'.
         struct StackEntry
         {
-            PieceTree::RedBlackTree node;
+            RedBlackTree::View node;
             Direction dir = Direction::Right;
         };
 
@@ -31,12 +31,74 @@ typedef enum {
     CRLF_TYPE = 1,
 } CRLF_ENUM_t;
 
+typedef enum {
+    /// UTF-8
+    UTF8_FILE_ENCODING = 0,
+    /// UTF-16 little endian, without byte order mark
+    UTF16LE_FILE_ENCODING = 1,
+} FileEncoding_t;
+
+typedef enum {
+    /// Keep the line breaks as they are
+    KEEP_LINE_ENDINGS = 0,
+    /// Write `CRLF` line breaks as `LF`
+    LF_LINE_ENDINGS = 1,
+    /// Write `LF` line breaks as `CRLF`
+    CRLF_LINE_ENDINGS = 2,
+} LineEndings_t;
+
 typedef struct {
     BOOL is_success;
     UnRedoID_t id;
 } UnRedoResult_t;
 
+typedef struct {
+    /// The maximum number of undo entries, `0` means no limit.
+    size_t maxEntries;
+    /// The maximum number of bytes the undo entries and the revisions may keep alive, `0` means no limit. The oldest revisions are dropped first, then the oldest undo entries.
+    size_t maxBytes;
+    /// Edits which follow each other within this many seconds are undone together, `0` turns this off.
+    double coalesceInterval;
+    /// Edits are undone together until an inserted word ends.
+    BOOL coalesceWords;
+} HistoryPolicy_t;
+
+typedef struct {
+    size_t undoCount;
+    size_t redoCount;
+    /// The bytes which only the undo and redo history and the revisions keep alive.
+    size_t pinnedBytes;
+} HistoryMemory_t;
+
 NS_ASSUME_NONNULL_BEGIN
+/// A search running on background threads.
+@interface PieceTreeSearchTask: NSObject
+/// Stop the search. No batch is delivered after this returns. Must not be called from the batch handler, return `NO` from the handler instead.
+- (void)cancel;
+/// Block until the search has finished or was cancelled. Returns `NO` if it was cancelled.
+- (BOOL)waitUntilFinished;
+@end
+
+/// An immutable version of a storage. All methods may be called from any thread.
+@interface PieceTreeSnapshot: NSObject
+/// The version of the storage, versions are numbered in the order of the edits starting from `0`.
+@property (nonatomic, readonly) uint64_t version;
+/// The number of `UTF-16` code units contained in the snapshot.
+@property (nonatomic, readonly) Length_t length;
+/// The number of lines contained in the snapshot.
+@property (nonatomic, readonly) Length_t lineCount;
+/// A hash of the text. Equal text has an equal hash, no matter how it was edited.
+@property (nonatomic, readonly) uint64_t contentHash;
+/// The string corresponding to the snapshot.
+@property (nonatomic, readonly) NSString *string;
+/// Get the line number where a specific `UTF-16` code unit index is located.
+- (Index_t)getLineIndexAtIndex: (Index_t)index;
+/// Get the string corresponding to a specific line number using the `LF` line break method.
+- (NSString *)getLFLineContentAtLineIndex: (size_t)lineIndex;
+/// Write the text to a file, see `-[PieceTreeStorage writeToPath:encoding:lineEndings:]`.
+- (BOOL)writeToPath: (nonnull NSString*)path encoding: (FileEncoding_t)encoding lineEndings: (LineEndings_t)lineEndings;
+@end
+
 @interface PieceTreeStorage: NSObject
 /// Always return `UTF-16` LE encoding.
 @property (nonatomic, readonly) NSStringEncoding usedEncoding;
@@ -46,6 +108,8 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, readonly) Length_t length;
 /// The number of lines contained in the current class.
 @property (nonatomic, readonly) Length_t lineCount;
+/// A hash of the text, maintained by every edit. Equal text has an equal hash, no matter how it was edited, so comparing it with the hash of the saved text tells whether the document is dirty.
+@property (nonatomic, readonly) uint64_t contentHash;
 /// The string corresponding to the current class.
 @property (nonatomic, readonly) NSString *string;
 /// Initiate with a `NSString` object.
@@ -57,6 +121,10 @@ NS_ASSUME_NONNULL_BEGIN
 - (void)insertString: (nonnull NSString*)string atOffset: (Index_t)offset;
 /// Remove the code unit at the specified `UTF-16` code unit index.
 - (void)removeAtIndex: (Index_t)index withLength: (Index_t)length;
+/// Replace several `UTF-16` code unit ranges at once, e.g. all matches of a search. The ranges refer to the text before the replacement, are sorted by location and do not overlap.
+///
+/// The replacement is a single edit with a single undo entry. Returns `NO` and leaves the text untouched if the ranges are not sorted, overlap or are out of range.
+- (BOOL)replaceRanges: (nonnull NSArray<NSValue *> *)ranges withStrings: (nonnull NSArray<NSString *> *)strings;
 /// Get the string corresponding to a specific line number using the `LF` line break method.
 - (NSString *)getLFLineContentAtLineIndex: (size_t)lineIndex;
 /// Get the string corresponding to a specific line number using the `CRLF` line break method.
@@ -67,14 +135,74 @@ NS_ASSUME_NONNULL_BEGIN
 - (char_t)getCodeUnitAtIndex: (Index_t)index;
 /// Get the line range corresponding to a specific line number and break line mode.
 - (NSRange)getLineRangeAtLineIndex: (Index_t)lineIndex withCRFLType: (CRLF_ENUM_t)type withActualCRFLType: (nullable CRLF_Type_t*)actualType;
+/// Take a snapshot of the latest edit.
+///
+/// This is the only method which may be called from other threads while the storage is being edited. It never waits for an edit in progress and costs a few atomic operations, the text is shared with the storage.
+- (PieceTreeSnapshot *)snapshot;
+/// Save the text together with the undo and redo history to a session file.
+///
+/// The session is written to a temporary file which is then renamed over `path`, so a storage which has loaded the old file keeps working.
+- (BOOL)saveSessionToPath: (nonnull NSString*)path;
+/// Replace the text and the undo and redo history with a session saved by `saveSessionToPath:`. Returns `NO` and leaves the storage untouched if the file is not a valid session.
+///
+/// The text is not copied, the storage reads it from the mapped file. The file must not be modified while it is loaded, replace it instead.
+- (BOOL)loadSessionFromPath: (nonnull NSString*)path;
+/// Write the text to a file.
+///
+/// The text is streamed from the storage without building a string, the memory used does not depend on its length. The file is written to a temporary file which is then renamed over `path`, so `path` never holds a partially written file.
+- (BOOL)writeToPath: (nonnull NSString*)path encoding: (FileEncoding_t)encoding lineEndings: (LineEndings_t)lineEndings;
+/// Limits on the undo history. Setting a policy drops the oldest undo entries beyond its limits right away.
+@property (nonatomic) HistoryPolicy_t historyPolicy;
+/// The cost of the undo and redo history.
+@property (nonatomic, readonly) HistoryMemory_t historyMemory;
 /// Commit current state to undo and redo stack.
 - (void)quickCommitState;
+/// Commit current state to undo and redo stack and record it as a new revision. Returns the id of the revision.
+///
+/// Revisions are kept when later edits start a new branch of the history, until `historyPolicy.maxEntries` or `historyPolicy.maxBytes` drops the oldest ones.
+- (UnRedoID_t)commitState;
+/// Execute undo. A nonzero `id` checks out that revision instead, see `checkoutRevisionWithID:`.
+///
+/// The `id` of the result is the current revision afterwards.
+- (UnRedoResult_t)undoWithID: (UnRedoID_t)id;
+/// Execute redo. A nonzero `id` checks out that revision instead, see `checkoutRevisionWithID:`.
+///
+/// The `id` of the result is the current revision afterwards.
+- (UnRedoResult_t)redoWithID: (UnRedoID_t)id;
+/// Replace the text with a revision in constant time. The checkout can be undone like an edit and clears the redo stack. Fails if the revision does not exist or was dropped.
+- (UnRedoResult_t)checkoutRevisionWithID: (UnRedoID_t)id;
+/// The revision last committed or checked out, `0` if there is none. The text may have been edited since.
+@property (nonatomic, readonly) UnRedoID_t currentRevisionID;
+/// The ids of the revisions which are kept, the oldest first.
+@property (nonatomic, readonly) NSArray<NSNumber *> *revisionIDs;
+/// The revision which was current when the revision was committed, `0` if there is none or the revision does not exist.
+- (UnRedoID_t)parentOfRevisionWithID: (UnRedoID_t)id;
+/// A snapshot of the text of a revision, `nil` if the revision does not exist. Its `version` is the current version of the storage.
+- (nullable PieceTreeSnapshot *)snapshotOfRevisionWithID: (UnRedoID_t)id;
 /// Execute undo.
 - (UnRedoResult_t)quickUndo;
 /// Execute redo.
 - (UnRedoResult_t)quickRedo;
 /// Enumerate all `UTF-16` code units within the specified `UTF-16` code unit index range.
 - (void)enumerateCodeUnitWithRange: (NSRange)range usingBlock: (BOOL (^)(Index_t index, char_t unit_char))block;
+/// Find a string without materializing the document.
+///
+/// A forward search returns the first match starting at or after `index`, a backward search returns the last match ending at or before `index`. The `location` of the returned range is `NSNotFound` when there is no match. Case insensitive searches only fold ASCII letters.
+- (NSRange)findString: (nonnull NSString*)pattern fromIndex: (Index_t)index backwards: (BOOL)backwards caseSensitive: (BOOL)caseSensitive;
+/// Find all non-overlapping occurrences of a string, in document order.
+- (NSArray<NSValue *> *)findAllString: (nonnull NSString*)pattern caseSensitive: (BOOL)caseSensitive;
+/// Find all non-overlapping occurrences of a string on background threads.
+///
+/// The search runs on a snapshot, later edits do not affect it. The matches are handed to `batchHandler` in document order and in batches, one batch at a time on a background thread. Returning `NO` from the handler cancels the search. `completionHandler` is called once at the end with `YES` if every match was delivered.
+- (PieceTreeSearchTask*)findAllStringConcurrently: (nonnull NSString*)pattern caseSensitive: (BOOL)caseSensitive batchHandler: (BOOL (^)(NSArray<NSValue *> *batch))batchHandler completionHandler: (void (^)(BOOL finished))completionHandler;
+/// Returns the offset into the pattern at which a regular expression fails to compile, or `-1` if the pattern is valid.
++ (NSInteger)errorOffsetOfRegularExpression: (nonnull NSString*)pattern;
+/// Find the first match of a regular expression which starts at or after `index`. The pattern must be valid.
+///
+/// The `location` of the returned range is `NSNotFound` when there is no match. `^` and `$` always match at line boundaries.
+- (NSRange)findRegularExpression: (nonnull NSString*)pattern fromIndex: (Index_t)index caseSensitive: (BOOL)caseSensitive;
+/// Find the non-overlapping matches of a regular expression in document order, at most `limit` matches are returned when `limit` is not zero. The pattern must be valid.
+- (NSArray<NSValue *> *)findAllRegularExpression: (nonnull NSString*)pattern caseSensitive: (BOOL)caseSensitive limit: (Index_t)limit;
 #ifdef TEXTBUF_UTF16
 /// Get the composed character range corresponding to the `UTF-16` code unit at the specified index.
 - (NSRange)rangeOfComposedCharacterSequenceAtIndex: (Index_t)index;
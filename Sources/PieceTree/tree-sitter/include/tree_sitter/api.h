@@ -85,6 +85,16 @@ typedef struct {
   void (*log)(void *payload, TSLogType log_type, const char *buffer);
 } TSLogger;
 
+typedef struct {
+  uint64_t subtree_allocations;
+  uint64_t subtree_pool_hits;
+  uint64_t subtree_cache_hits;
+  uint64_t stack_node_allocations;
+  uint64_t stack_node_pool_hits;
+  uint64_t stack_node_cache_hits;
+  uint32_t peak_live_stack_nodes;
+} TSParserStats;
+
 typedef struct {
   uint32_t start_byte;
   uint32_t old_end_byte;
@@ -319,6 +329,35 @@ void ts_parser_set_timeout_micros(TSParser *self, uint64_t timeout_micros);
  */
 uint64_t ts_parser_timeout_micros(const TSParser *self);
 
+/**
+ * Set how many released objects of the most frequently allocated kinds the
+ * parser keeps for reuse: the heap data of leaf nodes (32 by default) and the
+ * nodes of its parse stack (50 by default).
+ */
+void ts_parser_set_pool_capacity(
+  TSParser *self,
+  uint32_t subtree_capacity,
+  uint32_t stack_node_capacity
+);
+
+/**
+ * Get the allocation counters of the parser, accumulated over its parses
+ * since it was created or since the last call to [`ts_parser_reset_stats`].
+ *
+ * For leaf nodes and stack nodes, the number of allocations and how many of
+ * them were served by the parser's own pool and by the thread cache (see
+ * [`ts_set_thread_cache_capacity`]), the rest went to the allocator. The
+ * internal nodes of the syntax tree vary in size and are not counted. The
+ * peak of live stack nodes is the deepest the parse stack has been, over all
+ * its versions.
+ */
+void ts_parser_stats(const TSParser *self, TSParserStats *stats);
+
+/**
+ * Reset the allocation counters of the parser.
+ */
+void ts_parser_reset_stats(TSParser *self);
+
 /**
  * Set the parser's current cancellation flag pointer.
  *
@@ -1235,6 +1274,24 @@ void ts_set_allocator(
 	void (*new_free)(void *)
 );
 
+/**
+ * Set how many free objects of each fixed-size kind (leaf nodes and parse
+ * stack nodes) every thread keeps in its own cache. It is 0 by default, so
+ * there is no cache. With a cache, the objects which a parser's pool has no
+ * room for and the leaves of deleted trees wait there for the next parse on
+ * the same thread, whichever parser runs it.
+ *
+ * Set it before parsing on other threads. A thread which used the cache
+ * should call [`ts_thread_cache_flush`] before it exits and before the
+ * allocator changes, otherwise the objects in its cache are leaked.
+ */
+void ts_set_thread_cache_capacity(uint32_t capacity);
+
+/**
+ * Free the objects in the calling thread's cache.
+ */
+void ts_thread_cache_flush(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,6 +1,13 @@
 #include "alloc.h"
+#include "atomic.h"
 #include <stdlib.h>
 
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TS_THREAD_LOCAL __declspec(thread)
+#else
+#define TS_THREAD_LOCAL _Thread_local
+#endif
+
 static void *ts_malloc_default(size_t size) {
   void *result = malloc(size);
   if (size > 0 && !result) {
@@ -45,3 +52,52 @@ void ts_set_allocator(
   ts_current_realloc = new_realloc ? new_realloc : ts_realloc_default;
   ts_current_free = new_free ? new_free : free;
 }
+
+// Thread cache
+
+typedef struct TSFreeBlock {
+  struct TSFreeBlock *next;
+} TSFreeBlock;
+
+typedef struct {
+  TSFreeBlock *head;
+  size_t size;
+} TSBlockCache;
+
+static volatile size_t ts_thread_cache_capacity = 0;
+static TS_THREAD_LOCAL TSBlockCache ts_thread_caches[TSBlockCacheKindCount];
+
+void ts_set_thread_cache_capacity(uint32_t capacity) {
+  ts_thread_cache_capacity = capacity;
+}
+
+void *ts_block_cache_pop(TSBlockCacheKind kind) {
+  TSBlockCache *cache = &ts_thread_caches[kind];
+  TSFreeBlock *block = cache->head;
+  if (!block) return NULL;
+  cache->head = block->next;
+  cache->size--;
+  return block;
+}
+
+bool ts_block_cache_push(TSBlockCacheKind kind, void *block) {
+  TSBlockCache *cache = &ts_thread_caches[kind];
+  if (cache->size >= atomic_load(&ts_thread_cache_capacity)) return false;
+  TSFreeBlock *free_block = block;
+  free_block->next = cache->head;
+  cache->head = free_block;
+  cache->size++;
+  return true;
+}
+
+void ts_thread_cache_flush(void) {
+  for (unsigned i = 0; i < TSBlockCacheKindCount; i++) {
+    TSBlockCache *cache = &ts_thread_caches[i];
+    while (cache->head) {
+      TSFreeBlock *block = cache->head;
+      cache->head = block->next;
+      ts_free(block);
+    }
+    cache->size = 0;
+  }
+}
@@ -30,6 +30,18 @@ extern void (*ts_current_free)(void *);
 #define ts_free    ts_current_free
 #endif
 
+// Free blocks of the fixed-size objects which a parse allocates and releases
+// most, kept per thread when `ts_set_thread_cache_capacity` enabled it. The
+// blocks come from `ts_malloc`, so a block may be freed by any thread.
+typedef enum {
+  TSBlockCacheSubtree,
+  TSBlockCacheStackNode,
+  TSBlockCacheKindCount,
+} TSBlockCacheKind;
+
+void *ts_block_cache_pop(TSBlockCacheKind kind);
+bool ts_block_cache_push(TSBlockCacheKind kind, void *block);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include "./lexer.h"
 #include "./subtree.h"
 #include "./length.h"
@@ -68,6 +69,44 @@ static void ts_lexer__get_chunk(Lexer *self) {
   }
 }
 
+// Decode a surrogate pair whose trailing surrogate is not in the current chunk,
+// because the input hands out the text in several spans (e.g. the pieces of a
+// piece table) and the pair was split between two of them. The lexer moves on
+// to the chunk which holds the trailing surrogate.
+static void ts_lexer__get_split_surrogate_pair(Lexer *self, uint16_t lead) {
+  self->lookahead_size = 2;
+  self->data.lookahead = lead;
+
+  const TSRange *current_range = &self->included_ranges[self->current_included_range_index];
+  uint32_t next_byte = self->current_position.bytes + 2;
+  if (next_byte >= current_range->end_byte) return;
+
+  TSPoint next_point = {
+    self->current_position.extent.row,
+    self->current_position.extent.column + 2,
+  };
+  uint32_t next_size = 0;
+  const char *next_chunk = self->input.read(
+    self->input.payload,
+    next_byte,
+    next_point,
+    &next_size
+  );
+  if (!next_size) return;
+
+  self->chunk = next_chunk;
+  self->chunk_start = next_byte;
+  self->chunk_size = next_size;
+  if (next_size >= 2) {
+    uint16_t trail;
+    memcpy(&trail, next_chunk, sizeof(trail));
+    if (U16_IS_TRAIL(trail)) {
+      self->lookahead_size = 4;
+      self->data.lookahead = U16_GET_SUPPLEMENTARY(lead, trail);
+    }
+  }
+}
+
 // Decode the next unicode character in the current chunk of source code.
 // This assumes that the lexer has already retrieved a chunk of source
 // code that spans the current position.
@@ -82,6 +121,29 @@ static void ts_lexer__get_lookahead(Lexer *self) {
   }
 
   const uint8_t *chunk = (const uint8_t *)self->chunk + position_in_chunk;
+
+  // Most characters are ASCII, or in UTF16 are a single code unit outside of
+  // the surrogates, and decode to themselves.
+  if (self->input.encoding == TSInputEncodingUTF16) {
+    if (size >= 2) {
+      uint16_t unit;
+      memcpy(&unit, chunk, sizeof(unit));
+      if (unit < 0xD800 || unit > 0xDFFF) {
+        self->lookahead_size = 2;
+        self->data.lookahead = unit;
+        return;
+      }
+      if (U16_IS_LEAD(unit) && size < 4) {
+        ts_lexer__get_split_surrogate_pair(self, unit);
+        return;
+      }
+    }
+  } else if (chunk[0] < 0x80) {
+    self->lookahead_size = 1;
+    self->data.lookahead = chunk[0];
+    return;
+  }
+
   UnicodeDecodeFunction decode = self->input.encoding == TSInputEncodingUTF8
     ? ts_decode_utf8
     : ts_decode_utf16;
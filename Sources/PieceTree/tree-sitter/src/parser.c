@@ -1919,6 +1919,29 @@ const size_t *ts_parser_cancellation_flag(const TSParser *self) {
   return (const size_t *)self->cancellation_flag;
 }
 
+void ts_parser_set_pool_capacity(
+  TSParser *self,
+  uint32_t subtree_capacity,
+  uint32_t stack_node_capacity
+) {
+  ts_subtree_pool_set_capacity(&self->tree_pool, subtree_capacity);
+  ts_stack_set_node_pool_capacity(self->stack, stack_node_capacity);
+}
+
+void ts_parser_stats(const TSParser *self, TSParserStats *stats) {
+  stats->subtree_allocations = self->tree_pool.allocation_count;
+  stats->subtree_pool_hits = self->tree_pool.pool_hit_count;
+  stats->subtree_cache_hits = self->tree_pool.cache_hit_count;
+  ts_stack_node_pool_stats(self->stack, stats);
+}
+
+void ts_parser_reset_stats(TSParser *self) {
+  self->tree_pool.allocation_count = 0;
+  self->tree_pool.pool_hit_count = 0;
+  self->tree_pool.cache_hit_count = 0;
+  ts_stack_reset_node_pool_stats(self->stack);
+}
+
 void ts_parser_set_cancellation_flag(TSParser *self, const size_t *flag) {
   self->cancellation_flag = (const volatile size_t *)flag;
 }
@@ -45,6 +45,16 @@ typedef struct {
 
 typedef Array(StackNode *) StackNodeArray;
 
+typedef struct {
+  StackNodeArray free_nodes;
+  uint32_t capacity;
+  uint32_t live_count;
+  uint32_t peak_live_count;
+  uint64_t allocation_count;
+  uint64_t pool_hit_count;
+  uint64_t cache_hit_count;
+} StackNodePool;
+
 typedef enum {
   StackStatusActive,
   StackStatusPaused,
@@ -64,7 +74,7 @@ struct Stack {
   Array(StackHead) heads;
   StackSliceArray slices;
   Array(StackIterator) iterators;
-  StackNodeArray node_pool;
+  StackNodePool node_pool;
   StackNode *base_node;
   SubtreePool *subtree_pool;
 };
@@ -88,7 +98,7 @@ static void stack_node_retain(StackNode *self) {
 
 static void stack_node_release(
   StackNode *self,
-  StackNodeArray *pool,
+  StackNodePool *pool,
   SubtreePool *subtree_pool
 ) {
 recur:
@@ -108,9 +118,10 @@ recur:
     first_predecessor = self->links[0].node;
   }
 
-  if (pool->size < MAX_NODE_POOL_SIZE) {
-    array_push(pool, self);
-  } else {
+  pool->live_count--;
+  if (pool->free_nodes.size < pool->capacity) {
+    array_push(&pool->free_nodes, self);
+  } else if (!ts_block_cache_push(TSBlockCacheStackNode, self)) {
     ts_free(self);
   }
 
@@ -139,11 +150,21 @@ static StackNode *stack_node_new(
   Subtree subtree,
   bool is_pending,
   TSStateId state,
-  StackNodeArray *pool
+  StackNodePool *pool
 ) {
-  StackNode *node = pool->size > 0
-    ? array_pop(pool)
-    : ts_malloc(sizeof(StackNode));
+  StackNode *node;
+  pool->allocation_count++;
+  if (pool->free_nodes.size > 0) {
+    pool->pool_hit_count++;
+    node = array_pop(&pool->free_nodes);
+  } else if ((node = ts_block_cache_pop(TSBlockCacheStackNode))) {
+    pool->cache_hit_count++;
+  } else {
+    node = ts_malloc(sizeof(StackNode));
+  }
+  if (++pool->live_count > pool->peak_live_count) {
+    pool->peak_live_count = pool->live_count;
+  }
   *node = (StackNode) {
     .ref_count = 1,
     .link_count = 0,
@@ -263,7 +284,7 @@ static void stack_node_add_link(
 
 static void stack_head_delete(
   StackHead *self,
-  StackNodeArray *pool,
+  StackNodePool *pool,
   SubtreePool *subtree_pool
 ) {
   if (self->node) {
@@ -422,11 +443,12 @@ Stack *ts_stack_new(SubtreePool *subtree_pool) {
   array_init(&self->heads);
   array_init(&self->slices);
   array_init(&self->iterators);
-  array_init(&self->node_pool);
+  array_init(&self->node_pool.free_nodes);
   array_reserve(&self->heads, 4);
   array_reserve(&self->slices, 4);
   array_reserve(&self->iterators, 4);
-  array_reserve(&self->node_pool, MAX_NODE_POOL_SIZE);
+  array_reserve(&self->node_pool.free_nodes, MAX_NODE_POOL_SIZE);
+  self->node_pool.capacity = MAX_NODE_POOL_SIZE;
 
   self->subtree_pool = subtree_pool;
   self->base_node = stack_node_new(NULL, NULL_SUBTREE, false, 1, &self->node_pool);
@@ -445,15 +467,40 @@ void ts_stack_delete(Stack *self) {
     stack_head_delete(&self->heads.contents[i], &self->node_pool, self->subtree_pool);
   }
   array_clear(&self->heads);
-  if (self->node_pool.contents) {
-    for (uint32_t i = 0; i < self->node_pool.size; i++)
-      ts_free(self->node_pool.contents[i]);
-    array_delete(&self->node_pool);
+  if (self->node_pool.free_nodes.contents) {
+    for (uint32_t i = 0; i < self->node_pool.free_nodes.size; i++)
+      ts_free(self->node_pool.free_nodes.contents[i]);
+    array_delete(&self->node_pool.free_nodes);
   }
   array_delete(&self->heads);
   ts_free(self);
 }
 
+void ts_stack_set_node_pool_capacity(Stack *self, uint32_t capacity) {
+  StackNodePool *pool = &self->node_pool;
+  while (pool->free_nodes.size > capacity) {
+    StackNode *node = array_pop(&pool->free_nodes);
+    if (!ts_block_cache_push(TSBlockCacheStackNode, node)) ts_free(node);
+  }
+  pool->capacity = capacity;
+}
+
+void ts_stack_node_pool_stats(const Stack *self, TSParserStats *stats) {
+  const StackNodePool *pool = &self->node_pool;
+  stats->stack_node_allocations = pool->allocation_count;
+  stats->stack_node_pool_hits = pool->pool_hit_count;
+  stats->stack_node_cache_hits = pool->cache_hit_count;
+  stats->peak_live_stack_nodes = pool->peak_live_count;
+}
+
+void ts_stack_reset_node_pool_stats(Stack *self) {
+  StackNodePool *pool = &self->node_pool;
+  pool->allocation_count = 0;
+  pool->pool_hit_count = 0;
+  pool->cache_hit_count = 0;
+  pool->peak_live_count = pool->live_count;
+}
+
 uint32_t ts_stack_version_count(const Stack *self) {
   return self->heads.size;
 }
@@ -34,6 +34,15 @@ Stack *ts_stack_new(SubtreePool *);
 // Release the memory reserved for a given stack.
 void ts_stack_delete(Stack *);
 
+// Set the number of released nodes which the stack keeps for reuse.
+void ts_stack_set_node_pool_capacity(Stack *, uint32_t);
+
+// Get the node allocation counters of the stack.
+void ts_stack_node_pool_stats(const Stack *, TSParserStats *);
+
+// Reset the node allocation counters of the stack.
+void ts_stack_reset_node_pool_stats(Stack *);
+
 // Get the stack's current number of versions.
 uint32_t ts_stack_version_count(const Stack *);
 
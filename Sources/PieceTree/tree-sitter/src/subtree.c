@@ -20,7 +20,6 @@ typedef struct {
 } Edit;
 
 #define TS_MAX_INLINE_TREE_LENGTH UINT8_MAX
-#define TS_MAX_TREE_POOL_SIZE 32
 
 // ExternalScannerState
 
@@ -119,11 +118,26 @@ void ts_subtree_array_reverse(SubtreeArray *self) {
 // SubtreePool
 
 SubtreePool ts_subtree_pool_new(uint32_t capacity) {
-  SubtreePool self = {array_new(), array_new()};
+  SubtreePool self = {
+    .free_trees = array_new(),
+    .tree_stack = array_new(),
+    .capacity = capacity,
+  };
   array_reserve(&self.free_trees, capacity);
   return self;
 }
 
+static void ts_subtree_pool_free_block(SubtreeHeapData *tree) {
+  if (!ts_block_cache_push(TSBlockCacheSubtree, tree)) ts_free(tree);
+}
+
+void ts_subtree_pool_set_capacity(SubtreePool *self, uint32_t capacity) {
+  while (self->free_trees.size > capacity) {
+    ts_subtree_pool_free_block(array_pop(&self->free_trees).ptr);
+  }
+  self->capacity = capacity;
+}
+
 void ts_subtree_pool_delete(SubtreePool *self) {
   if (self->free_trees.contents) {
     for (unsigned i = 0; i < self->free_trees.size; i++) {
@@ -135,18 +149,26 @@ void ts_subtree_pool_delete(SubtreePool *self) {
 }
 
 static SubtreeHeapData *ts_subtree_pool_allocate(SubtreePool *self) {
+  self->allocation_count++;
   if (self->free_trees.size > 0) {
+    self->pool_hit_count++;
     return array_pop(&self->free_trees).ptr;
-  } else {
-    return ts_malloc(sizeof(SubtreeHeapData));
   }
+  SubtreeHeapData *tree = ts_block_cache_pop(TSBlockCacheSubtree);
+  if (tree) {
+    self->cache_hit_count++;
+    return tree;
+  }
+  return ts_malloc(sizeof(SubtreeHeapData));
 }
 
+// Leaves which the pool has no room for go to the thread cache, so the leaves
+// of a tree which is deleted between parses are there for the next parse.
 static void ts_subtree_pool_free(SubtreePool *self, SubtreeHeapData *tree) {
-  if (self->free_trees.capacity > 0 && self->free_trees.size + 1 <= TS_MAX_TREE_POOL_SIZE) {
+  if (self->free_trees.size < self->capacity) {
     array_push(&self->free_trees, (MutableSubtree) {.ptr = tree});
   } else {
-    ts_free(tree);
+    ts_subtree_pool_free_block(tree);
   }
 }
 
@@ -171,6 +171,10 @@ typedef Array(MutableSubtree) MutableSubtreeArray;
 typedef struct {
   MutableSubtreeArray free_trees;
   MutableSubtreeArray tree_stack;
+  uint32_t capacity;
+  uint64_t allocation_count;
+  uint64_t pool_hit_count;
+  uint64_t cache_hit_count;
 } SubtreePool;
 
 void ts_external_scanner_state_init(ExternalScannerState *, const char *, unsigned);
@@ -185,6 +189,7 @@ void ts_subtree_array_remove_trailing_extras(SubtreeArray *, SubtreeArray *);
 void ts_subtree_array_reverse(SubtreeArray *);
 
 SubtreePool ts_subtree_pool_new(uint32_t capacity);
+void ts_subtree_pool_set_capacity(SubtreePool *, uint32_t capacity);
 void ts_subtree_pool_delete(SubtreePool *);
 
 Subtree ts_subtree_new_leaf(
@@ -39,7 +39,7 @@ static inline uint32_t ts_decode_utf16(
   int32_t *code_point
 ) {
   uint32_t i = 0;
-  U16_NEXT(((uint16_t *)string), i, length, *code_point);
+  U16_NEXT(((uint16_t *)string), i, length / 2, *code_point);
   return i * 2;
 }
 
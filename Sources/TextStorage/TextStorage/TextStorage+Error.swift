@@ -32,5 +32,39 @@ extension TextStorage {
         /// - Parameter lineRange: 越界的行编号范围。
         /// - Parameter lineCount: 当前文本存储中所含有的行的总数。
         case lineRangeOutOfRange(lineRange: ClosedRange<Int>, lineCount: Int)
+        /// 编码单元的范围互相重叠
+        ///
+        /// - Parameter first: 重叠的两个范围中靠前的一个。
+        /// - Parameter second: 重叠的两个范围中靠后的一个。
+        case overlappingRanges(first: Range<Int>, second: Range<Int>)
+    }
+    
+    /// 本类可能抛出的所有查找模式错误
+    public enum PatternError: Error {
+        /// 正则表达式无法被编译
+        ///
+        /// - Parameter pattern: 无法被编译的正则表达式。
+        /// - Parameter offset: 编译失败的位置在正则表达式中的编码单元索引。
+        case invalidRegularExpression(pattern: String, offset: Int)
+    }
+    
+    /// 本类可能抛出的所有会话文件错误
+    public enum SessionError: Error {
+        /// 会话文件无法被写入
+        ///
+        /// - Parameter url: 会话文件的路径。
+        case cannotWriteSession(url: URL)
+        /// 会话文件无法被读取，或者不是有效的会话文件
+        ///
+        /// - Parameter url: 会话文件的路径。
+        case cannotReadSession(url: URL)
+    }
+    
+    /// 本类可能抛出的所有文件写入错误
+    public enum WriteError: Error {
+        /// 文件无法被写入
+        ///
+        /// - Parameter url: 文件的路径。
+        case cannotWriteFile(url: URL)
     }
 }
@@ -0,0 +1,143 @@
+//
+//  TextStorage+History.swift
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+import Foundation
+@_implementationOnly import PieceTree
+
+@available(iOS 13.0, macOS 12.0, *)
+extension TextStorage {
+
+    /// 撤销历史的限制
+    ///
+    /// 每条撤销记录都会保留一个旧版本的文本存储，默认情况下撤销记录的个数不受限制。
+    public struct HistoryPolicy {
+        /// 撤销记录的最大个数，`nil` 表示不限制。超出限制时最早的记录将被丢弃。
+        public var maxEntries: Int?
+        /// 撤销记录与修订版本最多可以占用的内存字节数，`nil` 表示不限制。超出限制时先丢弃最早的修订版本，再丢弃最早的撤销记录。
+        public var maxBytes: Int?
+        /// 相邻两次编辑（或者保存状态）的间隔小于该时间（单位为秒）时，两者合并为一次撤销。`0` 表示不按时间合并。
+        ///
+        /// 插入与删除不会被合并为一次撤销。
+        public var coalesceInterval: TimeInterval
+        /// 是否将连续的编辑合并为一次撤销，直到插入的文本结束了一个单词（即含有空白字符或者 ASCII 标点符号）
+        ///
+        /// 与 `coalesceInterval` 同时设置时，两个条件都满足才会合并。
+        public var coalescesWords: Bool
+
+        public init(maxEntries: Int? = nil, maxBytes: Int? = nil, coalesceInterval: TimeInterval = 0, coalescesWords: Bool = false) {
+            self.maxEntries = maxEntries
+            self.maxBytes = maxBytes
+            self.coalesceInterval = coalesceInterval
+            self.coalescesWords = coalescesWords
+        }
+    }
+
+    /// 撤销与重做历史的开销
+    public struct HistoryMemory {
+        /// 撤销记录的个数
+        public let undoCount: Int
+        /// 重做记录的个数
+        public let redoCount: Int
+        /// 仅被撤销与重做历史以及修订版本保留的内存字节数
+        ///
+        /// 编辑插入的文本保存在只增不减的缓冲区中，丢弃撤销记录不会释放这些文本，因此这里不统计文本本身。
+        public let pinnedBytes: Int
+    }
+
+    /// 撤销历史的限制
+    ///
+    /// 设置新的限制后，超出限制的最早的撤销记录会被立即丢弃。
+    public var historyPolicy: HistoryPolicy {
+        get {
+            let policy = self.pieceTree.historyPolicy
+            return HistoryPolicy(maxEntries: policy.maxEntries == 0 ? nil : policy.maxEntries,
+                                 maxBytes: policy.maxBytes == 0 ? nil : policy.maxBytes,
+                                 coalesceInterval: policy.coalesceInterval,
+                                 coalescesWords: policy.coalesceWords.boolValue)
+        }
+        set {
+            self.pieceTree.historyPolicy = HistoryPolicy_t(maxEntries: max(newValue.maxEntries ?? 0, 0),
+                                                           maxBytes: max(newValue.maxBytes ?? 0, 0),
+                                                           coalesceInterval: max(newValue.coalesceInterval, 0),
+                                                           coalesceWords: ObjCBool(newValue.coalescesWords))
+        }
+    }
+
+    /// 撤销与重做历史的开销
+    ///
+    /// > 时间复杂度与最近一次编辑所修改的节点个数有关，与文本长度无关。
+    public var historyMemory: HistoryMemory {
+        let memory = self.pieceTree.historyMemory
+        return HistoryMemory(undoCount: memory.undoCount, redoCount: memory.redoCount, pinnedBytes: memory.pinnedBytes)
+    }
+}
+
+//MARK: - Revisions
+
+@available(iOS 13.0, macOS 12.0, *)
+extension TextStorage {
+
+    /// 通过 `commitState()` 保存的修订版本
+    ///
+    /// 修订版本按照保存的先后顺序从 `1` 开始编号。在撤销之后保存状态会开始一个新的分支，原有分支上的修订版本仍然被保留，直到超出 `historyPolicy.maxEntries` 或者 `historyPolicy.maxBytes` 的限制而被丢弃。
+    public struct Revision: Hashable {
+        /// 修订版本的编号
+        public let id: Int
+        /// 保存该修订版本时的当前修订版本的编号，`nil` 表示不存在
+        public let parentID: Int?
+    }
+
+    /// 所有被保留的修订版本，按照编号从小到大排列
+    ///
+    /// > 时间复杂度关于修订版本的个数为 `O(n)`。
+    public var revisions: [Revision] {
+        return self.pieceTree.revisionIDs.map { number in
+            let id = number.intValue
+            let parentID = self.pieceTree.parentOfRevision(withID: id)
+            return Revision(id: id, parentID: parentID == 0 ? nil : parentID)
+        }
+    }
+
+    /// 最近一次保存或者切换到的修订版本的编号，`nil` 表示不存在
+    ///
+    /// 撤销与重做会同时改变当前修订版本。此后文本可能已经被编辑过。
+    public var currentRevisionID: Int? {
+        let id = self.pieceTree.currentRevisionID
+        return id == 0 ? nil : id
+    }
+
+    /// 将文本切换到指定的修订版本
+    ///
+    /// 切换可以像编辑一样被撤销，并且会清空重做记录。
+    ///
+    /// > 时间复杂度为 `O(1)`。
+    ///
+    /// - Parameter id: 修订版本的编号。
+    /// - Returns: 返回是否切换成功，修订版本不存在或者已被丢弃时返回 `false`。
+    @discardableResult
+    public func checkout(revision id: Int) -> Bool {
+        guard id > 0 else {
+            return false
+        }
+        return self.pieceTree.checkoutRevision(withID: id).is_success.boolValue
+    }
+
+    /// 获取指定修订版本的快照
+    ///
+    /// 不需要切换到该修订版本即可读取其文本，因此可以用于浏览撤销历史。
+    ///
+    /// > 时间复杂度为 `O(1)`。
+    ///
+    /// - Parameter id: 修订版本的编号。
+    /// - Returns: 返回修订版本的快照，修订版本不存在或者已被丢弃时返回 `nil`。
+    public func snapshot(ofRevision id: Int) -> Snapshot? {
+        guard id > 0, let snapshot = self.pieceTree.snapshotOfRevision(withID: id) else {
+            return nil
+        }
+        return Snapshot(snapshot)
+    }
+}
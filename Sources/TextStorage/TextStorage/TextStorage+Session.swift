@@ -0,0 +1,55 @@
+//
+//  TextStorage+Session.swift
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+import Foundation
+@_implementationOnly import PieceTree
+
+@available(iOS 13.0, macOS 12.0, *)
+extension TextStorage {
+
+    /// 使用会话文件初始化当前类
+    ///
+    /// 会话文件由 `saveSession(to:)` 方法保存，初始化后文本与撤销、重做历史均与保存时相同。
+    ///
+    /// > 文本不会被复制，而是直接从映射到内存的会话文件中读取，因此加载的耗时几乎与文本长度无关。会话文件在加载之后不能被修改，只能被替换。
+    ///
+    /// > 当前方法仅在会话文件无法被读取或者无效时抛出 `SessionError` 错误。
+    ///
+    /// - Parameter url: 会话文件的路径。
+    public convenience init(sessionContentsOf url: URL) throws {
+        self.init()
+        try self.loadSession(from: url)
+    }
+
+    /// 将文本与撤销、重做历史保存为会话文件
+    ///
+    /// 会话文件保存了文本存储的内部结构（包括所有撤销与重做的版本，各版本共享的部分只保存一次），加载时无需重新扫描文本。会话文件会先被写入临时文件，再替换 `url` 处的文件。
+    ///
+    /// > 时间复杂度为 `O(n)`。
+    ///
+    /// > 当前方法仅在会话文件无法被写入时抛出 `SessionError` 错误。
+    ///
+    /// - Parameter url: 会话文件的路径。
+    public func saveSession(to url: URL) throws {
+        guard self.pieceTree.saveSession(toPath: url.path) else {
+            throw TextStorage.SessionError.cannotWriteSession(url: url)
+        }
+    }
+
+    /// 加载会话文件，替换当前的文本与撤销、重做历史
+    ///
+    /// 会话文件无效时当前文本存储保持不变。
+    ///
+    /// > 当前方法仅在会话文件无法被读取或者无效时抛出 `SessionError` 错误。
+    ///
+    /// - Parameter url: 会话文件的路径。
+    public func loadSession(from url: URL) throws {
+        guard self.pieceTree.loadSession(fromPath: url.path) else {
+            throw TextStorage.SessionError.cannotReadSession(url: url)
+        }
+    }
+}
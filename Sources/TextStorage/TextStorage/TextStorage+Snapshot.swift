@@ -0,0 +1,99 @@
+//
+//  TextStorage+Snapshot.swift
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+import Foundation
+@_implementationOnly import PieceTree
+
+@available(iOS 13.0, macOS 12.0, *)
+extension TextStorage {
+
+    /// 文本存储在某次编辑之后的不可变版本
+    ///
+    /// 快照与文本存储共享文本数据，获取快照不会复制文本。快照的所有属性与方法都可以在任意线程中调用，之后对文本存储的修改不会影响已经获取的快照。
+    public final class Snapshot: @unchecked Sendable {
+
+        let pieceTreeSnapshot: PieceTreeSnapshot
+
+        init(_ pieceTreeSnapshot: PieceTreeSnapshot) {
+            self.pieceTreeSnapshot = pieceTreeSnapshot
+        }
+
+        /// 快照的版本号
+        ///
+        /// 文本存储的初始状态的版本号为 `0`，每次编辑（包括成功的撤销与重做）之后版本号加一。
+        public var version: UInt64 {
+            self.pieceTreeSnapshot.version
+        }
+
+        /// 快照所含有的 `UTF-16` 编码单元的个数
+        ///
+        /// > 访问此属性的时间复杂度为 `O(1)`。
+        public var length: Int {
+            self.pieceTreeSnapshot.length
+        }
+
+        /// 快照所含有的行的总数
+        ///
+        /// > 访问此属性的时间复杂度为 `O(1)`。
+        public var lineCount: Int {
+            self.pieceTreeSnapshot.lineCount
+        }
+
+        /// 快照所存储的文本的哈希值
+        ///
+        /// 与 `TextStorage.contentHash` 相同，相同的文本总是具有相同的哈希值。
+        ///
+        /// > 访问此属性的时间复杂度为 `O(1)`。
+        public var contentHash: UInt64 {
+            self.pieceTreeSnapshot.contentHash
+        }
+
+        /// 快照中存储的字符串
+        ///
+        /// > 调用本属性的时间复杂度是 `O(n)`。
+        public var string: String {
+            self.pieceTreeSnapshot.string
+        }
+
+        /// 获取某个编码单元所在的行的编号
+        ///
+        /// 行的编号从 `1` 开始。
+        ///
+        /// > 时间复杂度为关于快照的编码单元总数的 `O(log n)`。
+        ///
+        /// > 当前方法仅在指标越界时抛出 `IndexError` 错误。
+        public func lineIndex(at position: Int) throws -> Int {
+            guard position >= 0 && position < self.length else {
+                throw TextStorage.IndexError.codeUnitIndexOutOfRange(unitIndex: position, totalRange: 0..<self.length)
+            }
+            return self.pieceTreeSnapshot.getLineIndex(at: position)
+        }
+
+        /// 获取指定行的内容（不含末尾的 `\n`）
+        ///
+        /// > 时间复杂度为关于快照的编码单元总数的 `O(log n)`。
+        ///
+        /// > 当前方法仅在行编号越界时抛出 `IndexError` 错误。
+        public func lineContent(lineIndex: Int) throws -> String {
+            guard lineIndex >= 1 && lineIndex <= self.lineCount else {
+                throw TextStorage.IndexError.lineIndexOutOfRange(lineIndex: lineIndex, lineCount: self.lineCount)
+            }
+            return self.pieceTreeSnapshot.getLFLineContent(atLineIndex: lineIndex)
+        }
+    }
+
+    /// 获取当前文本存储最近一次编辑之后的快照
+    ///
+    /// 这是当前类唯一可以在其他线程中调用的方法：当前类在自己的线程中被编辑时，其他线程（例如渲染、语法分析与查找线程）可以随时获取快照并在快照上读取文本，获取快照不会等待正在进行的编辑。
+    ///
+    /// > 时间复杂度为 `O(1)`。
+    ///
+    /// - Returns: 返回最近一次编辑之后的快照。
+    public func snapshot() -> Snapshot {
+        Snapshot(self.pieceTree.snapshot())
+    }
+}
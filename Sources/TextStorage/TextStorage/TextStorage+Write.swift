@@ -0,0 +1,93 @@
+//
+//  TextStorage+Write.swift
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+import Foundation
+@_implementationOnly import PieceTree
+
+@available(iOS 13.0, macOS 12.0, *)
+extension TextStorage {
+
+    /// 将文本写入文件时使用的编码方式
+    public enum FileEncoding {
+        /// UTF-8 编码标准
+        ///
+        /// 文本中无法配对的 UTF-16 代理项将被写为 `U+FFFD`。
+        case utf8
+        /// 小端序的 UTF-16 编码标准，不写入字节顺序标记（BOM）
+        case utf16LittleEndian
+
+        var bridge: FileEncoding_t {
+            switch self {
+            case .utf8:
+                return UTF8_FILE_ENCODING
+            case .utf16LittleEndian:
+                return UTF16LE_FILE_ENCODING
+            }
+        }
+    }
+
+    /// 将文本写入文件时对换行符的处理方式
+    public enum LineEndingPolicy {
+        /// 保持文本中的换行符不变
+        case preserve
+        /// 将 `\r\n` 换行符写为 `\n`
+        ///
+        /// 单独的 `\r` 不是换行符，保持不变。
+        case lf
+        /// 将不跟在 `\r` 之后的 `\n` 换行符写为 `\r\n`
+        case crlf
+
+        var bridge: LineEndings_t {
+            switch self {
+            case .preserve:
+                return KEEP_LINE_ENDINGS
+            case .lf:
+                return LF_LINE_ENDINGS
+            case .crlf:
+                return CRLF_LINE_ENDINGS
+            }
+        }
+    }
+
+    /// 将文本写入文件
+    ///
+    /// 文本直接从文本存储的内部结构中流式写出，不会构造完整的字符串，所使用的内存与文本长度无关。文本会先被写入临时文件，再替换 `url` 处的文件，因此 `url` 处永远不会出现写入了一半的文件。
+    ///
+    /// > 时间复杂度为 `O(n)`。
+    ///
+    /// > 当前方法仅在文件无法被写入时抛出 `WriteError` 错误。
+    ///
+    /// - Parameter url: 文件的路径。
+    /// - Parameter encoding: 文件的编码方式。
+    /// - Parameter lineEndings: 对换行符的处理方式。
+    public func write(to url: URL, encoding: FileEncoding = .utf8, lineEndings: LineEndingPolicy = .preserve) throws {
+        guard self.pieceTree.write(toPath: url.path, encoding: encoding.bridge, lineEndings: lineEndings.bridge) else {
+            throw TextStorage.WriteError.cannotWriteFile(url: url)
+        }
+    }
+}
+
+@available(iOS 13.0, macOS 12.0, *)
+extension TextStorage.Snapshot {
+
+    /// 将快照的文本写入文件
+    ///
+    /// 与 `TextStorage.write(to:encoding:lineEndings:)` 相同，但可以在任意线程中调用，因此可以在后台线程中保存文档而不阻塞编辑。
+    ///
+    /// > 时间复杂度为 `O(n)`。
+    ///
+    /// > 当前方法仅在文件无法被写入时抛出 `WriteError` 错误。
+    ///
+    /// - Parameter url: 文件的路径。
+    /// - Parameter encoding: 文件的编码方式。
+    /// - Parameter lineEndings: 对换行符的处理方式。
+    public func write(to url: URL, encoding: TextStorage.FileEncoding = .utf8, lineEndings: TextStorage.LineEndingPolicy = .preserve) throws {
+        guard self.pieceTreeSnapshot.write(toPath: url.path, encoding: encoding.bridge, lineEndings: lineEndings.bridge) else {
+            throw TextStorage.WriteError.cannotWriteFile(url: url)
+        }
+    }
+}
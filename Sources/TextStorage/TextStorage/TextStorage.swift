@@ -110,6 +110,15 @@ public class TextStorage: TextStorageProvider {
         self.pieceTree.lineCount
     }
     
+    /// 当前类存储的文本的哈希值
+    ///
+    /// 相同的文本总是具有相同的哈希值，与文本经过怎样的编辑得到无关。将其与保存时记录的哈希值比较即可判断文档是否被修改（例如编辑后又撤销回保存时的状态，文档不被视为已修改）。
+    ///
+    /// > 访问此属性的时间复杂度为 `O(1)`，哈希值在每次编辑时以 `O(log n)` 的代价维护。
+    public var contentHash: UInt64 {
+        self.pieceTree.contentHash
+    }
+    
     /// 当前文本存储类支持的编码方式
     ///
     /// 当前仅支持 UTF-16 编码标准。这是因为当前类的使用者一般会想要使用 CoreText 框架绘制文本，使用 UTF-16 编码格式将更方便 CoreText 框架的使用。
@@ -336,14 +345,206 @@ extension TextStorage {
 }
 
 
+//MARK: - Search APIs
+
+@available(iOS 13.0, macOS 12.0, *)
+extension TextStorage {
+    
+    /// 查找指定文本在当前文本存储中出现的编码单元范围
+    ///
+    /// 查找直接在 PieceTree 的各个片段上进行，不会生成整个文本存储的字符串，跨越多个片段的匹配同样能够被找到。
+    ///
+    /// > 时间复杂度关于当前文本存储中所含编码单元的个数为 `O(n)`。
+    ///
+    /// - Parameter text: 想要查找的文本。该值为空字符串时总是返回 `nil`。
+    /// - Parameter position: 查找的起始编码单元索引，默认值为 `0`。正向查找时返回起始位置不小于该值的第一个匹配，逆向查找时返回结束位置不大于该值的最后一个匹配。
+    /// - Parameter backwards: 是否逆向查找，默认值为 `false`。
+    /// - Parameter caseSensitive: 是否区分大小写，默认值为 `true`。值为 `false` 时仅忽略 ASCII 字母的大小写。
+    /// - Returns: 返回匹配的编码单元范围，没有匹配时返回 `nil`。
+    ///
+    /// > 当前方法仅在指标越界时抛出 `IndexError` 错误。如果你完全确保参数对应的索引不越界，可以考虑使用 `try!` 语法。
+    public func find(_ text: String, from position: Int = 0, backwards: Bool = false, caseSensitive: Bool = true) throws -> Range<Int>? {
+        guard position >= 0 && position <= self.length else {
+            throw Self.IndexError.codeUnitIndexOutOfRange(unitIndex: position, totalRange: 0..<self.length)
+        }
+        let range = self.pieceTree.findString(text, from: position, backwards: backwards, caseSensitive: caseSensitive)
+        guard range.location != NSNotFound else {
+            return nil
+        }
+        return range.lowerBound..<range.upperBound
+    }
+    
+    /// 查找指定文本在当前文本存储中出现的所有编码单元范围
+    ///
+    /// 返回的范围互不重叠，并按照在文本存储中出现的先后顺序排列。
+    ///
+    /// > 时间复杂度关于当前文本存储中所含编码单元的个数为 `O(n)`。
+    ///
+    /// - Parameter text: 想要查找的文本。该值为空字符串时总是返回空数组。
+    /// - Parameter caseSensitive: 是否区分大小写，默认值为 `true`。值为 `false` 时仅忽略 ASCII 字母的大小写。
+    /// - Returns: 返回所有匹配的编码单元范围。
+    public func findAll(_ text: String, caseSensitive: Bool = true) -> [Range<Int>] {
+        self.pieceTree.findAllString(text, caseSensitive: caseSensitive).map { value in
+            let range = value.rangeValue
+            return range.lowerBound..<range.upperBound
+        }
+    }
+    
+    /// 在后台线程中并行查找指定文本在当前文本存储中出现的所有编码单元范围
+    ///
+    /// 查找在调用时的文本快照上进行，之后对文本存储的修改不会影响查找结果。文本会被划分为若干区间并在多个线程上同时查找，匹配结果按照在文本存储中出现的先后顺序分批返回，所有批次合并后与 `findAll(_:caseSensitive:)` 的结果相同。
+    ///
+    /// 停止迭代返回的异步序列即可取消查找。
+    ///
+    /// - Parameter text: 想要查找的文本。该值为空字符串时序列不会返回任何批次。
+    /// - Parameter caseSensitive: 是否区分大小写，默认值为 `true`。值为 `false` 时仅忽略 ASCII 字母的大小写。
+    /// - Returns: 返回一个异步序列，序列的每个元素为一批按顺序排列的匹配范围。
+    public func findAllConcurrently(_ text: String, caseSensitive: Bool = true) -> AsyncStream<[Range<Int>]> {
+        AsyncStream { continuation in
+            let task = self.pieceTree.findAllStringConcurrently(text, caseSensitive: caseSensitive, batchHandler: { batch in
+                let ranges = batch.map { value in
+                    let range = value.rangeValue
+                    return range.lowerBound..<range.upperBound
+                }
+                if case .terminated = continuation.yield(ranges) {
+                    return false
+                }
+                return true
+            }, completionHandler: { _ in
+                continuation.finish()
+            })
+            continuation.onTermination = { _ in
+                task.cancel()
+            }
+        }
+    }
+    
+    /// 查找正则表达式在当前文本存储中的第一个匹配
+    ///
+    /// 正则表达式直接在 PieceTree 的各个片段上流式执行，不会生成整个文本存储的字符串。支持的语法为 ECMAScript 正则表达式的常用子集（字符、字符类、分组、选择、贪婪与非贪婪量词、`^`、`$`、`\b` 与 `\B`），其中 `^` 与 `$` 总是匹配行的开头与结尾。
+    ///
+    /// > 时间复杂度关于当前文本存储中所含编码单元的个数为 `O(n)`。
+    ///
+    /// - Parameter pattern: 正则表达式。
+    /// - Parameter position: 查找的起始编码单元索引，默认值为 `0`。返回起始位置不小于该值的第一个匹配。
+    /// - Parameter caseSensitive: 是否区分大小写，默认值为 `true`。值为 `false` 时仅忽略 ASCII 字母的大小写。
+    /// - Returns: 返回匹配的编码单元范围，没有匹配时返回 `nil`。
+    ///
+    /// > 当前方法在指标越界时抛出 `IndexError` 错误，在正则表达式无法被编译时抛出 `PatternError` 错误。
+    public func find(regularExpression pattern: String, from position: Int = 0, caseSensitive: Bool = true) throws -> Range<Int>? {
+        guard position >= 0 && position <= self.length else {
+            throw Self.IndexError.codeUnitIndexOutOfRange(unitIndex: position, totalRange: 0..<self.length)
+        }
+        try Self.validateRegularExpression(pattern)
+        let range = self.pieceTree.findRegularExpression(pattern, from: position, caseSensitive: caseSensitive)
+        guard range.location != NSNotFound else {
+            return nil
+        }
+        return range.lowerBound..<range.upperBound
+    }
+    
+    /// 查找正则表达式在当前文本存储中的所有匹配
+    ///
+    /// 返回的范围互不重叠，并按照在文本存储中出现的先后顺序排列。
+    ///
+    /// > 时间复杂度关于当前文本存储中所含编码单元的个数为 `O(n)`。
+    ///
+    /// - Parameter pattern: 正则表达式。
+    /// - Parameter caseSensitive: 是否区分大小写，默认值为 `true`。值为 `false` 时仅忽略 ASCII 字母的大小写。
+    /// - Parameter limit: 最多返回的匹配的个数，默认值为 `nil`，表示不限制个数。找到足够的匹配后查找会立即停止。
+    /// - Returns: 返回所有匹配的编码单元范围。
+    ///
+    /// > 当前方法仅在正则表达式无法被编译时抛出 `PatternError` 错误。
+    public func findAll(regularExpression pattern: String, caseSensitive: Bool = true, limit: Int? = nil) throws -> [Range<Int>] {
+        try Self.validateRegularExpression(pattern)
+        if let limit, limit <= 0 {
+            return []
+        }
+        return self.pieceTree.findAllRegularExpression(pattern, caseSensitive: caseSensitive, limit: limit ?? 0).map { value in
+            let range = value.rangeValue
+            return range.lowerBound..<range.upperBound
+        }
+    }
+    
+    private static func validateRegularExpression(_ pattern: String) throws {
+        let offset = PieceTreeStorage.errorOffset(ofRegularExpression: pattern)
+        guard offset < 0 else {
+            throw Self.PatternError.invalidRegularExpression(pattern: pattern, offset: offset)
+        }
+    }
+}
+
+//MARK: - Batch Edit APIs
+
+@available(iOS 13.0, macOS 12.0, *)
+extension TextStorage {
+    
+    /// 一次性替换多个编码单元范围内的文本
+    ///
+    /// 所有范围都是替换之前的文本中的范围，它们不需要排序，但是不能互相重叠。起点相同的空范围按照参数中的先后顺序插入，并且位于以该位置为起点的非空范围的替换文本之前。所有替换在一次遍历中完成，并且只产生一条撤销记录，适用于多光标编辑、全部替换以及格式化等一次修改大量位置的场景。
+    ///
+    /// 此方法以编码单元为单位进行替换，不会扩展到组合字符的边界。
+    ///
+    /// > 时间复杂度关于替换的个数 `k` 与文本存储中的片段个数 `p` 为 `O(min(k log p, p + k))`，关于插入文本的总长度为 `O(m)`。
+    ///
+    /// - Parameter replacements: 想要替换的编码单元范围以及用于替换的文本。
+    ///
+    /// > 当前方法仅在范围越界或者互相重叠时抛出 `IndexError` 错误。
+    public func replace(_ replacements: [(range: Range<Int>, text: String)]) throws {
+        // Insertions go before a range which starts at the same location.
+        let sorted = replacements.enumerated().sorted { lhs, rhs in
+            (lhs.element.range.lowerBound, lhs.element.range.isEmpty ? 0 : 1, lhs.offset) < (rhs.element.range.lowerBound, rhs.element.range.isEmpty ? 0 : 1, rhs.offset)
+        }.map(\.element)
+        var previous: Range<Int>? = nil
+        for replacement in sorted {
+            let range = replacement.range
+            guard range.lowerBound >= 0 && range.upperBound <= self.length else {
+                throw Self.IndexError.codeUnitRangeOutOfRange(unitRange: range, totalRange: 0..<self.length)
+            }
+            if let previous, range.lowerBound < previous.upperBound {
+                throw Self.IndexError.overlappingRanges(first: previous, second: range)
+            }
+            previous = range
+        }
+        let success = self.pieceTree.replaceRanges(sorted.map { NSValue(range: NSRange($0.range)) }, withStrings: sorted.map(\.text))
+        assert(success)
+    }
+    
+    /// 将指定文本在当前文本存储中的所有出现替换为另一段文本
+    ///
+    /// 所有替换只产生一条撤销记录，参见 `replace(_:)`。
+    ///
+    /// > 时间复杂度关于当前文本存储中所含编码单元的个数为 `O(n)`。
+    ///
+    /// - Parameter text: 想要查找的文本。
+    /// - Parameter replacement: 用于替换的文本。
+    /// - Parameter caseSensitive: 是否区分大小写，默认值为 `true`。值为 `false` 时仅忽略 ASCII 字母的大小写。
+    /// - Returns: 返回被替换的出现的个数。
+    @discardableResult
+    public func replaceAll(_ text: String, with replacement: String, caseSensitive: Bool = true) -> Int {
+        let ranges = self.findAll(text, caseSensitive: caseSensitive)
+        guard !ranges.isEmpty else {
+            return 0
+        }
+        let success = self.pieceTree.replaceRanges(ranges.map { NSValue(range: NSRange($0)) }, withStrings: Array(repeating: replacement, count: ranges.count))
+        assert(success)
+        return ranges.count
+    }
+}
+
 //MARK: - Undo And Redo APIs
 
 @available(iOS 13.0, macOS 12.0, *)
 extension TextStorage {
     
     /// 保存当前的状态以供撤销或者重做
-    public func commitState() {
-        self.pieceTree.quickCommitState()
+    ///
+    /// 保存的状态同时被记录为一个新的修订版本，可以通过 `checkout(revision:)` 随时回到该版本，参见 `revisions`。
+    ///
+    /// - Returns: 返回新的修订版本的编号。
+    @discardableResult
+    public func commitState() -> Int {
+        return self.pieceTree.commitState()
     }
     
     /// 撤销到最近的上一个保存的状态
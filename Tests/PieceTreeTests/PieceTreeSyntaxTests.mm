@@ -0,0 +1,589 @@
+//
+//  PieceTreeSyntaxTests.mm
+//
+//
+//  Created by mc-public on 2026/10/18.
+//
+
+#if DEBUG
+#import <XCTest/XCTest.h>
+#import <chrono>
+#import <condition_variable>
+#import <mutex>
+#import <random>
+#import <span>
+#import <string>
+
+#import "../../Sources/PieceTree/fredbuf/fredbuf-highlighter.h"
+#import "../../Sources/PieceTree/fredbuf/fredbuf-injections.h"
+#import "../../Sources/PieceTree/fredbuf/fredbuf-parse-service.h"
+#import "../../Sources/PieceTree/fredbuf/fredbuf-query.h"
+#import "../../Sources/PieceTree/fredbuf/fredbuf-structure.h"
+
+using namespace PieceTree;
+
+extern "C" const TSLanguage *tree_sitter_c(void);
+
+namespace
+{
+    const std::STRING_VIEW edit_texts[] = { u"int ", u"x", u" = 1", u";", u"\n", u"\r\n", u"{", u"}", u"(", u")",
+                                            u"/* c */", u"// c\n", u"\"s\"", u"#define M 2\n", u"ab", u"😀" };
+
+    std::STRING sample_source()
+    {
+        return u"#include <stdio.h>\n"
+               u"// sample\r\n"
+               u"static int count = 0;\n"
+               u"int main(int argc, char **argv) {\n"
+               u"    for (int i = 0; i < argc; i++) { count += i; }\n"
+               u"    printf(\"%d\\n\", count); /* 😀 */\n"
+               u"    return 0;\n"
+               u"}\n";
+    }
+
+    TSTree* parse(TSParser* parser, const OwningSnapshot& snapshot, TSTree* old_tree)
+    {
+        fredbuf_snapshot_input input = { &snapshot, nullptr, 0, { } };
+        TSTree* tree = ts_parser_parse(parser, old_tree, fredbuf_load_snapshot_ts_input(&input));
+        fredbuf_snapshot_input_free(&input);
+        return tree;
+    }
+
+    // Every node with its type, bytes and points, in document order.
+    std::string describe(const TSTree* tree)
+    {
+        std::string result;
+        TSTreeCursor cursor = ts_tree_cursor_new(ts_tree_root_node(tree));
+        for (bool more = true; more;)
+        {
+            TSNode node = ts_tree_cursor_current_node(&cursor);
+            TSPoint start = ts_node_start_point(node);
+            TSPoint end = ts_node_end_point(node);
+            result += std::string{ ts_node_type(node) } + (ts_node_is_missing(node) ? "!" : "")
+                      + "[" + std::to_string(ts_node_start_byte(node)) + "," + std::to_string(ts_node_end_byte(node))
+                      + ")(" + std::to_string(start.row) + ":" + std::to_string(start.column)
+                      + "-" + std::to_string(end.row) + ":" + std::to_string(end.column) + ") ";
+            if (ts_tree_cursor_goto_first_child(&cursor))
+                continue;
+            while (not ts_tree_cursor_goto_next_sibling(&cursor))
+            {
+                if (not ts_tree_cursor_goto_parent(&cursor))
+                {
+                    more = false;
+                    break;
+                }
+            }
+        }
+        ts_tree_cursor_delete(&cursor);
+        return result;
+    }
+
+    // Makes a random insert, removal or undo.
+    void random_edit(Tree* tree, std::mt19937* random)
+    {
+        size_t length = rep(tree->length());
+        switch ((*random)() % 8)
+        {
+        case 0:
+            tree->try_undo(CharOffset{ });
+            return;
+        case 1:
+        case 2:
+        case 3:
+            if (length != 0)
+            {
+                size_t offset = (*random)() % length;
+                tree->remove(CharOffset{ offset }, Length{ std::min<size_t>(1 + (*random)() % 12, length - offset) });
+                return;
+            }
+            [[fallthrough]];
+        default:
+            tree->insert(CharOffset{ (*random)() % (length + 1) }, edit_texts[(*random)() % std::size(edit_texts)]);
+            return;
+        }
+    }
+
+    // Identifiers in capitals, two known names, "main" and everything but "count", the last in two forms.
+    constexpr std::string_view predicate_query =
+        "((identifier) @constant (#match? @constant \"^[A-Z][A-Z0-9_]*$\"))\n"
+        "((identifier) @builtin (#any-of? @builtin \"printf\" \"argc\"))\n"
+        "((identifier) @main (#eq? @main \"main\"))\n"
+        "((identifier) @other (#not-eq? @other \"count\"))\n"
+        "((init_declarator declarator: (identifier) @same value: (identifier) @value) (#eq? @same @value))\n";
+
+    // Functions with their names, blocks and the comments which do not mention "sample".
+    constexpr std::string_view structure_query =
+        "(function_definition declarator: (function_declarator declarator: (identifier) @name)) @function\n"
+        "(compound_statement) @block\n"
+        "((comment) @comment (#not-match? @comment \"sample\"))\n";
+
+    // Macros are injected in the language their name gives, comments in C.
+    constexpr std::string_view injection_query =
+        "(preproc_def name: (identifier) @injection.language value: (preproc_arg) @injection.content)\n"
+        "((comment) @injection.content (#set! injection.language \"c\"))\n";
+
+    const TSLanguage* resolve_language(std::string_view name)
+    {
+        return name == "c" or name == "aa" or name == "aba" or name == "M" ? tree_sitter_c() : nullptr;
+    }
+
+    // Every injected language with its ranges.  The trees are left out, tree-sitter does not promise that an
+    // incremental parse over changed included ranges equals a fresh one.
+    std::string describe(const InjectionLayer& layer)
+    {
+        std::vector<InjectedTree> trees;
+        layer.injected_trees(&trees);
+        std::string result;
+        for (const InjectedTree& tree : trees)
+        {
+            result += std::string{ tree.language };
+            for (const TSRange& range : tree.ranges)
+            {
+                result += "[" + std::to_string(range.start_byte) + "," + std::to_string(range.end_byte) + ")("
+                          + std::to_string(range.start_point.row) + ":" + std::to_string(range.start_point.column) + "-"
+                          + std::to_string(range.end_point.row) + ":" + std::to_string(range.end_point.column) + ")";
+            }
+            result += tree.tree != nullptr ? "\n" : " without tree\n";
+        }
+        return result;
+    }
+
+    // A C file of 'functions' functions for the parse benchmarks.  With 'errors' every function lacks a
+    // semicolon, so error recovery runs all over the file.
+    std::STRING benchmark_source(size_t functions, bool errors)
+    {
+        std::string source;
+        for (size_t i = 0; i < functions; i++)
+        {
+            std::string n = std::to_string(i);
+            source += "static int f" + n + "(int a, int b) {\n"
+                      "    int c = a * " + n + (errors ? "\n" : ";\n") +
+                      "    for (int i = 0; i < b; i++) { c += i; }\n"
+                      "    return c + b; /* " + n + " */\n"
+                      "}\n";
+        }
+        return { source.begin(), source.end() };
+    }
+
+    // Measures the first parse of the benchmark source.
+    void measure_full_parse(XCTestCase* test, bool errors)
+    {
+        TreeBuilder builder;
+        builder.accept(benchmark_source(20000, errors));
+        Tree tree = builder.create();
+        OwningSnapshot snapshot { &tree };
+        TSParser* parser = ts_parser_new();
+        ts_parser_set_language(parser, tree_sitter_c());
+        [test measureBlock:^{
+            ts_tree_delete(parse(parser, snapshot, nullptr));
+        }];
+        ts_parser_delete(parser);
+    }
+
+    // Measures the reparse of the benchmark source after typing a character in the middle of it.
+    void measure_incremental_parse(XCTestCase* test, bool errors)
+    {
+        TreeBuilder builder;
+        builder.accept(benchmark_source(20000, errors));
+        Tree tree = builder.create();
+        tree.journal_edits(JournalEdits::Yes);
+        OwningSnapshot before { &tree };
+        TSParser* parser = ts_parser_new();
+        ts_parser_set_language(parser, tree_sitter_c());
+        TSTree* base = parse(parser, before, nullptr);
+        tree.insert(CharOffset { rep(tree.length()) / 2 }, u"x");
+        EditJournal edits;
+        tree.drain_edit_journal(&edits);
+        TSInputEdit edit = fredbuf_convert_edit_record(edits.front());
+        OwningSnapshot after { &tree };
+        [test measureBlock:^{
+            TSTree* old_tree = ts_tree_copy(base);
+            ts_tree_edit(old_tree, &edit);
+            ts_tree_delete(parse(parser, after, old_tree));
+            ts_tree_delete(old_tree);
+        }];
+        ts_tree_delete(base);
+        ts_parser_delete(parser);
+    }
+
+    // A match as its pattern and the bytes and types of its captures.
+    std::string describe_match(uint32_t pattern_index, std::span<const TSQueryCapture> captures)
+    {
+        std::string result = std::to_string(pattern_index);
+        for (const TSQueryCapture& capture : captures)
+        {
+            result += " " + std::to_string(capture.index) + ":" + ts_node_type(capture.node)
+                      + (ts_node_is_missing(capture.node) ? "!" : "") + "[" + std::to_string(ts_node_start_byte(capture.node))
+                      + "," + std::to_string(ts_node_end_byte(capture.node)) + ")";
+        }
+        return result;
+    }
+
+    // Every span of the lines of 'snapshot' as "line:first-last:capture".
+    std::string highlight_all(Highlighter* highlighter, const OwningSnapshot& snapshot)
+    {
+        HighlightSpans spans;
+        highlighter->highlight(&spans, Line{ 1 }, Line{ rep(snapshot.line_count()) });
+        std::string result;
+        for (const HighlightSpan& span : spans)
+        {
+            result += std::to_string(rep(span.line)) + ":" + std::to_string(span.first_column) + "-"
+                      + std::to_string(span.last_column) + ":" + std::string{ highlighter->capture_name(span.capture) } + " ";
+        }
+        return result;
+    }
+
+    EditPoint edit_point(const OwningSnapshot& snapshot, CharOffset offset)
+    {
+        LinePosition position = snapshot.line_position(offset);
+        return { .row = rep(position.line) - 1, .column = rep(distance(position.line_start, offset)) };
+    }
+} // namespace [anon]
+
+@interface PieceTreeSyntaxTests : XCTestCase
+@end
+
+@implementation PieceTreeSyntaxTests
+
+- (void)testEditJournal {
+    /* trees edited with the journal and parsed incrementally must equal fresh parses, points included */
+    TSParser *parser = ts_parser_new();
+    XCTAssertTrue(ts_parser_set_language(parser, tree_sitter_c()));
+    for (unsigned seed = 0; seed < 4; seed++) {
+        std::mt19937 random { seed };
+        TreeBuilder builder;
+        builder.accept(sample_source());
+        Tree tree = builder.create();
+        tree.journal_edits(JournalEdits::Yes);
+        TSTree *old_tree = parse(parser, OwningSnapshot { &tree }, nullptr);
+        for (size_t round = 0; round < 150; round++) {
+            EditJournal edits;
+            for (size_t count = 1 + random() % 4; count != 0; count--) {
+                OwningSnapshot before { &tree };
+                random_edit(&tree, &random);
+                EditJournal step;
+                tree.drain_edit_journal(&step);
+                /* the points of a single record refer to the text before and after it */
+                if (step.size() == 1) {
+                    OwningSnapshot after { &tree };
+                    XCTAssertTrue(step[0].start_point == edit_point(before, step[0].start));
+                    XCTAssertTrue(step[0].old_end_point == edit_point(before, step[0].old_end));
+                    XCTAssertTrue(step[0].new_end_point == edit_point(after, step[0].new_end));
+                }
+                edits.insert(edits.end(), step.begin(), step.end());
+            }
+            for (const EditRecord &record : edits) {
+                TSInputEdit edit = fredbuf_convert_edit_record(record);
+                ts_tree_edit(old_tree, &edit);
+            }
+            OwningSnapshot snapshot { &tree };
+            TSTree *incremental = parse(parser, snapshot, old_tree);
+            TSTree *fresh = parse(parser, snapshot, nullptr);
+            XCTAssertTrue(describe(incremental) == describe(fresh), "seed %u round %zu", seed, round);
+            ts_tree_delete(fresh);
+            ts_tree_delete(old_tree);
+            old_tree = incremental;
+        }
+        ts_tree_delete(old_tree);
+    }
+    ts_parser_delete(parser);
+}
+
+- (void)testParseService {
+    /* a burst of edits coalesces into a few parses, the last of which matches a fresh parse of the final text */
+    std::mutex mutex;
+    std::condition_variable parsed;
+    uint64_t parsed_version = 0;
+    size_t parse_count = 0;
+    TreeBuilder builder;
+    builder.accept(sample_source());
+    ConcurrentTree document { builder.create() };
+    document.tree().journal_edits(JournalEdits::Yes);
+    ParseService service { tree_sitter_c(), [&](uint64_t version) {
+        std::lock_guard lock { mutex };
+        parsed_version = version;
+        parse_count++;
+        parsed.notify_all();
+    } };
+    service.submit(&document);
+    std::mt19937 random { 42 };
+    for (size_t i = 0; i < 2000; i++) {
+        random_edit(&document.tree(), &random);
+        document.publish();
+        service.submit(&document);
+    }
+    uint64_t final_version = document.version();
+    {
+        std::unique_lock lock { mutex };
+        XCTAssertTrue(parsed.wait_for(lock, std::chrono::seconds(30), [&] { return parsed_version == final_version; }));
+        XCTAssertTrue(parse_count < final_version);
+    }
+    std::optional<ParsedVersion> parse = service.latest_parse();
+    XCTAssertTrue(parse.has_value() && parse->version == final_version);
+    if (parse.has_value()) {
+        TSParser *parser = ts_parser_new();
+        ts_parser_set_language(parser, tree_sitter_c());
+        TSTree *fresh = ::parse(parser, document.snapshot(), nullptr);
+        XCTAssertTrue(describe(parse->tree) == describe(fresh));
+        ts_tree_delete(fresh);
+        ts_tree_delete(parse->tree);
+        ts_parser_delete(parser);
+    }
+}
+
+- (void)testHighlighterPredicates {
+    /* captures whose text predicates fail are dropped */
+    TSParser *parser = ts_parser_new();
+    ts_parser_set_language(parser, tree_sitter_c());
+    TreeBuilder builder;
+    builder.accept(u"int MAX_A = main;\nint x = x; printf(count, argc);\n");
+    Tree tree = builder.create();
+    OwningSnapshot snapshot { &tree };
+    Highlighter highlighter { tree_sitter_c(), predicate_query };
+    XCTAssertTrue(highlighter.valid());
+    highlighter.update({ .tree = parse(parser, snapshot, nullptr), .version = 1, .snapshot = snapshot });
+    XCTAssertTrue(highlight_all(&highlighter, snapshot) ==
+                   "1:4-9:constant 1:4-9:other 1:12-16:main 1:12-16:other "
+                   "2:4-5:other 2:4-5:same 2:8-9:other 2:8-9:value 2:11-17:builtin 2:11-17:other 2:25-29:builtin 2:25-29:other ");
+    /* an invalid predicate fails the query at its pattern */
+    Highlighter invalid { tree_sitter_c(), "(string_literal)\n((identifier) @a (#eq? @a))" };
+    XCTAssertEqual(invalid.error(), TSQueryErrorSyntax);
+    XCTAssertEqual(invalid.error_offset(), 17u);
+    Highlighter invalid_regex { tree_sitter_c(), "((identifier) @a (#match? @a \"(\"))" };
+    XCTAssertFalse(invalid_regex.valid());
+    ts_parser_delete(parser);
+}
+
+- (void)testHighlighterFollowsParseService {
+    /* a highlighter fed by the parse service through random edits highlights the same as a fresh one */
+    std::mutex mutex;
+    std::condition_variable parsed;
+    std::optional<uint64_t> parsed_version;
+    TreeBuilder builder;
+    builder.accept(sample_source());
+    ConcurrentTree document { builder.create() };
+    document.tree().journal_edits(JournalEdits::Yes);
+    ParseService service { tree_sitter_c(), [&](uint64_t version) {
+        std::lock_guard lock { mutex };
+        parsed_version = version;
+        parsed.notify_all();
+    } };
+    TSParser *parser = ts_parser_new();
+    ts_parser_set_language(parser, tree_sitter_c());
+    Highlighter highlighter { tree_sitter_c(), predicate_query };
+    std::mt19937 random { 7 };
+    service.submit(&document);
+    for (size_t round = 0; round < 60; round++) {
+        {
+            std::unique_lock lock { mutex };
+            XCTAssertTrue(parsed.wait_for(lock, std::chrono::seconds(30), [&] { return parsed_version == document.version(); }));
+        }
+        std::optional<ParsedVersion> parse = service.latest_parse();
+        XCTAssertTrue(parse.has_value());
+        if (not parse.has_value())
+            break;
+        OwningSnapshot snapshot = parse->snapshot;
+        highlighter.update(std::move(*parse));
+        /* only the lines around the edits are queried again, the rest come from the cache */
+        Highlighter fresh { tree_sitter_c(), predicate_query };
+        fresh.update({ .tree = ::parse(parser, snapshot, nullptr), .version = 1, .snapshot = snapshot });
+        XCTAssertTrue(highlight_all(&highlighter, snapshot) == highlight_all(&fresh, snapshot), "round %zu", round);
+        for (size_t count = 1 + random() % 3; count != 0; count--) {
+            random_edit(&document.tree(), &random);
+        }
+        document.publish();
+        service.submit(&document);
+    }
+    ts_parser_delete(parser);
+}
+
+- (void)testStructureFollowsParseService {
+    /* a structure index fed by the parse service through random edits holds the same entries as a fresh one */
+    std::mutex mutex;
+    std::condition_variable parsed;
+    std::optional<uint64_t> parsed_version;
+    TreeBuilder builder;
+    builder.accept(sample_source());
+    ConcurrentTree document { builder.create() };
+    document.tree().journal_edits(JournalEdits::Yes);
+    ParseService service { tree_sitter_c(), [&](uint64_t version) {
+        std::lock_guard lock { mutex };
+        parsed_version = version;
+        parsed.notify_all();
+    } };
+    TSParser *parser = ts_parser_new();
+    ts_parser_set_language(parser, tree_sitter_c());
+    StructureIndex structure { tree_sitter_c(), structure_query };
+    XCTAssertTrue(structure.valid());
+    std::mt19937 random { 11 };
+    service.submit(&document);
+    for (size_t round = 0; round < 60; round++) {
+        {
+            std::unique_lock lock { mutex };
+            XCTAssertTrue(parsed.wait_for(lock, std::chrono::seconds(30), [&] { return parsed_version == document.version(); }));
+        }
+        std::optional<ParsedVersion> parse = service.latest_parse();
+        XCTAssertTrue(parse.has_value());
+        if (not parse.has_value())
+            break;
+        OwningSnapshot snapshot = parse->snapshot;
+        structure.update(std::move(*parse));
+        StructureIndex fresh { tree_sitter_c(), structure_query };
+        fresh.update({ .tree = ::parse(parser, snapshot, nullptr), .version = 1, .snapshot = snapshot });
+        StructureEntries entries;
+        StructureEntries fresh_entries;
+        structure.entries(&entries, Line { 1 }, Line { rep(snapshot.line_count()) });
+        fresh.entries(&fresh_entries, Line { 1 }, Line { rep(snapshot.line_count()) });
+        XCTAssertTrue(entries == fresh_entries, "round %zu", round);
+        if (round == 0) {
+            /* the "// sample" comment fails its predicate, the other one on line 6 does not */
+            size_t comments = 0;
+            for (const StructureEntry &entry : entries) {
+                if (structure.capture_name(entry.capture) == "comment") {
+                    comments++;
+                    XCTAssertTrue(entry.first_line == Line { 6 });
+                }
+            }
+            XCTAssertEqual(comments, 1u);
+        }
+        for (size_t count = 1 + random() % 3; count != 0; count--) {
+            random_edit(&document.tree(), &random);
+        }
+        document.publish();
+        service.submit(&document);
+    }
+    ts_parser_delete(parser);
+}
+
+- (void)testInjectionLayer {
+    /* after every edit the layer holds the same languages, ranges and trees as a layer built from scratch */
+    ThreadPool pool { 2 };
+    TSParser *parser = ts_parser_new();
+    ts_parser_set_language(parser, tree_sitter_c());
+    auto check = [&](std::STRING_VIEW text, auto edit, std::string_view expected_language) {
+        TreeBuilder builder;
+        builder.accept(text);
+        Tree tree = builder.create();
+        InjectionLayer layer { tree_sitter_c(), injection_query, resolve_language, &pool };
+        XCTAssertTrue(layer.valid());
+        OwningSnapshot before { &tree };
+        TSTree *old_tree = parse(parser, before, nullptr);
+        layer.update({ .tree = ts_tree_copy(old_tree), .version = 1, .snapshot = before });
+        edit(&tree);
+        OwningSnapshot after { &tree };
+        EditJournal edits;
+        diff_edits(&edits, before, after);
+        for (const EditRecord &record : edits) {
+            TSInputEdit input_edit = fredbuf_convert_edit_record(record);
+            ts_tree_edit(old_tree, &input_edit);
+        }
+        layer.update({ .tree = parse(parser, after, old_tree), .version = 2, .snapshot = after });
+        ts_tree_delete(old_tree);
+        InjectionLayer fresh { tree_sitter_c(), injection_query, resolve_language, &pool };
+        fresh.update({ .tree = parse(parser, after, nullptr), .version = 1, .snapshot = after });
+        XCTAssertTrue(describe(layer) == describe(fresh), "%s", describe(layer).c_str());
+        XCTAssertTrue(describe(layer).starts_with(expected_language));
+    };
+    /* renaming a macro moves its value to the new language */
+    check(u"int a;\n#define aa x + 1\n", [](Tree *tree) { tree->insert(CharOffset { 16 }, u"b"); }, "aba[");
+    /* shortening a comment to end on the edit keeps it */
+    check(u"int a; // note x\nint b;\n", [](Tree *tree) { tree->remove(CharOffset { 12 }, Length { 4 }); }, "c[");
+
+    /* random edits, with the layer following the parses */
+    for (unsigned seed = 0; seed < 3; seed++) {
+        std::mt19937 random { seed };
+        TreeBuilder builder;
+        builder.accept(sample_source());
+        builder.accept(u"#define M (1 + 2)\n// M\n");
+        Tree tree = builder.create();
+        InjectionLayer layer { tree_sitter_c(), injection_query, resolve_language, &pool };
+        OwningSnapshot previous { &tree };
+        TSTree *old_tree = parse(parser, previous, nullptr);
+        layer.update({ .tree = ts_tree_copy(old_tree), .version = 1, .snapshot = previous });
+        for (size_t version = 2; version < 100; version++) {
+            random_edit(&tree, &random);
+            OwningSnapshot snapshot { &tree };
+            EditJournal edits;
+            diff_edits(&edits, previous, snapshot);
+            for (const EditRecord &record : edits) {
+                TSInputEdit input_edit = fredbuf_convert_edit_record(record);
+                ts_tree_edit(old_tree, &input_edit);
+            }
+            TSTree *new_tree = parse(parser, snapshot, old_tree);
+            ts_tree_delete(old_tree);
+            old_tree = new_tree;
+            layer.update({ .tree = ts_tree_copy(new_tree), .version = version, .snapshot = snapshot });
+            InjectionLayer fresh { tree_sitter_c(), injection_query, resolve_language, &pool };
+            fresh.update({ .tree = parse(parser, snapshot, nullptr), .version = 1, .snapshot = snapshot });
+            XCTAssertTrue(describe(layer) == describe(fresh), "seed %u version %zu", seed, version);
+            previous = snapshot;
+        }
+        ts_tree_delete(old_tree);
+    }
+    ts_parser_delete(parser);
+}
+
+- (void)testQueryMatchesParallel {
+    /* the cursors over the ranges report every match a single cursor does, once */
+    std::STRING source;
+    for (int i = 0; i < 12000; i++) {
+        /* declarations without a semicolon end on a zero-width node, which may be a range boundary */
+        std::string line = i % 3 == 0 ? "int x" + std::to_string(i) + " = " + std::to_string(i) + "\n"
+                                      : "int f" + std::to_string(i) + "(void) { return " + std::to_string(i) + "; }\n";
+        source.append(line.begin(), line.end());
+    }
+    TreeBuilder builder;
+    builder.accept(source);
+    Tree document = builder.create();
+    TSParser *parser = ts_parser_new();
+    ts_parser_set_language(parser, tree_sitter_c());
+    TSTree *tree = parse(parser, OwningSnapshot { &document }, nullptr);
+    uint32_t error_offset = 0;
+    TSQueryError error = TSQueryErrorNone;
+    std::string_view query_source = "(_) @named\n\";\" @semicolon\n";
+    TSQuery *query = ts_query_new(tree_sitter_c(), query_source.data(), static_cast<uint32_t>(query_source.size()), &error_offset, &error);
+    XCTAssertTrue(query != nullptr);
+
+    std::vector<std::string> expected;
+    TSQueryCursor *cursor = ts_query_cursor_new();
+    ts_query_cursor_exec(cursor, query, ts_tree_root_node(tree));
+    TSQueryMatch match;
+    while (ts_query_cursor_next_match(cursor, &match)) {
+        expected.push_back(describe_match(match.pattern_index, { match.captures, match.capture_count }));
+    }
+    ts_query_cursor_delete(cursor);
+
+    ThreadPool pool { 4 };
+    QueryMatches matches;
+    query_matches_parallel(&matches, query, tree, &pool);
+    std::vector<std::string> found;
+    for (const QueryMatch &found_match : matches.matches) {
+        found.push_back(describe_match(found_match.pattern_index,
+                                       std::span { matches.captures }.subspan(found_match.first_capture, found_match.capture_count)));
+    }
+    std::sort(expected.begin(), expected.end());
+    std::sort(found.begin(), found.end());
+    XCTAssertTrue(found == expected, "%zu matches, %zu expected", found.size(), expected.size());
+    ts_query_delete(query);
+    ts_tree_delete(tree);
+    ts_parser_delete(parser);
+}
+
+- (void)testFullParsePerformance {
+    measure_full_parse(self, false);
+}
+
+- (void)testFullParseWithErrorsPerformance {
+    measure_full_parse(self, true);
+}
+
+- (void)testIncrementalParsePerformance {
+    measure_incremental_parse(self, false);
+}
+
+- (void)testIncrementalParseWithErrorsPerformance {
+    measure_incremental_parse(self, true);
+}
+
+@end
+#endif
@@ -76,6 +76,24 @@ final class TextStorageTests: XCTestCase {
                 _ = try storage3.codeUnit(at: index)
             }
         }
+        self.printTime("[TextStorage]Find all occurrences of a string in sqlite3.c") {
+            _ = storage3.findAll("sqlite3_")
+        }
+        let semaphore = DispatchSemaphore(value: 0)
+        self.printTime("[TextStorage]Find all occurrences of a string in sqlite3.c concurrently") {
+            Task {
+                for await _ in storage3.findAllConcurrently("sqlite3_") { }
+                semaphore.signal()
+            }
+            semaphore.wait()
+        }
+        try self.printTime("[TextStorage]Find all matches of a regular expression in sqlite3.c") {
+            _ = try storage3.findAll(regularExpression: "^\\s*#\\s*define\\s+\\w+")
+        }
+        self.printTime("[NSRegularExpression]Find all matches of a regular expression in sqlite3.c") {
+            let regularExpression = try! NSRegularExpression(pattern: "^\\s*#\\s*define\\s+\\w+", options: [.anchorsMatchLines])
+            _ = regularExpression.matches(in: string as String, range: NSRange(location: 0, length: string.length))
+        }
         self.printTime("[NSMutableStrig]Insert sqlite3.c to top of sqlit3.c") {
             string2.insert(string as String, at: 0)
         }
@@ -125,6 +143,24 @@ final class TextStorageTests: XCTestCase {
         }
     }
     
+    func testLineView() throws {
+        /* one piece per code unit, so the first line covers more pieces than a line view keeps inline and its CRLF is split over two pieces */
+        let content = "12345678\r\n\r\nxy"
+        let storage = TextStorage()
+        for unit in content.utf16.reversed() {
+            try storage.insert(text: String(utf16CodeUnits: [unit], count: 1), at: 0, respectComposedCharacter: false)
+        }
+        XCTAssert(storage.string == content)
+        XCTAssert(storage.lines.map(\.string) == ["12345678", "", "xy"])
+        XCTAssert(storage.lines.map(\.type) == [.CRLF, .CRLF, .NO])
+        XCTAssert(try storage.snapshot().lineContent(lineIndex: 1) == "12345678\r")
+        _ = try storage.delete(range: 2..<6)
+        try storage.insert(text: "-", at: 1, respectComposedCharacter: false)
+        XCTAssert(try storage.lineContent(lineIndex: 1).string == "1-278")
+        XCTAssert(try storage.snapshot().lineContent(lineIndex: 1) == "1-278\r")
+        self.testLineContent(storage: storage, nil)
+    }
+    
     func testInsertion() {
         self.testStrings.forEach { content in
             self.testInsertion(content)
@@ -148,6 +184,218 @@ final class TextStorageTests: XCTestCase {
         }
     }
     
+    func testFind() throws {
+        try self.testStrings.forEach { content in
+            try self.testFind(content)
+        }
+    }
+    
+    func testFindConcurrently() async throws {
+        for content in self.testStrings {
+            let storage = TextStorage(content)
+            try storage.insert(text: "Hel", at: 0, respectComposedCharacter: false)
+            try storage.insert(text: "lo", at: 3, respectComposedCharacter: false)
+            for pattern in ["Hello", "\n", "🌏"] {
+                var ranges = [Range<Int>]()
+                for await batch in storage.findAllConcurrently(pattern) {
+                    ranges.append(contentsOf: batch)
+                }
+                XCTAssert(ranges == storage.findAll(pattern))
+            }
+        }
+    }
+    
+    func testRegularExpressionFind() throws {
+        try self.testStrings.forEach { content in
+            try self.testRegularExpressionFind(content)
+        }
+        /* `\w` and `\b` only know the ASCII word characters, unlike ICU, so they are not compared with `NSRegularExpression` */
+        let words = TextStorage("llo wörld_2, x")
+        try words.insert(text: "Hé", at: 0, respectComposedCharacter: false)
+        XCTAssert(try words.findAll(regularExpression: "\\w+") == [0..<1, 2..<5, 6..<7, 8..<13, 15..<16])
+        XCTAssert(try words.findAll(regularExpression: "\\W") == [1..<2, 5..<6, 7..<8, 13..<14, 14..<15])
+        XCTAssert(try words.findAll(regularExpression: "\\bl") == [2..<3])
+        XCTAssert(try words.findAll(regularExpression: "o\\b") == [4..<5])
+        XCTAssert(try words.findAll(regularExpression: "\\Bl") == [3..<4, 9..<10])
+        XCTAssert(try words.find(regularExpression: "H\\w+") == nil)
+        XCTAssertThrowsError(try TextStorage("Hello").findAll(regularExpression: "(Hello"))
+        XCTAssertThrowsError(try TextStorage("Hello").findAll(regularExpression: "[a-"))
+        XCTAssertThrowsError(try TextStorage("Hello").findAll(regularExpression: "*"))
+    }
+
+    func testSnapshot() throws {
+        let storage = TextStorage("Hello\n")
+        let first = storage.snapshot()
+        try storage.insert(text: "World\n", at: storage.length, respectComposedCharacter: false)
+        let second = storage.snapshot()
+        XCTAssert(first.version == 0 && first.string == "Hello\n" && first.lineCount == 2)
+        XCTAssert(second.version == 1 && second.string == "Hello\nWorld\n")
+        XCTAssert(try second.lineContent(lineIndex: 2) == "World")
+        XCTAssert(try second.lineIndex(at: 6) == 2)
+        XCTAssert(storage.undo() && storage.snapshot().string == "Hello\n")
+        XCTAssert(second.string == "Hello\nWorld\n")
+
+        // One writer, the readers check that every snapshot is a consistent version.
+        let writes = 20000
+        let readerCount = 4
+        let lock = NSLock()
+        var writing = true
+        var reads = 0
+        let shared = TextStorage()
+        self.printTime("[TextStorage]\(writes) edits with \(readerCount) readers taking snapshots") {
+            DispatchQueue.concurrentPerform(iterations: readerCount + 1) { index in
+                if index == 0 {
+                    for _ in 0..<writes {
+                        try! shared.insert(text: "ab\n", at: shared.length, respectComposedCharacter: false)
+                    }
+                    lock.lock()
+                    writing = false
+                    lock.unlock()
+                    return
+                }
+                var count = 0
+                while true {
+                    lock.lock()
+                    let stop = !writing
+                    lock.unlock()
+                    let snapshot = shared.snapshot()
+                    XCTAssert(snapshot.length == 3 * Int(snapshot.version))
+                    XCTAssert(snapshot.lineCount == Int(snapshot.version) + 1)
+                    /* a torn or stale segment keeps the length, so the content is compared as well */
+                    if count % 64 == 0 {
+                        XCTAssert(snapshot.string == String(repeating: "ab\n", count: Int(snapshot.version)))
+                    }
+                    count += 1
+                    if stop {
+                        break
+                    }
+                }
+                lock.lock()
+                reads += count
+                lock.unlock()
+            }
+        }
+        print("[TextStorage]Snapshots taken:", reads)
+        XCTAssert(shared.snapshot().version == UInt64(writes))
+    }
+
+    func testSession() throws {
+        let storage = TextStorage("Hello\r\nWorld\n")
+        try storage.insert(text: "🌏", at: 5, respectComposedCharacter: false)
+        storage.commitState()
+        try storage.insert(text: "Again\n", at: storage.length, respectComposedCharacter: false)
+        let url = FileManager.default.temporaryDirectory.appendingPathComponent("TextStorageTests.session")
+        try storage.saveSession(to: url)
+        let restored = try TextStorage(sessionContentsOf: url)
+        XCTAssert(restored.string == storage.string && restored.lineCount == storage.lineCount)
+        XCTAssert(restored.undo() && storage.undo() && restored.string == storage.string)
+        XCTAssert(restored.redo() && restored.string == "Hello🌏\r\nWorld\nAgain\n")
+        // Saving over the loaded file must not disturb the storage reading from it.
+        try restored.insert(text: "!", at: 0, respectComposedCharacter: false)
+        try restored.saveSession(to: url)
+        XCTAssert(restored.string == "!Hello🌏\r\nWorld\nAgain\n")
+        XCTAssert(try TextStorage(sessionContentsOf: url).string == restored.string)
+        try Data("not a session".utf8).write(to: url)
+        XCTAssertThrowsError(try restored.loadSession(from: url))
+        XCTAssert(restored.string == "!Hello🌏\r\nWorld\nAgain\n")
+        try? FileManager.default.removeItem(at: url)
+    }
+
+    func testContentHash() throws {
+        let storage = TextStorage("Hello World\n")
+        let saved = storage.contentHash
+        try storage.insert(text: "Big ", at: 6, respectComposedCharacter: false)
+        XCTAssert(storage.contentHash != saved)
+        XCTAssert(storage.contentHash == TextStorage("Hello Big World\n").contentHash)
+        XCTAssert(storage.undo() && storage.contentHash == saved)
+        let snapshot = storage.snapshot()
+        try storage.delete(range: 0..<6)
+        try storage.insert(text: "Hello ", at: 0, respectComposedCharacter: false)
+        XCTAssert(storage.contentHash == saved && snapshot.contentHash == saved)
+    }
+
+    func testWrite() throws {
+        let storage = TextStorage("Hello\r\n🌏\nWorld")
+        let url = FileManager.default.temporaryDirectory.appendingPathComponent("TextStorageTests.txt")
+        try storage.write(to: url)
+        XCTAssert(try String(contentsOf: url, encoding: .utf8) == storage.string)
+        try storage.write(to: url, encoding: .utf16LittleEndian, lineEndings: .crlf)
+        XCTAssert(try String(contentsOf: url, encoding: .utf16LittleEndian) == "Hello\r\n🌏\r\nWorld")
+        let snapshot = storage.snapshot()
+        try storage.insert(text: "!", at: 0, respectComposedCharacter: false)
+        try snapshot.write(to: url, lineEndings: .lf)
+        XCTAssert(try String(contentsOf: url, encoding: .utf8) == "Hello\n🌏\nWorld")
+        /* the replacement of an unpaired surrogate and the character after it straddle the end of the staging buffer */
+        let padding = String(repeating: "a", count: 65532)
+        let unpaired = TextStorage(padding + "中")
+        try unpaired.insert(text: String(utf16CodeUnits: [0xD800], count: 1), at: 65532, respectComposedCharacter: false)
+        XCTAssert(unpaired.length == 65534)
+        try unpaired.write(to: url)
+        XCTAssert(try String(contentsOf: url, encoding: .utf8) == padding + "\u{FFFD}中")
+        try? FileManager.default.removeItem(at: url)
+    }
+
+    func testHistoryPolicy() throws {
+        let storage = TextStorage()
+        storage.historyPolicy = TextStorage.HistoryPolicy(maxEntries: 3)
+        for i in 0..<10 {
+            storage.commitState()
+            try storage.insert(text: "\(i)", at: storage.length, respectComposedCharacter: false)
+        }
+        XCTAssert(storage.historyMemory.undoCount == 3 && storage.historyMemory.pinnedBytes > 0)
+        XCTAssert(storage.undo() && storage.undo() && storage.undo() && !storage.undo())
+        XCTAssert(storage.string == "0123456")
+        let words = TextStorage()
+        words.historyPolicy = TextStorage.HistoryPolicy(coalescesWords: true)
+        for (i, character) in "hello world".enumerated() {
+            words.commitState()
+            try words.insert(text: String(character), at: i, respectComposedCharacter: false)
+        }
+        XCTAssert(words.undo() && words.string == "hello ")
+        XCTAssert(words.undo() && words.string == "" && !words.undo())
+    }
+
+    func testRevisions() throws {
+        let storage = TextStorage("hello")
+        let first = storage.commitState()
+        try storage.insert(text: " world", at: storage.length, respectComposedCharacter: false)
+        let second = storage.commitState()
+        while storage.string != "hello" {
+            XCTAssert(storage.undo())
+        }
+        try storage.insert(text: ">> ", at: 0, respectComposedCharacter: false)
+        let third = storage.commitState()
+        XCTAssert(storage.revisions.map(\.parentID) == [nil, first, first])
+        XCTAssert(storage.snapshot(ofRevision: second)?.string == "hello world")
+        XCTAssert(storage.checkout(revision: second) && storage.string == "hello world" && storage.currentRevisionID == second)
+        XCTAssert(storage.undo() && storage.string == ">> hello" && storage.currentRevisionID == third)
+        XCTAssert(!storage.checkout(revision: 42) && storage.snapshot(ofRevision: 42) == nil)
+        /* revisions pin memory of their own, which counts towards the budget even while the commits coalesce into one undo entry */
+        let coalesced = TextStorage()
+        coalesced.historyPolicy = TextStorage.HistoryPolicy(coalesceInterval: 3600)
+        for i in 0..<50 {
+            coalesced.commitState()
+            try coalesced.insert(text: "\(i)\n", at: 0, respectComposedCharacter: false)
+        }
+        let pinned = coalesced.historyMemory.pinnedBytes
+        XCTAssert(coalesced.historyMemory.undoCount == 1 && coalesced.revisions.count == 50)
+        coalesced.historyPolicy = TextStorage.HistoryPolicy(maxBytes: pinned / 2, coalesceInterval: 3600)
+        XCTAssert(coalesced.revisions.count < 50 && coalesced.revisions.last?.id == coalesced.currentRevisionID)
+        XCTAssert(coalesced.historyMemory.pinnedBytes < pinned)
+        XCTAssert(coalesced.checkout(revision: coalesced.revisions[0].id))
+    }
+
+    func testReplace() throws {
+        let storage = TextStorage("one two one three one")
+        XCTAssert(storage.replaceAll("one", with: "1") == 3 && storage.string == "1 two 1 three 1")
+        XCTAssert(storage.undo() && storage.string == "one two one three one")
+        try storage.replace([(range: 8..<11, text: "ONE"), (range: 0..<3, text: ""), (range: 21..<21, text: "!")])
+        XCTAssert(storage.string == " two ONE three one!")
+        XCTAssertThrowsError(try storage.replace([(range: 0..<4, text: ""), (range: 2..<3, text: "")]))
+        XCTAssertThrowsError(try storage.replace([(range: 0..<100, text: "")]))
+        XCTAssert(storage.string == " two ONE three one!")
+    }
+
 }
 
 //MARK: - UTF-16 Interaction Tests
@@ -302,6 +550,60 @@ extension TextStorageTests {
     }
 }
 
+//MARK: - Search Tests
+
+extension TextStorageTests {
+    
+    func testFind(_ content: String) throws {
+        let patterns = ["\n", "\r\n", "🌏", "Hello", "hello,world", "你好"]
+        let storage = TextStorage(content)
+        /* split the content into several pieces so that matches straddle piece boundaries */
+        try storage.insert(text: "Hel", at: 0, respectComposedCharacter: false)
+        try storage.insert(text: "lo", at: 3, respectComposedCharacter: false)
+        let string = storage.nsString
+        for pattern in patterns {
+            for caseSensitive in [true, false] {
+                let options: NSString.CompareOptions = caseSensitive ? [.literal] : [.literal, .caseInsensitive]
+                var expected = [Range<Int>]()
+                var searchRange = NSRange(location: 0, length: string.length)
+                while true {
+                    let found = string.range(of: pattern, options: options, range: searchRange)
+                    guard found.location != NSNotFound else { break }
+                    expected.append(found.lowerBound..<found.upperBound)
+                    searchRange = NSRange(location: found.upperBound, length: string.length - found.upperBound)
+                }
+                XCTAssert(storage.findAll(pattern, caseSensitive: caseSensitive) == expected)
+                XCTAssert(try storage.find(pattern, caseSensitive: caseSensitive) == expected.first)
+                XCTAssert(try storage.find(pattern, from: storage.length, backwards: true, caseSensitive: caseSensitive) == expected.last)
+            }
+        }
+    }
+}
+
+extension TextStorageTests {
+    
+    func testRegularExpressionFind(_ content: String) throws {
+        let patterns = ["o,W", "\\d", "[A-Z]l*", "l+?o", "(?:Wo|Hel)+", "^🌏", "!$"]
+        let storage = TextStorage(content)
+        /* split the content into several pieces so that matches straddle piece boundaries */
+        try storage.insert(text: "Hel", at: 0, respectComposedCharacter: false)
+        try storage.insert(text: "lo", at: 3, respectComposedCharacter: false)
+        let string = storage.nsString as String
+        for pattern in patterns {
+            for caseSensitive in [true, false] {
+                let options: NSRegularExpression.Options = caseSensitive ? [.anchorsMatchLines] : [.anchorsMatchLines, .caseInsensitive]
+                let regularExpression = try NSRegularExpression(pattern: pattern, options: options)
+                let expected = regularExpression.matches(in: string, range: NSRange(location: 0, length: storage.length)).map { result in
+                    result.range.lowerBound..<result.range.upperBound
+                }
+                XCTAssert(try storage.findAll(regularExpression: pattern, caseSensitive: caseSensitive) == expected)
+                XCTAssert(try storage.findAll(regularExpression: pattern, caseSensitive: caseSensitive, limit: 1) == Array(expected.prefix(1)))
+                XCTAssert(try storage.find(regularExpression: pattern, caseSensitive: caseSensitive) == expected.first)
+            }
+        }
+    }
+}
+
 //MARK: - Deletion Tests
 extension TextStorageTests {
     func testDeletion(_ content: String) throws {